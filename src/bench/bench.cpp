@@ -0,0 +1,110 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "bench.h"
+
+std::atomic<uint64_t> g_alloc_count(0);
+
+// ---------- 替换 glibc 的 malloc 系列函数，统计分配次数 ----------
+// operator new 最终也会调用 malloc，因此 C 与 C++ 的分配都会被统计
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void __libc_free(void *ptr);
+
+void *malloc(size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    g_alloc_count.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+}
+
+
+// ---------- 用例注册与运行 ----------
+
+struct BenchCase {
+    std::string name;       // 带参数的用例显示为 name/arg
+    BenchFunc func;
+    long arg;
+};
+
+// 用函数内静态变量，保证注册时已经完成构造
+static std::vector<BenchCase> &bench_cases() {
+    static std::vector<BenchCase> cases;
+    return cases;
+}
+
+void Bench::add(const char *name, BenchFunc func, long arg) {
+    BenchCase c = {name, func, arg};
+    if (arg != 0) {
+        c.name += "/" + std::to_string(arg);
+    }
+    bench_cases().push_back(c);
+}
+
+static const int64_t MIN_BENCH_NS = 200 * 1000 * 1000;   // 每个用例最少运行 200ms
+static const long long MAX_ITERATIONS = 100000000;
+
+int Bench::run_all(const char *filter) {
+    int count = 0;
+    for (size_t i = 0; i < bench_cases().size(); ++i) {
+        const BenchCase &c = bench_cases()[i];
+        if (filter && c.name.find(filter) == std::string::npos) {
+            continue;
+        }
+
+        // 逐步放大迭代次数，直到单轮运行时间足够长
+        long long iterations = 1;
+        int64_t elapsed = 0;
+        uint64_t allocs = 0;
+        while (true) {
+            BenchState state(iterations, c.arg);
+            uint64_t alloc_begin = g_alloc_count.load(std::memory_order_relaxed);
+            int64_t begin = BenchState::now_ns();
+            c.func(state);
+            elapsed = BenchState::now_ns() - begin - state.m_paused_ns;
+            allocs = g_alloc_count.load(std::memory_order_relaxed) - alloc_begin - state.m_paused_allocs;
+
+            if (elapsed >= MIN_BENCH_NS || iterations >= MAX_ITERATIONS) {
+                break;
+            }
+            // 按本轮耗时预估下一轮次数，最多放大 100 倍
+            long long next = elapsed > 0 ? iterations * MIN_BENCH_NS * 6 / 5 / elapsed : iterations * 100;
+            if (next > iterations * 100) next = iterations * 100;
+            if (next <= iterations) next = iterations + 1;
+            iterations = next < MAX_ITERATIONS ? next : MAX_ITERATIONS;
+        }
+
+        printf("%-40s %12lld %12.1f ns/op %10.2f allocs/op\n", c.name.c_str(), iterations,
+               (double)elapsed / iterations, (double)allocs / iterations);
+        fflush(stdout);
+        ++count;
+    }
+    return count;
+}
+
+int main(int argc, char *argv[]) {
+    // 用法：./microbench [过滤字符串]，如 ./microbench timer
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    if (Bench::run_all(filter) == 0) {
+        printf("no benchmark matches '%s'\n", filter ? filter : "");
+        return 1;
+    }
+    return 0;
+}
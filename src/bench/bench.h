@@ -0,0 +1,71 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <time.h>
+
+// 进程内所有线程的堆分配次数，由 bench.cpp 中替换的 malloc 系列函数统计
+extern std::atomic<uint64_t> g_alloc_count;
+
+// 单个基准用例的运行状态
+class BenchState {
+public:
+    BenchState(long long iterations, long arg)
+        : iterations(iterations), arg(arg), m_paused_ns(0), m_paused_allocs(0), m_pause_start(0), m_pause_allocs(0) {}
+
+    // 暂停计时，用于排除每轮的准备工作
+    void pause() {
+        m_pause_start = now_ns();
+        m_pause_allocs = g_alloc_count.load(std::memory_order_relaxed);
+    }
+    // 恢复计时
+    void resume() {
+        m_paused_ns += now_ns() - m_pause_start;
+        m_paused_allocs += g_alloc_count.load(std::memory_order_relaxed) - m_pause_allocs;
+    }
+
+    static int64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+
+public:
+    const long long iterations;     // 本轮需要执行的操作次数
+    const long arg;                 // 用例参数，如定时器数量、线程数量
+
+    int64_t m_paused_ns;            // 暂停期间累计的时间
+    uint64_t m_paused_allocs;       // 暂停期间累计的分配次数
+
+private:
+    int64_t m_pause_start;
+    uint64_t m_pause_allocs;
+};
+
+typedef void (*BenchFunc)(BenchState &state);
+
+// 基准用例注册表
+class Bench {
+public:
+    // 注册一个用例，arg 会通过 BenchState::arg 传给用例，非 0 时追加到用例名后
+    static void add(const char *name, BenchFunc func, long arg = 0);
+    // 运行名字中包含 filter 的所有用例，filter 为空时全部运行
+    static int run_all(const char *filter);
+};
+
+// 在全局作用域中注册用例
+struct BenchRegistrar {
+    BenchRegistrar(const char *name, BenchFunc func, long arg = 0) {
+        Bench::add(name, func, arg);
+    }
+};
+
+// 防止编译器把基准中的计算结果优化掉
+template<typename T>
+inline void bench_do_not_optimize(T const &value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#endif // BENCH_H_
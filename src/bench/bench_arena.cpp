@@ -0,0 +1,33 @@
+#include <cstdlib>
+#include "bench.h"
+#include "../core/arena/arena.h"
+
+// 一次请求内分配 arg 个小对象再整体归还，对比直接使用全局分配器
+static void bench_arena(BenchState &state) {
+    Arena arena;
+    for (long long i = 0; i < state.iterations; ++i) {
+        for (long j = 0; j < state.arg; ++j) {
+            void *p = arena.alloc(24 + (j & 31));
+            bench_do_not_optimize(p);
+        }
+        arena.reset();
+    }
+}
+
+static void bench_malloc(BenchState &state) {
+    void *ptrs[64];
+    for (long long i = 0; i < state.iterations; ++i) {
+        for (long j = 0; j < state.arg; ++j) {
+            ptrs[j] = malloc(24 + (j & 31));
+            bench_do_not_optimize(ptrs[j]);
+        }
+        for (long j = 0; j < state.arg; ++j) {
+            free(ptrs[j]);
+        }
+    }
+}
+
+static BenchRegistrar r1("arena/alloc_reset", bench_arena, 8);
+static BenchRegistrar r2("arena/alloc_reset", bench_arena, 64);
+static BenchRegistrar r3("arena/malloc_free", bench_malloc, 8);
+static BenchRegistrar r4("arena/malloc_free", bench_malloc, 64);
@@ -0,0 +1,55 @@
+#include <coroutine>
+#include <exception>
+#include "bench.h"
+#include "../core/coro/coro.h"
+
+// 与 ConnTask 相同，只是协程帧用默认的 operator new 从堆分配，作为对比
+struct HeapTask {
+    struct promise_type {
+        HeapTask get_return_object() noexcept { return HeapTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// 一个连接的生命周期：创建协程，挂起等待 arg 次事件，以 CLOSED 结束
+static ConnTask pooled_conn(Waiter &waiter, long &events) {
+    while (uint32_t ev = co_await waiter) {
+        events += ev;
+    }
+}
+
+static HeapTask heap_conn(Waiter &waiter, long &events) {
+    while (uint32_t ev = co_await waiter) {
+        events += ev;
+    }
+}
+
+template<typename Conn>
+static void run_conns(BenchState &state, Conn conn) {
+    Waiter waiter;
+    long events = 0;
+    for (long long i = 0; i < state.iterations; ++i) {
+        conn(waiter, events);
+        for (long j = 0; j < state.arg; ++j) {
+            waiter.wake(1);
+        }
+        waiter.wake(Waiter::CLOSED);
+    }
+    bench_do_not_optimize(events);
+}
+
+static void bench_coro_pooled(BenchState &state) {
+    run_conns(state, pooled_conn);
+}
+
+static void bench_coro_heap(BenchState &state) {
+    run_conns(state, heap_conn);
+}
+
+static BenchRegistrar r1("coro/conn/pooled", bench_coro_pooled, 1);
+static BenchRegistrar r2("coro/conn/heap", bench_coro_heap, 1);
+static BenchRegistrar r3("coro/conn/pooled", bench_coro_pooled, 16);
+static BenchRegistrar r4("coro/conn/heap", bench_coro_heap, 16);
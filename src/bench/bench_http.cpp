@@ -0,0 +1,155 @@
+#include <cstring>
+#include "bench.h"
+#include "../http/http_conn.h"
+
+// 抓取自真实客户端的请求报文
+static const char *corpus_curl =
+    "GET /index.html HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8808\r\n"
+    "User-Agent: curl/7.88.1\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+static const char *corpus_ab =
+    "GET / HTTP/1.1\r\n"
+    "Connection: Keep-Alive\r\n"
+    "Host: 127.0.0.1:8808\r\n"
+    "User-Agent: ApacheBench/2.3\r\n"
+    "Accept: */*\r\n"
+    "\r\n";
+
+static const char *corpus_chrome =
+    "GET /img/bg.png HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8808\r\n"
+    "Connection: keep-alive\r\n"
+    "sec-ch-ua: \"Chromium\";v=\"106\", \"Google Chrome\";v=\"106\", \"Not;A=Brand\";v=\"99\"\r\n"
+    "sec-ch-ua-mobile: ?0\r\n"
+    "User-Agent: Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/106.0.0.0 Safari/537.36\r\n"
+    "sec-ch-ua-platform: \"Windows\"\r\n"
+    "Accept: image/avif,image/webp,image/apng,image/svg+xml,image/*,*/*;q=0.8\r\n"
+    "Sec-Fetch-Site: same-origin\r\n"
+    "Sec-Fetch-Mode: no-cors\r\n"
+    "Sec-Fetch-Dest: image\r\n"
+    "Referer: http://127.0.0.1:8808/\r\n"
+    "Accept-Encoding: gzip, deflate, br\r\n"
+    "Accept-Language: zh-CN,zh;q=0.9,en;q=0.8\r\n"
+    "\r\n";
+
+static const char *corpus_post =
+    "POST /login HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8808\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Type: application/x-www-form-urlencoded\r\n"
+    "Content-Length: 28\r\n"
+    "\r\n"
+    "user=xsakura&password=123456";
+
+static const char *corpus_bad =
+    "BREW /pot HTTP/1.1\r\n"
+    "Host: 127.0.0.1:8808\r\n"
+    "\r\n";
+
+// 绕过 socket 直接驱动 HttpConn 的解析状态机
+class HttpConnBench {
+public:
+    // 模拟一次 read() 收到整个报文后的 process_read()
+    static HttpConn::HTTP_CODE parse(HttpConn &conn, const char *request, int len) {
+        conn.init();
+        memcpy(conn.m_read_buf, request, len);
+        conn.m_read_idx = len;
+        HttpConn::HTTP_CODE ret = conn.process_read();
+        conn.unmap();
+        return ret;
+    }
+
+    // 模拟报文被拆成 chunk 字节一段分多次到达
+    static HttpConn::HTTP_CODE parse_split(HttpConn &conn, const char *request, int len, int chunk) {
+        conn.init();
+        HttpConn::HTTP_CODE ret = HttpConn::NO_REQUEST;
+        for (int off = 0; off < len && ret == HttpConn::NO_REQUEST; off += chunk) {
+            int n = len - off < chunk ? len - off : chunk;
+            memcpy(conn.m_read_buf + conn.m_read_idx, request + off, n);
+            conn.m_read_idx += n;
+            ret = conn.process_read();
+        }
+        conn.unmap();
+        return ret;
+    }
+
+    // 生成响应报文：响应头格式化到 m_out 的内存块中，响应体只引用
+    static size_t respond(HttpConn &conn, HttpConn::HTTP_CODE code) {
+        conn.init();
+        conn.process_write(code);
+        return conn.m_out.size();
+    }
+
+    // 长连接上两次请求之间的状态重置
+    static void reset(HttpConn &conn) {
+        conn.init();
+    }
+};
+
+static HttpConn bench_conn;
+
+// do_request 需要资源目录，在 src 目录下运行时指向仓库的 root
+static bool bench_site = [] {
+    std::shared_ptr<SiteConfig> site(new SiteConfig);
+    site->doc_root = "../root";
+    site->routes = HttpConn::build_routes(*site);
+    SiteConfig::update(site);
+    return true;
+}();
+
+static void run_parse(BenchState &state, const char *request) {
+    int len = strlen(request);
+    for (long long i = 0; i < state.iterations; ++i) {
+        HttpConn::HTTP_CODE ret = HttpConnBench::parse(bench_conn, request, len);
+        bench_do_not_optimize(ret);
+    }
+}
+
+static void bench_parse_curl(BenchState &state) { run_parse(state, corpus_curl); }
+static void bench_parse_ab(BenchState &state) { run_parse(state, corpus_ab); }
+static void bench_parse_chrome(BenchState &state) { run_parse(state, corpus_chrome); }
+static void bench_parse_post(BenchState &state) { run_parse(state, corpus_post); }
+static void bench_parse_bad(BenchState &state) { run_parse(state, corpus_bad); }
+
+static void bench_parse_split(BenchState &state) {
+    int len = strlen(corpus_chrome);
+    for (long long i = 0; i < state.iterations; ++i) {
+        HttpConn::HTTP_CODE ret = HttpConnBench::parse_split(bench_conn, corpus_chrome, len, state.arg);
+        bench_do_not_optimize(ret);
+    }
+}
+
+static void bench_reset(BenchState &state) {
+    for (long long i = 0; i < state.iterations; ++i) {
+        HttpConnBench::reset(bench_conn);
+    }
+}
+
+// 依次重置 arg 个连接，模拟主线程在大量长连接之间切换，工作集超出缓存
+static void bench_reset_spread(BenchState &state) {
+    static HttpConn *conns = new HttpConn[state.arg];
+    for (long long i = 0; i < state.iterations; ++i) {
+        HttpConnBench::reset(conns[i % state.arg]);
+    }
+}
+
+static void bench_respond_404(BenchState &state) {
+    for (long long i = 0; i < state.iterations; ++i) {
+        size_t size = HttpConnBench::respond(bench_conn, HttpConn::NO_RESOURCE);
+        bench_do_not_optimize(size);
+    }
+}
+
+static BenchRegistrar r1("http/parse/curl", bench_parse_curl);
+static BenchRegistrar r2("http/parse/ab", bench_parse_ab);
+static BenchRegistrar r3("http/parse/chrome", bench_parse_chrome);
+static BenchRegistrar r4("http/parse/post", bench_parse_post);
+static BenchRegistrar r5("http/parse/bad", bench_parse_bad);
+static BenchRegistrar r6("http/parse_split/chrome", bench_parse_split, 64);
+static BenchRegistrar r7("http/parse_split/chrome", bench_parse_split, 8);
+static BenchRegistrar r8("http/reset", bench_reset);
+static BenchRegistrar r9("http/reset_spread", bench_reset_spread, 4096);
+static BenchRegistrar r10("http/respond/404", bench_respond_404);
@@ -0,0 +1,45 @@
+#include <vector>
+#include "bench.h"
+#include "../core/limit/client_limiter.h"
+
+// 每个 IP 每秒 1e9 个请求，只测量表的开销，不会被拒绝
+static ClientLimiter::Rule make_rule() {
+    ClientLimiter::Rule rule;
+    ClientLimiter::parse_rule("0.0.0.0/0 rate=1000000000 conns=1000000", rule);
+    return rule;
+}
+
+// 依次从 arg 个 IP 接受并关闭一个连接：已有表项时不加锁，只有两次原子加减
+static void bench_limit_accept(BenchState &state) {
+    if (!ClientLimiter::ready()) {
+        ClientLimiter::init(1);
+    }
+    ClientLimiter::Rule rule = make_rule();
+    uint32_t base = 0x0a000000;
+    for (long long i = 0; i < state.iterations; ++i) {
+        bool rejected;
+        int slot = ClientLimiter::acquire(rule, base + (uint32_t)(i % state.arg), rejected);
+        ClientLimiter::release(slot);
+        bench_do_not_optimize(slot);
+    }
+}
+
+// 一个连接上的请求依次经过令牌桶
+static void bench_limit_allow(BenchState &state) {
+    if (!ClientLimiter::ready()) {
+        ClientLimiter::init(1);
+    }
+    ClientLimiter::Rule rule = make_rule();
+    bool rejected;
+    int slot = ClientLimiter::acquire(rule, 0x0b000001, rejected);
+    for (long long i = 0; i < state.iterations; ++i) {
+        bool ok = ClientLimiter::allow(slot);
+        bench_do_not_optimize(ok);
+    }
+    ClientLimiter::release(slot);
+}
+
+static BenchRegistrar r1("limit/accept", bench_limit_accept, 1);
+static BenchRegistrar r2("limit/accept", bench_limit_accept, 1024);
+static BenchRegistrar r3("limit/accept", bench_limit_accept, 16384);
+static BenchRegistrar r4("limit/allow", bench_limit_allow, 0);
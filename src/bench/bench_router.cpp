@@ -0,0 +1,60 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "bench.h"
+#include "../http/router.h"
+
+// arg 个前缀路由加一个兜底的 "/"，查找最后注册的一个，对比按顺序逐个比较前缀
+static std::vector<std::string> make_prefixes(long n) {
+    std::vector<std::string> prefixes;
+    char buf[64];
+    for (long i = 0; i < n; ++i) {
+        snprintf(buf, sizeof(buf), "/api/v1/service%ld/", i);
+        prefixes.push_back(buf);
+    }
+    return prefixes;
+}
+
+static std::string make_path(long n) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "/api/v1/service%ld/users/42", n - 1);
+    return buf;
+}
+
+static void bench_router_find(BenchState &state) {
+    std::vector<std::string> prefixes = make_prefixes(state.arg);
+    Router<int> router;
+    router.add("/", Router<int>::PREFIX, -1);
+    for (size_t i = 0; i < prefixes.size(); ++i) {
+        router.add(prefixes[i], Router<int>::PREFIX, (int)i);
+    }
+    router.compile();
+    std::string path = make_path(state.arg);
+    for (long long i = 0; i < state.iterations; ++i) {
+        const int *route = router.find(path.c_str());
+        bench_do_not_optimize(route);
+    }
+}
+
+static void bench_router_linear(BenchState &state) {
+    std::vector<std::string> prefixes = make_prefixes(state.arg);
+    std::string path = make_path(state.arg);
+    for (long long i = 0; i < state.iterations; ++i) {
+        int route = -1;
+        for (size_t j = 0; j < prefixes.size(); ++j) {
+            if (strncmp(path.c_str(), prefixes[j].c_str(), prefixes[j].size()) == 0) {
+                route = j;
+                break;
+            }
+        }
+        bench_do_not_optimize(route);
+    }
+}
+
+static BenchRegistrar r1("router/find", bench_router_find, 4);
+static BenchRegistrar r2("router/find", bench_router_find, 64);
+static BenchRegistrar r3("router/find", bench_router_find, 1024);
+static BenchRegistrar r4("router/linear", bench_router_linear, 4);
+static BenchRegistrar r5("router/linear", bench_router_linear, 64);
+static BenchRegistrar r6("router/linear", bench_router_linear, 1024);
@@ -0,0 +1,88 @@
+#include <sched.h>
+#include "bench.h"
+#include "../core/threadpool/threadpool.h"
+
+// 空任务，只记录被处理的次数
+class BenchTask {
+public:
+    void process() {
+        m_done.fetch_add(1, std::memory_order_relaxed);
+    }
+    void shed() {
+        m_done.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static std::atomic<long long> m_done;
+};
+
+std::atomic<long long> BenchTask::m_done(0);
+
+// 每轮新建一个线程池，创建和析构（等待工作线程退出）都不计时
+// 排队时间上限设得足够大，基准中不丢弃请求
+static ThreadPool<BenchTask> *new_pool(int thread_number) {
+    return new ThreadPool<BenchTask>(thread_number, 1 << 20, 1 << 30, 1 << 30);
+}
+
+static void delete_pool(BenchState &state, ThreadPool<BenchTask> *pool) {
+    state.pause();
+    delete pool;
+    state.resume();
+}
+
+// 单个生产者（主线程）投递任务，arg 个工作线程处理，计时到全部处理完成
+static void bench_append_run(BenchState &state) {
+    state.pause();
+    ThreadPool<BenchTask> *pool = new_pool(state.arg);
+    BenchTask task;
+    BenchTask::m_done.store(0);
+    state.resume();
+
+    for (long long i = 0; i < state.iterations; ++i) {
+        while (!pool->append(&task)) {
+            sched_yield();
+        }
+    }
+    while (BenchTask::m_done.load(std::memory_order_relaxed) < state.iterations) {
+        sched_yield();
+    }
+    delete_pool(state, pool);
+}
+
+// 主线程每 64 个任务一批用 append_batch 投递，模拟一次 epoll_wait 返回很多事件，arg 个工作线程按批取出
+static void bench_batch_run(BenchState &state) {
+    static const int BATCH = 64;
+    state.pause();
+    ThreadPool<BenchTask> *pool = new_pool(state.arg);
+    BenchTask task;
+    BenchTask *tasks[BATCH];
+    for (int i = 0; i < BATCH; ++i) {
+        tasks[i] = &task;
+    }
+    BenchTask::m_done.store(0);
+    state.resume();
+
+    for (long long i = 0; i < state.iterations; ) {
+        int count = state.iterations - i < BATCH ? (int)(state.iterations - i) : BATCH;
+        int n = pool->append_batch(tasks, count);
+        if (n == 0) {
+            sched_yield();
+        }
+        i += n;
+    }
+    while (BenchTask::m_done.load(std::memory_order_relaxed) < state.iterations) {
+        sched_yield();
+    }
+    delete_pool(state, pool);
+}
+
+static BenchRegistrar r1("threadpool/append_run", bench_append_run, 1);
+static BenchRegistrar r2("threadpool/append_run", bench_append_run, 2);
+static BenchRegistrar r3("threadpool/append_run", bench_append_run, 4);
+static BenchRegistrar r4("threadpool/append_run", bench_append_run, 8);
+static BenchRegistrar r5("threadpool/append_run", bench_append_run, 16);
+static BenchRegistrar r6("threadpool/append_run", bench_append_run, 32);
+static BenchRegistrar r7("threadpool/append_run", bench_append_run, 64);
+static BenchRegistrar r8("threadpool/batch_run", bench_batch_run, 1);
+static BenchRegistrar r9("threadpool/batch_run", bench_batch_run, 4);
+static BenchRegistrar r10("threadpool/batch_run", bench_batch_run, 16);
+static BenchRegistrar r11("threadpool/batch_run", bench_batch_run, 64);
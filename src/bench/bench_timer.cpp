@@ -0,0 +1,108 @@
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "bench.h"
+#include "../core/timer/lst_timer.h"
+
+// 基准中的定时器到期不关闭任何 socket
+static void bench_cb_func(client_data *user_data) {
+    bench_do_not_optimize(user_data);
+}
+
+static uint32_t bench_rand(uint32_t &seed) {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+// 构造一个有 count 个活跃定时器的链表，超时时间分布在 [base, base + 15) 内
+// 按超时时间从大到小插入，每次都落在链表头部，避免准备阶段本身是 O(n^2)
+static void fill_timers(sort_timer_lst &lst, std::vector<util_timer *> &timers, long count, time_t base) {
+    uint32_t seed = 2022;
+    std::vector<time_t> expires(count);
+    for (long i = 0; i < count; ++i) {
+        expires[i] = base + bench_rand(seed) % 15;
+    }
+    std::sort(expires.begin(), expires.end(), std::greater<time_t>());
+
+    timers.resize(count);
+    for (long i = 0; i < count; ++i) {
+        util_timer *timer = new util_timer;
+        timer->expire = expires[i];
+        timer->cb_func = bench_cb_func;
+        timer->user_data = NULL;
+        lst.add_timer(timer);
+        timers[i] = timer;
+    }
+}
+
+// 新连接加入再关闭：init_timer 总是把定时器排在最后
+static void bench_add_del(BenchState &state) {
+    state.pause();
+    sort_timer_lst lst;
+    std::vector<util_timer *> timers;
+    time_t base = time(NULL) + 3600;
+    fill_timers(lst, timers, state.arg, base);
+    state.resume();
+
+    for (long long i = 0; i < state.iterations; ++i) {
+        util_timer *timer = new util_timer;
+        timer->expire = base + 15;
+        timer->cb_func = bench_cb_func;
+        timer->user_data = NULL;
+        lst.add_timer(timer);
+        lst.del_timer(timer);
+    }
+
+    state.pause();
+}
+
+// 活跃连接上有数据传输：adjust_timer 把随机一个定时器往后延
+static void bench_adjust(BenchState &state) {
+    state.pause();
+    sort_timer_lst lst;
+    std::vector<util_timer *> timers;
+    time_t base = time(NULL) + 3600;
+    fill_timers(lst, timers, state.arg, base);
+    uint32_t seed = 1314;
+    state.resume();
+
+    for (long long i = 0; i < state.iterations; ++i) {
+        util_timer *timer = timers[bench_rand(seed) % timers.size()];
+        timer->expire = base + 15 + i;
+        lst.adjust_timer(timer);
+    }
+
+    state.pause();
+}
+
+// 每次 tick 有一个连接超时，其余连接都未到期
+static void bench_tick(BenchState &state) {
+    state.pause();
+    sort_timer_lst lst;
+    std::vector<util_timer *> timers;
+    fill_timers(lst, timers, state.arg, time(NULL) + 3600);
+    state.resume();
+
+    for (long long i = 0; i < state.iterations; ++i) {
+        util_timer *timer = new util_timer;
+        timer->expire = 0;
+        timer->cb_func = bench_cb_func;
+        timer->user_data = NULL;
+        lst.add_timer(timer);
+        lst.tick();
+    }
+
+    state.pause();
+}
+
+static BenchRegistrar r1("timer/add_del", bench_add_del, 1000);
+static BenchRegistrar r2("timer/add_del", bench_add_del, 10000);
+static BenchRegistrar r3("timer/add_del", bench_add_del, 100000);
+static BenchRegistrar r4("timer/adjust", bench_adjust, 1000);
+static BenchRegistrar r5("timer/adjust", bench_adjust, 10000);
+static BenchRegistrar r6("timer/adjust", bench_adjust, 100000);
+static BenchRegistrar r7("timer/tick", bench_tick, 1000);
+static BenchRegistrar r8("timer/tick", bench_tick, 10000);
+static BenchRegistrar r9("timer/tick", bench_tick, 100000);
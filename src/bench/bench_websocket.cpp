@@ -0,0 +1,40 @@
+#include <cstring>
+#include <vector>
+#include "bench.h"
+#include "../http/websocket.h"
+
+static const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+
+// 解除 arg 字节负载的掩码，对比逐字节异或
+static void bench_unmask(BenchState &state) {
+    std::vector<char> data(state.arg, 'x');
+    for (long long i = 0; i < state.iterations; ++i) {
+        WsSession::unmask(&data[0], data.size(), mask);
+        bench_do_not_optimize(&data[0]);
+    }
+}
+
+static void bench_unmask_scalar(BenchState &state) {
+    std::vector<char> data(state.arg, 'x');
+    for (long long i = 0; i < state.iterations; ++i) {
+        for (long j = 0; j < state.arg; ++j) {
+            data[j] ^= mask[j & 3];
+        }
+        bench_do_not_optimize(&data[0]);
+    }
+}
+
+// 广播时每条消息序列化一次
+static void bench_frame(BenchState &state) {
+    std::vector<char> data(state.arg, 'x');
+    for (long long i = 0; i < state.iterations; ++i) {
+        std::shared_ptr<const std::string> frame = WsSession::frame(WsSession::TEXT, &data[0], data.size());
+        bench_do_not_optimize(frame.get());
+    }
+}
+
+static BenchRegistrar r1("ws/unmask", bench_unmask, 125);
+static BenchRegistrar r2("ws/unmask", bench_unmask, 4096);
+static BenchRegistrar r3("ws/unmask_scalar", bench_unmask_scalar, 125);
+static BenchRegistrar r4("ws/unmask_scalar", bench_unmask_scalar, 4096);
+static BenchRegistrar r5("ws/frame", bench_frame, 125);
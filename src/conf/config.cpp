@@ -1,8 +1,14 @@
+#include <cstdio>
+#include <cstring>
+#include <netdb.h>
+#include <arpa/inet.h>
 #include "config.h"
 
+std::shared_ptr<const SiteConfig> SiteConfig::m_current;
+
 void Config::parse_arg(int argc, char *argv[]) {
     int opt;
-    const char *str = "p:t:";
+    const char *str = "p:t:a:s:l:d:u:w:n:f:r:m:c:";
     while ((opt = getopt(argc, argv, str)) != -1) {
         switch (opt) {
             case 'p':
@@ -10,9 +16,139 @@ void Config::parse_arg(int argc, char *argv[]) {
                 break;
             case 't':
                 thread_num = atoi(optarg);
+                break;
+            case 'a':
+                admin_port = atoi(optarg);
+                break;
+            case 's':
+                slow_ms = atoi(optarg);
+                break;
+            case 'l':
+                log_dir = optarg;
+                break;
+            case 'd':
+                db_backend = optarg;
+                break;
+            case 'u':
+                db_user = optarg;
+                break;
+            case 'w':
+                db_password = optarg;
+                break;
+            case 'n':
+                db_name = optarg;
+                break;
+            case 'f':
+                // 配置文件中的值可以被后面的命令行参数覆盖
+                config_file = optarg;
+                if (!parse_file(optarg)) {
+                    fprintf(stderr, "open config file %s failed\n", optarg);
+                }
+                break;
+            case 'r':
+                doc_root = optarg;
+                break;
+            case 'm':
+                workers = atoi(optarg);
+                break;
+            case 'c':
+                coroutine = atoi(optarg);
+                break;
             default:
                 break;
         }
     }
 }
 
+// 去掉首尾的空白
+static std::string trim(const std::string &text) {
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) {
+        return "";
+    }
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+bool Config::parse_file(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+
+    // 代理和限流只能在配置文件中设置，重新读取时整体替换
+    proxy.clear();
+    limit.clear();
+    char line[1024];
+    while (fgets(line, sizeof(line), fp)) {
+        std::string text = trim(line);
+        size_t eq = text.find('=');
+        if (text.empty() || text[0] == '#' || eq == std::string::npos) {
+            continue;
+        }
+        std::string key = trim(text.substr(0, eq));
+        std::string value = trim(text.substr(eq + 1));
+
+        if (key == "port") port = atoi(value.c_str());
+        else if (key == "thread_num") thread_num = atoi(value.c_str());
+        else if (key == "thread_max") thread_max = atoi(value.c_str());
+        else if (key == "thread_grow_ms") thread_grow_ms = atoi(value.c_str());
+        else if (key == "thread_idle_s") thread_idle_s = atoi(value.c_str());
+        else if (key == "admin_port") admin_port = atoi(value.c_str());
+        else if (key == "tls_port") tls_port = atoi(value.c_str());
+        else if (key == "tls_cert") tls_cert = value;
+        else if (key == "tls_key") tls_key = value;
+        else if (key == "slow_ms") slow_ms = atoi(value.c_str());
+        else if (key == "timeout") timeout = atoi(value.c_str());
+        else if (key == "first_byte_timeout") first_byte_timeout = atoi(value.c_str());
+        else if (key == "header_timeout") header_timeout = atoi(value.c_str());
+        else if (key == "body_timeout") body_timeout = atoi(value.c_str());
+        else if (key == "send_min_rate") send_min_rate = atoi(value.c_str());
+        else if (key == "keepalive_timeout") keepalive_timeout = atoi(value.c_str());
+        else if (key == "workers") workers = atoi(value.c_str());
+        else if (key == "numa") numa = atoi(value.c_str());
+        else if (key == "coroutine") coroutine = atoi(value.c_str());
+        else if (key == "inline_requests") inline_requests = atoi(value.c_str());
+        else if (key == "huge_pages") {
+            huge_pages = value == "thp" ? 1 : value == "explicit" ? 2 : atoi(value.c_str());
+        }
+        else if (key == "doc_root") doc_root = value;
+        else if (key == "trace_file") trace_file = value;
+        else if (key == "log_dir") log_dir = value;
+        else if (key == "db_backend") db_backend = value;
+        else if (key == "db_host") db_host = value;
+        else if (key == "db_port") db_port = atoi(value.c_str());
+        else if (key == "db_user") db_user = value;
+        else if (key == "db_password") db_password = value;
+        else if (key == "db_name") db_name = value;
+        else if (key == "journal_file") journal_file = value;
+        else if (key == "user_table_size") user_table_size = atoi(value.c_str());
+        else if (key == "proxy") proxy.push_back(value);
+        else if (key == "limit") limit.push_back(value);
+        else fprintf(stderr, "%s: unknown config key %s\n", path, key.c_str());
+    }
+    fclose(fp);
+    return true;
+}
+
+bool SiteConfig::parse_proxy(const std::string &text, ProxyRoute &route) {
+    size_t space = text.find_first_of(" \t");
+    size_t colon = text.rfind(':');
+    if (space == std::string::npos || colon == std::string::npos || colon < space || text[0] != '/') {
+        return false;
+    }
+    route.prefix = text.substr(0, space);
+    std::string host = trim(text.substr(space, colon - space));
+    std::string port = text.substr(colon + 1);
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0) {
+        return false;
+    }
+    memcpy(&route.upstream, res->ai_addr, sizeof(route.upstream));
+    freeaddrinfo(res);
+    return true;
+}
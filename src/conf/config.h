@@ -3,6 +3,12 @@
 
 #include <unistd.h>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <memory>
+#include <vector>
+#include <netinet/in.h>
+#include "../core/limit/client_limiter.h"
 
 class Config
 {
@@ -11,13 +17,89 @@ public:
 
     // 解析命令行参数
     void parse_arg(int argc, char *argv[]);
+    // 解析配置文件，每行一个 key = value，# 开头为注释，返回是否成功打开文件
+    bool parse_file(const char *path);
 
     int port = 8808;        // 端口，默认 8808
-    int thread_num = 8;     // 线程池内的线程数量, 默认 8
+    int thread_num = 8;     // 线程池内的线程数量, 默认 8；自动伸缩时为下限
+    int thread_max = 0;     // 线程池自动伸缩的上限，默认 0 为不伸缩
+    int thread_grow_ms = 5; // 请求排队或者一批请求的处理超过这个时间时增加线程，毫秒
+    int thread_idle_s = 30; // 多出的线程空闲这么久后退出，秒
+    int admin_port = 0;     // 管理端口，只提供运行时统计，默认 0 不开启
+    int tls_port = 0;       // TLS 端口，需要 tls_cert 和 tls_key，默认 0 不开启
+    int slow_ms = 0;        // 慢请求阈值，毫秒，超过的请求写入 trace 文件，默认 0 不开启
+    int timeout = 15;       // 连接无数据传输的超时时间，秒，用于 HTTP/2、WebSocket、反向代理等没有单独期限的阶段
+    int first_byte_timeout = 10;    // 接受连接（包括 TLS 握手）到收到第一个请求字节的期限，秒
+    int header_timeout = 10;        // 收到请求的第一个字节到读完请求头的期限，秒
+    int body_timeout = 15;          // 读取请求体时两次收到数据的最长间隔，秒
+    int send_min_rate = 1024;       // 发送响应的最低平均速率，字节/秒，有 timeout 秒的宽限，0 为只按 timeout 的空闲时间
+    int keepalive_timeout = 15;     // 响应发送完到下一个请求的第一个字节的期限，秒
+    int workers = 0;        // 工作进程数，每个进程有自己的线程池，默认 0 为单进程
+    int numa = 0;           // 是否把连接表、缓冲区放到一个 NUMA 节点上，多进程模式下同时绑定工作进程的 CPU，默认 0 不绑定
+    int huge_pages = 0;     // 连接表和缓冲区使用的大页，0 不使用，1 透明大页，2 显式大页
+    int coroutine = 0;      // 连接的处理方式，0 按事件分派给回调，1 每个连接一个协程
+    int inline_requests = 0;    // 主线程直接处理不会阻塞的请求（错误、页缓存中的文件、运行时统计），默认 0 全部交给线程池
+
+    std::string config_file;                        // 配置文件，收到 SIGHUP 时重新读取
+    std::string doc_root;                           // 资源文件根目录，默认为工作目录下的 root
+    std::string trace_file = "slow_trace.json";     // 慢请求 trace 文件
+    std::string log_dir;                            // 日志目录，默认为空不记录日志
+    std::string tls_cert;                           // TLS 证书链，PEM
+    std::string tls_key;                            // TLS 私钥，PEM
+    std::vector<std::string> proxy;                 // 反向代理，每项为 "<路径前缀> <host>:<port>"
+    std::vector<std::string> limit;                 // 客户端限流，每项为 "<ip>[/<prefix>] rate=<n> burst=<n> conns=<n> [shared]"
+
+    std::string db_backend = "mysql";               // 用户表所在的数据库，mysql 或 memory（进程内，用于测试）
+    std::string db_host = "localhost";
+    int db_port = 3306;
+    std::string db_user = "root";
+    std::string db_password;
+    std::string db_name = "molecule";
+    std::string journal_file = "register.journal";  // 尚未写入数据库的注册用户
+    int user_table_size = 65536;                    // 多进程模式下共享用户表的表项数
+
+    const long LOG_FILE_SIZE = 64 * 1024 * 1024;    // 单个日志文件的大小上限
 
     const int MAX_FD = 65536;           //最大文件描述符
     const int MAX_EVENT_NUMBER = 10000; //最大事件数
     const int TIMESLOT = 5;             //最小超时单位
+    const int MAX_REQUESTS = 10000;     //请求队列的最大长度
+    const int QUEUE_TARGET_MS = 10;     //线程池持续繁忙时，请求最长排队时间
+    const int QUEUE_INTERVAL_MS = 100;  //线程池突发繁忙时，请求最长排队时间
+};
+
+struct RouteTable;
+
+// 处理请求时用到的、可以在运行中整体替换的配置
+// 请求开始处理时取一份快照并一直持有到响应发送完，重新加载配置时只替换指针（类似 RCU），
+// 正在处理的请求继续使用旧的快照，旧快照在最后一个持有者释放时销毁
+class SiteConfig {
+public:
+    // 路径以 prefix 开头的请求转发给上游
+    struct ProxyRoute {
+        std::string prefix;
+        sockaddr_in upstream;
+    };
+
+    std::string doc_root;       // 资源文件根目录
+    std::vector<ProxyRoute> proxies;
+    std::vector<ClientLimiter::Rule> limits;    // 按前缀从长到短排序
+    std::shared_ptr<const RouteTable> routes;   // 请求的路由，由 HttpConn::build_routes 生成
+
+    // 解析 "<路径前缀> <host>:<port>"，host 在加载配置时解析一次
+    static bool parse_proxy(const std::string &text, ProxyRoute &route);
+
+    // 当前生效的配置
+    static std::shared_ptr<const SiteConfig> current() {
+        return std::atomic_load(&m_current);
+    }
+    // 发布新的配置
+    static void update(std::shared_ptr<const SiteConfig> site) {
+        std::atomic_store(&m_current, site);
+    }
+
+private:
+    static std::shared_ptr<const SiteConfig> m_current;
 };
 
-#endif // CONFIG_H_
\ No newline at end of file
+#endif // CONFIG_H_
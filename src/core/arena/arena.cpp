@@ -0,0 +1,161 @@
+#include <cstdlib>
+#include <cstring>
+#include "arena.h"
+
+// 线程局部的空闲块池
+// local 只由所属线程访问；remote 由其他线程压入、所属线程整体取走
+// 线程退出时 remote 置为 RETIRED，之后其他线程归还的块直接释放。块池本身不释放，其他线程可能还持有指向它的块
+struct Arena::ChunkPool {
+    Chunk *local;
+    int count;
+    std::atomic<Chunk *> remote;
+};
+
+struct Arena::PoolHolder {
+    ChunkPool *pool = NULL;
+    ~PoolHolder();
+};
+
+Arena::Chunk *const Arena::RETIRED = reinterpret_cast<Arena::Chunk *>(1);
+thread_local Arena::ChunkPool *Arena::t_pool = NULL;
+thread_local Arena::PoolHolder Arena::t_holder;
+
+Arena::PoolHolder::~PoolHolder() {
+    if (!pool) {
+        return;
+    }
+    t_pool = NULL;
+    Chunk *chunk = pool->remote.exchange(RETIRED, std::memory_order_acquire);
+    while (chunk) {
+        Chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    chunk = pool->local;
+    while (chunk) {
+        Chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    pool->local = NULL;
+    pool->count = 0;
+}
+
+Arena::Chunk *Arena::get_chunk() {
+    ChunkPool *pool = t_pool;
+    if (!pool) {
+        pool = new ChunkPool;
+        pool->local = NULL;
+        pool->count = 0;
+        pool->remote.store(NULL, std::memory_order_relaxed);
+        t_pool = pool;
+        t_holder.pool = pool;
+    }
+    if (!pool->local) {
+        // 收回其他线程归还的块
+        Chunk *chunk = pool->remote.exchange(NULL, std::memory_order_acquire);
+        while (chunk) {
+            Chunk *next = chunk->next;
+            chunk->next = pool->local;
+            pool->local = chunk;
+            ++pool->count;
+            chunk = next;
+        }
+    }
+
+    Chunk *chunk = pool->local;
+    if (chunk) {
+        pool->local = chunk->next;
+        --pool->count;
+        return chunk;
+    }
+    chunk = static_cast<Chunk *>(malloc(sizeof(Chunk) + CHUNK_SIZE));
+    if (chunk) {
+        chunk->owner = pool;
+        chunk->size = CHUNK_SIZE;
+    }
+    return chunk;
+}
+
+void Arena::put_chunk(Chunk *chunk) {
+    ChunkPool *pool = chunk->owner;
+    if (!pool) {
+        free(chunk);
+        return;
+    }
+    if (pool == t_pool) {
+        if (pool->count >= MAX_CACHED_CHUNKS) {
+            free(chunk);
+            return;
+        }
+        chunk->next = pool->local;
+        pool->local = chunk;
+        ++pool->count;
+        return;
+    }
+
+    // 归还给所属线程
+    Chunk *head = pool->remote.load(std::memory_order_relaxed);
+    do {
+        if (head == RETIRED) {
+            free(chunk);
+            return;
+        }
+        chunk->next = head;
+    } while (!pool->remote.compare_exchange_weak(head, chunk, std::memory_order_release, std::memory_order_relaxed));
+}
+
+void *Arena::alloc_slow(size_t size, size_t align) {
+    // 多留 align 字节，保证对齐后仍放得下
+    size_t need = size + align;
+    if (need > CHUNK_SIZE) {
+        // 大块单独申请，不替换当前分配的块
+        Chunk *chunk = static_cast<Chunk *>(malloc(sizeof(Chunk) + need));
+        if (!chunk) {
+            return NULL;
+        }
+        chunk->owner = NULL;
+        chunk->size = need;
+        if (m_chunks) {
+            chunk->next = m_chunks->next;
+            m_chunks->next = chunk;
+        }
+        else {
+            chunk->next = NULL;
+            m_chunks = chunk;
+        }
+        uintptr_t p = reinterpret_cast<uintptr_t>(chunk + 1);
+        return reinterpret_cast<void *>((p + align - 1) & ~(uintptr_t)(align - 1));
+    }
+
+    Chunk *chunk = get_chunk();
+    if (!chunk) {
+        return NULL;
+    }
+    chunk->next = m_chunks;
+    m_chunks = chunk;
+    m_ptr = reinterpret_cast<char *>(chunk + 1);
+    m_end = m_ptr + chunk->size;
+    return alloc(size, align);
+}
+
+char *Arena::strndup(const char *s, size_t len) {
+    char *p = static_cast<char *>(alloc(len + 1, 1));
+    if (p) {
+        memcpy(p, s, len);
+        p[len] = '\0';
+    }
+    return p;
+}
+
+void Arena::reset() {
+    Chunk *chunk = m_chunks;
+    while (chunk) {
+        Chunk *next = chunk->next;
+        put_chunk(chunk);
+        chunk = next;
+    }
+    m_chunks = NULL;
+    m_ptr = NULL;
+    m_end = NULL;
+}
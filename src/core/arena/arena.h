@@ -0,0 +1,65 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// 按请求分配内存的 bump-pointer 分配器
+// 一个请求内的分配只向后移动指针，不单独释放，请求结束时 reset 一次归还所有内存块
+// 内存块来自线程局部的块池，分配和归还都不经过全局分配器；
+// 块在其他线程归还时（工作线程分配，主线程在长连接上 init 时归还）无锁地挂到所属线程的远程链表上，
+// 由所属线程下次取块时收回
+class Arena {
+public:
+    static const size_t CHUNK_SIZE = 4096;      // 内存块大小，放不下的分配单独向全局分配器申请
+    static const int MAX_CACHED_CHUNKS = 256;   // 每个线程最多缓存的空闲块数
+
+    Arena() : m_chunks(NULL), m_ptr(NULL), m_end(NULL) {}
+    ~Arena() { reset(); }
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    // 分配 size 字节，按 align 对齐，失败返回 NULL
+    void *alloc(size_t size, size_t align = alignof(std::max_align_t)) {
+        if (m_ptr) {
+            uintptr_t p = (reinterpret_cast<uintptr_t>(m_ptr) + align - 1) & ~(uintptr_t)(align - 1);
+            if (p + size <= reinterpret_cast<uintptr_t>(m_end)) {
+                m_ptr = reinterpret_cast<char *>(p + size);
+                return reinterpret_cast<void *>(p);
+            }
+        }
+        return alloc_slow(size, align);
+    }
+    // 复制 len 字节并补上结尾的 '\0'
+    char *strndup(const char *s, size_t len);
+
+    // 归还所有内存块，之前分配的内存全部失效
+    void reset();
+
+private:
+    struct ChunkPool;
+    struct PoolHolder;
+
+    // 内存块头部，数据紧跟其后
+    struct Chunk {
+        Chunk *next;
+        ChunkPool *owner;       // 所属线程的块池，单独申请的大块为 NULL
+        size_t size;            // 数据区大小
+    };
+
+    void *alloc_slow(size_t size, size_t align);
+
+    static Chunk *get_chunk();
+    static void put_chunk(Chunk *chunk);
+
+    static Chunk *const RETIRED;                // 线程已退出的块池的 remote 标记
+    static thread_local ChunkPool *t_pool;      // 当前线程的块池，线程退出后为 NULL
+    static thread_local PoolHolder t_holder;    // 线程退出时释放缓存的块
+
+    Chunk *m_chunks;            // 已使用的内存块，第一个是当前分配的块
+    char *m_ptr;                // 当前块中下一个可用的位置
+    char *m_end;                // 当前块的结尾
+};
+
+#endif // ARENA_H_
@@ -0,0 +1,183 @@
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <climits>
+#include <sys/uio.h>
+#include "buffer_chain.h"
+
+void BufferChain::reset() {
+    m_head = m_tail = NULL;
+    m_size = 0;
+    m_block = NULL;
+    m_block_left = 0;
+    m_retained = 0;
+    m_blobs.clear();
+}
+
+BufferChain::Segment *BufferChain::push(const char *data, size_t len) {
+    Segment *seg = static_cast<Segment *>(m_arena.alloc(sizeof(Segment), alignof(Segment)));
+    if (!seg) {
+        return NULL;
+    }
+    m_retained += sizeof(Segment);
+    seg->data = data;
+    seg->len = len;
+    seg->next = NULL;
+    seg->blob = false;
+    if (m_tail) {
+        m_tail->next = seg;
+    }
+    else {
+        m_head = seg;
+    }
+    m_tail = seg;
+    m_size += len;
+    return seg;
+}
+
+// 在当前内存块中留出 len 字节，放不下时换一个新块
+char *BufferChain::reserve(size_t len) {
+    if (len > m_block_left) {
+        size_t size = len > BLOCK_SIZE ? len : BLOCK_SIZE;
+        m_block = static_cast<char *>(m_arena.alloc(size, 1));
+        if (!m_block) {
+            m_block_left = 0;
+            return NULL;
+        }
+        m_retained += size;
+        m_block_left = size;
+    }
+    return m_block;
+}
+
+bool BufferChain::append(const char *data, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    char *p = reserve(len);
+    if (!p) {
+        return false;
+    }
+    memcpy(p, data, len);
+    m_block += len;
+    m_block_left -= len;
+    // 与上一段在同一块中相邻时直接延长
+    if (m_tail && m_tail->data + m_tail->len == p) {
+        m_tail->len += len;
+        m_size += len;
+        return true;
+    }
+    return push(p, len) != NULL;
+}
+
+bool BufferChain::printf(const char *format, ...) {
+    va_list arg_list;
+    va_start(arg_list, format);
+    bool ret = vprintf(format, arg_list);
+    va_end(arg_list);
+    return ret;
+}
+
+bool BufferChain::vprintf(const char *format, va_list arg_list) {
+    va_list retry;
+    va_copy(retry, arg_list);
+    char *p = m_block_left > 0 ? m_block : NULL;
+    int len = vsnprintf(p, m_block_left, format, arg_list);
+    if (len <= 0) {
+        va_end(retry);
+        return len == 0;
+    }
+    if ((size_t)len >= m_block_left) {
+        // 当前块放不下（vsnprintf 还要写结尾的 '\0'），换一块重新格式化
+        m_block_left = 0;
+        p = reserve(len + 1);
+        if (!p) {
+            va_end(retry);
+            return false;
+        }
+        vsnprintf(p, m_block_left, format, retry);
+    }
+    va_end(retry);
+    m_block += len;
+    m_block_left -= len;
+    if (m_tail && m_tail->data + m_tail->len == p) {
+        m_tail->len += len;
+        m_size += len;
+        return true;
+    }
+    return push(p, len) != NULL;
+}
+
+bool BufferChain::append_ref(const char *data, size_t len) {
+    if (len == 0) {
+        return true;
+    }
+    // 之后追加的数据不能再延长前面内存块中的段
+    m_block_left = 0;
+    return push(data, len) != NULL;
+}
+
+bool BufferChain::append_blob(const std::shared_ptr<const std::string> &blob) {
+    if (!blob || blob->empty()) {
+        return true;
+    }
+    if (!append_ref(blob->data(), blob->size())) {
+        return false;
+    }
+    m_tail->blob = true;
+    m_blobs.push_back(blob);
+    return true;
+}
+
+std::shared_ptr<const std::string> BufferChain::copy_pending() const {
+    std::shared_ptr<std::string> copy = std::make_shared<std::string>();
+    copy->reserve(m_size);
+    for (Segment *seg = m_head; seg; seg = seg->next) {
+        copy->append(seg->data, seg->len);
+    }
+    return copy;
+}
+
+ssize_t BufferChain::write_to(int fd) {
+    struct iovec iov[IOV_MAX];
+    int count = peek(iov, IOV_MAX);
+    if (count == 0) {
+        return 0;
+    }
+    ssize_t n = writev(fd, iov, count);
+    if (n > 0) {
+        consume(n);
+    }
+    return n;
+}
+
+int BufferChain::peek(struct iovec *iov, int max) const {
+    int count = 0;
+    for (Segment *seg = m_head; seg && count < max; seg = seg->next) {
+        iov[count].iov_base = const_cast<char *>(seg->data);
+        iov[count].iov_len = seg->len;
+        ++count;
+    }
+    return count;
+}
+
+// 丢弃发送完的段，最后一段可能只发送了一部分；发送完的共享块马上释放
+void BufferChain::consume(size_t n) {
+    size_t left = n;
+    m_size -= n;
+    while (m_head && left >= m_head->len) {
+        left -= m_head->len;
+        if (m_head->blob) {
+            m_blobs.pop_front();
+        }
+        m_head = m_head->next;
+    }
+    if (m_head) {
+        m_head->data += left;
+        m_head->len -= left;
+    }
+    else {
+        m_tail = NULL;
+        m_block_left = 0;
+    }
+}
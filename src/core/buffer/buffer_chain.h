@@ -0,0 +1,72 @@
+#ifndef BUFFER_CHAIN_H_
+#define BUFFER_CHAIN_H_
+
+#include <cstdarg>
+#include <cstddef>
+#include <deque>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "../arena/arena.h"
+
+// 待发送数据的链表，每一段可以是：
+//   内存块：append / printf 复制进来的数据，块从请求的 Arena 中分配，随 Arena 整体归还
+//   引用：  append_ref 直接指向调用者的内存（文件映射的一段、静态字符串），调用者保证发送完之前有效
+//   共享块：append_blob 持有一个 shared_ptr，这一段发送完时释放（缓存中的内容、WebSocket 帧）
+// write_to 一次 writev 最多发送 IOV_MAX 段，部分发送时从断开的位置继续
+class BufferChain {
+public:
+    static const size_t BLOCK_SIZE = 1024;      // 内存块的默认大小，更长的数据单独分配一块
+
+    explicit BufferChain(Arena &arena) : m_arena(arena) { reset(); }
+
+    // 复制 len 字节
+    bool append(const char *data, size_t len);
+    // 格式化后追加
+    bool printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+    bool vprintf(const char *format, va_list arg_list);
+    // 引用 len 字节，不复制
+    bool append_ref(const char *data, size_t len);
+    // 引用共享的内容，发送完或 reset 时释放
+    bool append_blob(const std::shared_ptr<const std::string> &blob);
+
+    // 尚未发送的字节数
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    // 上次 reset 以来从 Arena 分配的字节数，发送完的段也不会归还
+    size_t retained() const { return m_retained; }
+    // 复制出尚未发送的数据，用于在一直发送不完的连接上归还 Arena：复制、reset、归还 Arena 后再 append_blob
+    std::shared_ptr<const std::string> copy_pending() const;
+
+    // 用一次 writev 发送尽可能多的数据，丢弃已发送的部分，返回发送的字节数，出错返回 -1
+    ssize_t write_to(int fd);
+    // 不经过 writev 发送时（TLS）：取出最前面最多 max 段，发送后用 consume 丢弃已发送的 n 字节
+    int peek(struct iovec *iov, int max) const;
+    void consume(size_t n);
+
+    // 清空，内存块的空间由 Arena 在 reset 时回收
+    void reset();
+
+private:
+    struct Segment {
+        const char *data;
+        size_t len;
+        Segment *next;
+        bool blob;              // 引用 m_blobs 中的一块，发送完时从 m_blobs 的头部释放
+    };
+
+    Segment *push(const char *data, size_t len);
+    char *reserve(size_t len);
+
+    Arena &m_arena;
+    Segment *m_head;            // 第一段未发送完的数据
+    Segment *m_tail;
+    size_t m_size;
+    char *m_block;              // 当前内存块的可用位置，紧跟在 m_tail 的数据之后时可以直接延长 m_tail
+    size_t m_block_left;        // 当前内存块剩余的字节数
+    size_t m_retained;          // 从 Arena 分配的字节数
+    std::deque<std::shared_ptr<const std::string> > m_blobs;   // 与引用它们的段顺序相同
+};
+
+#endif // BUFFER_CHAIN_H_
@@ -0,0 +1,35 @@
+#include <new>
+#include "coro.h"
+#include "../metrics/metrics.h"
+
+FramePool::Node *FramePool::m_free[FramePool::MAX_SIZE / FramePool::GRANULE];
+size_t FramePool::m_pooled = 0;
+
+void *FramePool::alloc(size_t size) {
+    if (size > MAX_SIZE) {
+        Metrics::add(Metrics::CORO_FRAME_ALLOCS);
+        return ::operator new(size);
+    }
+    size_t index = (size - 1) / GRANULE;
+    Node *node = m_free[index];
+    if (node) {
+        m_free[index] = node->next;
+        --m_pooled;
+        return node;
+    }
+    // 第一次用到这一级，按级别的上限分配，放回后同一级的任意大小都能使用
+    Metrics::add(Metrics::CORO_FRAME_ALLOCS);
+    return ::operator new((index + 1) * GRANULE);
+}
+
+void FramePool::free(void *frame, size_t size) {
+    if (size > MAX_SIZE) {
+        ::operator delete(frame);
+        return;
+    }
+    size_t index = (size - 1) / GRANULE;
+    Node *node = static_cast<Node *>(frame);
+    node->next = m_free[index];
+    m_free[index] = node;
+    ++m_pooled;
+}
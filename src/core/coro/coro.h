@@ -0,0 +1,77 @@
+#ifndef CORO_H_
+#define CORO_H_
+
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
+// 协程帧的内存池，只在主线程使用
+// 按 64 字节分级，每级一个空闲链表；帧销毁后放回链表，同样大小的下一个协程直接取用，稳定运行后创建协程不再分配内存
+// 超过 MAX_SIZE 的帧直接从堆分配
+class FramePool {
+public:
+    static const size_t GRANULE = 64;
+    static const size_t MAX_SIZE = 4096;
+
+    static void *alloc(size_t size);
+    static void free(void *frame, size_t size);
+
+    static size_t pooled() { return m_pooled; }     // 空闲链表中的帧数
+
+private:
+    struct Node {
+        Node *next;
+    };
+
+    static Node *m_free[MAX_SIZE / GRANULE];
+    static size_t m_pooled;
+};
+
+// 连接协程的返回类型
+// 创建后立即执行到第一个 co_await，执行结束时协程帧自动销毁，不需要保存句柄
+// 协程只在主线程创建、恢复和结束，帧从 FramePool 分配
+struct ConnTask {
+    struct promise_type {
+        ConnTask get_return_object() noexcept { return ConnTask(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+
+        static void *operator new(size_t size) { return FramePool::alloc(size); }
+        static void operator delete(void *frame, size_t size) { FramePool::free(frame, size); }
+    };
+};
+
+// 一个 fd 上挂起的协程，co_await 它得到下一次唤醒时的 epoll 事件
+// 事件循环把 fd 上的事件交给 wake；连接被关闭（超时、出错、上游失败）时以 CLOSED 唤醒，协程直接结束
+class Waiter {
+public:
+    static const uint32_t CLOSED = 0;
+
+    Waiter() : m_events(CLOSED) {}
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::coroutine_handle<> handle) noexcept { m_handle = handle; }
+    uint32_t await_resume() const noexcept { return m_events; }
+
+    bool waiting() const { return (bool)m_handle; }
+    // 恢复挂起的协程，在它下一次挂起或者结束时返回；没有协程在等待时返回 false
+    bool wake(uint32_t events) {
+        if (!m_handle) {
+            return false;
+        }
+        std::coroutine_handle<> handle = m_handle;
+        m_handle = nullptr;
+        m_events = events;
+        handle.resume();
+        return true;
+    }
+
+private:
+    std::coroutine_handle<> m_handle;
+    uint32_t m_events;
+};
+
+#endif // CORO_H_
@@ -0,0 +1,260 @@
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+#include <sstream>
+#include <sched.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+#include "client_limiter.h"
+#include "../metrics/metrics.h"
+
+ClientLimiter::Entry *ClientLimiter::m_entries = NULL;
+ClientLimiter::Shard *ClientLimiter::m_shards = NULL;
+std::atomic<int> *ClientLimiter::m_conns = NULL;
+int ClientLimiter::m_processes = 1;
+int ClientLimiter::m_process = 0;
+
+bool ClientLimiter::init(int processes) {
+    if (processes < 1) {
+        processes = 1;
+    }
+    size_t entries = sizeof(Entry) * SLOTS;
+    size_t shards = sizeof(Shard) * SHARDS;
+    size_t conns = sizeof(std::atomic<int>) * SLOTS * processes;
+    // 匿名共享映射在 fork 后父子进程间共享，初始内容为 0：表项为空，锁未被持有，连接数为 0
+    // 页面在第一次访问时才分配，没有配置规则时几乎不占内存
+    char *addr = (char *)mmap(NULL, entries + shards + conns, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    m_entries = reinterpret_cast<Entry *>(addr);
+    m_shards = reinterpret_cast<Shard *>(addr + entries);
+    m_conns = reinterpret_cast<std::atomic<int> *>(addr + entries + shards);
+    m_processes = processes;
+    m_process = 0;
+    return true;
+}
+
+void ClientLimiter::reset_process(int process) {
+    if (!m_entries || process < 0 || process >= m_processes) {
+        return;
+    }
+    for (int slot = 0; slot < SLOTS; ++slot) {
+        m_conns[slot * m_processes + process].store(0, std::memory_order_relaxed);
+    }
+}
+
+bool ClientLimiter::parse_rule(const std::string &text, Rule &rule) {
+    std::istringstream in(text);
+    std::string cidr, token;
+    if (!(in >> cidr)) {
+        return false;
+    }
+    rule.prefix = 32;
+    size_t slash = cidr.find('/');
+    if (slash != std::string::npos) {
+        rule.prefix = atoi(cidr.c_str() + slash + 1);
+        cidr.resize(slash);
+    }
+    struct in_addr addr;
+    if (rule.prefix < 0 || rule.prefix > 32 || inet_pton(AF_INET, cidr.c_str(), &addr) != 1) {
+        return false;
+    }
+    rule.mask = rule.prefix == 0 ? 0 : 0xffffffffu << (32 - rule.prefix);
+    rule.network = ntohl(addr.s_addr) & rule.mask;
+    rule.shared = false;
+    rule.rate = 0;
+    rule.burst = 0;
+    rule.max_conns = 0;
+
+    while (in >> token) {
+        if (token == "shared") {
+            rule.shared = true;
+        }
+        else if (token.compare(0, 5, "rate=") == 0) {
+            rule.rate = atof(token.c_str() + 5);
+        }
+        else if (token.compare(0, 6, "burst=") == 0) {
+            rule.burst = atoi(token.c_str() + 6);
+        }
+        else if (token.compare(0, 6, "conns=") == 0) {
+            rule.max_conns = atoi(token.c_str() + 6);
+        }
+        else {
+            return false;
+        }
+    }
+    if (rule.rate < 0 || rule.burst < 0 || rule.max_conns < 0) {
+        return false;
+    }
+    // 没有给出容量时允许一秒的请求一起到达
+    if (rule.burst == 0) {
+        rule.burst = rule.rate > 1 ? (int)ceil(rule.rate) : 1;
+    }
+    return true;
+}
+
+void ClientLimiter::sort_rules(std::vector<Rule> &rules) {
+    std::stable_sort(rules.begin(), rules.end(), [](const Rule &a, const Rule &b) { return a.prefix > b.prefix; });
+}
+
+const ClientLimiter::Rule *ClientLimiter::match(const std::vector<Rule> &rules, uint32_t ip) {
+    for (size_t i = 0; i < rules.size(); ++i) {
+        if ((ip & rules[i].mask) == rules[i].network) {
+            return &rules[i];
+        }
+    }
+    return NULL;
+}
+
+// 高位为 1 保证 key 不为 0，网段共用时用网络地址和前缀长度区分
+uint64_t ClientLimiter::make_key(const Rule &rule, uint32_t ip) {
+    if (rule.shared) {
+        return 1ull << 40 | (uint64_t)(ip & rule.mask) << 8 | (uint64_t)rule.prefix;
+    }
+    return 1ull << 40 | (uint64_t)ip << 8 | 32;
+}
+
+// key 所在分片的第一个候选表项
+static inline int home_slot(uint64_t key) {
+    uint64_t h = key * 0x9E3779B97F4A7C15ull;
+    int shard = (int)(h >> 58);                                     // 高 6 位选分片
+    int start = (int)((h >> 32) % ClientLimiter::SHARD_SLOTS);
+    return shard * ClientLimiter::SHARD_SLOTS + start;
+}
+
+static inline int probe_slot(int home, int i) {
+    int base = home - home % ClientLimiter::SHARD_SLOTS;
+    return base + (home % ClientLimiter::SHARD_SLOTS + i) % ClientLimiter::SHARD_SLOTS;
+}
+
+int ClientLimiter::find(uint64_t key) {
+    int home = home_slot(key);
+    for (int i = 0; i < PROBES; ++i) {
+        int slot = probe_slot(home, i);
+        uint64_t k = m_entries[slot].key.load(std::memory_order_acquire);
+        if (k == key) {
+            return slot;
+        }
+        // 表项只会被回收给别的 key，不会再变为空，遇到空的表项说明后面也没有
+        if (k == 0) {
+            return -1;
+        }
+    }
+    return -1;
+}
+
+int ClientLimiter::insert(uint64_t key, int64_t now) {
+    // 等锁期间其他进程可能已经插入了同一个 key
+    int slot = find(key);
+    if (slot >= 0) {
+        return slot;
+    }
+    int home = home_slot(key);
+    for (int i = 0; i < PROBES; ++i) {
+        slot = probe_slot(home, i);
+        Entry &e = m_entries[slot];
+        uint64_t old = e.key.load(std::memory_order_relaxed);
+        if (old == 0) {
+            e.key.store(key);
+            return slot;
+        }
+        // 没有连接、令牌桶已经装满的表项和空的表项等价，可以回收
+        if (e.tat.load(std::memory_order_relaxed) > now || conns(slot) != 0) {
+            continue;
+        }
+        e.key.store(key);
+        // acquire 先增加连接数再检查 key，这里先改 key 再检查连接数，两边至少有一方能看到对方的修改
+        if (conns(slot) != 0) {
+            e.key.store(old);
+            continue;
+        }
+        return slot;
+    }
+    return -1;
+}
+
+int ClientLimiter::conns(int slot) {
+    int n = 0;
+    for (int p = 0; p < m_processes; ++p) {
+        n += m_conns[slot * m_processes + p].load();
+    }
+    return n;
+}
+
+int ClientLimiter::acquire(const Rule &rule, uint32_t ip, bool &rejected) {
+    rejected = false;
+    if (!m_entries) {
+        return -1;
+    }
+    uint64_t key = make_key(rule, ip);
+    int64_t now = now_ns();
+    // 取得表项的同时它可能正被回收，这时重试一次
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        int slot = find(key);
+        if (slot < 0) {
+            std::atomic<int> &lock = m_shards[home_slot(key) / SHARD_SLOTS].lock;
+            while (lock.exchange(1, std::memory_order_acquire)) {
+                sched_yield();
+            }
+            slot = insert(key, now);
+            lock.store(0, std::memory_order_release);
+            if (slot < 0) {
+                // 候选的表项都被占用，不限制这个客户端
+                Metrics::add(Metrics::LIMIT_TABLE_FULL);
+                return -1;
+            }
+        }
+
+        Entry &e = m_entries[slot];
+        std::atomic<int> &c = counter(slot);
+        c.fetch_add(1);
+        if (e.key.load() != key) {
+            c.fetch_sub(1);
+            continue;
+        }
+        // 重新加载配置后，新的速率在同一个客户端的下一个连接上生效
+        int64_t interval = rule.rate > 0 ? (int64_t)(1e9 / rule.rate) : 0;
+        e.interval.store(interval, std::memory_order_relaxed);
+        e.tolerance.store(interval * (rule.burst - 1), std::memory_order_relaxed);
+        if (rule.max_conns > 0 && conns(slot) > rule.max_conns) {
+            c.fetch_sub(1);
+            rejected = true;
+            Metrics::add(Metrics::LIMIT_CONN_REJECTS);
+            return -1;
+        }
+        return slot;
+    }
+    return -1;
+}
+
+void ClientLimiter::release(int slot) {
+    if (slot >= 0) {
+        counter(slot).fetch_sub(1);
+    }
+}
+
+bool ClientLimiter::allow(int slot) {
+    if (slot < 0) {
+        return true;
+    }
+    // 连接持有表项，表项在连接关闭之前不会被回收
+    Entry &e = m_entries[slot];
+    int64_t interval = e.interval.load(std::memory_order_relaxed);
+    if (interval == 0) {
+        return true;
+    }
+    int64_t tolerance = e.tolerance.load(std::memory_order_relaxed);
+    int64_t now = now_ns();
+    int64_t tat = e.tat.load(std::memory_order_relaxed);
+    int64_t next;
+    do {
+        // 理论到达时间比现在晚了超过 burst - 1 个间隔，即桶里没有令牌了
+        if (tat - tolerance > now) {
+            Metrics::add(Metrics::LIMIT_RATE_REJECTS);
+            return false;
+        }
+        next = (tat > now ? tat : now) + interval;
+    } while (!e.tat.compare_exchange_weak(tat, next, std::memory_order_relaxed));
+    return true;
+}
@@ -0,0 +1,86 @@
+#ifndef CLIENT_LIMITER_H_
+#define CLIENT_LIMITER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <time.h>
+
+// 按客户端 IP（或整个网段）限制请求速率和并发连接数
+// 状态放在一张固定大小的表中，按 key 的哈希分成 SHARDS 个分片，每个分片内开放寻址、最多探测 PROBES 个表项
+// 查找不加锁，只有新的 IP 插入表项时才锁住所在的分片；多进程模式下表放在 fork 前创建的共享内存中，所有工作进程共用
+// 请求速率用令牌桶限制，实现为 GCRA：每个表项只有一个“理论到达时间”，放行一个请求就向后推一个间隔，一次 CAS 完成
+// 并发连接数按进程分开计数，工作进程退出后由主进程清零它的计数
+class ClientLimiter {
+public:
+    // 一条限制规则，作用于 network/prefix 网段内的客户端
+    struct Rule {
+        uint32_t network;       // 主机字节序
+        uint32_t mask;
+        int prefix;
+        bool shared;            // 整个网段共用一个令牌桶和连接数，否则每个 IP 单独计算
+        double rate;            // 每秒请求数，0 为不限制
+        int burst;              // 令牌桶容量，允许的突发请求数
+        int max_conns;          // 并发连接数，0 为不限制
+    };
+
+    static const int SHARDS = 64;
+    static const int SHARD_SLOTS = 512;         // 每个分片的表项数，共 32768 个
+    static const int PROBES = 8;                // 开放寻址最多探测的表项数，都被占用时不限制这个客户端
+    static const int SLOTS = SHARDS * SHARD_SLOTS;
+
+    // 分配 processes 个进程共用的表，多进程模式需在 fork 之前调用
+    static bool init(int processes);
+    static bool ready() { return m_entries != NULL; }
+    // 当前进程使用第 process 组连接计数，fork 之后调用
+    static void set_process(int process) { m_process = process; }
+    // 主进程：第 process 个工作进程退出后清零它的连接计数
+    static void reset_process(int process);
+
+    // 解析 "<ip>[/<prefix>] rate=<n> burst=<n> conns=<n> [shared]"
+    static bool parse_rule(const std::string &text, Rule &rule);
+    // 按前缀从长到短排序，match 返回第一个包含 ip 的规则
+    static void sort_rules(std::vector<Rule> &rules);
+    static const Rule *match(const std::vector<Rule> &rules, uint32_t ip);
+
+    // 主线程，接受连接之后：取得 ip（主机字节序）的表项并计入一个连接，连接关闭时 release
+    // 超过连接数时 rejected 为 true；返回 -1 表示不限制（表已满或者 rejected）
+    static int acquire(const Rule &rule, uint32_t ip, bool &rejected);
+    // 任意线程，连接关闭时调用
+    static void release(int slot);
+    // 主线程，请求进入线程池之前：按令牌桶判断是否放行，slot 为 -1 时总是放行
+    static bool allow(int slot);
+
+private:
+    struct alignas(32) Entry {
+        std::atomic<uint64_t> key;          // 0 为空
+        std::atomic<int64_t> tat;           // 理论到达时间，纳秒，单调时钟
+        std::atomic<int64_t> interval;      // 两个请求之间的间隔，纳秒，0 为不限制速率
+        std::atomic<int64_t> tolerance;     // 允许提前的时间，即 (burst - 1) 个间隔
+    };
+
+    struct alignas(64) Shard {
+        std::atomic<int> lock;              // 只在插入时使用的自旋锁，可以跨进程
+    };
+
+    static uint64_t make_key(const Rule &rule, uint32_t ip);
+    static int find(uint64_t key);
+    static int insert(uint64_t key, int64_t now);   // 持有分片锁时调用
+    static int conns(int slot);                     // 所有进程的连接数之和
+    static std::atomic<int> &counter(int slot) { return m_conns[slot * m_processes + m_process]; }
+
+    static int64_t now_ns() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    static Entry *m_entries;
+    static Shard *m_shards;
+    static std::atomic<int> *m_conns;               // 按表项、进程排列
+    static int m_processes;
+    static int m_process;
+};
+
+#endif // CLIENT_LIMITER_H_
@@ -27,6 +27,10 @@ public:
     bool wait() {
         return sem_wait(&m_sem) == 0;
     }
+    // 信号量减 1。信号量为 0 时不阻塞，直接返回 false
+    bool trywait() {
+        return sem_trywait(&m_sem) == 0;
+    }
     // 信号量加 1。当信号量大于 0 时，其他正在调用 sem_wait 等待信号量的线程将会被唤醒
     bool post() {
         return sem_post(&m_sem) == 0;
@@ -63,6 +67,34 @@ private:
     pthread_mutex_t m_mutex;
 };
 
+// 读写锁类
+class RwLock {
+public:
+    // 创建并初始化读写锁
+    RwLock() {
+        if (pthread_rwlock_init(&m_rwlock, NULL) != 0) {
+            throw std::exception();
+        }
+    }
+    ~RwLock() {
+        pthread_rwlock_destroy(&m_rwlock);
+    }
+    // 获取读锁，可以有多个线程同时持有
+    bool rdlock() {
+        return pthread_rwlock_rdlock(&m_rwlock) == 0;
+    }
+    // 获取写锁
+    bool wrlock() {
+        return pthread_rwlock_wrlock(&m_rwlock) == 0;
+    }
+    // 释放读锁或写锁
+    bool unlock() {
+        return pthread_rwlock_unlock(&m_rwlock) == 0;
+    }
+private:
+    pthread_rwlock_t m_rwlock;
+};
+
 // 条件变量类
 class Cond {
 public:
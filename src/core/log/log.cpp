@@ -0,0 +1,382 @@
+#include <cstdarg>
+#include <cstring>
+#include <ctime>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include "log.h"
+#include "../metrics/metrics.h"
+
+std::atomic<bool> Log::m_enabled(false);
+std::atomic<bool> Log::m_running(false);
+std::atomic<bool> Log::m_stop(false);
+std::atomic<bool> Log::m_dump(false);
+pthread_t Log::m_thread;
+char Log::m_dir[256];
+long Log::m_max_file_size = 0;
+Log::LogFile Log::m_access;
+Log::LogFile Log::m_error;
+Log::Ring *Log::m_rings = NULL;
+Locker Log::m_rings_locker;
+std::atomic<bool> Log::m_sleeping(false);
+Locker Log::m_wait_locker;
+Cond Log::m_wait_cond;
+
+struct Log::RingHolder {
+    Ring *ring = NULL;
+    ~RingHolder();
+};
+
+thread_local Log::RingHolder Log::t_holder;
+
+// 缓冲区留在链表上，剩余的记录仍由后台线程写出
+Log::RingHolder::~RingHolder() {
+    if (!ring) {
+        return;
+    }
+    m_rings_locker.lock();
+    ring->in_use = false;
+    m_rings_locker.unlock();
+    ring = NULL;
+}
+
+static const char *level_names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+bool Log::init(const char *dir, long max_file_size) {
+    bool files = dir && dir[0] != '\0';
+    m_access.fd = -1;
+    m_error.fd = -1;
+    if (files) {
+        snprintf(m_dir, sizeof(m_dir), "%s", dir);
+        mkdir(m_dir, 0755);
+        m_max_file_size = max_file_size;
+
+        m_access.name = "access.log";
+        m_error.name = "error.log";
+        open_file(m_access);
+        open_file(m_error);
+        if (m_access.fd < 0 || m_error.fd < 0) {
+            return false;
+        }
+    }
+
+    m_stop = false;
+    if (pthread_create(&m_thread, NULL, worker, NULL) != 0) {
+        return false;
+    }
+    m_running = true;
+    m_enabled = files;
+    return true;
+}
+
+void Log::shutdown() {
+    if (!m_running) {
+        return;
+    }
+    m_enabled = false;
+    m_running = false;
+    m_wait_locker.lock();
+    m_stop = true;
+    m_wait_cond.signal();
+    m_wait_locker.unlock();
+    pthread_join(m_thread, NULL);
+    if (m_access.fd >= 0) {
+        close(m_access.fd);
+        close(m_error.fd);
+    }
+}
+
+
+// ---------- 业务线程写入 ----------
+
+// 当前线程的缓冲区，第一次使用时优先接手已退出线程的缓冲区，没有时创建并挂到链表上
+// 接手时 head、tail 保持不变，加锁保证能看到上一个线程最后写入的 tail
+Log::Ring *Log::ring() {
+    Ring *r = t_holder.ring;
+    if (!r) {
+        m_rings_locker.lock();
+        for (r = m_rings; r && r->in_use; r = r->link) {
+        }
+        if (!r) {
+            r = new Ring;
+            r->head = 0;
+            r->tail = 0;
+            r->link = m_rings;
+            m_rings = r;
+        }
+        r->in_use = true;
+        m_rings_locker.unlock();
+        t_holder.ring = r;
+    }
+    return r;
+}
+
+// 取得一个空闲记录，缓冲区满时丢弃
+LogRecord *Log::reserve() {
+    Ring *r = ring();
+    uint64_t tail = r->tail.load(std::memory_order_relaxed);
+    if (tail - r->head.load(std::memory_order_acquire) >= RING_SIZE) {
+        Metrics::add(Metrics::LOG_DROPS);
+        return NULL;
+    }
+    LogRecord *record = &r->records[tail % RING_SIZE];
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    record->time_us = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    return record;
+}
+
+// 发布 reserve 取得的记录，缓冲区原来是空的并且后台线程在等待时唤醒它
+// tail 和 m_sleeping 都按 seq_cst 读写：要么这里看到 m_sleeping，要么后台线程等待前的 empty() 看到新的 tail
+void Log::commit() {
+    Ring *r = ring();
+    uint64_t tail = r->tail.load(std::memory_order_relaxed);
+    r->tail.store(tail + 1);
+    if (tail == r->head.load(std::memory_order_acquire) && m_sleeping.load()) {
+        m_wait_locker.lock();
+        m_wait_cond.signal();
+        m_wait_locker.unlock();
+    }
+}
+
+void Log::access(const RequestTrace &trace, const char *method, long bytes) {
+    if (!m_enabled) {
+        return;
+    }
+    LogRecord *record = reserve();
+    if (!record) {
+        return;
+    }
+    record->type = LogRecord::ACCESS;
+    record->level = LEVEL_INFO;
+    record->access.client = trace.client;
+    record->access.status = trace.status;
+    record->access.method = method;
+    record->access.bytes = bytes;
+    record->access.duration_us = (trace.ts[RequestTrace::LAST_BYTE] - trace.ts[RequestTrace::FIRST_BYTE]) / 1000;
+    memcpy(record->access.url, trace.url, sizeof(record->access.url));
+    commit();
+}
+
+bool Log::trace(const RequestTrace &trace) {
+    if (!m_running) {
+        return false;
+    }
+    // 缓冲区满时丢弃这条慢请求，和其他日志一样计入丢弃数
+    LogRecord *record = reserve();
+    if (record) {
+        record->type = LogRecord::TRACE;
+        record->trace = trace;
+        commit();
+    }
+    return true;
+}
+
+bool Log::dump_traces() {
+    if (!m_running) {
+        return false;
+    }
+    m_dump = true;
+    m_wait_locker.lock();
+    m_wait_cond.signal();
+    m_wait_locker.unlock();
+    return true;
+}
+
+void Log::error(LEVEL level, const char *format, ...) {
+    if (!m_enabled) {
+        return;
+    }
+    LogRecord *record = reserve();
+    if (!record) {
+        return;
+    }
+    record->type = LogRecord::ERROR;
+    record->level = level;
+    va_list arg_list;
+    va_start(arg_list, format);
+    vsnprintf(record->message, LogRecord::MESSAGE_LEN, format, arg_list);
+    va_end(arg_list);
+    commit();
+}
+
+
+// ---------- 后台线程 ----------
+
+void *Log::worker(void *) {
+    while (!m_stop) {
+        drain();
+        // 先声明要等待再检查缓冲区，和 commit 的顺序相反，不会漏掉唤醒
+        m_wait_locker.lock();
+        m_sleeping = true;
+        while (!m_stop && !m_dump && empty()) {
+            m_wait_cond.wait(m_wait_locker.get());
+        }
+        m_sleeping = false;
+        // 有记录后再等一会儿攒成一批，这期间业务线程不会唤醒后台线程，只有 shutdown 会
+        if (!m_stop) {
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            struct timespec deadline;
+            long usec = now.tv_usec + FLUSH_INTERVAL_MS * 1000;
+            deadline.tv_sec = now.tv_sec + usec / 1000000;
+            deadline.tv_nsec = (usec % 1000000) * 1000;
+            m_wait_cond.timewait(m_wait_locker.get(), deadline);
+        }
+        m_wait_locker.unlock();
+    }
+    // 退出前写完剩余的记录
+    drain();
+    return NULL;
+}
+
+// 收集所有线程的缓冲区，返回是否有记录
+bool Log::drain() {
+    bool busy = false;
+    bool traced = false;
+    m_rings_locker.lock();
+    Ring *rings = m_rings;
+    m_rings_locker.unlock();
+
+    // 链表只会在头部插入，拿到头指针后可以不加锁遍历
+    for (Ring *r = rings; r; r = r->link) {
+        uint64_t head = r->head.load(std::memory_order_relaxed);
+        uint64_t tail = r->tail.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            const LogRecord &record = r->records[head % RING_SIZE];
+            if (record.type == LogRecord::TRACE) {
+                Tracer::write(record.trace);
+                traced = true;
+                continue;
+            }
+            format(record, record.type == LogRecord::ACCESS ? m_access : m_error);
+        }
+        if (r->head.load(std::memory_order_relaxed) != tail) {
+            r->head.store(tail, std::memory_order_release);
+            busy = true;
+        }
+    }
+    flush(m_access);
+    flush(m_error);
+    if (traced) {
+        Tracer::flush();
+    }
+    if (m_dump.exchange(false)) {
+        Tracer::write_recent();
+    }
+    return busy;
+}
+
+bool Log::empty() {
+    m_rings_locker.lock();
+    Ring *rings = m_rings;
+    m_rings_locker.unlock();
+    for (Ring *r = rings; r; r = r->link) {
+        if (r->tail.load() != r->head.load(std::memory_order_relaxed)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 把一条记录格式化到对应文件的批量缓冲区
+void Log::format(const LogRecord &record, LogFile &file) {
+    // 每秒只调用一次 localtime_r
+    static time_t cached_sec = 0;
+    static struct tm cached_tm;
+    time_t sec = record.time_us / 1000000;
+    if (sec != cached_sec) {
+        localtime_r(&sec, &cached_tm);
+        cached_sec = sec;
+    }
+
+    // 按天切分
+    if (cached_tm.tm_yday != file.day) {
+        flush(file);
+        rotate(file);
+        file.day = cached_tm.tm_yday;
+    }
+    if (file.len > BATCH_SIZE - 512) {
+        flush(file);
+    }
+
+    char timestr[32];
+    strftime(timestr, sizeof(timestr), "%Y-%m-%d %H:%M:%S", &cached_tm);
+    char *out = file.buf + file.len;
+    int left = BATCH_SIZE - file.len;
+    int len = 0;
+    if (record.type == LogRecord::ACCESS) {
+        char client[INET_ADDRSTRLEN] = {0};
+        inet_ntop(AF_INET, &record.access.client, client, sizeof(client));
+        len = snprintf(out, left, "%s.%06lld %s \"%s %s\" %d %ld %.6f\n", timestr, (long long)(record.time_us % 1000000),
+                       client, record.access.method, record.access.url, record.access.status, record.access.bytes,
+                       record.access.duration_us / 1e6);
+    }
+    else {
+        len = snprintf(out, left, "%s.%06lld [%s] %s\n", timestr, (long long)(record.time_us % 1000000),
+                       level_names[record.level], record.message);
+    }
+    if (len > 0) {
+        file.len += len < left ? len : left - 1;
+    }
+}
+
+// 写出批量缓冲区，超过大小上限时切分
+void Log::flush(LogFile &file) {
+    if (file.len == 0 || file.fd < 0) {
+        return;
+    }
+    if (m_max_file_size > 0 && file.size + file.len > m_max_file_size) {
+        rotate(file);
+    }
+    int off = 0;
+    while (off < file.len) {
+        int ret = ::write(file.fd, file.buf + off, file.len - off);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        off += ret;
+    }
+    file.size += off;
+    file.len = 0;
+}
+
+void Log::open_file(LogFile &file) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", m_dir, file.name);
+    file.fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    struct stat st;
+    file.size = (file.fd >= 0 && fstat(file.fd, &st) == 0) ? st.st_size : 0;
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    file.day = tm.tm_yday;
+}
+
+// 把当前文件改名为 name.年月日-时分秒，再打开新文件
+void Log::rotate(LogFile &file) {
+    if (file.size == 0) {
+        return;
+    }
+    char path[512], rotated[560];
+    snprintf(path, sizeof(path), "%s/%s", m_dir, file.name);
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    char suffix[32];
+    strftime(suffix, sizeof(suffix), "%Y%m%d-%H%M%S", &tm);
+    snprintf(rotated, sizeof(rotated), "%s.%s", path, suffix);
+    // 同一秒内按大小切分多次时加上序号
+    for (int seq = 1; ::access(rotated, F_OK) == 0; ++seq) {
+        snprintf(rotated, sizeof(rotated), "%s.%s.%d", path, suffix, seq);
+    }
+    rename(path, rotated);
+    close(file.fd);
+    open_file(file);
+}
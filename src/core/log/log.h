@@ -0,0 +1,137 @@
+#ifndef LOG_H_
+#define LOG_H_
+
+#include <atomic>
+#include <cstdio>
+#include <cstdint>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "../lock/locker.h"
+#include "../trace/tracer.h"
+
+// 固定大小的日志记录，由业务线程写入，后台线程格式化
+struct LogRecord {
+    enum TYPE
+    {
+        ACCESS = 0,
+        ERROR,
+        TRACE                       // 慢请求，写入 trace 文件
+    };
+
+    static const int MESSAGE_LEN = 216;
+
+    int64_t time_us;                // 墙上时间，微秒
+    int type;
+    int level;
+    union {
+        struct {
+            in_addr_t client;
+            int status;
+            const char *method;     // 指向静态字符串
+            long bytes;             // 发送的字节数
+            int64_t duration_us;    // 读入第一个字节到发送完最后一个字节
+            char url[RequestTrace::URL_LEN];
+        } access;
+        char message[MESSAGE_LEN];
+        RequestTrace trace;
+    };
+};
+
+// 异步日志
+// 每个线程把记录写入自己的无锁单生产者单消费者环形缓冲区，缓冲区满时丢弃并计数，不阻塞业务线程
+// 线程退出时归还缓冲区，之后创建的线程接着使用，缓冲区的个数不超过同时存在的线程数
+// 后台线程收集所有缓冲区，格式化后成批写入 access.log / error.log，并按大小和日期切分文件
+// 所有缓冲区都空时后台线程在条件变量上等待，业务线程向空的缓冲区写入第一条记录时唤醒它，醒来后再攒 FLUSH_INTERVAL_MS 的记录
+// 慢请求和 SIGUSR1 导出的最近请求也经过这里交给后台线程写入 trace 文件，不在处理请求的线程（通常是主线程）上写磁盘
+class Log {
+public:
+    /*
+        错误日志的级别
+        LEVEL_DEBUG     ：      调试信息
+        LEVEL_INFO      ：      一般信息，如连接关闭
+        LEVEL_WARN      ：      可恢复的异常
+        LEVEL_ERROR     ：      错误
+     */
+    enum LEVEL
+    {
+        LEVEL_DEBUG = 0,
+        LEVEL_INFO,
+        LEVEL_WARN,
+        LEVEL_ERROR
+    };
+
+    static const int RING_SIZE = 2048;                      // 每个线程缓冲区中的记录数
+    static const int FLUSH_INTERVAL_MS = 10;                // 被唤醒后攒一批记录的时间
+    static const int BATCH_SIZE = 64 * 1024;                // 一次 write 的最大字节数
+
+    // 打开日志目录并启动后台线程；dir 为空时不记录日志，后台线程只写慢请求的 trace
+    static bool init(const char *dir, long max_file_size);
+    // 写完所有剩余记录并停止后台线程
+    static void shutdown();
+
+    // 记录一次请求
+    static void access(const RequestTrace &trace, const char *method, long bytes);
+    // 记录一条错误日志，在调用线程中格式化消息
+    static void error(LEVEL level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+    // 交给后台线程写入 trace 文件，后台线程没有运行时返回 false
+    static bool trace(const RequestTrace &trace);
+    // 让后台线程把所有线程最近完成的请求写入 trace 文件（Tracer::write_recent），后台线程没有运行时返回 false
+    static bool dump_traces();
+
+    static bool enabled() { return m_enabled.load(std::memory_order_relaxed); }
+
+private:
+    struct Ring {
+        LogRecord records[RING_SIZE];
+        alignas(64) std::atomic<uint64_t> head;     // 后台线程读取的位置
+        alignas(64) std::atomic<uint64_t> tail;     // 业务线程写入的位置
+        Ring *link;
+        bool in_use;                                // 是否属于一个活着的线程，由 m_rings_locker 保护
+    };
+    struct RingHolder;
+
+    // 一个日志文件及其切分状态
+    struct LogFile {
+        const char *name;
+        int fd;
+        long size;                  // 当前文件大小
+        int day;                    // 当前文件对应的日期，用于按天切分
+        char buf[BATCH_SIZE];       // 待写入的批量数据
+        int len;
+    };
+
+    static Ring *ring();
+    static LogRecord *reserve();
+    static void commit();
+
+    static void *worker(void *arg);
+    static bool drain();
+    static bool empty();                                    // 所有缓冲区是否都已读完
+    static void format(const LogRecord &record, LogFile &file);
+    static void flush(LogFile &file);
+    static void open_file(LogFile &file);
+    static void rotate(LogFile &file);
+
+    static std::atomic<bool> m_enabled;             // 是否记录 access.log / error.log
+    static std::atomic<bool> m_running;             // 后台线程是否在运行
+    static std::atomic<bool> m_stop;
+    static std::atomic<bool> m_dump;                // 有还没处理的 dump_traces 请求
+    static pthread_t m_thread;
+    static char m_dir[256];
+    static long m_max_file_size;
+    static LogFile m_access;
+    static LogFile m_error;
+    static Ring *m_rings;
+    static Locker m_rings_locker;
+    static thread_local RingHolder t_holder;        // 线程退出时归还缓冲区
+    static std::atomic<bool> m_sleeping;            // 后台线程准备等待或者正在等待
+    static Locker m_wait_locker;
+    static Cond m_wait_cond;                        // 有新记录或者需要退出
+};
+
+#define LOG_DEBUG(format, ...) do { if (Log::enabled()) Log::error(Log::LEVEL_DEBUG, format, ##__VA_ARGS__); } while (0)
+#define LOG_INFO(format, ...) do { if (Log::enabled()) Log::error(Log::LEVEL_INFO, format, ##__VA_ARGS__); } while (0)
+#define LOG_WARN(format, ...) do { if (Log::enabled()) Log::error(Log::LEVEL_WARN, format, ##__VA_ARGS__); } while (0)
+#define LOG_ERROR(format, ...) do { if (Log::enabled()) Log::error(Log::LEVEL_ERROR, format, ##__VA_ARGS__); } while (0)
+
+#endif // LOG_H_
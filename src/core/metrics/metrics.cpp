@@ -0,0 +1,186 @@
+#include <cstdarg>
+#include <cstdio>
+#include <sys/mman.h>
+#include "metrics.h"
+
+Metrics::Shard Metrics::m_local_shards[Metrics::MAX_SHARDS];
+Metrics::Shard *Metrics::m_shards = Metrics::m_local_shards;
+int Metrics::m_shard_num = Metrics::MAX_SHARDS;
+int Metrics::m_base = 0;
+std::atomic<int> Metrics::m_next_shard(0);
+void (*Metrics::m_collectors[Metrics::MAX_COLLECTORS])(std::string &out);
+int Metrics::m_collector_num = 0;
+
+// 单独统计的状态码，其余归入 other
+static const int status_codes[Metrics::STATUS_NUM - 1] = {101, 200, 304, 400, 403, 404, 429, 500, 502, 503};
+
+// 延迟直方图各个桶的上界，微秒
+static const int64_t latency_bounds_us[Metrics::LATENCY_BUCKET_NUM - 1] = {
+    500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000, 500000, 1000000, 2500000
+};
+
+bool Metrics::init_shared(int processes) {
+    size_t size = sizeof(Shard) * MAX_SHARDS * processes;
+    // 匿名共享映射在 fork 后父子进程间共享，初始内容为 0，即所有原子量为 0
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    m_shards = static_cast<Shard *>(addr);
+    m_shard_num = MAX_SHARDS * processes;
+    m_base = 0;
+    return true;
+}
+
+void Metrics::set_process(int process) {
+    m_base = process * MAX_SHARDS;
+}
+
+void Metrics::reset_gauges(int process) {
+    static const COUNTER gauges[] = {CONNECTIONS_ACTIVE, QUEUE_DEPTH, ACCEPT_PAUSED, TIMERS_ACTIVE, WEBSOCKET_ACTIVE, PROXY_IDLE, CORO_ACTIVE, POOL_THREADS, POOL_BUSY};
+    for (int i = process * MAX_SHARDS; i < (process + 1) * MAX_SHARDS; ++i) {
+        for (size_t j = 0; j < sizeof(gauges) / sizeof(gauges[0]); ++j) {
+            m_shards[i].counters[gauges[j]].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+void Metrics::add_collector(void (*collector)(std::string &out)) {
+    if (m_collector_num < MAX_COLLECTORS) {
+        m_collectors[m_collector_num++] = collector;
+    }
+}
+
+void Metrics::count_status(int status) {
+    int i = 0;
+    while (i < STATUS_NUM - 1 && status_codes[i] != status) {
+        ++i;
+    }
+    shard().status[i].fetch_add(1, std::memory_order_relaxed);
+}
+
+void Metrics::observe_latency(int64_t us) {
+    int i = 0;
+    while (i < LATENCY_BUCKET_NUM - 1 && us > latency_bounds_us[i]) {
+        ++i;
+    }
+    Shard &s = shard();
+    s.latency_buckets[i].fetch_add(1, std::memory_order_relaxed);
+    s.latency_sum_us.fetch_add(us, std::memory_order_relaxed);
+}
+
+int64_t Metrics::get(COUNTER counter) {
+    int64_t sum = 0;
+    for (int i = 0; i < m_shard_num; ++i) {
+        sum += m_shards[i].counters[counter].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+// 追加一行格式化文本
+static void append_line(std::string &out, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void append_line(std::string &out, const char *format, ...) {
+    char line[256];
+    va_list arg_list;
+    va_start(arg_list, format);
+    int len = vsnprintf(line, sizeof(line), format, arg_list);
+    va_end(arg_list);
+    if (len > 0) {
+        out.append(line, len < (int)sizeof(line) ? len : sizeof(line) - 1);
+    }
+}
+
+// 输出一个不带标签的度量
+static void append_metric(std::string &out, const char *name, const char *type, const char *help, int64_t value) {
+    append_line(out, "# HELP %s %s\n# TYPE %s %s\n%s %lld\n", name, help, name, type, name, (long long)value);
+}
+
+void Metrics::render(std::string &out) {
+    append_metric(out, "molecule_connections_active", "gauge", "Number of open client connections.", get(CONNECTIONS_ACTIVE));
+    append_metric(out, "molecule_accepts_total", "counter", "Number of accepted connections.", get(ACCEPTS));
+    append_metric(out, "molecule_bytes_received_total", "counter", "Bytes read from client sockets.", get(BYTES_IN));
+    append_metric(out, "molecule_bytes_sent_total", "counter", "Bytes written to client sockets.", get(BYTES_OUT));
+    append_metric(out, "molecule_threadpool_queue_depth", "gauge", "Requests waiting in the thread pool queue.", get(QUEUE_DEPTH));
+    append_metric(out, "molecule_threadpool_rejects_total", "counter", "Requests rejected because the queue was full.", get(QUEUE_REJECTS));
+    append_metric(out, "molecule_threadpool_shed_total", "counter", "Requests dropped after waiting too long in the queue.", get(QUEUE_SHED));
+    append_metric(out, "molecule_threadpool_batches_total", "counter", "Batches of requests submitted to the thread pool, one lock each.", get(QUEUE_BATCHES));
+    append_metric(out, "molecule_threadpool_threads", "gauge", "Worker threads in the thread pool.", get(POOL_THREADS));
+    append_metric(out, "molecule_threadpool_busy", "gauge", "Worker threads processing requests.", get(POOL_BUSY));
+    append_line(out, "# HELP molecule_threadpool_grows_total Worker threads added by the elastic pool, by the signal that triggered it.\n");
+    append_line(out, "# TYPE molecule_threadpool_grows_total counter\n");
+    append_line(out, "molecule_threadpool_grows_total{reason=\"queue_wait\"} %lld\n", (long long)get(POOL_GROW_WAIT));
+    append_line(out, "molecule_threadpool_grows_total{reason=\"blocked\"} %lld\n", (long long)get(POOL_GROW_BLOCKED));
+    append_metric(out, "molecule_threadpool_retires_total", "counter", "Worker threads retired after staying idle for the cool-down.", get(POOL_RETIRES));
+    append_metric(out, "molecule_accept_paused", "gauge", "Whether accepting new connections is paused because the pool is saturated.", get(ACCEPT_PAUSED));
+    append_metric(out, "molecule_timers_active", "gauge", "Timers in the timer list.", get(TIMERS_ACTIVE));
+    append_metric(out, "molecule_timer_expirations_total", "counter", "Connections closed by timer expiration.", get(TIMER_EXPIRATIONS));
+    append_metric(out, "molecule_log_dropped_total", "counter", "Log records dropped because a log buffer was full.", get(LOG_DROPS));
+    append_metric(out, "molecule_workers", "gauge", "Worker processes alive in prefork mode.", get(WORKERS));
+    append_metric(out, "molecule_worker_restarts_total", "counter", "Worker processes restarted after exiting in prefork mode.", get(WORKER_RESTARTS));
+    append_metric(out, "molecule_http2_connections_total", "counter", "Connections switched to HTTP/2.", get(HTTP2_CONNECTIONS));
+    append_metric(out, "molecule_http2_streams_total", "counter", "HTTP/2 streams opened by clients.", get(HTTP2_STREAMS));
+    append_metric(out, "molecule_websocket_connections", "gauge", "Open WebSocket connections.", get(WEBSOCKET_ACTIVE));
+    append_metric(out, "molecule_websocket_messages_total", "counter", "WebSocket messages received from clients.", get(WEBSOCKET_MESSAGES));
+    append_metric(out, "molecule_proxy_requests_total", "counter", "Requests forwarded to upstreams.", get(PROXY_REQUESTS));
+    append_metric(out, "molecule_proxy_upstream_connects_total", "counter", "New connections opened to upstreams.", get(PROXY_CONNECTS));
+    append_metric(out, "molecule_proxy_upstream_idle", "gauge", "Idle keep-alive upstream connections.", get(PROXY_IDLE));
+    append_metric(out, "molecule_proxy_errors_total", "counter", "Proxied requests answered with 502.", get(PROXY_ERRORS));
+    append_metric(out, "molecule_tls_handshakes_total", "counter", "Completed TLS handshakes.", get(TLS_HANDSHAKES));
+    append_metric(out, "molecule_tls_resumed_total", "counter", "TLS handshakes that resumed a session.", get(TLS_RESUMED));
+    append_metric(out, "molecule_tls_ktls_total", "counter", "TLS connections sending through kernel TLS.", get(TLS_KTLS));
+    append_metric(out, "molecule_tls_errors_total", "counter", "Failed TLS handshakes.", get(TLS_ERRORS));
+    append_metric(out, "molecule_limit_connection_rejects_total", "counter", "Connections closed because the client exceeded its connection cap.", get(LIMIT_CONN_REJECTS));
+    append_metric(out, "molecule_limit_rate_rejects_total", "counter", "Requests answered with 429 because the client exceeded its request rate.", get(LIMIT_RATE_REJECTS));
+    append_metric(out, "molecule_limit_table_full_total", "counter", "Connections left unlimited because the limiter table was full.", get(LIMIT_TABLE_FULL));
+
+    // 按原因统计的超时，与 util_timer::REASON 的顺序一致
+    static const char *timeout_reasons[] = {"idle", "first_byte", "header", "body", "send", "keepalive"};
+    append_line(out, "# HELP molecule_timeouts_total Connections closed by timer expiration, by the phase that timed out.\n");
+    append_line(out, "# TYPE molecule_timeouts_total counter\n");
+    for (int j = 0; j <= TIMEOUT_KEEPALIVE - TIMEOUT_IDLE; ++j) {
+        append_line(out, "molecule_timeouts_total{reason=\"%s\"} %lld\n", timeout_reasons[j], (long long)get((COUNTER)(TIMEOUT_IDLE + j)));
+    }
+    append_metric(out, "molecule_coroutines_active", "gauge", "Connection coroutines alive in coroutine mode.", get(CORO_ACTIVE));
+    append_metric(out, "molecule_coroutine_frame_allocs_total", "counter", "Coroutine frames allocated from the heap because the frame pool was empty.", get(CORO_FRAME_ALLOCS));
+    append_metric(out, "molecule_inline_requests_total", "counter", "Requests answered on the reactor thread without entering the thread pool.", get(INLINE_REQUESTS));
+    append_metric(out, "molecule_inline_deferred_total", "counter", "Requests parsed on the reactor thread and handed to the thread pool because they could block.", get(INLINE_DEFERRED));
+
+    // 按状态码统计的请求数
+    int64_t status[STATUS_NUM] = {0};
+    for (int i = 0; i < m_shard_num; ++i) {
+        for (int j = 0; j < STATUS_NUM; ++j) {
+            status[j] += m_shards[i].status[j].load(std::memory_order_relaxed);
+        }
+    }
+    append_line(out, "# HELP molecule_requests_total Responses generated, by status code.\n");
+    append_line(out, "# TYPE molecule_requests_total counter\n");
+    for (int j = 0; j < STATUS_NUM - 1; ++j) {
+        append_line(out, "molecule_requests_total{code=\"%d\"} %lld\n", status_codes[j], (long long)status[j]);
+    }
+    append_line(out, "molecule_requests_total{code=\"other\"} %lld\n", (long long)status[STATUS_NUM - 1]);
+
+    // 请求延迟直方图，桶是累积的
+    int64_t buckets[LATENCY_BUCKET_NUM] = {0};
+    int64_t sum_us = 0;
+    for (int i = 0; i < m_shard_num; ++i) {
+        for (int j = 0; j < LATENCY_BUCKET_NUM; ++j) {
+            buckets[j] += m_shards[i].latency_buckets[j].load(std::memory_order_relaxed);
+        }
+        sum_us += m_shards[i].latency_sum_us.load(std::memory_order_relaxed);
+    }
+    append_line(out, "# HELP molecule_request_duration_seconds Time from first request byte read to last response byte sent.\n");
+    append_line(out, "# TYPE molecule_request_duration_seconds histogram\n");
+    int64_t cumulative = 0;
+    for (int j = 0; j < LATENCY_BUCKET_NUM - 1; ++j) {
+        cumulative += buckets[j];
+        append_line(out, "molecule_request_duration_seconds_bucket{le=\"%g\"} %lld\n", latency_bounds_us[j] / 1e6, (long long)cumulative);
+    }
+    cumulative += buckets[LATENCY_BUCKET_NUM - 1];
+    append_line(out, "molecule_request_duration_seconds_bucket{le=\"+Inf\"} %lld\n", (long long)cumulative);
+    append_line(out, "molecule_request_duration_seconds_sum %.6f\n", sum_us / 1e6);
+    append_line(out, "molecule_request_duration_seconds_count %lld\n", (long long)cumulative);
+
+    for (int i = 0; i < m_collector_num; ++i) {
+        m_collectors[i](out);
+    }
+}
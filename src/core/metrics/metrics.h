@@ -0,0 +1,172 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <time.h>
+
+// 运行时统计
+// 计数器按线程分片，每个线程只写自己的分片（按缓存行对齐），热点路径上没有竞争
+// 抓取时再把所有分片累加，以 Prometheus 文本格式输出
+// 多进程模式下分片放在主进程 fork 前创建的共享内存中，每个进程一组分片，任意进程都能输出全部进程的统计
+class Metrics {
+public:
+    /*
+        计数器与可增减的度量值
+        ACCEPTS             ：      累计接受的连接数
+        CONNECTIONS_ACTIVE  ：      当前活跃连接数
+        BYTES_IN            ：      累计读入字节数
+        BYTES_OUT           ：      累计写出字节数
+        QUEUE_DEPTH         ：      线程池请求队列中等待的请求数
+        QUEUE_REJECTS       ：      因队列已满被线程池拒绝的请求数
+        QUEUE_SHED          ：      排队过久被线程池丢弃的请求数
+        ACCEPT_PAUSED       ：      线程池饱和，主线程是否暂停接受新连接
+        TIMERS_ACTIVE       ：      定时器链表中的定时器数量
+        TIMER_EXPIRATIONS   ：      超时被关闭的连接数
+        LOG_DROPS           ：      日志缓冲区已满被丢弃的记录数
+        WORKERS             ：      多进程模式下存活的工作进程数
+        WORKER_RESTARTS     ：      多进程模式下退出后被重新拉起的工作进程数
+        HTTP2_CONNECTIONS   ：      累计切换到 HTTP/2 的连接数
+        HTTP2_STREAMS       ：      累计打开的 HTTP/2 流数
+        WEBSOCKET_ACTIVE    ：      当前的 WebSocket 连接数
+        WEBSOCKET_MESSAGES  ：      累计收到的 WebSocket 消息数
+        PROXY_REQUESTS      ：      累计转发给上游的请求数
+        PROXY_CONNECTS      ：      累计新建的上游连接数，与请求数之差为复用空闲连接的次数
+        PROXY_IDLE          ：      当前空闲的上游长连接数
+        PROXY_ERRORS        ：      上游出错、返回 502 的请求数
+        TLS_HANDSHAKES      ：      累计完成的 TLS 握手数
+        TLS_RESUMED         ：      其中恢复会话（票据或会话 ID）、没有做完整握手的次数
+        TLS_KTLS            ：      其中发送方向由内核 kTLS 加密的连接数
+        TLS_ERRORS          ：      握手失败的连接数
+        LIMIT_CONN_REJECTS  ：      客户端超过并发连接数被直接关闭的连接数
+        LIMIT_RATE_REJECTS  ：      客户端超过请求速率返回 429 的请求数
+        LIMIT_TABLE_FULL    ：      限流表的候选表项都被占用、没有限制的连接数
+        TIMEOUT_IDLE ~ TIMEOUT_KEEPALIVE ： 按原因（util_timer::REASON）统计的超时关闭的连接数，顺序与之一致
+        CORO_ACTIVE         ：      协程模式下当前的连接协程数
+        CORO_FRAME_ALLOCS   ：      协程帧池没有空闲的帧、从堆分配的次数
+        INLINE_REQUESTS     ：      在主线程内联处理、没有进入线程池的请求数
+        INLINE_DEFERRED     ：      主线程解析后发现可能阻塞、交给线程池的请求数
+        QUEUE_BATCHES       ：      主线程向线程池提交的批数，与入队的请求数之比为平均每批的请求数
+        POOL_THREADS        ：      线程池当前的工作线程数
+        POOL_BUSY           ：      其中正在处理请求的线程数
+        POOL_GROW_WAIT      ：      请求排队过久、线程池扩张的次数
+        POOL_GROW_BLOCKED   ：      一半以上的线程长时间卡在同一批请求上、线程池扩张的次数
+        POOL_RETIRES        ：      线程空闲过久、线程池收缩的次数
+     */
+    enum COUNTER
+    {
+        ACCEPTS = 0,
+        CONNECTIONS_ACTIVE,
+        BYTES_IN,
+        BYTES_OUT,
+        QUEUE_DEPTH,
+        QUEUE_REJECTS,
+        QUEUE_SHED,
+        ACCEPT_PAUSED,
+        TIMERS_ACTIVE,
+        TIMER_EXPIRATIONS,
+        LOG_DROPS,
+        WORKERS,
+        WORKER_RESTARTS,
+        HTTP2_CONNECTIONS,
+        HTTP2_STREAMS,
+        WEBSOCKET_ACTIVE,
+        WEBSOCKET_MESSAGES,
+        PROXY_REQUESTS,
+        PROXY_CONNECTS,
+        PROXY_IDLE,
+        PROXY_ERRORS,
+        TLS_HANDSHAKES,
+        TLS_RESUMED,
+        TLS_KTLS,
+        TLS_ERRORS,
+        LIMIT_CONN_REJECTS,
+        LIMIT_RATE_REJECTS,
+        LIMIT_TABLE_FULL,
+        TIMEOUT_IDLE,
+        TIMEOUT_FIRST_BYTE,
+        TIMEOUT_HEADER,
+        TIMEOUT_BODY,
+        TIMEOUT_SEND,
+        TIMEOUT_KEEPALIVE,
+        CORO_ACTIVE,
+        CORO_FRAME_ALLOCS,
+        INLINE_REQUESTS,
+        INLINE_DEFERRED,
+        QUEUE_BATCHES,
+        POOL_THREADS,
+        POOL_BUSY,
+        POOL_GROW_WAIT,
+        POOL_GROW_BLOCKED,
+        POOL_RETIRES,
+        COUNTER_NUM
+    };
+
+    static const int MAX_SHARDS = 64;           // 每个进程的分片数量，线程数超过时多个线程共用一个分片
+    static const int STATUS_NUM = 11;           // 单独统计的响应状态码个数，最后一个为其他
+    static const int LATENCY_BUCKET_NUM = 13;   // 延迟直方图的桶数，最后一个为 +Inf
+
+    // 在共享内存中为 processes 个进程分配分片，需在 fork 之前调用
+    static bool init_shared(int processes);
+    // 当前进程使用第 process 组分片，fork 之后、使用计数器之前调用
+    static void set_process(int process);
+    // 清零第 process 组分片中的可增减度量，进程退出后它的连接、队列都不存在了
+    static void reset_gauges(int process);
+
+    // 计数器加 n，n 可以为负
+    static void add(COUNTER counter, int64_t n = 1) {
+        shard().counters[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+    // 统计一个超时关闭的连接，reason 为 util_timer::REASON
+    static void count_timeout(int reason) {
+        add((COUNTER)(TIMEOUT_IDLE + reason));
+    }
+    // 统计一个已生成响应的状态码
+    static void count_status(int status);
+    // 统计一个请求从读入第一个字节到发送完最后一个字节的耗时
+    static void observe_latency(int64_t us);
+
+    // 累加所有分片
+    static int64_t get(COUNTER counter);
+    // 以 Prometheus 文本格式输出所有度量
+    static void render(std::string &out);
+    // 注册其他模块的度量输出函数，在 render 的最后调用，需在开始处理请求前注册
+    static void add_collector(void (*collector)(std::string &out));
+
+    // 单调时钟，微秒
+    static int64_t now_us() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    }
+
+private:
+    struct alignas(64) Shard {
+        std::atomic<int64_t> counters[COUNTER_NUM];
+        std::atomic<int64_t> status[STATUS_NUM];
+        std::atomic<int64_t> latency_buckets[LATENCY_BUCKET_NUM];
+        std::atomic<int64_t> latency_sum_us;
+    };
+
+    // 当前线程的分片，第一次使用时分配
+    static Shard &shard() {
+        static thread_local int t_shard = -1;
+        if (t_shard < 0) {
+            t_shard = m_next_shard.fetch_add(1, std::memory_order_relaxed) % MAX_SHARDS;
+        }
+        return m_shards[m_base + t_shard];
+    }
+
+    static Shard m_local_shards[MAX_SHARDS];    // 单进程模式下的分片
+    static Shard *m_shards;                     // 所有进程的分片
+    static int m_shard_num;                     // 所有进程的分片总数
+    static int m_base;                          // 当前进程第一个分片的下标
+    static std::atomic<int> m_next_shard;
+
+    static const int MAX_COLLECTORS = 8;
+    static void (*m_collectors[MAX_COLLECTORS])(std::string &out);
+    static int m_collector_num;
+};
+
+#endif // METRICS_H_
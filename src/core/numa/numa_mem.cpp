@@ -0,0 +1,231 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "numa_mem.h"
+
+// 与 <numaif.h> 中的定义相同
+static const int MPOL_PREFERRED_MODE = 1;
+static const int MAX_NODES = 64;
+static const int SAMPLE_PAGES = 256;    // 统计所在节点时每块内存抽样的页数
+
+std::vector<NumaMem::Region> NumaMem::m_regions;
+Locker NumaMem::m_locker;
+
+// 解析 "0-3,8,10-11" 格式的列表，对每个数调用 fn
+template<typename Fn>
+static bool parse_list(const char *path, Fn fn) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        return false;
+    }
+    char line[1024];
+    bool ok = fgets(line, sizeof(line), fp) != NULL;
+    fclose(fp);
+    if (!ok) {
+        return false;
+    }
+    for (char *p = line; *p && *p != '\n';) {
+        char *end;
+        long begin = strtol(p, &end, 10);
+        long last = begin;
+        if (end == p) {
+            break;
+        }
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+        for (long i = begin; i <= last; ++i) {
+            fn((int)i);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return true;
+}
+
+int NumaMem::node_count() {
+    int max_node = 0;
+    parse_list("/sys/devices/system/node/online", [&](int node) {
+        if (node > max_node) {
+            max_node = node;
+        }
+    });
+    return max_node + 1;
+}
+
+int NumaMem::current_node() {
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) {
+        return 0;
+    }
+    return node;
+}
+
+bool NumaMem::bind_node(int node) {
+    if (node < 0 || node >= MAX_NODES) {
+        return false;
+    }
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    if (!parse_list(path, [&](int cpu) { CPU_SET(cpu, &cpus); }) || CPU_COUNT(&cpus) == 0) {
+        return false;
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        return false;
+    }
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_set_mempolicy, MPOL_PREFERRED_MODE, &mask, MAX_NODES + 1) == 0;
+}
+
+void *NumaMem::alloc(const char *name, size_t size, int node, HUGE_PAGES huge) {
+    size_t page = huge == HUGE_NONE ? sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE;
+    size = (size + page - 1) / page * page;
+
+    Region region;
+    region.name = name;
+    region.size = size;
+    region.node = node;
+    region.hugetlb = false;
+    region.addr = MAP_FAILED;
+
+    if (huge == HUGE_EXPLICIT) {
+        // 大页池不够时 mmap 直接失败，不会在访问时才出错
+        region.addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        region.hugetlb = region.addr != MAP_FAILED;
+    }
+    if (region.addr == MAP_FAILED && huge != HUGE_NONE) {
+        // 多申请一个大页，截掉首尾使起始地址按 2MB 对齐，内核才能用大页映射
+        char *raw = (char *)mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw != MAP_FAILED) {
+            char *aligned = (char *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+            if (aligned > raw) {
+                munmap(raw, aligned - raw);
+            }
+            munmap(aligned + size, raw + HUGE_PAGE_SIZE - aligned);
+            madvise(aligned, size, MADV_HUGEPAGE);
+            region.addr = aligned;
+        }
+    }
+    if (region.addr == MAP_FAILED) {
+        region.addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    }
+    if (region.addr == MAP_FAILED) {
+        return NULL;
+    }
+
+    // 在第一次访问之前绑定节点，之后缺页时从该节点分配
+    if (node >= 0 && node < MAX_NODES) {
+        unsigned long mask = 1UL << node;
+        syscall(SYS_mbind, region.addr, size, MPOL_PREFERRED_MODE, &mask, MAX_NODES + 1, 0);
+    }
+
+    m_locker.lock();
+    m_regions.push_back(region);
+    m_locker.unlock();
+    return region.addr;
+}
+
+void NumaMem::free(void *addr) {
+    m_locker.lock();
+    for (size_t i = 0; i < m_regions.size(); ++i) {
+        if (m_regions[i].addr == addr) {
+            munmap(addr, m_regions[i].size);
+            m_regions.erase(m_regions.begin() + i);
+            break;
+        }
+    }
+    m_locker.unlock();
+}
+
+// 显式大页整块都是大页，透明大页从 /proc/self/smaps 中该映射的 AnonHugePages 读出
+size_t NumaMem::huge_bytes(const Region &region) {
+    if (region.hugetlb) {
+        return region.size;
+    }
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (!fp) {
+        return 0;
+    }
+    uintptr_t begin = (uintptr_t)region.addr, end = begin + region.size;
+    size_t total = 0;
+    bool inside = false;
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long lo, hi;
+        if (sscanf(line, "%lx-%lx ", &lo, &hi) == 2) {
+            // 内核可能把相邻的映射合并或拆分，统计落在本区域内的映射
+            inside = lo >= begin && hi <= end;
+            continue;
+        }
+        unsigned long kb;
+        if (inside && sscanf(line, "AnonHugePages: %lu kB", &kb) == 1) {
+            total += kb * 1024;
+        }
+    }
+    fclose(fp);
+    return total;
+}
+
+void NumaMem::render(std::string &out) {
+    m_locker.lock();
+    std::vector<Region> regions = m_regions;
+    m_locker.unlock();
+    if (regions.empty()) {
+        return;
+    }
+
+    char line[256];
+    out += "# HELP molecule_memory_region_bytes Size of large memory regions.\n";
+    out += "# TYPE molecule_memory_region_bytes gauge\n";
+    for (size_t i = 0; i < regions.size(); ++i) {
+        snprintf(line, sizeof(line), "molecule_memory_region_bytes{region=\"%s\",bound_node=\"%d\"} %zu\n",
+                 regions[i].name, regions[i].node, regions[i].size);
+        out += line;
+    }
+
+    out += "# HELP molecule_memory_region_huge_bytes Bytes of each region backed by huge pages.\n";
+    out += "# TYPE molecule_memory_region_huge_bytes gauge\n";
+    for (size_t i = 0; i < regions.size(); ++i) {
+        snprintf(line, sizeof(line), "molecule_memory_region_huge_bytes{region=\"%s\"} %zu\n",
+                 regions[i].name, huge_bytes(regions[i]));
+        out += line;
+    }
+
+    // 抽样查询页面实际所在的节点（move_pages 不传目标节点时只查询），按比例估算每个节点上的字节数
+    out += "# HELP molecule_memory_region_node_bytes Estimated resident bytes of each region per NUMA node, sampled.\n";
+    out += "# TYPE molecule_memory_region_node_bytes gauge\n";
+    size_t page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < regions.size(); ++i) {
+        const Region &region = regions[i];
+        size_t pages = region.size / page;
+        int samples = pages < (size_t)SAMPLE_PAGES ? (int)pages : SAMPLE_PAGES;
+        void *addrs[SAMPLE_PAGES];
+        int status[SAMPLE_PAGES];
+        for (int j = 0; j < samples; ++j) {
+            addrs[j] = (char *)region.addr + pages * j / samples * page;
+        }
+        if (samples == 0 || syscall(SYS_move_pages, 0, samples, addrs, NULL, status, 0) != 0) {
+            continue;
+        }
+        int count[MAX_NODES] = {0};
+        for (int j = 0; j < samples; ++j) {
+            if (status[j] >= 0 && status[j] < MAX_NODES) {
+                ++count[status[j]];
+            }
+        }
+        for (int node = 0; node < MAX_NODES; ++node) {
+            if (count[node] > 0) {
+                snprintf(line, sizeof(line), "molecule_memory_region_node_bytes{region=\"%s\",node=\"%d\"} %zu\n",
+                         region.name, node, region.size / samples * count[node]);
+                out += line;
+            }
+        }
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef NUMA_MEM_H_
+#define NUMA_MEM_H_
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "../lock/locker.h"
+
+// 连接表等大块内存的分配与放置
+// 直接用 mmap 向内核申请，可以绑定到指定的 NUMA 节点（mbind），使用透明大页（madvise）或显式大页（MAP_HUGETLB）
+// 记录每块内存的用途，抓取统计时查询实际所在的节点和大页数量
+// 直接使用系统调用，不依赖 libnuma；内核不支持 NUMA 时节点相关的操作失败，分配照常进行
+class NumaMem {
+public:
+    /*
+        大页的使用方式
+        HUGE_NONE           ：      普通 4KB 页
+        HUGE_TRANSPARENT    ：      透明大页，按 2MB 对齐后 madvise(MADV_HUGEPAGE)，由内核尽量合并
+        HUGE_EXPLICIT       ：      显式大页（MAP_HUGETLB），需要预先配置 vm.nr_hugepages，申请失败时退回透明大页
+     */
+    enum HUGE_PAGES
+    {
+        HUGE_NONE = 0,
+        HUGE_TRANSPARENT,
+        HUGE_EXPLICIT
+    };
+
+    static const size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+    // 在线的节点数量，不支持 NUMA 时为 1
+    static int node_count();
+    // 当前线程所在 CPU 的节点
+    static int current_node();
+    // 把当前线程绑定到 node 的 CPU 上，并优先从 node 分配内存，之后创建的线程继承这两个设置
+    static bool bind_node(int node);
+
+    // 分配 size 字节清零的内存，node < 0 时不绑定节点，name 为统计中的名字，失败返回 NULL
+    static void *alloc(const char *name, size_t size, int node, HUGE_PAGES huge);
+    // 释放 alloc 分配的内存
+    static void free(void *addr);
+
+    // 以 Prometheus 文本格式输出每块内存的大小、所在节点和大页数量
+    static void render(std::string &out);
+
+private:
+    struct Region {
+        const char *name;
+        void *addr;
+        size_t size;            // 映射的大小，按页对齐
+        int node;               // 绑定的节点，-1 为未绑定
+        bool hugetlb;           // 是否为显式大页
+    };
+
+    static size_t huge_bytes(const Region &region);
+
+    static std::vector<Region> m_regions;
+    static Locker m_locker;
+};
+
+#endif // NUMA_MEM_H_
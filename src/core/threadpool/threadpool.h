@@ -1,11 +1,14 @@
 #ifndef THREADPOOL_H_
 #define THREADPOOL_H_
 
-#include <list>
+#include <deque>
+#include <atomic>
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
+#include <time.h>
 #include "../lock/locker.h"
+#include "../metrics/metrics.h"
 
 template<typename T>
 class ThreadPool {
@@ -14,76 +17,338 @@ public:
     // actor_model 
     // thread_number 线程池中线程的数量
     // max_requests 请求队列中最多允许的、等待处理的请求的数量
-    ThreadPool(int thread_number = 8, int max_requests = 10000);
+    // target_ms、interval_ms 排队时间的上限，见 run()
+    ThreadPool(int thread_number = 8, int max_requests = 10000, int target_ms = 10, int interval_ms = 100);
+    // 通知所有线程退出，等到它们都离开 run() 后返回，队列中还没有处理的请求不再处理
     ~ThreadPool();
+    static const int MAX_BATCH = 16;    // 工作线程一次最多取出的请求数
+    static const int MAX_THREADS = 256; // 工作线程数的上限
+
     // 添加请求
-    bool append(T *request);
+    bool append(T *request) { return append_batch(&request, 1) == 1; }
+    // 一次加锁添加 count 个请求，只唤醒处理它们需要的空闲线程；队列放不下时只添加前面的，返回添加的个数
+    int append_batch(T *const *requests, int count);
+    // 调整工作线程的数量，多出的线程在处理完手上的请求后退出；thread_number 同时作为自动收缩的下限
+    void resize(int thread_number);
+    // 允许线程池在 [thread_number, max_threads] 之间自动伸缩，见 grow() 和 run()
+    // 请求排队超过 grow_ms，或者一半以上的线程处理一批请求超过 grow_ms 时增加线程；线程空闲 idle_s 秒后退出
+    // max_threads 不大于当前的线程数时线程数固定
+    void set_elastic(int max_threads, int grow_ms, int idle_s);
+    // 线程池是否已经饱和：队列超过上限的 3/4，或者正在丢弃排队过久的请求
+    bool saturated() const {
+        return m_queue_size.load(std::memory_order_relaxed) * 4 >= m_max_requests * 3 ||
+               m_shedding.load(std::memory_order_relaxed);
+    }
 private:
+    // 队列中的请求及其入队时间
+    struct Task {
+        T *request;
+        int64_t enqueue_us;
+    };
+
+    // 一个空闲的工作线程，在自己的条件变量上等待
+    // append_batch 把要唤醒的线程从空闲链表上取下、设置 woken 后再唤醒；
+    // 醒来时 woken 仍为 false 说明是超时或者虚假唤醒，线程自己从链表上摘下，不计入 m_pending
+    struct IdleThread {
+        Cond cond;
+        bool woken;
+        IdleThread *prev;
+        IdleThread *next;
+    };
+
     // 工作线程运行函数，不断从工作队列中取出任务执行
     static void *worker(void *arg);
     void run();
+    // 持有 m_queue_locker 时调用，创建一个分离的工作线程
+    bool add_thread();
+    // 让所有线程退出并等待它们离开 run()，析构和构造失败时调用
+    void stop();
+    // 持有 m_queue_locker 时调用，需要时增加一个线程，返回扩张的原因，没有扩张时返回 COUNTER_NUM
+    Metrics::COUNTER grow(int64_t now);
+    // 空闲链表的操作，持有 m_queue_locker 时调用
+    void push_idle(IdleThread *thread);
+    void remove_idle(IdleThread *thread);
+    // 唤醒所有空闲线程，让它们检查是否需要退出
+    void wake_all();
+    // 队列中有 size 个请求时一个线程取出的个数：按线程数平分，至少 1 个，最多 MAX_BATCH 个
+    int batch_share(int size) const {
+        int share = (size + m_thread_number - 1) / m_thread_number;
+        return share < 1 ? 1 : (share > MAX_BATCH ? MAX_BATCH : share);
+    }
 private:
-    int m_thread_number;        // 线程池中线程的数量
+    int m_thread_number;        // 线程池中线程的数量，不含等待退出的线程
     int m_max_requests;         // 请求队列中允许的最大请求数
-    pthread_t *m_threads;       // 描述线程池的数组，大小为 m_thread_number
-    std::list<T *> m_work_queue; // 请求队列
+    int m_retire;               // 需要退出的线程数，由 m_queue_locker 保护
+    IdleThread *m_idle_threads; // 空闲、还没有被选中唤醒的线程，后进先出，由 m_queue_locker 保护
+    int m_idle;                 // m_idle_threads 中的线程数，由 m_queue_locker 保护
+    int m_pending;              // 已经被选中唤醒、还没有开始运行的线程数，由 m_queue_locker 保护
+    int m_min_threads;          // 空闲时收缩到的线程数
+    int m_max_threads;          // 繁忙时扩张到的线程数，等于 m_min_threads 时线程数固定
+    int64_t m_grow_us;          // 排队时间或者一批请求的处理时间超过它时认为线程不够
+    int64_t m_idle_us;          // 多于 m_min_threads 时，线程空闲这么久后退出
+    int64_t m_last_grow_us;     // 最近一次扩张的时间，两次扩张至少间隔 m_grow_us
+    bool m_slot_used[MAX_THREADS];              // 工作线程占用的 m_busy_since 下标，由 m_queue_locker 保护
+    int m_slot_end;                             // 用到过的最大下标加一，由 m_queue_locker 保护
+    std::atomic<int64_t> m_busy_since[MAX_THREADS]; // 线程开始处理当前这批请求的时间，空闲时为 0
+    std::deque<Task> m_work_queue; // 请求队列
     Locker m_queue_locker;      // 保护请求队列的数组
-    Sem m_queue_stat;           // 是否有任务需要处理
     bool m_stop;                 // 是否结束线程
+    int m_workers;              // 已经创建、还没有离开 run() 的线程数，由 m_queue_locker 保护
+    Cond m_exit_cond;           // 最后一个线程离开 run() 时通知 stop()
+
+    int64_t m_target_us;        // 队列持续不空时，允许的最长排队时间
+    int64_t m_interval_us;      // 队列近期空过时，允许的最长排队时间
+    int64_t m_last_empty_us;    // 最近一次出队时发现队列为空的时间
+    std::atomic<int> m_queue_size;      // 队列长度，供主线程无锁读取
+    std::atomic<bool> m_shedding;       // 队列已经持续 interval 不空，正在按 target 丢弃
 };
 
 template<typename T>
-ThreadPool<T>::ThreadPool(int thread_number, int max_requests) {
-    m_thread_number = thread_number;
+ThreadPool<T>::ThreadPool(int thread_number, int max_requests, int target_ms, int interval_ms) {
     m_max_requests = max_requests;
-    m_threads = NULL;
+    m_target_us = (int64_t)target_ms * 1000;
+    m_interval_us = (int64_t)interval_ms * 1000;
+    m_retire = 0;
+    m_idle_threads = NULL;
+    m_idle = 0;
+    m_pending = 0;
     m_stop = false;
-
-    if (thread_number <= 0 || max_requests <= 0) {
-        throw std::exception();
+    m_workers = 0;
+    if (thread_number > MAX_THREADS) {
+        thread_number = MAX_THREADS;
     }
+    m_thread_number = thread_number;
+    m_min_threads = thread_number;
+    m_max_threads = thread_number;
+    m_grow_us = m_target_us;
+    m_idle_us = 30 * 1000000LL;
+    m_last_grow_us = 0;
+    m_slot_end = 0;
+    for (int i = 0; i < MAX_THREADS; ++i) {
+        m_slot_used[i] = false;
+        m_busy_since[i] = 0;
+    }
+    m_last_empty_us = Metrics::now_us();
+    m_queue_size = 0;
+    m_shedding = false;
 
-    // 创建线程池
-    m_threads = new pthread_t[m_thread_number];
-    if (!m_threads) {
+    if (thread_number <= 0 || max_requests <= 0) {
         throw std::exception();
     }
 
     // 遍历初始化线程池
+    m_queue_locker.lock();
     for (int i = 0; i < thread_number; ++i) {
         // printf("create the %dth thread\n", i);
-        if (pthread_create(m_threads + i, NULL, worker, this) != 0) {
-            delete[] m_threads;
-            throw std::exception();
-        }
-        if (pthread_detach(m_threads[i])) {
-            delete[] m_threads;
+        if (!add_thread()) {
+            m_queue_locker.unlock();
+            // 构造失败时不会调用析构，已经创建的线程在这里退出
+            stop();
             throw std::exception();
         }
     }
-
+    m_queue_locker.unlock();
 }
 
 template<typename T>
 ThreadPool<T>::~ThreadPool() {
-    delete[] m_threads;
-    m_stop = true;
+    stop();
 }
 
 template<typename T>
-bool ThreadPool<T>::append(T *request) {
+void ThreadPool<T>::stop() {
     m_queue_locker.lock();
-    if (m_work_queue.size() > m_max_requests) {
-        // 当前请求队列中的请求数量已经超过了设定的最大值
-        m_queue_locker.unlock();
-        return false;
+    m_stop = true;
+    wake_all();
+    // 忙碌的线程处理完手上的一批请求后退出，之后才能释放队列和锁
+    while (m_workers > 0) {
+        m_exit_cond.wait(m_queue_locker.get());
     }
-    m_work_queue.push_back(request);
     m_queue_locker.unlock();
-    m_queue_stat.post();
+}
+
+template<typename T>
+bool ThreadPool<T>::add_thread() {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker, this) != 0) {
+        return false;
+    }
+    ++m_workers;
+    pthread_detach(thread);
     return true;
 }
 
+template<typename T>
+void ThreadPool<T>::resize(int thread_number) {
+    if (thread_number <= 0) {
+        return;
+    }
+    if (thread_number > MAX_THREADS) {
+        thread_number = MAX_THREADS;
+    }
+    m_queue_locker.lock();
+    m_min_threads = thread_number;
+    if (m_max_threads < thread_number) {
+        m_max_threads = thread_number;
+    }
+    int diff = thread_number - m_thread_number;
+    if (diff > 0) {
+        // 优先取消还没退出的线程
+        int keep = diff < m_retire ? diff : m_retire;
+        m_retire -= keep;
+        for (int i = keep; i < diff; ++i) {
+            if (!add_thread()) {
+                thread_number = m_thread_number + i;
+                break;
+            }
+        }
+    }
+    else {
+        m_retire -= diff;
+    }
+    m_thread_number = thread_number;
+    // 唤醒要退出的线程，被唤醒的线程先检查是否需要退出，忙碌的线程处理完手上的请求后检查
+    if (diff < 0) {
+        wake_all();
+    }
+    m_queue_locker.unlock();
+}
+
+template<typename T>
+void ThreadPool<T>::push_idle(IdleThread *thread) {
+    thread->woken = false;
+    thread->prev = NULL;
+    thread->next = m_idle_threads;
+    if (m_idle_threads) {
+        m_idle_threads->prev = thread;
+    }
+    m_idle_threads = thread;
+    ++m_idle;
+}
+
+template<typename T>
+void ThreadPool<T>::remove_idle(IdleThread *thread) {
+    if (thread->prev) {
+        thread->prev->next = thread->next;
+    }
+    else {
+        m_idle_threads = thread->next;
+    }
+    if (thread->next) {
+        thread->next->prev = thread->prev;
+    }
+    --m_idle;
+}
+
+template<typename T>
+void ThreadPool<T>::wake_all() {
+    for (IdleThread *thread = m_idle_threads; thread; thread = thread->next) {
+        thread->cond.signal();
+    }
+}
+
+template<typename T>
+void ThreadPool<T>::set_elastic(int max_threads, int grow_ms, int idle_s) {
+    m_queue_locker.lock();
+    if (max_threads > MAX_THREADS) {
+        max_threads = MAX_THREADS;
+    }
+    m_max_threads = max_threads > m_min_threads ? max_threads : m_min_threads;
+    if (grow_ms > 0) {
+        m_grow_us = (int64_t)grow_ms * 1000;
+    }
+    if (idle_s > 0) {
+        m_idle_us = (int64_t)idle_s * 1000000;
+    }
+    // 上限调低后多出的线程处理完手上的请求后退出
+    int diff = m_thread_number - m_max_threads;
+    if (diff > 0) {
+        m_retire += diff;
+        m_thread_number = m_max_threads;
+        wake_all();
+    }
+    m_queue_locker.unlock();
+}
+
+// 两种情况说明线程不够，都要求此时没有空闲线程：
+// 队首的请求已经排队超过 m_grow_us，即线程处理不过来；
+// 一半以上的线程处理手上的一批请求已经超过 m_grow_us，多半阻塞在磁盘、数据库或上游上，排队的请求还没有超时也先扩张
+// 每 m_grow_us 最多增加一个线程，避免一次突发就扩到上限
+template<typename T>
+Metrics::COUNTER ThreadPool<T>::grow(int64_t now) {
+    if (m_thread_number >= m_max_threads || m_idle > 0 || m_work_queue.empty() ||
+        now - m_last_grow_us < m_grow_us) {
+        return Metrics::COUNTER_NUM;
+    }
+    Metrics::COUNTER reason = Metrics::POOL_GROW_WAIT;
+    if (now - m_work_queue.front().enqueue_us <= m_grow_us) {
+        int blocked = 0;
+        for (int i = 0; i < m_slot_end; ++i) {
+            int64_t since = m_busy_since[i].load(std::memory_order_relaxed);
+            if (since != 0 && now - since > m_grow_us) {
+                ++blocked;
+            }
+        }
+        if (blocked * 2 < m_thread_number) {
+            return Metrics::COUNTER_NUM;
+        }
+        reason = Metrics::POOL_GROW_BLOCKED;
+    }
+    m_last_grow_us = now;
+    if (!add_thread()) {
+        return Metrics::COUNTER_NUM;
+    }
+    ++m_thread_number;
+    return reason;
+}
+
+// 主线程在一次 epoll_wait 返回的所有事件处理完后调用一次，整批请求只加一次锁、用同一个入队时间
+// 每个线程取走 share 个请求（与 run() 中的计算一致），唤醒的线程数是处理这些请求需要的数量，不超过空闲的线程数
+template<typename T>
+int ThreadPool<T>::append_batch(T *const *requests, int count) {
+    if (count <= 0) {
+        return 0;
+    }
+    int64_t now = Metrics::now_us();
+    m_queue_locker.lock();
+    int room = m_max_requests - (int)m_work_queue.size();
+    int n = count < room ? count : (room > 0 ? room : 0);
+    for (int i = 0; i < n; ++i) {
+        Task task = {requests[i], now};
+        m_work_queue.push_back(task);
+    }
+    int size = m_work_queue.size();
+    m_queue_size.store(size, std::memory_order_relaxed);
+    // 在锁内、唤醒线程之前增加，线程出队时同样在锁内减少，队列长度不会出现负数
+    Metrics::add(Metrics::QUEUE_DEPTH, n);
+    // 已经唤醒、还没有运行的线程也会来取请求，不重复唤醒
+    int share = batch_share(size);
+    int wake = (size + share - 1) / share - m_pending;
+    if (wake > m_idle) {
+        wake = m_idle;
+    }
+    // 在锁内唤醒：线程要拿到锁才能离开等待，IdleThread 在此之前一直有效
+    for (int i = 0; i < wake; ++i) {
+        IdleThread *thread = m_idle_threads;
+        remove_idle(thread);
+        thread->woken = true;
+        thread->cond.signal();
+        ++m_pending;
+    }
+    Metrics::COUNTER grew = grow(now);
+    m_queue_locker.unlock();
+
+    if (n < count) {
+        // 当前请求队列中的请求数量已经超过了设定的最大值
+        Metrics::add(Metrics::QUEUE_REJECTS, count - n);
+    }
+    Metrics::add(Metrics::QUEUE_BATCHES);
+    if (grew != Metrics::COUNTER_NUM) {
+        Metrics::add(grew);
+    }
+    return n;
+}
+
 template<typename T>
 void *ThreadPool<T>::worker(void *arg) {
     ThreadPool *pool = (ThreadPool *)arg;
@@ -91,27 +356,120 @@ void *ThreadPool<T>::worker(void *arg) {
     return pool;
 }
 
+// 按排队时间丢弃请求（CoDel 的思路），而不是只看队列长度：
+// 队列在 interval 内空过，说明只是突发，允许排队到 interval；
+// 队列持续 interval 不空，说明处理能力不足，排队超过 target 的请求直接返回 503，
+// 让后面的请求仍能在较短时间内被处理
+// 工作线程一次取出 batch_share 个请求，一批只加一次锁；队列不空时处理完直接取下一批，不再等待
+// 线程数多于 m_min_threads 时空闲等待最多 m_idle_us，期间没有请求就退出
 template<typename T>
 void ThreadPool<T>::run() {
-    while (!m_stop) {
+    Task batch[MAX_BATCH];
+    // 占用一个下标记录处理开始的时间；等待退出的线程还占着下标时可能没有空位，这时不参与阻塞的判断
+    m_queue_locker.lock();
+    int slot = 0;
+    while (slot < MAX_THREADS && m_slot_used[slot]) {
+        ++slot;
+    }
+    if (slot < MAX_THREADS) {
+        m_slot_used[slot] = true;
+        if (slot >= m_slot_end) {
+            m_slot_end = slot + 1;
+        }
+    }
+    m_queue_locker.unlock();
+    Metrics::add(Metrics::POOL_THREADS);
+
+    IdleThread self;
+    while (true) {
         // 等待任务到来
-        m_queue_stat.wait();
         m_queue_locker.lock();
-        if (m_work_queue.empty()) {
+        int64_t idle_since = Metrics::now_us();
+        bool expired = false;
+        while (m_work_queue.empty() && m_retire == 0 && !m_stop) {
+            push_idle(&self);
+            if (m_thread_number > m_min_threads) {
+                // 条件变量按 CLOCK_REALTIME 计时，每次按剩余的空闲时间重新计算
+                int64_t left = idle_since + m_idle_us - Metrics::now_us();
+                struct timespec deadline;
+                clock_gettime(CLOCK_REALTIME, &deadline);
+                int64_t nsec = deadline.tv_nsec + (left > 0 ? left : 0) * 1000;
+                deadline.tv_sec += nsec / 1000000000;
+                deadline.tv_nsec = nsec % 1000000000;
+                self.cond.timewait(m_queue_locker.get(), deadline);
+            }
+            else {
+                self.cond.wait(m_queue_locker.get());
+            }
+            if (self.woken) {
+                --m_pending;
+            }
+            else {
+                remove_idle(&self);
+            }
+            if (m_work_queue.empty() && m_thread_number > m_min_threads && Metrics::now_us() - idle_since >= m_idle_us) {
+                expired = true;
+                break;
+            }
+        }
+        if (m_stop || m_retire > 0 || expired) {
+            if (expired) {
+                // 空闲过久，线程池收缩
+                --m_thread_number;
+                Metrics::add(Metrics::POOL_RETIRES);
+            }
+            else if (!m_stop) {
+                // 线程池缩小，当前线程退出
+                --m_retire;
+            }
+            if (slot < MAX_THREADS) {
+                m_slot_used[slot] = false;
+            }
+            Metrics::add(Metrics::POOL_THREADS, -1);
+            // 解锁之后不再访问线程池，stop() 可能马上释放它
+            if (--m_workers == 0) {
+                m_exit_cond.signal();
+            }
             m_queue_locker.unlock();
-            continue;
+            break;
         }
 
-        T *request = m_work_queue.front();
-        m_work_queue.pop_front();
+        int count = batch_share(m_work_queue.size());
+        for (int i = 0; i < count; ++i) {
+            batch[i] = m_work_queue.front();
+            m_work_queue.pop_front();
+        }
+        int64_t now = Metrics::now_us();
+        if (m_work_queue.empty()) {
+            m_last_empty_us = now;
+        }
+        bool shedding = now - m_last_empty_us > m_interval_us;
+        m_queue_size.store(m_work_queue.size(), std::memory_order_relaxed);
+        m_shedding.store(shedding, std::memory_order_relaxed);
+        Metrics::add(Metrics::QUEUE_DEPTH, -count);
         m_queue_locker.unlock();
-
-        if (!request) {
-            continue;
+        Metrics::add(Metrics::POOL_BUSY);
+        if (slot < MAX_THREADS) {
+            m_busy_since[slot].store(now, std::memory_order_relaxed);
         }
 
-        request->process();
-
+        int64_t limit = shedding ? m_target_us : m_interval_us;
+        for (int i = 0; i < count; ++i) {
+            Task &task = batch[i];
+            if (!task.request) {
+                continue;
+            }
+            if (now - task.enqueue_us > limit) {
+                Metrics::add(Metrics::QUEUE_SHED);
+                task.request->shed();
+                continue;
+            }
+            task.request->process();
+        }
+        if (slot < MAX_THREADS) {
+            m_busy_since[slot].store(0, std::memory_order_relaxed);
+        }
+        Metrics::add(Metrics::POOL_BUSY, -1);
     }
 }
 #endif // THREADPOOL_H_
\ No newline at end of file
@@ -13,6 +13,7 @@ void sort_timer_lst::add_timer(util_timer *timer) {
     if (!timer) {
         return;
     }
+    Metrics::add(Metrics::TIMERS_ACTIVE);
     if (!head) {
         head = tail = timer;
         return;
@@ -30,6 +31,26 @@ void sort_timer_lst::adjust_timer(util_timer *timer) {
     if (!timer) {
         return;
     }
+    // 进入有绝对期限的阶段时到期时间可能提前，从链表中取出后从头插入
+    if (timer->prev && timer->expire < timer->prev->expire) {
+        timer->prev->next = timer->next;
+        if (timer->next) {
+            timer->next->prev = timer->prev;
+        }
+        else {
+            tail = timer->prev;
+        }
+        timer->prev = timer->next = NULL;
+        if (timer->expire < head->expire) {
+            timer->next = head;
+            head->prev = timer;
+            head = timer;
+        }
+        else {
+            add_timer(timer, head);
+        }
+        return;
+    }
     util_timer *tmp = timer->next;
     if (!tmp || (timer->expire < tmp->expire)) {
         // 如果是尾部节点或者当前节点还是小于后面节点的时间
@@ -52,6 +73,7 @@ void sort_timer_lst::del_timer(util_timer *timer) {
     if (!timer) {
         return;
     }
+    Metrics::add(Metrics::TIMERS_ACTIVE, -1);
     if ((timer == head) && (timer == tail)) {
         delete timer;
         head = tail = NULL;
@@ -84,7 +106,26 @@ void sort_timer_lst::tick() {
         if (cur < tmp->expire) {
             break;
         }
+        if (tmp->keepalive_interval > 0 && tmp->conn && tmp->conn->keepalive()) {
+            // 已发送 ping，重新排队，下一次到期时还没有收到 pong 再关闭
+            head = tmp->next;
+            if (head) {
+                head->prev = NULL;
+            }
+            else {
+                tail = NULL;
+            }
+            tmp->prev = tmp->next = NULL;
+            tmp->expire = cur + tmp->keepalive_interval;
+            Metrics::add(Metrics::TIMERS_ACTIVE, -1);
+            add_timer(tmp);
+            tmp = head;
+            continue;
+        }
         tmp->cb_func(tmp->user_data);
+        Metrics::add(Metrics::TIMERS_ACTIVE, -1);
+        Metrics::add(Metrics::TIMER_EXPIRATIONS);
+        Metrics::count_timeout(tmp->reason);
         head = tmp->next;
         if (head) {
             head->prev = NULL;
@@ -179,6 +220,11 @@ class Utils;
 void cb_func(client_data *user_data) {
     epoll_ctl(Utils::u_epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
     assert(user_data);
+    // 关闭前退出广播频道、关闭上游连接
+    if (user_data->timer && user_data->timer->conn) {
+        user_data->timer->conn->release_sessions();
+    }
     close(user_data->sockfd);
     HttpConn::m_user_count--;
+    Metrics::add(Metrics::CONNECTIONS_ACTIVE, -1);
 }
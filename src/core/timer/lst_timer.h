@@ -11,6 +11,7 @@
 #include <arpa/inet.h>
 #include <sys/epoll.h>
 #include "../../http/http_conn.h"
+#include "../metrics/metrics.h"
 
 class util_timer;
 
@@ -22,11 +23,37 @@ struct client_data {
 
 class util_timer {
 public:
-    util_timer() :prev(NULL), next(NULL) {}
+    /*
+        到期的原因，即连接所处的阶段，决定到期时间怎样计算，到期关闭时按原因计数
+        IDLE        ：      没有单独期限的阶段（HTTP/2、WebSocket、反向代理），按空闲时间
+        FIRST_BYTE  ：      接受连接到收到第一个请求字节，包括 TLS 握手
+        HEADER      ：      收到请求的第一个字节到读完请求头
+        BODY        ：      读取请求体，按两次收到数据的间隔
+        SEND        ：      发送响应，按最低平均速率
+        KEEPALIVE   ：      响应发送完到下一个请求的第一个字节
+     */
+    enum REASON
+    {
+        IDLE = 0,
+        FIRST_BYTE,
+        HEADER,
+        BODY,
+        SEND,
+        KEEPALIVE,
+        REASON_NUM
+    };
+
+    util_timer() :conn(NULL), keepalive_interval(0), reason(IDLE), phase_start(0), prev(NULL), next(NULL) {}
 public:
     time_t expire;
     void (*cb_func)(client_data *);
     client_data *user_data;
+    // 超时关闭时由 cb_func 释放连接上的会话（WebSocket、转发中的上游连接）
+    HttpConn *conn;
+    // 大于 0 时为长连接（WebSocket），到期时先调用 conn->keepalive() 发送 ping，成功则延后这么多秒
+    int keepalive_interval;
+    REASON reason;
+    time_t phase_start;         // 进入当前阶段的时间，有绝对期限的阶段从这里开始计算，期间的活动不会延后
     util_timer *prev;
     util_timer *next;
 };
@@ -37,7 +64,7 @@ public:
     ~sort_timer_lst();
     // 加入节点
     void add_timer(util_timer *timer);
-    // 更新时间
+    // 更新时间，到期时间可以提前也可以延后
     void adjust_timer(util_timer *timer);
     // 删除指定对象
     void del_timer(util_timer *timer);
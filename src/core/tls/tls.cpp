@@ -0,0 +1,158 @@
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <openssl/err.h>
+#include "tls.h"
+#include "../metrics/metrics.h"
+
+SSL_CTX *TlsContext::m_ctx = NULL;
+
+// ALPN 按服务器的顺序选择：客户端支持 h2 时优先，HTTP/2 的连接序言由 HttpConn 识别
+static int select_alpn(SSL *, const unsigned char **out, unsigned char *outlen,
+                       const unsigned char *in, unsigned int inlen, void *) {
+    static const unsigned char protos[] = "\x02h2\x08http/1.1";
+    unsigned char *selected;
+    if (SSL_select_next_proto(&selected, outlen, protos, sizeof(protos) - 1, in, inlen) != OPENSSL_NPN_NEGOTIATED) {
+        // 客户端只支持其他协议时不协商，按 HTTP/1.1 处理
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+bool TlsContext::init(const char *cert, const char *key) {
+    SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+    if (!ctx) {
+        return false;
+    }
+    SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+    // 部分写入：SSL_write 每发出一个记录就返回，BufferChain 据此丢弃发送完的部分；
+    // 重试时数据相同但地址可以不同；空闲连接释放读写缓冲区
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+    // 握手完成后内核支持时把加密交给 kTLS；不允许重新协商，读写不会互相等待
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_NO_RENEGOTIATION | SSL_OP_CIPHER_SERVER_PREFERENCE);
+    if (SSL_CTX_use_certificate_chain_file(ctx, cert) != 1 ||
+        SSL_CTX_use_PrivateKey_file(ctx, key, SSL_FILETYPE_PEM) != 1 ||
+        SSL_CTX_check_private_key(ctx) != 1) {
+        ERR_print_errors_fp(stderr);
+        SSL_CTX_free(ctx);
+        return false;
+    }
+
+    // TLS 1.2 的客户端不支持票据时用会话 ID 恢复，缓存在进程内；
+    // 票据的密钥在 SSL_CTX_new 时生成，fork 之后所有工作进程相同。TLS 1.3 每次握手只签发一张票据
+    static const unsigned char sid_ctx[] = "molecule";
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, SESSION_CACHE_SIZE);
+    SSL_CTX_set_timeout(ctx, SESSION_TIMEOUT);
+    SSL_CTX_set_session_id_context(ctx, sid_ctx, sizeof(sid_ctx) - 1);
+    SSL_CTX_set_num_tickets(ctx, 1);
+
+    SSL_CTX_set_alpn_select_cb(ctx, select_alpn, NULL);
+    m_ctx = ctx;
+    return true;
+}
+
+
+TlsConn::TlsConn(int fd) : m_ssl(NULL), m_established(false), m_ktls_send(false) {
+    if (TlsContext::get()) {
+        m_ssl = SSL_new(TlsContext::get());
+    }
+    if (m_ssl) {
+        SSL_set_fd(m_ssl, fd);
+        SSL_set_accept_state(m_ssl);
+    }
+}
+
+TlsConn::~TlsConn() {
+    if (m_ssl) {
+        SSL_free(m_ssl);
+    }
+}
+
+TlsConn::STATUS TlsConn::handshake() {
+    if (!m_ssl) {
+        return FAILED;
+    }
+    ERR_clear_error();
+    int ret = SSL_do_handshake(m_ssl);
+    if (ret == 1) {
+        m_established = true;
+        m_ktls_send = BIO_get_ktls_send(SSL_get_wbio(m_ssl));
+        Metrics::add(Metrics::TLS_HANDSHAKES);
+        if (SSL_session_reused(m_ssl)) {
+            Metrics::add(Metrics::TLS_RESUMED);
+        }
+        if (m_ktls_send) {
+            Metrics::add(Metrics::TLS_KTLS);
+        }
+        return DONE;
+    }
+    switch (SSL_get_error(m_ssl, ret)) {
+        case SSL_ERROR_WANT_READ:
+            return WANT_READ;
+        case SSL_ERROR_WANT_WRITE:
+            return WANT_WRITE;
+        default:
+            // 包括用明文 HTTP 访问 TLS 端口
+            Metrics::add(Metrics::TLS_ERRORS);
+            return FAILED;
+    }
+}
+
+ssize_t TlsConn::read(char *buf, size_t len) {
+    size_t total = 0;
+    while (total < len) {
+        ERR_clear_error();
+        int n = SSL_read(m_ssl, buf + total, len - total > INT_MAX ? INT_MAX : len - total);
+        if (n > 0) {
+            total += n;
+            continue;
+        }
+        // 先交出已经读到的数据，关闭或者出错在下一次读取时报告
+        if (total > 0) {
+            break;
+        }
+        int err = SSL_get_error(m_ssl, n);
+        if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE) {
+            errno = EAGAIN;
+            return -1;
+        }
+        return 0;
+    }
+    return total;
+}
+
+ssize_t TlsConn::write(const char *data, size_t len) {
+    ERR_clear_error();
+    int n = SSL_write(m_ssl, data, len > INT_MAX ? INT_MAX : len);
+    if (n > 0) {
+        return n;
+    }
+    int err = SSL_get_error(m_ssl, n);
+    errno = err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ ? EAGAIN : EPIPE;
+    return -1;
+}
+
+ssize_t TlsConn::writev(const struct iovec *iov, int count) {
+    if (count == 1 || iov[0].iov_len >= RECORD_SIZE) {
+        return write(static_cast<const char *>(iov[0].iov_base), iov[0].iov_len);
+    }
+    // 第一段不足一个记录时把后面的段复制进来凑满一个记录，数据不变时重试得到的内容相同
+    char buf[RECORD_SIZE];
+    size_t len = 0;
+    for (int i = 0; i < count && len < RECORD_SIZE; ++i) {
+        size_t n = iov[i].iov_len < RECORD_SIZE - len ? iov[i].iov_len : RECORD_SIZE - len;
+        memcpy(buf + len, iov[i].iov_base, n);
+        len += n;
+    }
+    return write(buf, len);
+}
+
+void TlsConn::shutdown() {
+    if (m_ssl && m_established) {
+        ERR_clear_error();
+        SSL_shutdown(m_ssl);
+    }
+}
@@ -0,0 +1,66 @@
+#ifndef TLS_H_
+#define TLS_H_
+
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <openssl/ssl.h>
+
+// 进程内唯一的 TLS 上下文：证书、协议版本、会话缓存
+// 在 fork 之前创建，工作进程继承同一份会话票据（session ticket）密钥，任意进程签发的票据都能在其他进程恢复
+class TlsContext {
+public:
+    static const long SESSION_CACHE_SIZE = 20480;   // 服务器端会话缓存（session ID）的条目数
+    static const long SESSION_TIMEOUT = 3600;       // 会话的有效期，秒
+
+    // 加载证书链和私钥，开启会话缓存、kTLS，ALPN 支持 h2 和 http/1.1
+    static bool init(const char *cert, const char *key);
+    static SSL_CTX *get() { return m_ctx; }
+
+private:
+    static SSL_CTX *m_ctx;
+};
+
+// 一个客户端连接上的 TLS 会话，socket 是非阻塞的
+// 握手、读、写都在主线程进行；握手后内核支持时发送方向由 kTLS 完成加密，
+// 这时响应（包括文件映射）直接用 writev 写入 socket，不经过用户态的加密和复制
+class TlsConn {
+public:
+    enum STATUS
+    {
+        DONE = 0,       // 握手完成
+        WANT_READ,      // 等待 socket 可读后继续
+        WANT_WRITE,     // 等待 socket 可写后继续
+        FAILED          // 握手失败，关闭连接
+    };
+
+    static const size_t RECORD_SIZE = 16384;        // TLS 记录的最大明文长度
+
+    explicit TlsConn(int fd);
+    ~TlsConn();
+
+    STATUS handshake();
+    bool established() const { return m_established; }
+    bool ktls_send() const { return m_ktls_send; }  // 发送方向已经交给内核加密
+    // OpenSSL 中还有已经解密、没有读走的数据（上一次 read 的 buf 放不下整个记录）
+    bool pending() const { return m_ssl && SSL_pending(m_ssl) > 0; }
+
+    // 读取解密后的数据直到没有完整的记录或者 buf 已满，返回读到的字节数；
+    // 还没有完整的记录返回 -1 且 errno 为 EAGAIN，对方关闭或者出错返回 0
+    ssize_t read(char *buf, size_t len);
+    // 加密并发送，一次最多一个记录，返回发送的明文字节数；socket 发送缓冲区满时返回 -1 且 errno 为 EAGAIN，
+    // 这时记录已经加密好留在 OpenSSL 中，下一次必须从同样的数据开始重试；出错返回 -1
+    ssize_t write(const char *data, size_t len);
+    // 小的段合并成一个记录再发送，避免响应头单独占一个记录
+    ssize_t writev(const struct iovec *iov, int count);
+
+    // 发送 close_notify，不等待对方的回复
+    void shutdown();
+
+private:
+    SSL *m_ssl;
+    bool m_established;
+    bool m_ktls_send;
+};
+
+#endif // TLS_H_
@@ -0,0 +1,213 @@
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "tracer.h"
+#include "../log/log.h"
+
+int64_t Tracer::m_slow_ns = 0;
+FILE *Tracer::m_file = NULL;
+Locker Tracer::m_file_locker;
+Tracer::Ring *Tracer::m_rings = NULL;
+Locker Tracer::m_rings_locker;
+
+struct Tracer::RingHolder {
+    Ring *ring = NULL;
+    ~RingHolder();
+};
+
+thread_local Tracer::RingHolder Tracer::t_holder;
+
+// 缓冲区留在链表上，其中的请求仍然可以读取
+Tracer::RingHolder::~RingHolder() {
+    if (!ring) {
+        return;
+    }
+    m_rings_locker.lock();
+    ring->in_use = false;
+    m_rings_locker.unlock();
+    ring = NULL;
+}
+
+// 相邻两个阶段之间的区间，在 trace 中显示为一个事件
+static const struct {
+    RequestTrace::PHASE begin;
+    RequestTrace::PHASE end;
+    const char *name;
+} trace_spans[] = {
+    {RequestTrace::ACCEPT, RequestTrace::FIRST_BYTE, "wait"},
+    {RequestTrace::FIRST_BYTE, RequestTrace::ENQUEUE, "read"},
+    {RequestTrace::ENQUEUE, RequestTrace::DEQUEUE, "queue"},
+    {RequestTrace::DEQUEUE, RequestTrace::PARSE_DONE, "parse"},
+    {RequestTrace::PARSE_DONE, RequestTrace::RESPONSE_READY, "handle"},
+    {RequestTrace::RESPONSE_READY, RequestTrace::LAST_BYTE, "send"},
+};
+
+void Tracer::init(int slow_ms, const char *path) {
+    m_slow_ns = (int64_t)slow_ms * 1000000;
+    if (m_file) {
+        fclose(m_file);
+        m_file = NULL;
+    }
+    if (slow_ms <= 0) {
+        return;
+    }
+    m_file = fopen(path, "w");
+    if (m_file) {
+        // JSON 数组格式，结尾的 ] 可以省略，便于一直追加
+        fputs("[\n", m_file);
+        fflush(m_file);
+    }
+}
+
+// 当前线程的环形缓冲区，第一次使用时优先接手已退出线程的缓冲区，没有时创建
+Tracer::Ring *Tracer::ring() {
+    Ring *r = t_holder.ring;
+    if (!r) {
+        m_rings_locker.lock();
+        for (r = m_rings; r && r->in_use; r = r->link) {
+        }
+        if (!r) {
+            r = new Ring;
+            r->next = 0;
+            r->link = m_rings;
+            m_rings = r;
+        }
+        r->in_use = true;
+        m_rings_locker.unlock();
+        t_holder.ring = r;
+    }
+    return r;
+}
+
+void Tracer::finish(const RequestTrace &trace) {
+    Ring *r = ring();
+    r->locker.lock();
+    r->records[r->next % RING_SIZE] = trace;
+    ++r->next;
+    r->locker.unlock();
+
+    if (m_file && trace.ts[RequestTrace::FIRST_BYTE] != 0 &&
+        trace.ts[RequestTrace::LAST_BYTE] - trace.ts[RequestTrace::FIRST_BYTE] >= m_slow_ns) {
+        // 日志的后台线程没有运行时（例如 microbench）直接写入
+        if (!Log::trace(trace)) {
+            write(trace);
+            flush();
+        }
+    }
+}
+
+void Tracer::dump_recent() {
+    if (!m_file) {
+        return;
+    }
+    // 日志的后台线程没有运行时直接写入
+    if (!Log::dump_traces()) {
+        write_recent();
+    }
+}
+
+void Tracer::write_recent() {
+    if (!m_file) {
+        return;
+    }
+    m_rings_locker.lock();
+    for (Ring *r = m_rings; r; r = r->link) {
+        r->locker.lock();
+        unsigned int count = r->next < RING_SIZE ? r->next : RING_SIZE;
+        for (unsigned int i = r->next - count; i != r->next; ++i) {
+            write(r->records[i % RING_SIZE]);
+        }
+        r->locker.unlock();
+    }
+    m_rings_locker.unlock();
+    flush();
+}
+
+// 从 cursor 处继续读取，一次只锁一个线程的环形缓冲区，读取期间被覆盖的记录跳过
+bool Tracer::read_recent(Cursor &cursor, std::string &out, size_t max) {
+    int pid = getpid();
+    while (out.size() < max) {
+        m_rings_locker.lock();
+        Ring *r = m_rings;
+        for (int i = 0; r && i < cursor.ring; ++i) {
+            r = r->link;
+        }
+        m_rings_locker.unlock();
+        if (!r) {
+            return false;
+        }
+
+        r->locker.lock();
+        if (!cursor.started) {
+            // 只读取开始读这个线程时已经完成的请求
+            cursor.end = r->next;
+            cursor.pos = r->next < RING_SIZE ? 0 : r->next - RING_SIZE;
+            cursor.started = true;
+        }
+        if (r->next - cursor.pos > RING_SIZE) {
+            // 还没读到的记录已经被覆盖
+            cursor.pos = r->next - RING_SIZE;
+            if ((int)(cursor.end - cursor.pos) < 0) {
+                cursor.pos = cursor.end;
+            }
+        }
+        while (cursor.pos != cursor.end && out.size() < max) {
+            format_trace(r->records[cursor.pos % RING_SIZE], pid, out);
+            ++cursor.pos;
+        }
+        bool done = cursor.pos == cursor.end;
+        r->locker.unlock();
+
+        if (done) {
+            ++cursor.ring;
+            cursor.started = false;
+        }
+    }
+    return true;
+}
+
+// 把一个请求写成若干个 Complete 事件，同一连接上的请求显示在同一行
+void Tracer::format_trace(const RequestTrace &trace, int pid, std::string &out) {
+    char client[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &trace.client, client, sizeof(client));
+    char line[512];
+    int n;
+
+    const int64_t *ts = trace.ts;
+    if (ts[RequestTrace::FIRST_BYTE] && ts[RequestTrace::LAST_BYTE]) {
+        n = snprintf(line, sizeof(line), "{\"name\":\"request\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,"
+                     "\"args\":{\"url\":\"%s\",\"status\":%d,\"client\":\"%s\"}},\n",
+                     ts[RequestTrace::FIRST_BYTE] / 1000.0, (ts[RequestTrace::LAST_BYTE] - ts[RequestTrace::FIRST_BYTE]) / 1000.0,
+                     pid, trace.sockfd, trace.url, trace.status, client);
+        out.append(line, n < (int)sizeof(line) ? n : sizeof(line) - 1);
+    }
+    for (size_t i = 0; i < sizeof(trace_spans) / sizeof(trace_spans[0]); ++i) {
+        int64_t begin = ts[trace_spans[i].begin];
+        int64_t end = ts[trace_spans[i].end];
+        if (begin == 0 || end == 0) {
+            continue;
+        }
+        n = snprintf(line, sizeof(line), "{\"name\":\"%s\",\"cat\":\"phase\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+                     trace_spans[i].name, begin / 1000.0, (end - begin) / 1000.0, pid, trace.sockfd);
+        out.append(line, n < (int)sizeof(line) ? n : sizeof(line) - 1);
+    }
+}
+
+void Tracer::write(const RequestTrace &trace) {
+    if (!m_file) {
+        return;
+    }
+    std::string out;
+    format_trace(trace, getpid(), out);
+    m_file_locker.lock();
+    fputs(out.c_str(), m_file);
+    m_file_locker.unlock();
+}
+
+void Tracer::flush() {
+    if (!m_file) {
+        return;
+    }
+    m_file_locker.lock();
+    fflush(m_file);
+    m_file_locker.unlock();
+}
@@ -0,0 +1,122 @@
+#ifndef TRACER_H_
+#define TRACER_H_
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <time.h>
+#include <netinet/in.h>
+#include "../lock/locker.h"
+
+// 一个请求在各个阶段的时间戳
+struct RequestTrace {
+    /*
+        请求经过的阶段
+        ACCEPT          ：      接受连接，只有连接上的第一个请求有
+        FIRST_BYTE      ：      读入请求的第一个字节
+        ENQUEUE         ：      放入线程池请求队列
+        DEQUEUE         ：      工作线程取出请求
+        PARSE_DONE      ：      请求解析完成
+        RESPONSE_READY  ：      响应报文生成完成
+        LAST_BYTE       ：      发送完响应的最后一个字节
+     */
+    enum PHASE
+    {
+        ACCEPT = 0,
+        FIRST_BYTE,
+        ENQUEUE,
+        DEQUEUE,
+        PARSE_DONE,
+        RESPONSE_READY,
+        LAST_BYTE,
+        PHASE_NUM
+    };
+
+    static const int URL_LEN = 64;
+
+    int64_t ts[PHASE_NUM];      // 各阶段的单调时钟时间，纳秒，0 表示未经过该阶段
+    int sockfd;
+    in_addr_t client;
+    int status;                 // 响应状态码
+    char url[URL_LEN];          // 请求地址，超长时截断
+
+    void reset() {
+        memset(ts, 0, sizeof(ts));
+        status = 0;
+        url[0] = '\0';
+    }
+    void mark(PHASE phase) {
+        ts[phase] = now_ns();
+    }
+    // 记录请求地址，去掉会破坏 JSON 的字符
+    void set_url(const char *text) {
+        int i = 0;
+        for (; text[i] && i < URL_LEN - 1; ++i) {
+            char c = text[i];
+            url[i] = (c == '"' || c == '\\' || (unsigned char)c < 0x20) ? '_' : c;
+        }
+        url[i] = '\0';
+    }
+
+    // 单调时钟，走 vDSO，不陷入内核
+    static int64_t now_ns() {
+        struct timespec t;
+        clock_gettime(CLOCK_MONOTONIC, &t);
+        return (int64_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+    }
+};
+
+// 请求阶段耗时的记录器
+// 每个线程在自己的环形缓冲区中保留最近完成的请求，超过阈值的慢请求交给日志的后台线程写入 trace 文件
+// 线程退出时归还缓冲区，之后创建的线程接着使用，缓冲区的个数不超过同时存在的线程数
+// trace 文件为 Chrome Trace Event 格式，可以直接在 chrome://tracing 或 Perfetto 中打开
+class Tracer {
+public:
+    static const int RING_SIZE = 1024;      // 每个线程保留的最近请求数
+
+    // slow_ms 为慢请求阈值，小于等于 0 时不写 trace 文件
+    static void init(int slow_ms, const char *path);
+    // 请求完成，记录到当前线程的环形缓冲区，超过阈值时交给日志的后台线程写入 trace 文件
+    static void finish(const RequestTrace &trace);
+    // 把所有线程环形缓冲区中的请求写入 trace 文件，日志的后台线程在运行时交给它写，不在主线程上写磁盘
+    static void dump_recent();
+    // dump_recent 的实际写入，由日志的后台线程调用
+    static void write_recent();
+    // 把一个请求追加到 trace 文件，flush 之后才写到磁盘；由日志的后台线程调用
+    static void write(const RequestTrace &trace);
+    static void flush();
+
+    // 分段读取所有线程环形缓冲区中的请求，格式与 trace 文件相同
+    struct Cursor {
+        int ring;               // 第几个线程的环形缓冲区
+        unsigned int pos;       // 下一个读取的请求
+        unsigned int end;       // 开始读这个线程时的 next，之后完成的请求不再读取
+        bool started;
+        Cursor() : ring(0), pos(0), end(0), started(false) {}
+    };
+    // 从 cursor 处继续，追加到 out 直到超过 max 字节，返回 false 表示已经读完
+    static bool read_recent(Cursor &cursor, std::string &out, size_t max);
+
+private:
+    struct Ring {
+        RequestTrace records[RING_SIZE];
+        unsigned int next;      // 下一个写入位置
+        Locker locker;          // 只在 dump_recent 读取时才会有竞争
+        Ring *link;             // 所有线程的环形缓冲区串成链表
+        bool in_use;            // 是否属于一个活着的线程，由 m_rings_locker 保护
+    };
+    struct RingHolder;
+
+    static Ring *ring();
+    static void format_trace(const RequestTrace &trace, int pid, std::string &out);
+
+    static int64_t m_slow_ns;
+    static FILE *m_file;
+    static Locker m_file_locker;
+    static Ring *m_rings;
+    static Locker m_rings_locker;
+    static thread_local RingHolder t_holder;    // 线程退出时归还缓冲区
+};
+
+#endif // TRACER_H_
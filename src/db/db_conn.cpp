@@ -0,0 +1,11 @@
+#include <cstring>
+#include "db_conn.h"
+DbConnFactory find_db_factory(const char *name) {
+    if (strcmp(name, "mysql") == 0) {
+        return create_mysql_conn;
+    }
+    if (strcmp(name, "memory") == 0) {
+        return create_memory_conn;
+    }
+    return NULL;
+}
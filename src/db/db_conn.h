@@ -0,0 +1,42 @@
+#ifndef DB_CONN_H_
+#define DB_CONN_H_
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// 数据库的连接参数
+struct DbConfig {
+    std::string host;
+    int port;
+    std::string user;
+    std::string password;
+    std::string database;
+};
+
+typedef std::pair<std::string, std::string> UserRecord;    // 用户名，密码
+
+// 数据库连接接口，用户表只需要全量读取和插入
+// 具体的数据库由 DbConnFactory 决定，测试时可以换成进程内的实现
+class DbConn {
+public:
+    virtual ~DbConn() {}
+
+    // 读取用户表中的所有用户
+    virtual bool load_users(std::vector<UserRecord> &users) = 0;
+    // 插入一个用户，用户名已存在时返回 false
+    virtual bool insert_user(const UserRecord &user) = 0;
+    // 用一条语句插入多个用户，已存在的用户名跳过，用于批量写回
+    virtual bool insert_users(const std::vector<UserRecord> &users) = 0;
+};
+
+// 创建一个连接，失败时返回 NULL
+typedef DbConn *(*DbConnFactory)(const DbConfig &config);
+
+DbConn *create_mysql_conn(const DbConfig &config);     // MySQL，见 mysql_conn.cpp
+DbConn *create_memory_conn(const DbConfig &config);    // 进程内的用户表，见 memory_conn.cpp
+
+// 按名字选择数据库实现："mysql" 或 "memory"
+DbConnFactory find_db_factory(const char *name);
+
+#endif // DB_CONN_H_
@@ -0,0 +1,43 @@
+#include <map>
+#include "db_conn.h"
+#include "../core/lock/locker.h"
+
+// 进程内的用户表，所有连接共享，用来代替本地没有的 mysqld
+class MemoryConn : public DbConn {
+public:
+    bool load_users(std::vector<UserRecord> &users) {
+        m_locker.lock();
+        for (std::map<std::string, std::string>::iterator it = m_table.begin(); it != m_table.end(); ++it) {
+            users.push_back(*it);
+        }
+        m_locker.unlock();
+        return true;
+    }
+
+    bool insert_user(const UserRecord &user) {
+        m_locker.lock();
+        bool ret = m_table.insert(user).second;
+        m_locker.unlock();
+        return ret;
+    }
+
+    bool insert_users(const std::vector<UserRecord> &users) {
+        m_locker.lock();
+        for (size_t i = 0; i < users.size(); ++i) {
+            m_table.insert(users[i]);
+        }
+        m_locker.unlock();
+        return true;
+    }
+
+private:
+    static std::map<std::string, std::string> m_table;
+    static Locker m_locker;
+};
+
+std::map<std::string, std::string> MemoryConn::m_table;
+Locker MemoryConn::m_locker;
+
+DbConn *create_memory_conn(const DbConfig &) {
+    return new MemoryConn;
+}
@@ -0,0 +1,82 @@
+#include <mysql/mysql.h>
+#include "db_conn.h"
+
+// MySQL 用户表：CREATE TABLE user(username CHAR(50) PRIMARY KEY, passwd CHAR(50))
+class MysqlConn : public DbConn {
+public:
+    MysqlConn() : m_mysql(NULL) {}
+    ~MysqlConn() {
+        if (m_mysql) {
+            mysql_close(m_mysql);
+        }
+    }
+
+    bool connect(const DbConfig &config) {
+        m_mysql = mysql_init(NULL);
+        if (!m_mysql) {
+            return false;
+        }
+        return mysql_real_connect(m_mysql, config.host.c_str(), config.user.c_str(), config.password.c_str(),
+                                  config.database.c_str(), config.port, NULL, 0) != NULL;
+    }
+
+    bool load_users(std::vector<UserRecord> &users) {
+        if (mysql_query(m_mysql, "SELECT username, passwd FROM user")) {
+            return false;
+        }
+        MYSQL_RES *result = mysql_store_result(m_mysql);
+        if (!result) {
+            return false;
+        }
+        while (MYSQL_ROW row = mysql_fetch_row(result)) {
+            users.push_back(UserRecord(row[0] ? row[0] : "", row[1] ? row[1] : ""));
+        }
+        mysql_free_result(result);
+        return true;
+    }
+
+    bool insert_user(const UserRecord &user) {
+        std::string sql = "INSERT INTO user(username, passwd) VALUES('";
+        append_escaped(sql, user.first);
+        sql += "', '";
+        append_escaped(sql, user.second);
+        sql += "')";
+        return mysql_real_query(m_mysql, sql.data(), sql.size()) == 0;
+    }
+
+    bool insert_users(const std::vector<UserRecord> &users) {
+        if (users.empty()) {
+            return true;
+        }
+        // 日志重放时可能有已经写入的用户，用 IGNORE 保证幂等
+        std::string sql = "INSERT IGNORE INTO user(username, passwd) VALUES";
+        for (size_t i = 0; i < users.size(); ++i) {
+            sql += i == 0 ? "('" : ", ('";
+            append_escaped(sql, users[i].first);
+            sql += "', '";
+            append_escaped(sql, users[i].second);
+            sql += "')";
+        }
+        return mysql_real_query(m_mysql, sql.data(), sql.size()) == 0;
+    }
+
+private:
+    // 转义后追加到 SQL 语句中
+    void append_escaped(std::string &sql, const std::string &value) {
+        std::string escaped(value.size() * 2 + 1, '\0');
+        unsigned long len = mysql_real_escape_string(m_mysql, &escaped[0], value.data(), value.size());
+        sql.append(escaped.data(), len);
+    }
+
+private:
+    MYSQL *m_mysql;
+};
+
+DbConn *create_mysql_conn(const DbConfig &config) {
+    MysqlConn *conn = new MysqlConn;
+    if (!conn->connect(config)) {
+        delete conn;
+        return NULL;
+    }
+    return conn;
+}
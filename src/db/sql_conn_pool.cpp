@@ -0,0 +1,52 @@
+#include "sql_conn_pool.h"
+
+SqlConnPool *SqlConnPool::instance() {
+    static SqlConnPool pool;
+    return &pool;
+}
+
+bool SqlConnPool::init(DbConnFactory factory, const DbConfig &config, int size) {
+    for (int i = 0; i < size; ++i) {
+        DbConn *conn = factory(config);
+        if (!conn) {
+            destroy();
+            return false;
+        }
+        m_free.push_back(conn);
+        ++m_size;
+        m_reserve.post();
+    }
+    return true;
+}
+
+DbConn *SqlConnPool::get() {
+    m_reserve.wait();
+    m_locker.lock();
+    DbConn *conn = m_free.front();
+    m_free.pop_front();
+    m_locker.unlock();
+    return conn;
+}
+
+void SqlConnPool::release(DbConn *conn) {
+    if (!conn) {
+        return;
+    }
+    m_locker.lock();
+    m_free.push_back(conn);
+    m_locker.unlock();
+    m_reserve.post();
+}
+
+// 只在没有线程使用连接时调用，此时信号量等于空闲连接数
+// 每关闭一个连接取走一次信号量，否则部分失败的 init 之后再 init 或 get 会多计，取到不存在的连接
+void SqlConnPool::destroy() {
+    m_locker.lock();
+    for (std::list<DbConn *>::iterator it = m_free.begin(); it != m_free.end(); ++it) {
+        delete *it;
+        m_reserve.trywait();
+    }
+    m_free.clear();
+    m_size = 0;
+    m_locker.unlock();
+}
@@ -0,0 +1,51 @@
+#ifndef SQL_CONN_POOL_H_
+#define SQL_CONN_POOL_H_
+
+#include <list>
+#include "db_conn.h"
+#include "../core/lock/locker.h"
+
+// 数据库连接池，启动时建立固定数量的连接
+class SqlConnPool {
+public:
+    static SqlConnPool *instance();
+
+    // 建立 size 个连接，任意一个失败则返回 false
+    bool init(DbConnFactory factory, const DbConfig &config, int size);
+    // 取出一个连接，没有空闲连接时阻塞等待
+    DbConn *get();
+    // 归还连接
+    void release(DbConn *conn);
+    // 关闭所有连接，空闲连接数随之清零
+    void destroy();
+
+    bool ready() const { return m_size > 0; }
+
+private:
+    SqlConnPool() : m_size(0) {}
+    ~SqlConnPool() { destroy(); }
+
+private:
+    int m_size;                     // 连接总数
+    std::list<DbConn *> m_free;     // 空闲连接
+    Locker m_locker;                // 保护空闲连接列表
+    Sem m_reserve;                  // 空闲连接数
+};
+
+// 在作用域内持有一个连接，离开作用域时自动归还
+class ConnectionRAII {
+public:
+    ConnectionRAII(DbConn **conn, SqlConnPool *pool) : m_pool(pool) {
+        m_conn = pool->get();
+        *conn = m_conn;
+    }
+    ~ConnectionRAII() {
+        m_pool->release(m_conn);
+    }
+
+private:
+    DbConn *m_conn;
+    SqlConnPool *m_pool;
+};
+
+#endif // SQL_CONN_POOL_H_
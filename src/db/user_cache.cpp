@@ -0,0 +1,191 @@
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <sys/mman.h>
+#include "user_cache.h"
+
+UserCache *UserCache::instance() {
+    static UserCache cache;
+    return &cache;
+}
+
+bool UserCache::init_shared(int capacity) {
+    int slots = capacity / SHARD_NUM;
+    if (slots < 1) {
+        return false;
+    }
+    size_t shards = sizeof(SharedShard) * SHARD_NUM;
+    size_t entries = sizeof(SharedEntry) * slots * SHARD_NUM;
+    // 匿名共享映射在 fork 后父子进程间共享，初始内容为 0 即全部为空表项；页面在第一次写入时才分配
+    char *addr = (char *)mmap(NULL, shards + entries, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+    SharedShard *shared = reinterpret_cast<SharedShard *>(addr);
+    // 工作进程可能在注册时崩溃或者被 SIGKILL，读写锁没有健壮属性，持有者退出后其他进程会一直阻塞
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    for (int i = 0; i < SHARD_NUM; ++i) {
+        pthread_mutex_init(&shared[i].lock, &attr);
+        shared[i].count = 0;
+    }
+    pthread_mutexattr_destroy(&attr);
+    m_entries = reinterpret_cast<SharedEntry *>(addr + shards);
+    m_shard_slots = slots;
+    m_shared = shared;
+    return true;
+}
+
+void UserCache::lock_shared(int shard) {
+    SharedShard &s = m_shared[shard];
+    if (pthread_mutex_lock(&s.lock) != EOWNERDEAD) {
+        return;
+    }
+    // 持有者在修改分片时退出：表项先写内容、最后改状态，状态为 USED 的表项都是完整的，只有 count 可能不准
+    int count = 0;
+    for (int i = 0; i < m_shard_slots; ++i) {
+        if (m_entries[shard * m_shard_slots + i].state == SharedEntry::USED) {
+            ++count;
+        }
+    }
+    s.count = count;
+    pthread_mutex_consistent(&s.lock);
+}
+
+int UserCache::find_shared(const std::string &name, int &free_slot) {
+    size_t h = hash(name);
+    int base = (int)(h % SHARD_NUM) * m_shard_slots;
+    int start = (int)(h / SHARD_NUM % m_shard_slots);
+    free_slot = -1;
+    for (int i = 0; i < m_shard_slots; ++i) {
+        int slot = base + (start + i) % m_shard_slots;
+        SharedEntry &e = m_entries[slot];
+        if (e.state == SharedEntry::EMPTY) {
+            if (free_slot < 0) {
+                free_slot = slot;
+            }
+            return -1;
+        }
+        if (e.state == SharedEntry::ERASED) {
+            if (free_slot < 0) {
+                free_slot = slot;
+            }
+            continue;
+        }
+        if (name == e.name) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+bool UserCache::put_shared(const std::string &name, const std::string &password, bool overwrite) {
+    if (name.size() >= (size_t)FIELD_LEN || password.size() >= (size_t)FIELD_LEN) {
+        return false;
+    }
+    int shard = hash(name) % SHARD_NUM;
+    lock_shared(shard);
+    int free_slot;
+    int slot = find_shared(name, free_slot);
+    bool ret = true;
+    if (slot >= 0) {
+        ret = overwrite;
+        if (ret) {
+            memcpy(m_entries[slot].password, password.c_str(), password.size() + 1);
+        }
+    }
+    else if (free_slot >= 0) {
+        // 先写内容再标记为 USED，进程在中途退出时不会留下不完整的用户
+        slot = free_slot;
+        memcpy(m_entries[slot].name, name.c_str(), name.size() + 1);
+        memcpy(m_entries[slot].password, password.c_str(), password.size() + 1);
+        std::atomic_signal_fence(std::memory_order_release);
+        m_entries[slot].state = SharedEntry::USED;
+        ++m_shared[shard].count;
+    }
+    else {
+        // 分片已满
+        ret = false;
+    }
+    unlock_shared(shard);
+    return ret;
+}
+
+void UserCache::load(const std::vector<UserRecord> &users) {
+    for (size_t i = 0; i < users.size(); ++i) {
+        if (m_shared) {
+            put_shared(users[i].first, users[i].second, true);
+            continue;
+        }
+        Shard &s = shard(users[i].first);
+        s.lock.wrlock();
+        s.users[users[i].first] = users[i].second;
+        s.lock.unlock();
+    }
+}
+
+bool UserCache::check(const std::string &name, const std::string &password) {
+    if (m_shared) {
+        int shard = hash(name) % SHARD_NUM;
+        lock_shared(shard);
+        int free_slot;
+        int slot = find_shared(name, free_slot);
+        bool ret = slot >= 0 && password == m_entries[slot].password;
+        unlock_shared(shard);
+        return ret;
+    }
+    Shard &s = shard(name);
+    s.lock.rdlock();
+    std::unordered_map<std::string, std::string>::iterator it = s.users.find(name);
+    bool ret = it != s.users.end() && it->second == password;
+    s.lock.unlock();
+    return ret;
+}
+
+bool UserCache::insert(const std::string &name, const std::string &password) {
+    if (m_shared) {
+        return put_shared(name, password, false);
+    }
+    Shard &s = shard(name);
+    s.lock.wrlock();
+    bool ret = s.users.insert(std::make_pair(name, password)).second;
+    s.lock.unlock();
+    return ret;
+}
+
+void UserCache::erase(const std::string &name) {
+    if (m_shared) {
+        int shard = hash(name) % SHARD_NUM;
+        lock_shared(shard);
+        int free_slot;
+        int slot = find_shared(name, free_slot);
+        if (slot >= 0) {
+            m_entries[slot].state = SharedEntry::ERASED;
+            --m_shared[shard].count;
+        }
+        unlock_shared(shard);
+        return;
+    }
+    Shard &s = shard(name);
+    s.lock.wrlock();
+    s.users.erase(name);
+    s.lock.unlock();
+}
+
+size_t UserCache::size() {
+    size_t count = 0;
+    for (int i = 0; i < SHARD_NUM; ++i) {
+        if (m_shared) {
+            lock_shared(i);
+            count += m_shared[i].count;
+            unlock_shared(i);
+            continue;
+        }
+        m_shards[i].lock.rdlock();
+        count += m_shards[i].users.size();
+        m_shards[i].lock.unlock();
+    }
+    return count;
+}
@@ -0,0 +1,79 @@
+#ifndef USER_CACHE_H_
+#define USER_CACHE_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <pthread.h>
+#include "db_conn.h"
+#include "../core/lock/locker.h"
+
+// 内存中的用户表，启动时从数据库全量加载，登录时不访问数据库
+// 按用户名哈希分片，每个分片一把读写锁，登录只加读锁
+// 多进程模式下由主进程在 fork 之前创建共享的用户表（init_shared），所有工作进程读写同一张表，
+// 在一个进程注册的用户马上可以在其他进程登录，同一用户名在不同进程并发注册时也只有一个成功；
+// 共享分片用健壮的互斥锁，持有锁的进程崩溃后下一个加锁的进程接手，其他进程不会一直阻塞
+class UserCache {
+public:
+    static const int SHARD_NUM = 16;
+    static const int FIELD_LEN = 64;    // 共享用户表中用户名和密码的最大长度（含结尾的 '\0'），与表单的限制一致
+
+    static UserCache *instance();
+
+    // 创建 capacity 个表项的共享用户表，需在 fork 之前调用
+    bool init_shared(int capacity);
+    // 用数据库中的用户填充缓存
+    void load(const std::vector<UserRecord> &users);
+    // 用户名和密码是否匹配
+    bool check(const std::string &name, const std::string &password);
+    // 加入一个新用户，用户名已存在（或者共享用户表已满）时返回 false
+    bool insert(const std::string &name, const std::string &password);
+    // 删除用户，写入数据库失败时回滚
+    void erase(const std::string &name);
+    size_t size();
+
+private:
+    UserCache() : m_shared(NULL), m_entries(NULL), m_shard_slots(0) {}
+
+    struct Shard {
+        std::unordered_map<std::string, std::string> users;
+        RwLock lock;
+    };
+
+    // 共享用户表的一个分片，分片内开放寻址
+    struct SharedShard {
+        pthread_mutex_t lock;           // 跨进程的健壮互斥锁
+        int count;
+    };
+    struct SharedEntry {
+        enum STATE
+        {
+            EMPTY = 0,
+            USED,
+            ERASED                      // 删除后留下的墓碑，查找时跳过，插入时可以复用
+        };
+        char state;
+        char name[FIELD_LEN];
+        char password[FIELD_LEN];
+    };
+
+    size_t hash(const std::string &name) { return std::hash<std::string>()(name); }
+    Shard &shard(const std::string &name) {
+        return m_shards[hash(name) % SHARD_NUM];
+    }
+    // 在 name 所在的共享分片中查找，持有分片锁时调用；返回表项下标，不存在时返回 -1，
+    // free_slot 为可以插入的第一个位置，分片已满时为 -1
+    int find_shared(const std::string &name, int &free_slot);
+    // 给共享分片加锁；上一个持有者已经退出时把锁恢复为一致状态，并按表项重新统计 count
+    void lock_shared(int shard);
+    void unlock_shared(int shard) { pthread_mutex_unlock(&m_shared[shard].lock); }
+    // 写入共享用户表，overwrite 为 false 时用户名已存在返回 false
+    bool put_shared(const std::string &name, const std::string &password, bool overwrite);
+
+    Shard m_shards[SHARD_NUM];
+    SharedShard *m_shared;              // 为 NULL 时使用进程内的 m_shards
+    SharedEntry *m_entries;             // 按分片排列
+    int m_shard_slots;                  // 每个共享分片的表项数
+};
+
+#endif // USER_CACHE_H_
@@ -0,0 +1,240 @@
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include "user_writer.h"
+#include "user_cache.h"
+
+UserWriter *UserWriter::instance() {
+    static UserWriter writer;
+    return &writer;
+}
+
+// 日志记录格式：用户名长度(2 字节)，密码长度(2 字节)，用户名，密码
+// 密码长度为 TOMBSTONE 时没有密码，表示作废前面最近一条同名用户的记录
+static const uint16_t TOMBSTONE = 0xffff;
+
+static void encode_record(const UserRecord &user, std::string &record) {
+    uint16_t lens[2] = {(uint16_t)user.first.size(), (uint16_t)user.second.size()};
+    record.assign((const char *)lens, sizeof(lens));
+    record += user.first;
+    record += user.second;
+}
+
+static void encode_tombstone(const std::string &name, std::string &record) {
+    uint16_t lens[2] = {(uint16_t)name.size(), TOMBSTONE};
+    record.assign((const char *)lens, sizeof(lens));
+    record += name;
+}
+
+bool UserWriter::init(SqlConnPool *pool, const char *journal) {
+    m_pool = pool;
+    m_fd = open(journal, O_RDWR | O_CREAT | O_APPEND, 0600);
+    if (m_fd < 0) {
+        return false;
+    }
+
+    // 上次退出时还没写入数据库的用户
+    std::vector<UserRecord> users;
+    if (!replay(users)) {
+        // 截不掉残缺的记录时不接受注册，之后写入的用户会在重放时丢失
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    if (!users.empty()) {
+        UserCache::instance()->load(users);
+        m_pending = users;
+        m_appended = users.size();
+    }
+
+    m_stop = false;
+    if (pthread_create(&m_thread, NULL, worker, this) != 0) {
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void UserWriter::shutdown() {
+    if (m_fd < 0) {
+        return;
+    }
+    m_locker.lock();
+    m_stop = true;
+    m_cond.signal();
+    m_locker.unlock();
+    pthread_join(m_thread, NULL);
+
+    // 等正在落盘的线程结束再关闭，之后的 append 看到 m_fd 为 -1 直接失败
+    m_locker.lock();
+    while (m_syncing > 0) {
+        m_cond.wait(m_locker.get());
+    }
+    close(m_fd);
+    m_fd = -1;
+    m_locker.unlock();
+}
+
+bool UserWriter::append(const UserRecord &user) {
+    std::string record;
+    encode_record(user, record);
+
+    m_locker.lock();
+    if (m_fd < 0 || ::write(m_fd, record.data(), record.size()) != (ssize_t)record.size()) {
+        m_locker.unlock();
+        return false;
+    }
+    // O_APPEND 写入后文件偏移量在这条记录的结尾
+    off_t end = lseek(m_fd, 0, SEEK_CUR);
+    // 先计入日志中的用户数，落盘期间后台线程不会清空日志
+    ++m_appended;
+    ++m_syncing;
+    int fd = m_fd;
+    m_locker.unlock();
+
+    // 落盘后才算注册成功，多个线程的 fdatasync 会被内核合并；在锁外执行，shutdown 等它结束才关闭 fd
+    bool synced = fdatasync(fd) == 0;
+
+    m_locker.lock();
+    --m_syncing;
+    if (synced) {
+        m_pending.push_back(user);
+    }
+    else {
+        // 注册失败，由调用者回滚用户表；日志中的记录要作废，否则重启重放时会注册一个客户端被告知不存在的用户
+        --m_appended;
+        discard(user, end - (off_t)record.size(), end);
+    }
+    bool wake = m_pending.size() >= (size_t)BATCH_SIZE || (m_stop && m_syncing == 0);
+    m_locker.unlock();
+
+    if (wake) {
+        m_cond.signal();
+    }
+    return synced;
+}
+
+// 这条记录之后没有别的记录时直接截掉，不需要新的磁盘空间（落盘失败常常是因为磁盘已满）；
+// 之后已经有其他线程追加的记录时不能截断，追加一条作废记录
+// 两种方式都再落盘一次，仍然失败时无法补救
+void UserWriter::discard(const UserRecord &user, off_t start, off_t end) {
+    if (end > 0 && lseek(m_fd, 0, SEEK_END) == end && ftruncate(m_fd, start) == 0) {
+        fdatasync(m_fd);
+        return;
+    }
+    std::string record;
+    encode_tombstone(user.first, record);
+    if (::write(m_fd, record.data(), record.size()) == (ssize_t)record.size()) {
+        fdatasync(m_fd);
+    }
+}
+
+bool UserWriter::replay(std::vector<UserRecord> &users) {
+    lseek(m_fd, 0, SEEK_SET);
+    std::string data;
+    char buf[4096];
+    ssize_t len;
+    while ((len = read(m_fd, buf, sizeof(buf))) > 0) {
+        data.append(buf, len);
+    }
+
+    size_t off = 0;
+    while (off + 4 <= data.size()) {
+        uint16_t lens[2];
+        memcpy(lens, data.data() + off, sizeof(lens));
+        size_t password_len = lens[1] == TOMBSTONE ? 0 : lens[1];
+        if (off + 4 + lens[0] + password_len > data.size()) {
+            // 写到一半的记录
+            break;
+        }
+        off += 4;
+        std::string name = data.substr(off, lens[0]);
+        if (lens[1] == TOMBSTONE) {
+            // 作废前面最近一条同名的记录
+            for (size_t i = users.size(); i > 0; --i) {
+                if (users[i - 1].first == name) {
+                    users.erase(users.begin() + (i - 1));
+                    break;
+                }
+            }
+        }
+        else {
+            users.push_back(UserRecord(name, data.substr(off + lens[0], lens[1])));
+        }
+        off += lens[0] + password_len;
+    }
+    // 日志以 O_APPEND 打开，不截掉的话新的记录写在残缺记录之后，下次重放时会停在残缺处而丢失
+    if (off < data.size() && ftruncate(m_fd, off) != 0) {
+        return false;
+    }
+    return true;
+}
+
+void *UserWriter::worker(void *arg) {
+    UserWriter *writer = (UserWriter *)arg;
+    writer->run();
+    return writer;
+}
+
+void UserWriter::run() {
+    while (true) {
+        m_locker.lock();
+        if (!m_stop && m_pending.size() < (size_t)BATCH_SIZE) {
+            // 攒一批，最多等 FLUSH_INTERVAL_MS
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            struct timespec deadline;
+            long usec = now.tv_usec + FLUSH_INTERVAL_MS * 1000;
+            deadline.tv_sec = now.tv_sec + usec / 1000000;
+            deadline.tv_nsec = (usec % 1000000) * 1000;
+            m_cond.timewait(m_locker.get(), deadline);
+        }
+        size_t count = m_pending.size() < (size_t)BATCH_SIZE ? m_pending.size() : BATCH_SIZE;
+        std::vector<UserRecord> batch(m_pending.begin(), m_pending.begin() + count);
+        m_pending.erase(m_pending.begin(), m_pending.begin() + count);
+        bool stop = m_stop;
+        m_locker.unlock();
+
+        if (batch.empty()) {
+            if (stop) {
+                break;
+            }
+            continue;
+        }
+
+        if (!flush(batch)) {
+            // 放回队首，稍后重试；退出时留在日志里，下次启动重放
+            m_locker.lock();
+            m_pending.insert(m_pending.begin(), batch.begin(), batch.end());
+            m_locker.unlock();
+            if (stop) {
+                break;
+            }
+            usleep(RETRY_INTERVAL_MS * 1000);
+            continue;
+        }
+
+        m_locker.lock();
+        m_flushed += batch.size();
+        if (m_flushed == m_appended) {
+            // 日志中的用户都已经在数据库里了
+            ftruncate(m_fd, 0);
+            m_flushed = m_appended = 0;
+        }
+        m_locker.unlock();
+    }
+}
+
+bool UserWriter::flush(std::vector<UserRecord> &batch) {
+    if (!m_pool->ready()) {
+        return false;
+    }
+    DbConn *conn = NULL;
+    ConnectionRAII conn_raii(&conn, m_pool);
+    return conn->insert_users(batch);
+}
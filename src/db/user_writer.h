@@ -0,0 +1,55 @@
+#ifndef USER_WRITER_H_
+#define USER_WRITER_H_
+
+#include <vector>
+#include <pthread.h>
+#include <sys/types.h>
+#include "db_conn.h"
+#include "sql_conn_pool.h"
+#include "../core/lock/locker.h"
+
+// 注册用户的延迟写回
+// 工作线程只更新内存用户表并追加本地日志文件，由后台线程把新用户合并成多行 INSERT 批量写入数据库
+// 日志中的记录全部写入数据库后清空日志；启动时重放日志中尚未写入数据库的用户
+class UserWriter {
+public:
+    static const int BATCH_SIZE = 256;          // 一条 INSERT 最多包含的用户数
+    static const int FLUSH_INTERVAL_MS = 100;   // 没有攒够一批时，最长的等待时间
+    static const int RETRY_INTERVAL_MS = 1000;  // 写入数据库失败后的重试间隔
+
+    static UserWriter *instance();
+
+    // 打开日志，把其中的用户加入内存用户表并写入数据库，然后启动后台线程
+    bool init(SqlConnPool *pool, const char *journal);
+    // 写完剩余的用户并停止后台线程
+    void shutdown();
+
+    // 记录一个新用户，写入日志并落盘后返回，失败时返回 false，日志中的这条记录作废
+    bool append(const UserRecord &user);
+
+private:
+    UserWriter() : m_pool(NULL), m_fd(-1), m_stop(false), m_appended(0), m_flushed(0), m_syncing(0) {}
+
+    static void *worker(void *arg);
+    void run();
+    // 把 batch 写入数据库，在后台线程中调用
+    bool flush(std::vector<UserRecord> &batch);
+    // 读出日志中的所有用户，跳过被作废的记录，截掉结尾写到一半的记录
+    bool replay(std::vector<UserRecord> &users);
+    // 落盘失败时作废 [start, end) 处 user 的记录，持有 m_locker 时调用
+    void discard(const UserRecord &user, off_t start, off_t end);
+
+private:
+    SqlConnPool *m_pool;
+    int m_fd;                               // 日志文件
+    pthread_t m_thread;
+    bool m_stop;
+    std::vector<UserRecord> m_pending;      // 等待写入数据库的用户
+    long m_appended;                        // 写入日志的用户数
+    long m_flushed;                         // 写入数据库的用户数，等于 m_appended 时可以清空日志
+    int m_syncing;                          // 正在 fdatasync 的线程数，为 0 时 shutdown 才能关闭日志
+    Locker m_locker;                        // 保护以上状态
+    Cond m_cond;                            // 通知后台线程攒够一批或者退出，通知 shutdown 落盘已经结束
+};
+
+#endif // USER_WRITER_H_
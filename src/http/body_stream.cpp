@@ -0,0 +1,14 @@
+#include "body_stream.h"
+
+bool RecentTraceStream::next(std::string &chunk) {
+    size_t max = chunk.size() + CHUNK_SIZE;
+    if (m_begin) {
+        chunk.append("[\n");
+        m_begin = false;
+    }
+    if (Tracer::read_recent(m_cursor, chunk, max)) {
+        return true;
+    }
+    // 和 trace 文件一样省略结尾的 ]，最后一个事件后的逗号不影响加载
+    return false;
+}
@@ -0,0 +1,36 @@
+#ifndef BODY_STREAM_H_
+#define BODY_STREAM_H_
+
+#include <cstddef>
+#include <string>
+#include "../core/trace/tracer.h"
+
+// 分段生成的响应体，长度事先未知，用 chunked 编码边生成边发送
+// 只有上一段发送完（EPOLLOUT 就绪）才生成下一段，慢的客户端不会让服务器缓存整个响应体
+// 发送响应头之后请求的 Arena 会被重置，实现中不能引用请求解析时分配的内存
+class BodyStream {
+public:
+    static const size_t CHUNK_SIZE = 16384;     // 每一段的建议大小
+
+    virtual ~BodyStream() {}
+
+    virtual const char *content_type() const = 0;
+    // 把下一段追加到 chunk（不要改动已有的内容），返回 false 表示这是最后一段
+    // 返回 true 时至少要追加一个字节
+    virtual bool next(std::string &chunk) = 0;
+};
+
+// 所有线程最近完成的请求，Chrome Trace Event 格式
+class RecentTraceStream : public BodyStream {
+public:
+    RecentTraceStream() : m_begin(true) {}
+
+    const char *content_type() const { return "application/json"; }
+    bool next(std::string &chunk);
+
+private:
+    Tracer::Cursor m_cursor;
+    bool m_begin;
+};
+
+#endif // BODY_STREAM_H_
@@ -0,0 +1,474 @@
+#include "hpack.h"
+
+// 静态表，RFC 7541 附录 A
+static const HpackHeader static_table[HpackTable::STATIC_NUM] = {
+    HpackHeader(":authority", ""),
+    HpackHeader(":method", "GET"),
+    HpackHeader(":method", "POST"),
+    HpackHeader(":path", "/"),
+    HpackHeader(":path", "/index.html"),
+    HpackHeader(":scheme", "http"),
+    HpackHeader(":scheme", "https"),
+    HpackHeader(":status", "200"),
+    HpackHeader(":status", "204"),
+    HpackHeader(":status", "206"),
+    HpackHeader(":status", "304"),
+    HpackHeader(":status", "400"),
+    HpackHeader(":status", "404"),
+    HpackHeader(":status", "500"),
+    HpackHeader("accept-charset", ""),
+    HpackHeader("accept-encoding", "gzip, deflate"),
+    HpackHeader("accept-language", ""),
+    HpackHeader("accept-ranges", ""),
+    HpackHeader("accept", ""),
+    HpackHeader("access-control-allow-origin", ""),
+    HpackHeader("age", ""),
+    HpackHeader("allow", ""),
+    HpackHeader("authorization", ""),
+    HpackHeader("cache-control", ""),
+    HpackHeader("content-disposition", ""),
+    HpackHeader("content-encoding", ""),
+    HpackHeader("content-language", ""),
+    HpackHeader("content-length", ""),
+    HpackHeader("content-location", ""),
+    HpackHeader("content-range", ""),
+    HpackHeader("content-type", ""),
+    HpackHeader("cookie", ""),
+    HpackHeader("date", ""),
+    HpackHeader("etag", ""),
+    HpackHeader("expect", ""),
+    HpackHeader("expires", ""),
+    HpackHeader("from", ""),
+    HpackHeader("host", ""),
+    HpackHeader("if-match", ""),
+    HpackHeader("if-modified-since", ""),
+    HpackHeader("if-none-match", ""),
+    HpackHeader("if-range", ""),
+    HpackHeader("if-unmodified-since", ""),
+    HpackHeader("last-modified", ""),
+    HpackHeader("link", ""),
+    HpackHeader("location", ""),
+    HpackHeader("max-forwards", ""),
+    HpackHeader("proxy-authenticate", ""),
+    HpackHeader("proxy-authorization", ""),
+    HpackHeader("range", ""),
+    HpackHeader("referer", ""),
+    HpackHeader("refresh", ""),
+    HpackHeader("retry-after", ""),
+    HpackHeader("server", ""),
+    HpackHeader("set-cookie", ""),
+    HpackHeader("strict-transport-security", ""),
+    HpackHeader("transfer-encoding", ""),
+    HpackHeader("user-agent", ""),
+    HpackHeader("vary", ""),
+    HpackHeader("via", ""),
+    HpackHeader("www-authenticate", ""),
+};
+
+// Huffman 编码表，RFC 7541 附录 B，下标为字节值，256 为 EOS
+struct HuffmanCode {
+    uint32_t code;
+    uint8_t bits;
+};
+
+static const HuffmanCode huffman_codes[257] = {
+    {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+    {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+    {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+    {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+    {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+    {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+    {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+    {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+    {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+    {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+    {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+    {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+    {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+    {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+    {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+    {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+    {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+    {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+    {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+    {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+    {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+    {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+    {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+    {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+    {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+    {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+    {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+    {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+    {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+    {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+    {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+    {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+    {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+    {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+    {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+    {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+    {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+    {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+    {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+    {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+    {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+    {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+    {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+    {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+    {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+    {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+    {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+    {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+    {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+    {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+    {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+    {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+    {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+    {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+    {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+    {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+    {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+    {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+    {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+    {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+    {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+    {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+    {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+    {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+    {0x3fffffff, 30},
+};
+
+// Huffman 解码树，由编码表在第一次使用时生成
+// 内部结点 child 为子结点的下标，叶子结点 symbol 为字节值，EOS 为 256
+struct HuffmanNode {
+    int child[2];
+    int symbol;
+};
+
+static const std::vector<HuffmanNode> &huffman_tree() {
+    static const std::vector<HuffmanNode> tree = [] {
+        std::vector<HuffmanNode> nodes(1, HuffmanNode{{0, 0}, -1});
+        for (int sym = 0; sym < 257; ++sym) {
+            int node = 0;
+            for (int i = huffman_codes[sym].bits - 1; i >= 0; --i) {
+                int bit = (huffman_codes[sym].code >> i) & 1;
+                if (nodes[node].child[bit] == 0) {
+                    nodes[node].child[bit] = nodes.size();
+                    nodes.push_back(HuffmanNode{{0, 0}, -1});
+                }
+                node = nodes[node].child[bit];
+            }
+            nodes[node].symbol = sym;
+        }
+        return nodes;
+    }();
+    return tree;
+}
+
+
+// ---------- 整数和字符串 ----------
+
+namespace hpack {
+
+// 整数放在第一个字节的低 prefix_bits 位中，放不下时后续字节每个 7 位，first 为第一个字节的高位标志
+void encode_int(uint64_t value, int prefix_bits, uint8_t first, std::string &out) {
+    uint64_t max_prefix = (1u << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out.push_back((char)(first | value));
+        return;
+    }
+    out.push_back((char)(first | max_prefix));
+    value -= max_prefix;
+    while (value >= 128) {
+        out.push_back((char)(0x80 | (value & 0x7f)));
+        value >>= 7;
+    }
+    out.push_back((char)value);
+}
+
+bool decode_int(const uint8_t *&p, const uint8_t *end, int prefix_bits, uint64_t &value) {
+    if (p >= end) {
+        return false;
+    }
+    uint64_t max_prefix = (1u << prefix_bits) - 1;
+    value = *p++ & max_prefix;
+    if (value < max_prefix) {
+        return true;
+    }
+    for (int shift = 0; p < end; shift += 7) {
+        // 超过 32 位的整数在 HTTP/2 中没有意义，按错误处理
+        if (shift > 28) {
+            return false;
+        }
+        uint8_t b = *p++;
+        value += (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return value <= UINT32_MAX;
+        }
+    }
+    return false;
+}
+
+size_t huffman_length(const std::string &s) {
+    size_t bits = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        bits += huffman_codes[(uint8_t)s[i]].bits;
+    }
+    return (bits + 7) / 8;
+}
+
+void encode_string(const std::string &s, std::string &out) {
+    size_t huff_len = huffman_length(s);
+    if (huff_len >= s.size()) {
+        encode_int(s.size(), 7, 0, out);
+        out.append(s);
+        return;
+    }
+
+    encode_int(huff_len, 7, 0x80, out);
+    uint64_t acc = 0;
+    int acc_bits = 0;
+    for (size_t i = 0; i < s.size(); ++i) {
+        const HuffmanCode &c = huffman_codes[(uint8_t)s[i]];
+        acc = (acc << c.bits) | c.code;
+        acc_bits += c.bits;
+        while (acc_bits >= 8) {
+            acc_bits -= 8;
+            out.push_back((char)(acc >> acc_bits));
+        }
+    }
+    // 最后不满一个字节的部分用 EOS 的高位（全 1）填充
+    if (acc_bits > 0) {
+        out.push_back((char)((acc << (8 - acc_bits)) | (0xff >> acc_bits)));
+    }
+}
+
+bool huffman_decode(const uint8_t *data, size_t len, std::string &out) {
+    const std::vector<HuffmanNode> &tree = huffman_tree();
+    int node = 0;
+    int pad_bits = 0;           // 上一个字符之后走过的位数
+    bool pad_ones = true;       // 这些位是否全为 1
+    for (size_t i = 0; i < len; ++i) {
+        for (int b = 7; b >= 0; --b) {
+            int bit = (data[i] >> b) & 1;
+            node = tree[node].child[bit];
+            if (node == 0) {
+                return false;
+            }
+            ++pad_bits;
+            pad_ones = pad_ones && bit;
+            int sym = tree[node].symbol;
+            if (sym >= 0) {
+                // 字符串中出现 EOS 是解码错误
+                if (sym == 256) {
+                    return false;
+                }
+                out.push_back((char)sym);
+                node = 0;
+                pad_bits = 0;
+                pad_ones = true;
+            }
+        }
+    }
+    // 填充不超过 7 位，且必须是 EOS 的高位
+    return pad_bits < 8 && pad_ones;
+}
+
+bool decode_string(const uint8_t *&p, const uint8_t *end, std::string &out) {
+    if (p >= end) {
+        return false;
+    }
+    bool huffman = *p & 0x80;
+    uint64_t len;
+    if (!decode_int(p, end, 7, len) || len > (uint64_t)(end - p)) {
+        return false;
+    }
+    out.clear();
+    bool ok = true;
+    if (huffman) {
+        ok = huffman_decode(p, len, out);
+    }
+    else {
+        out.assign(reinterpret_cast<const char *>(p), len);
+    }
+    p += len;
+    return ok;
+}
+
+}
+
+
+// ---------- 动态表 ----------
+
+const HpackHeader *HpackTable::get(size_t index) const {
+    if (index == 0) {
+        return NULL;
+    }
+    if (index <= STATIC_NUM) {
+        return &static_table[index - 1];
+    }
+    index -= STATIC_NUM + 1;
+    return index < m_entries.size() ? &m_entries[index] : NULL;
+}
+
+size_t HpackTable::find(const std::string &name, const std::string &value, bool &exact) const {
+    size_t name_index = 0;
+    exact = false;
+    for (size_t i = 0; i < STATIC_NUM; ++i) {
+        if (static_table[i].first == name) {
+            if (static_table[i].second == value) {
+                exact = true;
+                return i + 1;
+            }
+            if (name_index == 0) {
+                name_index = i + 1;
+            }
+        }
+    }
+    for (size_t i = 0; i < m_entries.size(); ++i) {
+        if (m_entries[i].first == name) {
+            if (m_entries[i].second == value) {
+                exact = true;
+                return STATIC_NUM + 1 + i;
+            }
+            if (name_index == 0) {
+                name_index = STATIC_NUM + 1 + i;
+            }
+        }
+    }
+    return name_index;
+}
+
+void HpackTable::evict(size_t limit) {
+    while (m_size > limit && !m_entries.empty()) {
+        const HpackHeader &old = m_entries.back();
+        m_size -= old.first.size() + old.second.size() + ENTRY_OVERHEAD;
+        m_entries.pop_back();
+    }
+}
+
+void HpackTable::insert(const std::string &name, const std::string &value) {
+    size_t size = name.size() + value.size() + ENTRY_OVERHEAD;
+    // 比整个表还大的条目会清空动态表，自己也不加入
+    if (size > m_max_size) {
+        evict(0);
+        return;
+    }
+    evict(m_max_size - size);
+    m_entries.push_front(HpackHeader(name, value));
+    m_size += size;
+}
+
+void HpackTable::set_max_size(size_t max_size) {
+    m_max_size = max_size;
+    evict(max_size);
+}
+
+
+// ---------- 解码 ----------
+
+bool HpackDecoder::decode(const uint8_t *data, size_t len, HpackHeaders &headers) {
+    const uint8_t *p = data, *end = data + len;
+    size_t list_size = 0;
+    bool header_seen = false;
+    while (p < end) {
+        uint8_t b = *p;
+        uint64_t index;
+        std::string name, value;
+        bool add = false;
+
+        if (b & 0x80) {
+            // 1xxxxxxx：索引
+            const HpackHeader *h;
+            if (!hpack::decode_int(p, end, 7, index) || !(h = m_table.get(index))) {
+                return false;
+            }
+            name = h->first;
+            value = h->second;
+        }
+        else if ((b & 0xe0) == 0x20) {
+            // 001xxxxx：动态表大小更新，只能出现在头部块的开头，不能超过我们允许的大小
+            if (header_seen || !hpack::decode_int(p, end, 5, index) || index > MAX_TABLE_SIZE) {
+                return false;
+            }
+            m_table.set_max_size(index);
+            continue;
+        }
+        else {
+            // 01xxxxxx：加入动态表；0000xxxx：不加入；0001xxxx：永不加入
+            add = (b & 0xc0) == 0x40;
+            int prefix = add ? 6 : 4;
+            if (!hpack::decode_int(p, end, prefix, index)) {
+                return false;
+            }
+            if (index) {
+                const HpackHeader *h = m_table.get(index);
+                if (!h) {
+                    return false;
+                }
+                name = h->first;
+            }
+            else if (!hpack::decode_string(p, end, name)) {
+                return false;
+            }
+            if (!hpack::decode_string(p, end, value)) {
+                return false;
+            }
+        }
+
+        header_seen = true;
+        list_size += name.size() + value.size() + HpackTable::ENTRY_OVERHEAD;
+        if (list_size > MAX_HEADER_LIST_SIZE) {
+            return false;
+        }
+        if (add) {
+            m_table.insert(name, value);
+        }
+        headers.push_back(HpackHeader(name, value));
+    }
+    return true;
+}
+
+
+// ---------- 编码 ----------
+
+void HpackEncoder::set_max_table_size(size_t size) {
+    // 对端允许的更大的表也只用 4096 字节，够放常用的响应头
+    if (size > 4096) {
+        size = 4096;
+    }
+    if (size != m_table.max_size()) {
+        m_table.set_max_size(size);
+        m_pending_size = true;
+    }
+}
+
+void HpackEncoder::begin(std::string &out) {
+    if (m_pending_size) {
+        hpack::encode_int(m_table.max_size(), 5, 0x20, out);
+        m_pending_size = false;
+    }
+}
+
+void HpackEncoder::encode(const std::string &name, const std::string &value, std::string &out, bool index) {
+    bool exact;
+    size_t found = m_table.find(name, value, exact);
+    if (exact) {
+        hpack::encode_int(found, 7, 0x80, out);
+        return;
+    }
+    if (index) {
+        hpack::encode_int(found, 6, 0x40, out);
+    }
+    else {
+        hpack::encode_int(found, 4, 0x00, out);
+    }
+    if (!found) {
+        hpack::encode_string(name, out);
+    }
+    hpack::encode_string(value, out);
+    if (index) {
+        m_table.insert(name, value);
+    }
+}
@@ -0,0 +1,84 @@
+#ifndef HPACK_H_
+#define HPACK_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+// HPACK 头部压缩（RFC 7541），HTTP/2 的请求头和响应头都用它编码
+
+typedef std::pair<std::string, std::string> HpackHeader;
+typedef std::vector<HpackHeader> HpackHeaders;
+
+// 动态表：新加入的条目下标最小，总大小超过上限时从最旧的条目开始淘汰
+class HpackTable {
+public:
+    static const size_t ENTRY_OVERHEAD = 32;    // 每个条目在大小计算中额外占用的字节
+    static const size_t STATIC_NUM = 61;        // 静态表的条目数，动态表的下标从 62 开始
+
+    explicit HpackTable(size_t max_size) : m_size(0), m_max_size(max_size) {}
+
+    // 按 HPACK 下标（从 1 开始，先静态表后动态表）取条目，下标无效返回 NULL
+    const HpackHeader *get(size_t index) const;
+    // 查找条目，名字和值都相同时返回下标并置 exact，只有名字相同时返回名字的下标，都没有返回 0
+    size_t find(const std::string &name, const std::string &value, bool &exact) const;
+
+    void insert(const std::string &name, const std::string &value);
+    void set_max_size(size_t max_size);
+    size_t max_size() const { return m_max_size; }
+
+private:
+    void evict(size_t limit);
+
+    std::deque<HpackHeader> m_entries;
+    size_t m_size;
+    size_t m_max_size;
+};
+
+class HpackDecoder {
+public:
+    static const size_t MAX_TABLE_SIZE = 4096;          // 我们在 SETTINGS_HEADER_TABLE_SIZE 中允许的动态表大小
+    static const size_t MAX_HEADER_LIST_SIZE = 65536;   // 一个头部块解码后的上限，防止压缩炸弹
+
+    HpackDecoder() : m_table(MAX_TABLE_SIZE) {}
+
+    // 解码一个完整的头部块，追加到 headers，格式错误返回 false（连接错误 COMPRESSION_ERROR）
+    bool decode(const uint8_t *data, size_t len, HpackHeaders &headers);
+
+private:
+    HpackTable m_table;
+};
+
+class HpackEncoder {
+public:
+    HpackEncoder() : m_table(4096), m_pending_size(false) {}
+
+    // 对端通过 SETTINGS_HEADER_TABLE_SIZE 调整动态表的上限，下一个头部块开头会带上大小更新
+    void set_max_table_size(size_t size);
+    // 编码一个头部，index 为 false 时不加入动态表（每次都会变的值，如 content-length）
+    void encode(const std::string &name, const std::string &value, std::string &out, bool index = true);
+    // 开始一个新的头部块
+    void begin(std::string &out);
+
+private:
+    HpackTable m_table;
+    bool m_pending_size;
+};
+
+// 带前缀的整数和字符串编解码，客户端工具也会用到
+namespace hpack {
+
+void encode_int(uint64_t value, int prefix_bits, uint8_t first, std::string &out);
+bool decode_int(const uint8_t *&p, const uint8_t *end, int prefix_bits, uint64_t &value);
+// 字符串较短时使用 Huffman 编码
+void encode_string(const std::string &s, std::string &out);
+bool decode_string(const uint8_t *&p, const uint8_t *end, std::string &out);
+bool huffman_decode(const uint8_t *data, size_t len, std::string &out);
+size_t huffman_length(const std::string &s);
+
+}
+
+#endif // HPACK_H_
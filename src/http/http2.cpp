@@ -0,0 +1,676 @@
+#include "http2.h"
+#include "http_conn.h"
+
+const char Http2Session::PREFACE[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+static const uint32_t MAX_WINDOW = 0x7fffffff;     // 流量控制窗口的上限 2^31-1
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void put_u32(std::string &out, uint32_t v) {
+    char b[4] = {(char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v};
+    out.append(b, 4);
+}
+
+// HTTP2-Settings 头部是 SETTINGS 帧负载的 base64url 编码，不带填充
+static bool base64url_decode(const char *s, std::string &out) {
+    uint32_t acc = 0;
+    int bits = 0;
+    for (; *s && *s != '='; ++s) {
+        char c = *s;
+        int v;
+        if (c >= 'A' && c <= 'Z') v = c - 'A';
+        else if (c >= 'a' && c <= 'z') v = c - 'a' + 26;
+        else if (c >= '0' && c <= '9') v = c - '0' + 52;
+        else if (c == '-' || c == '+') v = 62;
+        else if (c == '_' || c == '/') v = 63;
+        else if (c == ' ' || c == '\t') continue;
+        else return false;
+        acc = acc << 6 | v;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            out.push_back((char)(acc >> bits));
+        }
+    }
+    return true;
+}
+
+Http2Session::Http2Session(int sockfd, in_addr_t client)
+    : m_state(STATE_PREFACE), m_header_stream(0), m_header_end_stream(false), m_last_stream_id(0), m_next_stream(0),
+      m_recv_consumed(0), m_send_window(DEFAULT_WINDOW), m_peer_initial_window(DEFAULT_WINDOW), m_peer_max_frame(MAX_FRAME_SIZE),
+      m_sockfd(sockfd), m_client(client), m_refuse(0), m_limit_slot(-1), m_goaway_sent(false), m_goaway_received(false) {
+    // 服务器的第一个帧必须是 SETTINGS，其余参数使用默认值
+    frame_header(m_ctrl, 6, SETTINGS, 0, 0);
+    m_ctrl.push_back(0);
+    m_ctrl.push_back(SETTINGS_MAX_CONCURRENT_STREAMS);
+    put_u32(m_ctrl, MAX_CONCURRENT_STREAMS);
+    Metrics::add(Metrics::HTTP2_CONNECTIONS);
+}
+
+Http2Session::~Http2Session() {
+    for (std::map<uint32_t, Stream>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+        m_finished.push_back(it->second);
+    }
+    m_streams.clear();
+    release();
+}
+
+bool Http2Session::upgrade(const char *settings, const char *method, const char *url, const RequestTrace &trace) {
+    std::string payload;
+    if (!base64url_decode(settings, payload) || payload.size() % 6 != 0) {
+        return false;
+    }
+    // 升级请求中的设置相当于对端的第一个 SETTINGS 帧，101 响应就是确认，不需要再发送 ACK
+    for (size_t i = 0; i < payload.size(); i += 6) {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(payload.data()) + i;
+        if (!apply_setting((uint16_t)(p[0] << 8 | p[1]), get_u32(p + 2))) {
+            return false;
+        }
+    }
+
+    Stream &stream = open_stream(1);
+    stream.end_stream = true;
+    stream.method = method;
+    stream.path = url;
+    stream.trace = trace;
+    m_last_stream_id = 1;
+    resolve(stream);
+    return true;
+}
+
+
+// ---------- 读取 ----------
+
+void Http2Session::feed(const char *data, size_t len, int refuse) {
+    m_in.append(data, len);
+    m_refuse = refuse;
+
+    size_t pos = 0;
+    while (!m_goaway_sent) {
+        size_t left = m_in.size() - pos;
+        if (m_state == STATE_PREFACE) {
+            size_t n = left < PREFACE_LEN ? left : PREFACE_LEN;
+            if (memcmp(m_in.data() + pos, PREFACE, n) != 0) {
+                goaway(PROTOCOL_ERROR);
+                break;
+            }
+            if (n < PREFACE_LEN) {
+                break;
+            }
+            pos += PREFACE_LEN;
+            m_state = STATE_SETTINGS;
+            continue;
+        }
+
+        // 帧头：长度 24 位，类型，标志，流标识符 31 位
+        if (left < 9) {
+            break;
+        }
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(m_in.data()) + pos;
+        uint32_t frame_len = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+        uint8_t type = p[3], flags = p[4];
+        uint32_t stream_id = get_u32(p + 5) & MAX_WINDOW;
+        if (frame_len > MAX_FRAME_SIZE) {
+            goaway(FRAME_SIZE_ERROR);
+            break;
+        }
+        if (left < 9 + frame_len) {
+            break;
+        }
+        // 连接序言之后的第一个帧必须是 SETTINGS
+        if (m_state == STATE_SETTINGS && (type != SETTINGS || (flags & FLAG_ACK))) {
+            goaway(PROTOCOL_ERROR);
+            break;
+        }
+        pos += 9 + frame_len;
+        if (!on_frame(type, flags, stream_id, p + 9, frame_len)) {
+            break;
+        }
+    }
+
+    if (m_goaway_sent) {
+        m_in.clear();
+    }
+    else {
+        m_in.erase(0, pos);
+    }
+    m_refuse = 0;
+}
+
+bool Http2Session::on_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len) {
+    // 头部块必须连续，中间不能夹着其他帧
+    if (m_header_stream && (type != CONTINUATION || stream_id != m_header_stream)) {
+        return goaway(PROTOCOL_ERROR);
+    }
+
+    switch (type) {
+        case DATA:
+            return on_data(stream_id, flags, payload, len);
+        case HEADERS:
+        {
+            if (stream_id == 0) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            uint32_t off = 0, pad = 0;
+            if (flags & FLAG_PADDED) {
+                if (len < 1) {
+                    return goaway(FRAME_SIZE_ERROR);
+                }
+                pad = payload[0];
+                off = 1;
+            }
+            // 不支持优先级，跳过依赖和权重
+            if (flags & FLAG_PRIORITY) {
+                off += 5;
+            }
+            if (off + pad > len) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            m_header_block.assign(reinterpret_cast<const char *>(payload + off), len - off - pad);
+            m_header_stream = stream_id;
+            m_header_end_stream = flags & FLAG_END_STREAM;
+            return (flags & FLAG_END_HEADERS) ? on_headers() : true;
+        }
+        case CONTINUATION:
+        {
+            if (m_header_stream == 0) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            if (m_header_block.size() + len > HpackDecoder::MAX_HEADER_LIST_SIZE) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            m_header_block.append(reinterpret_cast<const char *>(payload), len);
+            return (flags & FLAG_END_HEADERS) ? on_headers() : true;
+        }
+        case PRIORITY:
+        {
+            if (stream_id == 0) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            if (len != 5) {
+                rst_stream(stream_id, FRAME_SIZE_ERROR);
+            }
+            return true;
+        }
+        case RST_STREAM:
+        {
+            if (stream_id == 0 || stream_id > m_last_stream_id) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            if (len != 4) {
+                return goaway(FRAME_SIZE_ERROR);
+            }
+            close_stream(stream_id);
+            return true;
+        }
+        case SETTINGS:
+            return on_settings(flags, stream_id, payload, len);
+        case PUSH_PROMISE:
+            // 客户端不能推送
+            return goaway(PROTOCOL_ERROR);
+        case PING:
+        {
+            if (stream_id != 0) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            if (len != 8) {
+                return goaway(FRAME_SIZE_ERROR);
+            }
+            if (!(flags & FLAG_ACK)) {
+                frame_header(m_ctrl, 8, PING, FLAG_ACK, 0);
+                m_ctrl.append(reinterpret_cast<const char *>(payload), 8);
+            }
+            return true;
+        }
+        case GOAWAY:
+        {
+            if (stream_id != 0) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            // 已经打开的流继续处理完，不再接受新的流
+            m_goaway_received = true;
+            return true;
+        }
+        case WINDOW_UPDATE:
+            return on_window_update(stream_id, payload, len);
+        default:
+            // 未知类型的帧直接忽略
+            return true;
+    }
+}
+
+bool Http2Session::on_headers() {
+    uint32_t stream_id = m_header_stream;
+    bool end_stream = m_header_end_stream;
+    m_header_stream = 0;
+
+    // 即使这个流会被拒绝也要解码，保持动态表与对端一致
+    HpackHeaders headers;
+    if (!m_decoder.decode(reinterpret_cast<const uint8_t *>(m_header_block.data()), m_header_block.size(), headers)) {
+        return goaway(COMPRESSION_ERROR);
+    }
+    m_header_block.clear();
+
+    std::map<uint32_t, Stream>::iterator it = m_streams.find(stream_id);
+    if (it != m_streams.end()) {
+        // 已打开的流上的 HEADERS 是请求体之后的 trailer，必须结束请求
+        if (it->second.end_stream) {
+            rst_stream(stream_id, STREAM_CLOSED);
+            close_stream(stream_id);
+            return true;
+        }
+        if (!end_stream) {
+            return goaway(PROTOCOL_ERROR);
+        }
+        it->second.end_stream = true;
+        resolve(it->second);
+        return true;
+    }
+
+    // 客户端打开的流为奇数，且必须递增
+    if (stream_id % 2 == 0) {
+        return goaway(PROTOCOL_ERROR);
+    }
+    if (stream_id <= m_last_stream_id) {
+        return goaway(STREAM_CLOSED);
+    }
+    m_last_stream_id = stream_id;
+    if (m_goaway_received || m_streams.size() >= MAX_CONCURRENT_STREAMS) {
+        rst_stream(stream_id, REFUSED_STREAM);
+        return true;
+    }
+
+    std::string method, path;
+    for (size_t i = 0; i < headers.size(); ++i) {
+        if (headers[i].first == ":method") {
+            method = headers[i].second;
+        }
+        else if (headers[i].first == ":path") {
+            path = headers[i].second;
+        }
+    }
+    if (method.empty() || path.empty()) {
+        rst_stream(stream_id, PROTOCOL_ERROR);
+        return true;
+    }
+
+    Stream &stream = open_stream(stream_id);
+    stream.end_stream = end_stream;
+    stream.method.swap(method);
+    stream.path.swap(path);
+    stream.trace.mark(RequestTrace::FIRST_BYTE);
+    stream.trace.mark(RequestTrace::PARSE_DONE);
+    if (end_stream) {
+        resolve(stream);
+    }
+    return true;
+}
+
+bool Http2Session::on_data(uint32_t stream_id, uint8_t flags, const uint8_t *payload, uint32_t len) {
+    if (stream_id == 0) {
+        return goaway(PROTOCOL_ERROR);
+    }
+    if ((flags & FLAG_PADDED) && (len < 1 || payload[0] >= len)) {
+        return goaway(PROTOCOL_ERROR);
+    }
+
+    // 请求体不使用，收到就归还连接级窗口，攒够半个窗口再发送 WINDOW_UPDATE
+    m_recv_consumed += len;
+    if (m_recv_consumed >= (uint32_t)DEFAULT_WINDOW / 2) {
+        window_update(0, m_recv_consumed);
+        m_recv_consumed = 0;
+    }
+
+    std::map<uint32_t, Stream>::iterator it = m_streams.find(stream_id);
+    if (it == m_streams.end() || it->second.end_stream) {
+        if (stream_id > m_last_stream_id) {
+            return goaway(PROTOCOL_ERROR);
+        }
+        rst_stream(stream_id, STREAM_CLOSED);
+        return true;
+    }
+
+    Stream &stream = it->second;
+    if (flags & FLAG_END_STREAM) {
+        stream.end_stream = true;
+        resolve(stream);
+    }
+    else if (len > 0) {
+        window_update(stream_id, len);
+    }
+    return true;
+}
+
+bool Http2Session::on_settings(uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len) {
+    if (stream_id != 0) {
+        return goaway(PROTOCOL_ERROR);
+    }
+    if (flags & FLAG_ACK) {
+        return len == 0 ? true : goaway(FRAME_SIZE_ERROR);
+    }
+    if (len % 6 != 0) {
+        return goaway(FRAME_SIZE_ERROR);
+    }
+    for (uint32_t i = 0; i < len; i += 6) {
+        if (!apply_setting((uint16_t)(payload[i] << 8 | payload[i + 1]), get_u32(payload + i + 2))) {
+            return false;
+        }
+    }
+    frame_header(m_ctrl, 0, SETTINGS, FLAG_ACK, 0);
+    if (m_state == STATE_SETTINGS) {
+        m_state = STATE_OPEN;
+    }
+    return true;
+}
+
+bool Http2Session::apply_setting(uint16_t id, uint32_t value) {
+    switch (id) {
+        case SETTINGS_HEADER_TABLE_SIZE:
+            m_encoder.set_max_table_size(value);
+            break;
+        case SETTINGS_ENABLE_PUSH:
+            if (value > 1) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            break;
+        case SETTINGS_INITIAL_WINDOW_SIZE:
+        {
+            if (value > MAX_WINDOW) {
+                return goaway(FLOW_CONTROL_ERROR);
+            }
+            // 新的初始值对所有已打开的流生效，窗口按差值调整
+            int64_t delta = (int64_t)value - m_peer_initial_window;
+            for (std::map<uint32_t, Stream>::iterator it = m_streams.begin(); it != m_streams.end(); ++it) {
+                it->second.send_window += delta;
+                if (it->second.send_window > MAX_WINDOW) {
+                    return goaway(FLOW_CONTROL_ERROR);
+                }
+            }
+            m_peer_initial_window = value;
+            break;
+        }
+        case SETTINGS_MAX_FRAME_SIZE:
+            if (value < MAX_FRAME_SIZE || value > 0xffffff) {
+                return goaway(PROTOCOL_ERROR);
+            }
+            m_peer_max_frame = value;
+            break;
+        default:
+            // 其余设置只影响对端，未知的设置忽略
+            break;
+    }
+    return true;
+}
+
+bool Http2Session::on_window_update(uint32_t stream_id, const uint8_t *payload, uint32_t len) {
+    if (len != 4) {
+        return goaway(FRAME_SIZE_ERROR);
+    }
+    uint32_t increment = get_u32(payload) & MAX_WINDOW;
+    if (stream_id == 0) {
+        if (increment == 0) {
+            return goaway(PROTOCOL_ERROR);
+        }
+        m_send_window += increment;
+        return m_send_window > MAX_WINDOW ? goaway(FLOW_CONTROL_ERROR) : true;
+    }
+
+    std::map<uint32_t, Stream>::iterator it = m_streams.find(stream_id);
+    if (it == m_streams.end()) {
+        // 已经关闭的流上的 WINDOW_UPDATE 忽略，从未打开的流是协议错误
+        return stream_id > m_last_stream_id ? goaway(PROTOCOL_ERROR) : true;
+    }
+    it->second.send_window += increment;
+    if (increment == 0 || it->second.send_window > MAX_WINDOW) {
+        rst_stream(stream_id, increment == 0 ? PROTOCOL_ERROR : FLOW_CONTROL_ERROR);
+        close_stream(stream_id);
+    }
+    return true;
+}
+
+
+// ---------- 请求处理 ----------
+
+Http2Session::Stream &Http2Session::open_stream(uint32_t stream_id) {
+    Stream &stream = m_streams[stream_id];
+    stream.id = stream_id;
+    stream.send_window = m_peer_initial_window;
+    stream.end_stream = false;
+    stream.resolved = false;
+    stream.headers_sent = false;
+    stream.status = 0;
+    stream.content_type = NULL;
+    stream.retry_after = false;
+    stream.body = NULL;
+    stream.body_len = 0;
+    stream.sent = 0;
+    stream.file_address = NULL;
+    stream.file_size = 0;
+    stream.trace.reset();
+    stream.trace.sockfd = m_sockfd;
+    stream.trace.client = m_client;
+    Metrics::add(Metrics::HTTP2_STREAMS);
+    return stream;
+}
+
+// 和 HTTP/1.1 共用 HttpConn 的静态文件映射，只支持 GET、HEAD，其余方法按请求错误处理
+void Http2Session::resolve(Stream &stream) {
+    if (stream.resolved) {
+        return;
+    }
+    stream.resolved = true;
+    stream.trace.set_url(stream.path.c_str());
+
+    HttpConn::HTTP_CODE code;
+    bool head = stream.method == "HEAD";
+    if (m_refuse) {
+        code = (HttpConn::HTTP_CODE)m_refuse;
+    }
+    else if (!ClientLimiter::allow(m_limit_slot)) {
+        code = HttpConn::TOO_MANY_REQUESTS;
+    }
+    else if (!head && stream.method != "GET") {
+        code = HttpConn::BAD_REQUEST;
+    }
+    else if (stream.path == HttpConn::METRICS_URL) {
+        std::shared_ptr<std::string> body(new std::string);
+        Metrics::render(*body);
+        stream.blob = body;
+        code = HttpConn::CONTENT_REQUEST;
+    }
+    else {
+        char *path = stream.path[0] == '/' ? HttpConn::decode_path(m_arena, stream.path.c_str()) : NULL;
+        if (!path) {
+            code = HttpConn::BAD_REQUEST;
+        }
+        else {
+            struct stat st;
+            code = HttpConn::map_file(m_arena, *SiteConfig::current(), path, st, stream.file_address);
+            stream.file_size = st.st_size;
+        }
+        m_arena.reset();
+    }
+
+    switch (code) {
+        case HttpConn::FILE_REQUEST:
+            stream.status = 200;
+            stream.body = stream.file_address;
+            stream.body_len = stream.file_size;
+            break;
+        case HttpConn::CONTENT_REQUEST:
+            stream.status = 200;
+            stream.content_type = "text/plain; version=0.0.4";
+            stream.body = stream.blob->data();
+            stream.body_len = stream.blob->size();
+            break;
+        default:
+            stream.status = HttpConn::error_page(code, stream.body);
+            stream.body_len = strlen(stream.body);
+            stream.retry_after = code == HttpConn::SERVICE_UNAVAILABLE || code == HttpConn::TOO_MANY_REQUESTS;
+            break;
+    }
+    stream.head = head;
+    Metrics::count_status(stream.status);
+    stream.trace.status = stream.status;
+    stream.trace.mark(RequestTrace::RESPONSE_READY);
+}
+
+void Http2Session::close_stream(uint32_t stream_id) {
+    std::map<uint32_t, Stream>::iterator it = m_streams.find(stream_id);
+    if (it != m_streams.end()) {
+        // 已经放入发送缓冲区的帧可能还引用着文件映射，等发送完再释放
+        m_finished.push_back(it->second);
+        m_streams.erase(it);
+    }
+}
+
+void Http2Session::release() {
+    for (size_t i = 0; i < m_finished.size(); ++i) {
+        Stream &stream = m_finished[i];
+        if (stream.file_address) {
+            munmap(stream.file_address, stream.file_size);
+        }
+        if (stream.resolved) {
+            RequestTrace &trace = stream.trace;
+            trace.mark(RequestTrace::LAST_BYTE);
+            Metrics::observe_latency((trace.ts[RequestTrace::LAST_BYTE] - trace.ts[RequestTrace::FIRST_BYTE]) / 1000);
+            Tracer::finish(trace);
+            Log::access(trace, stream.method.c_str(), stream.sent);
+        }
+    }
+    m_finished.clear();
+}
+
+
+// ---------- 发送 ----------
+
+void Http2Session::frame_header(std::string &out, uint32_t len, uint8_t type, uint8_t flags, uint32_t stream_id) {
+    char b[9] = {(char)(len >> 16), (char)(len >> 8), (char)len, (char)type, (char)flags,
+                 (char)(stream_id >> 24), (char)(stream_id >> 16), (char)(stream_id >> 8), (char)stream_id};
+    out.append(b, 9);
+}
+
+void Http2Session::rst_stream(uint32_t stream_id, ERROR_CODE code) {
+    frame_header(m_ctrl, 4, RST_STREAM, 0, stream_id);
+    put_u32(m_ctrl, code);
+}
+
+void Http2Session::window_update(uint32_t stream_id, uint32_t increment) {
+    frame_header(m_ctrl, 4, WINDOW_UPDATE, 0, stream_id);
+    put_u32(m_ctrl, increment);
+}
+
+bool Http2Session::goaway(ERROR_CODE code) {
+    if (!m_goaway_sent) {
+        frame_header(m_ctrl, 8, GOAWAY, 0, 0);
+        put_u32(m_ctrl, m_last_stream_id);
+        put_u32(m_ctrl, code);
+        m_goaway_sent = true;
+        LOG_WARN("http2 connection error %d, last stream %u", code, m_last_stream_id);
+    }
+    return false;
+}
+
+// 响应头编码成一个头部块，超过对端的最大帧时拆成 HEADERS 加 CONTINUATION
+void Http2Session::encode_headers(Stream &stream, BufferChain &out) {
+    std::string block;
+    m_encoder.begin(block);
+    m_encoder.encode(":status", std::to_string(stream.status), block);
+    if (stream.content_type) {
+        m_encoder.encode("content-type", stream.content_type, block);
+    }
+    if (stream.retry_after) {
+        m_encoder.encode("retry-after", std::to_string(HttpConn::RETRY_AFTER), block);
+    }
+    m_encoder.encode("content-length", std::to_string(stream.body_len), block, false);
+
+    bool end_stream = stream.head || stream.body_len == 0;
+    std::string frames;
+    size_t off = 0;
+    do {
+        size_t n = block.size() - off < m_peer_max_frame ? block.size() - off : m_peer_max_frame;
+        uint8_t flags = off + n == block.size() ? FLAG_END_HEADERS : 0;
+        if (off == 0) {
+            frame_header(frames, n, HEADERS, flags | (end_stream ? FLAG_END_STREAM : 0), stream.id);
+        }
+        else {
+            frame_header(frames, n, CONTINUATION, flags, stream.id);
+        }
+        frames.append(block, off, n);
+        off += n;
+    } while (off < block.size());
+    out.append(frames.data(), frames.size());
+    stream.headers_sent = true;
+}
+
+void Http2Session::produce(BufferChain &out) {
+    if (out.empty()) {
+        release();
+    }
+    if (!m_ctrl.empty()) {
+        out.append(m_ctrl.data(), m_ctrl.size());
+        m_ctrl.clear();
+    }
+    // 连接错误之后不再发送响应
+    if (m_goaway_sent) {
+        return;
+    }
+
+    // 每一轮每个流最多发送一个帧，从上次停下的流开始，各个流的响应交错发送
+    size_t budget = SEND_BATCH;
+    std::vector<uint32_t> ids;
+    bool progress = true;
+    while (progress && budget > 0) {
+        progress = false;
+        ids.clear();
+        for (std::map<uint32_t, Stream>::iterator it = m_streams.lower_bound(m_next_stream); it != m_streams.end(); ++it) {
+            ids.push_back(it->first);
+        }
+        for (std::map<uint32_t, Stream>::iterator it = m_streams.begin(); it != m_streams.end() && it->first < m_next_stream; ++it) {
+            ids.push_back(it->first);
+        }
+
+        for (size_t i = 0; i < ids.size() && budget > 0; ++i) {
+            std::map<uint32_t, Stream>::iterator it = m_streams.find(ids[i]);
+            if (it == m_streams.end() || !it->second.resolved) {
+                continue;
+            }
+            Stream &stream = it->second;
+            if (!stream.headers_sent) {
+                encode_headers(stream, out);
+                progress = true;
+                if (stream.head || stream.body_len == 0) {
+                    close_stream(stream.id);
+                }
+                continue;
+            }
+
+            int64_t n = stream.body_len - stream.sent;
+            n = n < m_peer_max_frame ? n : m_peer_max_frame;
+            n = n < stream.send_window ? n : stream.send_window;
+            n = n < m_send_window ? n : m_send_window;
+            n = n < (int64_t)budget ? n : budget;
+            if (n <= 0) {
+                continue;
+            }
+            bool last = stream.sent + n == stream.body_len;
+            std::string header;
+            frame_header(header, n, DATA, last ? FLAG_END_STREAM : 0, stream.id);
+            // 帧头复制到内存块中，数据只引用文件映射
+            out.append(header.data(), header.size());
+            out.append_ref(stream.body + stream.sent, n);
+            stream.sent += n;
+            stream.send_window -= n;
+            m_send_window -= n;
+            budget -= n;
+            progress = true;
+            m_next_stream = stream.id + 1;
+            if (last) {
+                close_stream(stream.id);
+            }
+        }
+    }
+}
@@ -0,0 +1,171 @@
+#ifndef HTTP2_H_
+#define HTTP2_H_
+
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+#include "hpack.h"
+#include "../core/arena/arena.h"
+#include "../core/buffer/buffer_chain.h"
+#include "../core/trace/tracer.h"
+
+// 一个 HTTP/2 连接（h2c，明文）上的所有流
+// 由 HttpConn 持有，读到的字节交给 feed 解析帧、处理请求，produce 把待发送的帧放入连接的 BufferChain
+// 和 HTTP/1.1 一样，同一时刻只有一个线程访问（EPOLLONESHOT）：工作线程 feed，主线程和工作线程都会 produce
+class Http2Session {
+public:
+    static const char PREFACE[];                        // 客户端连接序言
+    static const size_t PREFACE_LEN = 24;
+    static const uint32_t MAX_FRAME_SIZE = 16384;       // 我们接受的最大帧，也是默认值
+    static const uint32_t MAX_CONCURRENT_STREAMS = 100; // 一个连接上同时打开的流
+    static const int32_t DEFAULT_WINDOW = 65535;        // 流量控制窗口的初始大小
+    static const size_t SEND_BATCH = 256 * 1024;        // 一次 produce 最多放入的响应体字节，其余等发送完再生成
+
+    enum FRAME_TYPE
+    {
+        DATA = 0,
+        HEADERS,
+        PRIORITY,
+        RST_STREAM,
+        SETTINGS,
+        PUSH_PROMISE,
+        PING,
+        GOAWAY,
+        WINDOW_UPDATE,
+        CONTINUATION
+    };
+
+    enum FLAG
+    {
+        FLAG_ACK = 0x1,
+        FLAG_END_STREAM = 0x1,
+        FLAG_END_HEADERS = 0x4,
+        FLAG_PADDED = 0x8,
+        FLAG_PRIORITY = 0x20
+    };
+
+    enum SETTING
+    {
+        SETTINGS_HEADER_TABLE_SIZE = 1,
+        SETTINGS_ENABLE_PUSH,
+        SETTINGS_MAX_CONCURRENT_STREAMS,
+        SETTINGS_INITIAL_WINDOW_SIZE,
+        SETTINGS_MAX_FRAME_SIZE,
+        SETTINGS_MAX_HEADER_LIST_SIZE
+    };
+
+    enum ERROR_CODE
+    {
+        NO_ERROR = 0,
+        PROTOCOL_ERROR,
+        INTERNAL_ERROR,
+        FLOW_CONTROL_ERROR,
+        SETTINGS_TIMEOUT,
+        STREAM_CLOSED,
+        FRAME_SIZE_ERROR,
+        REFUSED_STREAM,
+        CANCEL,
+        COMPRESSION_ERROR
+    };
+
+    Http2Session(int sockfd, in_addr_t client);
+    ~Http2Session();
+
+    // 客户端带着 "Upgrade: h2c" 发来的 HTTP/1.1 请求成为流 1，settings 为 HTTP2-Settings 头部的值
+    // 101 响应由调用者发送，之后等待客户端的连接序言
+    bool upgrade(const char *settings, const char *method, const char *url, const RequestTrace &trace);
+
+    // 处理读到的字节，不完整的帧留到下一次
+    // refuse 为 HttpConn::HTTP_CODE：SERVICE_UNAVAILABLE（线程池已满）或 TOO_MANY_REQUESTS（客户端超过速率）时
+    // 新的请求不访问磁盘直接返回 503 或 429，为 0（NO_REQUEST）时正常处理
+    void feed(const char *data, size_t len, int refuse = 0);
+    // 之后新的流按客户端的限流表项检查请求速率，超过时返回 429（ClientLimiter::allow 不加锁，可以在工作线程调用）
+    void set_limit(int slot) { m_limit_slot = slot; }
+
+    // 把待发送的帧放入 out，受流量控制窗口限制，各个流的 DATA 帧轮流发送
+    // out 为空时先释放上一批已发送完的流
+    void produce(BufferChain &out);
+
+    // 已发送 GOAWAY 或者对方已发送 GOAWAY 且所有流都结束，发送完后关闭连接
+    bool closing() const { return m_goaway_sent || (m_goaway_received && m_streams.empty()); }
+
+private:
+    // 一个请求及其响应
+    struct Stream {
+        uint32_t id;
+        int64_t send_window;            // 对端为这个流开放的发送窗口，SETTINGS 调整初始值后可能为负
+        bool end_stream;                // 对端是否已经发送完请求
+        bool resolved;                  // 响应是否已经生成
+        bool headers_sent;
+        bool head;                      // HEAD 请求只发送响应头
+        int status;
+        const char *content_type;
+        bool retry_after;
+        const char *body;               // 响应体，指向文件映射、静态页面或 blob
+        size_t body_len;
+        size_t sent;
+        char *file_address;             // 文件映射，流结束并且发送完后解除
+        size_t file_size;
+        std::shared_ptr<const std::string> blob;    // 动态生成的响应体
+        std::string method;
+        std::string path;
+        RequestTrace trace;
+    };
+
+    bool on_frame(uint8_t type, uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len);
+    bool on_headers();                      // 头部块接收完整
+    bool on_data(uint32_t stream_id, uint8_t flags, const uint8_t *payload, uint32_t len);
+    bool on_settings(uint8_t flags, uint32_t stream_id, const uint8_t *payload, uint32_t len);
+    bool on_window_update(uint32_t stream_id, const uint8_t *payload, uint32_t len);
+    bool apply_setting(uint16_t id, uint32_t value);
+
+    Stream &open_stream(uint32_t stream_id);
+    void resolve(Stream &stream);           // 请求接收完整后映射文件或者生成错误页面
+    void close_stream(uint32_t stream_id);  // 流结束或被重置，等发送缓冲区中引用它的帧发送完再释放
+    void release();                         // 释放已发送完的流：解除映射、记录日志
+
+    void frame_header(std::string &out, uint32_t len, uint8_t type, uint8_t flags, uint32_t stream_id);
+    void rst_stream(uint32_t stream_id, ERROR_CODE code);
+    void window_update(uint32_t stream_id, uint32_t increment);
+    bool goaway(ERROR_CODE code);           // 连接错误，返回 false 方便调用者直接返回
+    void encode_headers(Stream &stream, BufferChain &out);
+
+    enum STATE
+    {
+        STATE_PREFACE = 0,                  // 等待连接序言
+        STATE_SETTINGS,                     // 等待客户端的第一个 SETTINGS 帧
+        STATE_OPEN
+    };
+
+    STATE m_state;
+    std::string m_in;                       // 未处理的输入
+    std::string m_ctrl;                     // 待发送的控制帧
+    std::string m_header_block;             // 正在接收的头部块，HEADERS 加上若干 CONTINUATION
+    uint32_t m_header_stream;               // 正在接收头部块的流，0 表示没有
+    bool m_header_end_stream;
+
+    HpackDecoder m_decoder;
+    HpackEncoder m_encoder;
+    Arena m_arena;                          // 解析路径、拼接文件名用，处理完一个请求就归还
+
+    std::map<uint32_t, Stream> m_streams;   // 打开的流，按流标识符排序
+    std::vector<Stream> m_finished;         // 响应已经全部放入发送缓冲区、还在等待发送的流
+    uint32_t m_last_stream_id;              // 对端打开过的最大的流
+    uint32_t m_next_stream;                 // 轮流发送时下一个从这个流开始
+    uint32_t m_recv_consumed;               // 收到还没有归还连接级窗口的字节
+
+    int64_t m_send_window;                  // 连接级的发送窗口
+    int32_t m_peer_initial_window;          // 对端 SETTINGS_INITIAL_WINDOW_SIZE
+    uint32_t m_peer_max_frame;              // 对端 SETTINGS_MAX_FRAME_SIZE
+    int m_sockfd;                           // 记录访问日志用
+    in_addr_t m_client;
+    int m_refuse;                           // 本次 feed 中新的请求直接返回的错误，0 为正常处理
+    int m_limit_slot;                       // 连接的限流表项，-1 为不限制
+    bool m_goaway_sent;
+    bool m_goaway_received;
+};
+
+#endif // HTTP2_H_
@@ -1,4 +1,6 @@
 
+#include <sys/syscall.h>
+#include <linux/openat2.h>
 #include "http_conn.h"
 
 //定义http响应的一些状态信息
@@ -11,12 +13,26 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
-
-// 当浏览器出现连接重置时，可能是网站根目录出错或 http 响应格式出错或者访问的文件中内容完全为空
-const char *doc_root = "/home/xsakura/project/molecule-01/root";
+const char *error_502_title = "Bad Gateway";
+const char *error_502_form = "The upstream server did not return a valid response.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is overloaded, please try again later.\n";
+const char *error_429_title = "Too Many Requests";
+const char *error_429_form = "You have sent too many requests, please slow down.\n";
+
+// 登录、注册根据结果返回的页面
+static const char *login_ok_page = "/welcome.html";
+static const char *login_error_page = "/loginError.html";
+static const char *register_ok_page = "/login.html";
+static const char *register_error_page = "/registerError.html";
+
+// 与 HttpConn::METHOD 一一对应，用于访问日志
+static const char *method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE", "OPTIONS", "CONNECT", "PATH"};
 
 int HttpConn::m_epollfd = -1;       // 所有的 socket 上的事件都被注册同一个 epoll 对象
-int HttpConn::m_user_count = 0;     // 统计用户的数量
+std::atomic<int> HttpConn::m_user_count(0);     // 统计用户的数量
+const char *HttpConn::METRICS_URL = "/metrics"; // 保留的运行时统计地址
+const char *HttpConn::TRACE_URL = "/debug/requests";    // 管理端口上导出最近请求的地址
 
 
 // ---------- 一系列操作文件描述符的操作 ----------
@@ -69,25 +85,47 @@ void HttpConn::init() {
 
     m_method = GET;
     m_url = 0;
+    m_path = 0;
     m_version = 0;
+    m_arena.reset();
 
     m_content_length = 0;
     m_linger = false;
     m_host = 0;
+    m_http2_settings = 0;
+    m_upgrade_h2c = false;
+    m_upgrade_ws = false;
+    m_ws_key = 0;
+    m_string = 0;
+    m_header_start = 0;
 
-    m_write_idx = 0;
     bytes_have_send = 0;
-    bytes_to_send = 0;
-
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
-    memset(m_real_file, '\0', FILENAME_LEN);
+    m_out.reset();
+
+    m_body.clear();
+    m_content_type = NULL;
+    delete m_stream;
+    m_stream = NULL;
+    m_site.reset();
+    m_trace.reset();
+    m_inline = false;
+    m_parsed = false;
+
+    // 只重置下标，不清空缓冲区：解析只访问 m_read_idx 之前的数据，行和请求体在解析时以 '\0' 结尾，
+    // 响应放在 m_out 中，内存随 m_arena 归还。读缓冲区多留一个字节，请求体正好填满缓冲区时也能写入结尾的 '\0'
+    if (!m_read_buf) {
+        set_buffer(new char[BUFFER_SIZE]);
+        m_buf_owned = true;
+    }
 }
 
 // 初始化连接，外部调用初始化套接字地址
 void HttpConn::init(int sockfd, const sockaddr_in &address) {
     m_sockfd = sockfd;
     m_address = address;
+    m_admin = false;
+    m_tls_wait = false;
+    m_tls_wake = false;
 
     // 端口复用
     int reuse = 1;
@@ -98,22 +136,90 @@ void HttpConn::init(int sockfd, const sockaddr_in &address) {
 
     // 用户总数加一
     m_user_count++;
+    Metrics::add(Metrics::CONNECTIONS_ACTIVE);
+
+    // 超时关闭的连接不经过 close_conn，上一个连接的 HTTP/2 会话在 fd 复用时释放
+    delete m_h2;
+    m_h2 = NULL;
+    release_sessions();
 
     // 初始化基本信息
     init();
+    m_trace.sockfd = sockfd;
+    m_trace.client = address.sin_addr.s_addr;
+    m_trace.mark(RequestTrace::ACCEPT);
 }
 
 // 关闭连接
 void HttpConn::close_conn() {
     if (m_sockfd != -1) {
         char client_info[16] = {0};
-        printf("%s 关闭连接", inet_ntop(AF_INET, &m_address.sin_addr.s_addr, client_info, 16));
+        LOG_INFO("%s 关闭连接", inet_ntop(AF_INET, &m_address.sin_addr.s_addr, client_info, 16));
+        // TLS 的 close_notify 要在关闭 socket 之前发送
+        release_sessions();
         removefd(m_epollfd, m_sockfd);
         m_sockfd = -1;
         m_user_count--; // 用户数量减一
+        Metrics::add(Metrics::CONNECTIONS_ACTIVE, -1);
+        delete m_h2;
+        m_h2 = NULL;
     }
 }
 
+void HttpConn::release_sessions() {
+    ClientLimiter::release(m_limit_slot);
+    m_limit_slot = -1;
+    ws_close();
+    delete m_proxy;
+    m_proxy = NULL;
+    if (m_tls) {
+        m_tls->shutdown();
+        delete m_tls;
+        m_tls = NULL;
+    }
+}
+
+bool HttpConn::tls_handshake() {
+    switch (m_tls->handshake()) {
+        case TlsConn::DONE:
+            return true;
+        case TlsConn::WANT_READ:
+            m_tls_wait = true;
+            rearm(EPOLLIN);
+            return true;
+        case TlsConn::WANT_WRITE:
+            m_tls_wait = true;
+            rearm(EPOLLOUT);
+            return true;
+        default:
+            return false;
+    }
+}
+
+void HttpConn::rearm(int ev) {
+    // OpenSSL 中还有解密好的数据时 socket 上可能不会再有 EPOLLIN，同时等待 EPOLLOUT（立即就绪），
+    // 事件循环看到 tls_wake 后当作可读处理
+    m_tls_wake = (ev & EPOLLIN) && m_tls && m_tls->pending();
+    if (m_tls_wake) {
+        ev |= EPOLLOUT;
+    }
+    modfd(m_epollfd, m_sockfd, ev);
+}
+
+ssize_t HttpConn::send_out() {
+    if (m_tls && !m_tls->ktls_send()) {
+        struct iovec iov[16];
+        int count = m_out.peek(iov, 16);
+        ssize_t n = m_tls->writev(iov, count);
+        if (n > 0) {
+            m_out.consume(n);
+        }
+        return n;
+    }
+    // 明文连接和 kTLS 连接都直接 writev，文件映射的页由内核读取（和加密），不复制到用户空间
+    return m_out.write_to(m_sockfd);
+}
+
 // 循环读取客户数据，直到无数据可读或对方关闭连接
 bool HttpConn::read() {
     // 读取的数据已经超过了设定的读缓冲区大小
@@ -122,14 +228,40 @@ bool HttpConn::read() {
     }
 
     int bytes_read = 0;
-    // 下次读取的总长度要根据数组中已经存在的数据长度读入
-    bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
-    m_read_idx += bytes_read;
-
+    m_tls_wait = false;
+    if (m_tls) {
+        if (!m_tls->established()) {
+            if (!tls_handshake()) {
+                return false;
+            }
+            if (m_tls_wait) {
+                return true;
+            }
+        }
+        // 握手刚完成时请求可能已经和客户端的 Finished 一起到达
+        bytes_read = m_tls->read(m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx);
+        if (bytes_read < 0 && errno == EAGAIN) {
+            // 记录还不完整，等待剩下的部分；有待发送的数据时同时等待可写
+            m_tls_wait = true;
+            rearm(m_out.empty() ? EPOLLIN : EPOLLIN | EPOLLOUT);
+            return true;
+        }
+    }
+    else {
+        // 下次读取的总长度要根据数组中已经存在的数据长度读入
+        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx, 0);
+    }
     if (bytes_read <= 0) {
         return false;
     }
 
+    if (m_trace.ts[RequestTrace::FIRST_BYTE] == 0) {
+        // 当前请求的第一个字节
+        m_trace.mark(RequestTrace::FIRST_BYTE);
+    }
+    m_read_idx += bytes_read;
+    Metrics::add(Metrics::BYTES_IN, bytes_read);
+
     // printf("读取到了数据\n");
     // printf("%s", m_read_buf);
 
@@ -138,51 +270,75 @@ bool HttpConn::read() {
 
 // 写 http 响应
 bool HttpConn::write() {
-    // printf("写入数据功能正在实现...\n");
-    int temp = 0;
-
-    // printf("%d %s\n", m_sockfd, m_url);
+    if (m_tls && !m_tls->established()) {
+        // 握手中 socket 发送缓冲区满过，继续握手
+        m_tls_wait = false;
+        if (!tls_handshake()) {
+            return false;
+        }
+        if (!m_tls_wait) {
+            rearm(EPOLLIN);
+        }
+        return true;
+    }
+    if (m_h2) {
+        return write_h2();
+    }
+    if (is_websocket()) {
+        return write_ws();
+    }
+    if (m_proxy) {
+        return write_proxy(m_proxy->resume());
+    }
 
-    if (bytes_to_send == 0) {
+    if (m_out.empty() && !m_stream) {
         // 要发送的字节为 0，这一次响应结束
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        rearm(EPOLLIN);
         init();
         return true;
     }
 
     while (1) {
-        // 分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
+        // 分散写，一次最多 IOV_MAX 段
+        ssize_t temp = send_out();
         if (temp < 0) {
             // 在非阻塞读取中，在没有数据读取后会有 EAGAIN 错误
             // 如果 TCP 写缓冲没有空间，则等待下一轮 EPOLLOUT 事件，
             if (errno == EAGAIN) {
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                rearm(EPOLLOUT);
                 return true;
             }
             unmap();
             return false;
         }
 
+        Metrics::add(Metrics::BYTES_OUT, temp);
         bytes_have_send += temp;
-        bytes_to_send -= temp;
-        if (bytes_have_send >= m_iv[0].iov_len) {
-            // 如果响应头信息发送完毕
-            m_iv[0].iov_len = 0;
-            m_iv[1].iov_base = m_file_address + (bytes_have_send - m_write_idx);
-            m_iv[1].iov_len = bytes_to_send;
-        }
-        else {
-            // 从已发送的位置往后继续发送
-            m_iv[0].iov_base = m_write_buf + bytes_have_send;
-            m_iv[0].iov_len = m_iv[0].iov_len - bytes_have_send;
-        }
 
-        if (bytes_to_send <= 0) {
+        if (m_out.empty() && m_stream) {
+            // 上一段已经交给内核才生成下一段，发送缓冲区满时停在 EAGAIN，内存中最多只有一段
+            // 响应头已经发出，请求的 Arena 不再需要，每一段的链表节点不会一直累积
+            m_out.reset();
+            m_arena.reset();
+            next_chunk();
+            continue;
+        }
+        if (m_out.empty()) {
             // 数据发送完毕
+            m_trace.mark(RequestTrace::LAST_BYTE);
+            Metrics::observe_latency((m_trace.ts[RequestTrace::LAST_BYTE] - m_trace.ts[RequestTrace::FIRST_BYTE]) / 1000);
+            Tracer::finish(m_trace);
+            Log::access(m_trace, method_names[m_method], bytes_have_send);
             unmap();
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+            rearm(EPOLLIN);
 
+            if (m_ws) {
+                // 101 发送完，之后的数据都是 WebSocket 帧
+                init();
+                m_ws->set_established();
+                WsHub::subscribe(this, m_ws->channel());
+                return true;
+            }
             if (m_linger) {
                 init();
                 return true;
@@ -196,51 +352,678 @@ bool HttpConn::write() {
     return false;
 }
 
+HttpConn::PHASE HttpConn::phase() const {
+    if (m_h2 || m_ws || m_proxy) {
+        return PHASE_OTHER;
+    }
+    if (!m_out.empty() || m_stream) {
+        return PHASE_SEND;
+    }
+    if (m_check_state == CHECK_STATE_CONTENT) {
+        return PHASE_BODY;
+    }
+    // TLS 握手时读缓冲区为空，和等待第一个请求字节算作同一个阶段
+    if (m_read_idx == 0) {
+        return PHASE_WAIT;
+    }
+    // 工作线程还没有解析到的请求头已经完整时，之后等待的是请求体（或者处理结果）
+    return memmem(m_read_buf, m_read_idx, "\r\n\r\n", 4) ? PHASE_BODY : PHASE_HEADER;
+}
+
 // 有线程池中的工作线程调用，这是处理 http 请求的入口函数
 void HttpConn::process() {
+    m_trace.mark(RequestTrace::DEQUEUE);
+
+    // 以 HTTP/2 连接序言开头的连接直接切换到 HTTP/2
+    if (!m_h2 && is_h2_preface()) {
+        m_h2 = new Http2Session(m_sockfd, m_address.sin_addr.s_addr);
+        m_h2->set_limit(m_limit_slot);
+    }
+    if (m_h2) {
+        process_h2(NO_REQUEST);
+        rearm(EPOLLOUT);
+        return;
+    }
 
-    // 解析 HTTP 请求，根据返回的状态值判断 HTTP 报文是否完整
-    HTTP_CODE read_ret = process_read();
+    // 解析 HTTP 请求，根据返回的状态值判断 HTTP 报文是否完整；主线程已经解析完的请求直接处理
+    HTTP_CODE read_ret = m_parsed ? do_request() : process_read();
 
     if (read_ret == NO_REQUEST) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        rearm(EPOLLIN);
         return;
     }
 
     bool write_ret = process_write(read_ret);
+    m_trace.mark(RequestTrace::RESPONSE_READY);
     if (!write_ret) {
         close_conn();
     }
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    rearm(EPOLLOUT);
+}
+
+
+// 主线程，请求进入线程池之前调用
+// 解析和错误响应、页缓存中的小文件、运行时统计都不会阻塞，在主线程完成，省去进出线程池的两次切换和连接在核间的迁移
+// 文件要读磁盘、访问数据库、注册时没有声明不阻塞的处理函数仍然交给线程池
+HttpConn::INLINE HttpConn::process_inline() {
+    if (m_h2 || is_h2_preface()) {
+        return INLINE_POOL;
+    }
+    m_inline = true;
+    HTTP_CODE ret = process_read();
+    m_inline = false;
+
+    if (ret == BLOCKING_REQUEST) {
+        Metrics::add(Metrics::INLINE_DEFERRED);
+        return INLINE_POOL;
+    }
+    if (ret == NO_REQUEST) {
+        rearm(EPOLLIN);
+        return INLINE_READ;
+    }
+    Metrics::add(Metrics::INLINE_REQUESTS);
+    bool write_ret = process_write(ret);
+    m_trace.mark(RequestTrace::RESPONSE_READY);
+    return write_ret ? INLINE_WRITE : INLINE_CLOSE;
+}
+
+// 主线程，请求进入线程池之前检查客户端的请求速率
+// HTTP/2 连接上一次读入可能有多个流，也可能只有 SETTINGS、WINDOW_UPDATE 等控制帧，由会话按流检查
+bool HttpConn::admit() {
+    if (m_h2 || is_h2_preface()) {
+        return true;
+    }
+    return ClientLimiter::allow(m_limit_slot);
+}
+
+// 服务器过载或者客户端超过速率，不解析请求直接生成 503 或 429 响应，发送完后关闭连接
+bool HttpConn::reject(HTTP_CODE code) {
+    // HTTP/2 连接上只有新的流返回错误，已经打开的流继续发送
+    if (m_h2) {
+        process_h2(code);
+        return true;
+    }
+
+    m_linger = false;
+    bool ret = process_write(code);
+    m_trace.mark(RequestTrace::RESPONSE_READY);
+    return ret;
+}
+
+// 由线程池调用，请求排队过久被丢弃
+void HttpConn::shed() {
+    m_trace.mark(RequestTrace::DEQUEUE);
+    if (!reject()) {
+        close_conn();
+    }
+    rearm(EPOLLOUT);
+}
+
+
+
+// ---------- HTTP/2 ----------
+
+// 连接的第一个请求行以连接序言开头，至少读到 "PRI " 才能和 HTTP/1.1 的请求区分开
+bool HttpConn::is_h2_preface() {
+    if (m_check_state != CHECK_STATE_REQUESTLINE || m_start_line != 0 || m_read_idx < 4) {
+        return false;
+    }
+    size_t n = (size_t)m_read_idx < Http2Session::PREFACE_LEN ? m_read_idx : Http2Session::PREFACE_LEN;
+    return memcmp(m_read_buf, Http2Session::PREFACE, n) == 0;
+}
+
+// 创建 HTTP/2 会话，当前请求成为流 1，响应在 101 之后以 HTTP/2 帧发送
+HttpConn::HTTP_CODE HttpConn::upgrade_h2c() {
+    Http2Session *h2 = new Http2Session(m_sockfd, m_address.sin_addr.s_addr);
+    if (!h2->upgrade(m_http2_settings, method_names[m_method], m_url, m_trace)) {
+        // HTTP2-Settings 格式错误时忽略升级，按 HTTP/1.1 处理
+        delete h2;
+        m_upgrade_h2c = false;
+        return do_request();
+    }
+    // 升级请求在进入线程池之前已经检查过速率，之后的流由会话检查
+    h2->set_limit(m_limit_slot);
+    // 客户端收到 101 之后才会发送连接序言，读缓冲区中的 HTTP/1.1 请求不再需要
+    m_read_idx = 0;
+    m_h2 = h2;
+    return SWITCH_PROTOCOL;
+}
+
+// 读缓冲区中的数据全部交给会话，不完整的帧由会话保存
+void HttpConn::process_h2(HTTP_CODE refuse) {
+    m_h2->feed(m_read_buf, m_read_idx, refuse);
+    m_read_idx = 0;
+    m_h2->produce(m_out);
+}
+
+// 发送完一批帧后归还内存，再生成下一批，窗口用完或者没有要发送的数据时等待读事件
+bool HttpConn::write_h2() {
+    while (1) {
+        if (m_out.empty()) {
+            if (m_trace.status == 101) {
+                // 升级请求的 101 和流 1 的响应已经发送完，和其他请求一样记录一次；之后的流不再经过这里
+                m_trace.mark(RequestTrace::LAST_BYTE);
+                Metrics::observe_latency((m_trace.ts[RequestTrace::LAST_BYTE] - m_trace.ts[RequestTrace::FIRST_BYTE]) / 1000);
+                Tracer::finish(m_trace);
+                Log::access(m_trace, method_names[m_method], bytes_have_send);
+                m_trace.status = 0;
+            }
+            m_out.reset();
+            m_arena.reset();
+            m_h2->produce(m_out);
+            if (m_out.empty()) {
+                if (m_h2->closing()) {
+                    return false;
+                }
+                rearm(EPOLLIN);
+                return true;
+            }
+        }
+
+        ssize_t temp = send_out();
+        if (temp < 0) {
+            if (errno == EAGAIN) {
+                rearm(EPOLLOUT);
+                return true;
+            }
+            return false;
+        }
+        Metrics::add(Metrics::BYTES_OUT, temp);
+        bytes_have_send += temp;
+    }
+}
+
+
+
+// 长度行写在 m_chunk 预留的开头，和数据、结尾的 \r\n 作为一段引用，不再复制
+// 最后一段之后追加长度为 0 的结束块
+bool HttpConn::next_chunk() {
+    if (!m_stream) {
+        return false;
+    }
+    m_chunk.assign(CHUNK_HEAD, '\0');
+    bool more = m_stream->next(m_chunk);
+    size_t len = m_chunk.size() - CHUNK_HEAD;
+    if (len > 0) {
+        char head[CHUNK_HEAD + 1];
+        int n = snprintf(head, sizeof(head), "%zx\r\n", len);
+        memcpy(&m_chunk[CHUNK_HEAD - n], head, n);
+        m_chunk.append("\r\n");
+        m_out.append_ref(m_chunk.data() + CHUNK_HEAD - n, n + len + 2);
+    }
+    if (!more) {
+        m_out.append_ref("0\r\n\r\n", 5);
+        delete m_stream;
+        m_stream = NULL;
+    }
+    return true;
+}
+
+
+// ---------- 反向代理 ----------
+
+// 请求行和请求头原样转发（解析时行尾的 \r\n 被改成了 \0\0），去掉逐跳的头部，
+// 追加 X-Forwarded-For，和上游之间总是长连接
+bool HttpConn::build_proxy_request() {
+    static const char *hop_headers[] = {"Connection:", "Keep-Alive:", "Proxy-Connection:", "Upgrade:", "HTTP2-Settings:", "TE:"};
+    char client[INET_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET, &m_address.sin_addr, client, sizeof(client));
+    std::string forwarded = client;
+
+    std::string &req = m_proxy->request();
+    req.append(method_names[m_method]).append(" ").append(m_url).append(" HTTP/1.1\r\n");
+    for (const char *line = m_read_buf + m_header_start; *line; line += strlen(line) + 2) {
+        bool hop = false;
+        for (size_t i = 0; i < sizeof(hop_headers) / sizeof(hop_headers[0]); ++i) {
+            if (strncasecmp(line, hop_headers[i], strlen(hop_headers[i])) == 0) {
+                hop = true;
+                break;
+            }
+        }
+        if (hop) {
+            continue;
+        }
+        if (strncasecmp(line, "X-Forwarded-For:", 16) == 0) {
+            // 已经经过其他代理，把客户端地址接在后面
+            const char *value = line + 16;
+            value += strspn(value, " \t");
+            forwarded = std::string(value) + ", " + client;
+            continue;
+        }
+        req.append(line).append("\r\n");
+    }
+    req.append("X-Forwarded-For: ").append(forwarded).append("\r\nConnection: keep-alive\r\n\r\n");
+    if (m_string && m_content_length > 0) {
+        req.append(m_string, m_content_length);
+    }
+    return true;
+}
+
+bool HttpConn::proxy_event() {
+    if (!m_proxy) {
+        return true;
+    }
+    return write_proxy(m_proxy->on_upstream());
+}
+
+bool HttpConn::write_proxy(ProxyConn::STATUS status) {
+    switch (status) {
+        case ProxyConn::AGAIN:
+            return true;
+        case ProxyConn::FAILED:
+            return false;
+        case ProxyConn::BAD_GATEWAY:
+        {
+            // 客户端还没有收到任何数据，改为返回 502
+            Metrics::add(Metrics::PROXY_ERRORS);
+            delete m_proxy;
+            m_proxy = NULL;
+            m_out.reset();
+            if (!process_write(BAD_GATEWAY)) {
+                return false;
+            }
+            return write();
+        }
+        default:
+            break;
+    }
+
+    // 响应已经完整转发
+    count_status(m_proxy->status());
+    bool keepalive = m_proxy->keepalive();
+    long bytes = m_proxy->bytes();
+    delete m_proxy;
+    m_proxy = NULL;
+    m_trace.mark(RequestTrace::LAST_BYTE);
+    Metrics::observe_latency((m_trace.ts[RequestTrace::LAST_BYTE] - m_trace.ts[RequestTrace::FIRST_BYTE]) / 1000);
+    Tracer::finish(m_trace);
+    Log::access(m_trace, method_names[m_method], bytes);
+    if (!keepalive) {
+        return false;
+    }
+    init();
+    rearm(EPOLLIN);
+    return true;
+}
+
+
+// ---------- WebSocket ----------
+
+// 握手请求的路径作为频道，同一个频道上的连接收到彼此的消息
+HttpConn::HTTP_CODE HttpConn::upgrade_ws() {
+    m_ws = new WsSession(m_path);
+    return SWITCH_PROTOCOL;
+}
+
+// 由主线程调用：控制帧的回复直接追加到 m_out，完整的消息广播到频道，然后尽量发送
+bool HttpConn::process_ws() {
+    std::vector<WsSession::Message> messages;
+    m_ws->feed(m_read_buf, m_read_idx, m_out, messages);
+    m_read_idx = 0;
+    for (size_t i = 0; i < messages.size(); ++i) {
+        Metrics::add(Metrics::WEBSOCKET_MESSAGES);
+        WsHub::broadcast(m_ws->channel(), messages[i].first, messages[i].second.data(), messages[i].second.size());
+    }
+    return write_ws();
+}
+
+bool HttpConn::ws_send(const std::shared_ptr<const std::string> &frame) {
+    if (m_out.size() > WsSession::MAX_PENDING) {
+        // 对方长时间不读，不再为它缓存，下一次可写时关闭
+        m_ws->set_overflow();
+        rearm(EPOLLIN | EPOLLOUT);
+        return false;
+    }
+    bool idle = m_out.empty();
+    if (m_out.retained() > WsSession::MAX_RETAINED) {
+        // 输出一直没有发送完时 m_out 的段和控制帧占用的 Arena 不会归还，把未发送的数据复制出来后整体归还
+        std::shared_ptr<const std::string> pending = m_out.copy_pending();
+        m_out.reset();
+        m_arena.reset();
+        m_out.append_blob(pending);
+    }
+    m_out.append_blob(frame);
+    if (idle) {
+        rearm(EPOLLIN | EPOLLOUT);
+    }
+    return true;
+}
+
+// 发送完时归还内存，只等待读事件；没有发送完时同时等待读写，读到的帧不会被积压的输出挡住
+bool HttpConn::write_ws() {
+    if (m_ws->overflow()) {
+        return false;
+    }
+    while (!m_out.empty()) {
+        ssize_t temp = send_out();
+        if (temp < 0) {
+            if (errno == EAGAIN) {
+                rearm(EPOLLIN | EPOLLOUT);
+                return true;
+            }
+            return false;
+        }
+        Metrics::add(Metrics::BYTES_OUT, temp);
+    }
+    m_out.reset();
+    m_arena.reset();
+    if (m_ws->closing()) {
+        return false;
+    }
+    rearm(EPOLLIN);
+    return true;
+}
+
+// 空闲超时时先发送 ping，所有连接共用同一个帧；到下一次超时还没有收到 pong 再关闭
+bool HttpConn::keepalive() {
+    static const std::shared_ptr<const std::string> ping = WsSession::frame(WsSession::PING, "", 0);
+    if (!is_websocket() || m_ws->awaiting_pong()) {
+        return false;
+    }
+    m_ws->ping_sent();
+    return ws_send(ping);
+}
+
+void HttpConn::ws_close() {
+    if (m_ws) {
+        if (m_ws->established()) {
+            WsHub::unsubscribe(this, m_ws->channel());
+        }
+        delete m_ws;
+        m_ws = NULL;
+    }
 }
 
 
 // ---------- 一系列读取请求报文的函数 ----------
-// 根据请求，建立磁盘资源到内存的映射
+// 从 application/x-www-form-urlencoded 表单中取出 key 对应的值，并做 URL 解码
+static bool get_form_value(const char *form, const char *key, char *value, int len) {
+    int key_len = strlen(key);
+    const char *p = form;
+    while (p && *p) {
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            p += key_len + 1;
+            int i = 0;
+            for (; *p && *p != '&'; ++p) {
+                if (i >= len - 1) {
+                    return false;
+                }
+                char c = *p;
+                if (c == '+') {
+                    c = ' ';
+                }
+                else if (c == '%' && isxdigit((unsigned char)p[1]) && isxdigit((unsigned char)p[2])) {
+                    char hex[3] = {p[1], p[2], '\0'};
+                    c = (char)strtol(hex, NULL, 16);
+                    p += 2;
+                }
+                value[i++] = c;
+            }
+            value[i] = '\0';
+            return true;
+        }
+        p = strchr(p, '&');
+        if (p) {
+            ++p;
+        }
+    }
+    return false;
+}
+
+// 处理登录和注册，登录只查内存中的用户表，注册写入本地日志后由后台线程批量写入数据库
+HttpConn::HTTP_CODE HttpConn::do_user_request(bool login, const char *&page) {
+    SqlConnPool *pool = SqlConnPool::instance();
+    if (!pool->ready()) {
+        return INTERNAL_ERROR;
+    }
+
+    char name[USER_FIELD_LEN], password[USER_FIELD_LEN];
+    if (!m_string || !get_form_value(m_string, "user", name, USER_FIELD_LEN) ||
+        !get_form_value(m_string, "password", password, USER_FIELD_LEN) || name[0] == '\0') {
+        return BAD_REQUEST;
+    }
+
+    UserCache *users = UserCache::instance();
+    if (login) {
+        page = users->check(name, password) ? login_ok_page : login_error_page;
+        return NO_REQUEST;
+    }
+
+    // 先占住用户名，避免并发注册同一个用户
+    if (!users->insert(name, password)) {
+        page = register_error_page;
+        return NO_REQUEST;
+    }
+    if (!UserWriter::instance()->append(UserRecord(name, password))) {
+        users->erase(name);
+        LOG_ERROR("register %s failed", name);
+        page = register_error_page;
+        return NO_REQUEST;
+    }
+    page = register_ok_page;
+    return NO_REQUEST;
+}
 
 // 根据请求，建立磁盘资源到内存的映射
 HttpConn::HTTP_CODE HttpConn::do_request() {
-    // 获取 m_real_file 文件的相关的状态信息，-1 失败，0 成功
-    strcpy(m_real_file, doc_root);
-    int len = strlen(doc_root);
-    strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
-    if (stat(m_real_file, &m_file_stat) < 0) {
+    // 客户端请求升级到 HTTP/2
+    if (m_upgrade_h2c && m_http2_settings && !m_admin) {
+        // 流 1 的响应在升级时一起生成，可能要映射文件
+        return m_inline ? BLOCKING_REQUEST : upgrade_h2c();
+    }
+    // WebSocket 握手只能是 GET
+    if (m_upgrade_ws && m_ws_key && m_method == GET && !m_admin) {
+        return upgrade_ws();
+    }
+
+    // 取当前配置的快照，重新加载配置不影响这个请求，路由表也是快照的一部分
+    m_site = SiteConfig::current();
+    const Router<Route> &router = m_admin ? admin_routes() : m_site->routes->router;
+    const Route *route = router.find(m_path);
+    if (!route) {
+        return NO_RESOURCE;
+    }
+    if (m_inline && !route->nonblocking) {
+        return BLOCKING_REQUEST;
+    }
+    return route->handler(*this, route->arg);
+}
+
+// ---------- 路由 ----------
+
+namespace {
+
+struct RouteSpec {
+    const char *pattern;
+    HttpConn::MATCH match;
+    HttpConn::Route route;
+};
+
+// add_route 注册的路由
+std::vector<RouteSpec> &extra_routes() {
+    static std::vector<RouteSpec> routes;
+    return routes;
+}
+
+}
+
+void HttpConn::add_route(const char *pattern, MATCH match, Handler handler, int arg, bool nonblocking) {
+    RouteSpec spec = {pattern, match, {handler, arg, nonblocking}};
+    extra_routes().push_back(spec);
+}
+
+std::shared_ptr<const RouteTable> HttpConn::build_routes(const SiteConfig &site) {
+    // 内置路由，没有匹配到其他路由的请求都是静态文件
+    // 静态文件在主线程中只映射页缓存中的文件，不在时由 serve_file 返回 BLOCKING_REQUEST
+    static constexpr RouteSpec builtin[] = {
+        {"/", Router<Route>::PREFIX, {serve_file, 0, true}},
+        {"/metrics", Router<Route>::EXACT, {serve_metrics, 0, true}},
+        {"/login", Router<Route>::EXACT, {serve_user, 1, false}},
+        {"/register", Router<Route>::EXACT, {serve_user, 0, false}},
+    };
+
+    std::shared_ptr<RouteTable> table(new RouteTable);
+    Router<Route> &router = table->router;
+    for (size_t i = 0; i < sizeof(builtin) / sizeof(builtin[0]); ++i) {
+        router.add(builtin[i].pattern, builtin[i].match, builtin[i].route);
+    }
+    const std::vector<RouteSpec> &extra = extra_routes();
+    for (size_t i = 0; i < extra.size(); ++i) {
+        router.add(extra[i].pattern, extra[i].match, extra[i].route);
+    }
+    // 反向代理按解码后的路径匹配前缀，转发时使用原始的请求地址
+    // 只生成转发的请求，连接上游和转发都在主线程中以非阻塞方式进行
+    for (size_t i = 0; i < site.proxies.size(); ++i) {
+        Route route = {serve_proxy, (int)i, true};
+        router.add(site.proxies[i].prefix, Router<Route>::PREFIX, route);
+    }
+    router.compile();
+    return table;
+}
+
+const Router<HttpConn::Route> &HttpConn::admin_routes() {
+    // 管理端口上的连接，最近请求的数量和线程数成正比，边生成边发送，其余的地址都返回运行时统计
+    static const Router<Route> router = [] {
+        Router<Route> r;
+        Route metrics = {serve_metrics, 0, true}, trace = {serve_trace, 0, false};
+        r.add("/", Router<Route>::PREFIX, metrics);
+        r.add(TRACE_URL, Router<Route>::EXACT, trace);
+        r.compile();
+        return r;
+    }();
+    return router;
+}
+
+HttpConn::HTTP_CODE HttpConn::serve_file(HttpConn &conn, int) {
+    return map_file(conn.m_arena, *conn.m_site, conn.m_path, conn.m_file_stat, conn.m_file_address, conn.m_inline);
+}
+
+HttpConn::HTTP_CODE HttpConn::serve_user(HttpConn &conn, int login) {
+    const char *url = conn.m_path;
+    if (conn.m_method == POST) {
+        HTTP_CODE ret = conn.do_user_request(login, url);
+        if (ret != NO_REQUEST) {
+            return ret;
+        }
+    }
+    return map_file(conn.m_arena, *conn.m_site, url, conn.m_file_stat, conn.m_file_address);
+}
+
+HttpConn::HTTP_CODE HttpConn::serve_metrics(HttpConn &conn, int) {
+    Metrics::render(conn.m_body);
+    conn.m_content_type = "text/plain; version=0.0.4";
+    return CONTENT_REQUEST;
+}
+
+HttpConn::HTTP_CODE HttpConn::serve_trace(HttpConn &conn, int) {
+    conn.m_stream = new RecentTraceStream;
+    return STREAM_REQUEST;
+}
+
+HttpConn::HTTP_CODE HttpConn::serve_proxy(HttpConn &conn, int arg) {
+    // 没有 kTLS 的 TLS 连接不能用 splice 直接写 socket，响应经过 SSL_write
+    TlsConn *tls = conn.m_tls && !conn.m_tls->ktls_send() ? conn.m_tls : NULL;
+    conn.m_proxy = new ProxyConn(&conn, conn.m_sockfd, tls, conn.m_site->proxies[arg].upstream, conn.m_linger);
+    return PROXY_REQUEST;
+}
+
+// 只用内核缓存打开文件：路径查找需要读磁盘时 openat2 返回 EAGAIN，不会阻塞
+static int open_cached(const char *path) {
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = O_RDONLY;
+    how.resolve = RESOLVE_CACHED;
+    return syscall(SYS_openat2, AT_FDCWD, path, &how, sizeof(how));
+}
+
+// 映射的页是否都在页缓存中，发送时不会缺页读磁盘
+static bool pages_resident(void *addr, off_t size) {
+    static const size_t MAX_PAGES = HttpConn::INLINE_FILE_MAX / 4096;     // 按最小的页计算
+    static const long page_size = sysconf(_SC_PAGESIZE);
+    unsigned char vec[MAX_PAGES];
+    size_t pages = (size + page_size - 1) / page_size;
+    if (pages > MAX_PAGES || mincore(addr, size, vec) < 0) {
+        return false;
+    }
+    for (size_t i = 0; i < pages; ++i) {
+        if (!(vec[i] & 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 把路径映射到资源目录下的文件，文件名分配在 arena 中
+HttpConn::HTTP_CODE HttpConn::map_file(Arena &arena, const SiteConfig &site, const char *path, struct stat &st, char *&address, bool cached_only) {
+    address = NULL;
+    // 获取文件的相关的状态信息，-1 失败，0 成功
+    // 当浏览器出现连接重置时，可能是网站根目录出错或 http 响应格式出错或者访问的文件中内容完全为空
+    char *real_file = static_cast<char *>(arena.alloc(FILENAME_LEN, 1));
+    if (!real_file) {
+        return INTERNAL_ERROR;
+    }
+    const std::string &doc_root = site.doc_root;
+    int len = doc_root.size() < FILENAME_LEN - 1 ? doc_root.size() : FILENAME_LEN - 1;
+    memcpy(real_file, doc_root.data(), len);
+    real_file[len] = '\0';
+    strncpy(real_file + len, path, FILENAME_LEN - len - 1);
+    real_file[FILENAME_LEN - 1] = '\0';
+
+    int fd = -1;
+    if (cached_only) {
+        // 先打开再 fstat，路径只查找一次；缓存中确定不存在时直接返回 404，其他错误交给线程池按原来的顺序判断
+        fd = open_cached(real_file);
+        if (fd < 0) {
+            return errno == ENOENT || errno == ENOTDIR ? NO_RESOURCE : BLOCKING_REQUEST;
+        }
+        if (fstat(fd, &st) < 0 || st.st_size > INLINE_FILE_MAX) {
+            close(fd);
+            return BLOCKING_REQUEST;
+        }
+    }
+    else if (stat(real_file, &st) < 0) {
         return NO_RESOURCE;
     }
     // 是否有读权限
-    if (!(m_file_stat.st_mode & S_IROTH)) {
+    if (!(st.st_mode & S_IROTH)) {
+        if (fd >= 0) {
+            close(fd);
+        }
         return FORBIDDEN_REQUEST;
     }
     // 判断是否是目录
-    if (S_ISDIR(m_file_stat.st_mode)) {
+    if (S_ISDIR(st.st_mode)) {
+        if (fd >= 0) {
+            close(fd);
+        }
         return BAD_REQUEST;
     }
+    // 空文件不能映射
+    if (st.st_size == 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return FILE_REQUEST;
+    }
 
     // 以只读方式打开文件
-    int fd = open(m_real_file, O_RDONLY);
+    if (fd < 0) {
+        fd = open(real_file, O_RDONLY);
+    }
+    if (fd < 0) {
+        return FORBIDDEN_REQUEST;
+    }
     // 创建内存映射
-    m_file_address = (char *)mmap(0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    void *addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
     close(fd);
+    if (addr == MAP_FAILED) {
+        return INTERNAL_ERROR;
+    }
+    if (cached_only && !pages_resident(addr, st.st_size)) {
+        munmap(addr, st.st_size);
+        return BLOCKING_REQUEST;
+    }
+    address = static_cast<char *>(addr);
     return FILE_REQUEST;
 }
 
@@ -282,6 +1065,41 @@ HttpConn::LINE_STATUS HttpConn::parse_line() {
     return LINE_OPEN;
 }
 
+// 取出请求地址中 '?' 之前的路径并做 URL 解码，结果分配在 m_arena 中，路径为 / 时返回 /index.html
+// 解码出 '\0' 或者含有 ".." 路径段（会访问到资源目录之外）时返回 NULL
+char *HttpConn::decode_path(Arena &arena, const char *url) {
+    static const char index_page[] = "index.html";
+    size_t len = strcspn(url, "?#");
+    char *path = static_cast<char *>(arena.alloc(len + sizeof(index_page), 1));
+    if (!path) {
+        return NULL;
+    }
+    size_t n = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char c = url[i];
+        if (c == '%' && i + 2 < len && isxdigit((unsigned char)url[i + 1]) && isxdigit((unsigned char)url[i + 2])) {
+            char hex[3] = {url[i + 1], url[i + 2], '\0'};
+            c = (char)strtol(hex, NULL, 16);
+            i += 2;
+            if (c == '\0') {
+                return NULL;
+            }
+        }
+        path[n++] = c;
+    }
+    path[n] = '\0';
+    if (n == 1) {
+        memcpy(path + 1, index_page, sizeof(index_page));
+    }
+
+    for (const char *p = path; (p = strstr(p, "/..")) != NULL; p += 3) {
+        if (p[3] == '/' || p[3] == '\0') {
+            return NULL;
+        }
+    }
+    return path;
+}
+
 // 解析 http 请求行，获得请求方法，目标 url 及 http 版本号
 HttpConn::HTTP_CODE HttpConn::parse_request_line(char *text) {
     // strpbrk：返回 accept 串中任一字符在 s 串中最先出现的位置
@@ -331,9 +1149,12 @@ HttpConn::HTTP_CODE HttpConn::parse_request_line(char *text) {
     if (!m_url || m_url[0] != '/') return BAD_REQUEST;
 
     // 当 url 只为 / 时，显示界面
-    if (strlen(m_url) == 1) {
-        strcat(m_url, "index.html");
+    m_path = decode_path(m_arena, m_url);
+    if (!m_path) {
+        return BAD_REQUEST;
     }
+    m_trace.set_url(m_url);
+    m_header_start = m_start_line;
     m_check_state = CHECK_STATE_HEADER;
     return NO_REQUEST;
 }
@@ -364,6 +1185,22 @@ HttpConn::HTTP_CODE HttpConn::parse_headers(char *text) {
         text += strspn(text, " \t");
         m_content_length = atol(text);
     }
+    else if (strncasecmp(text, "Upgrade:", 8) == 0) {
+        // 只支持明文的 HTTP/2 和 WebSocket
+        text += 8;
+        m_upgrade_h2c = strstr(text, "h2c") != NULL;
+        m_upgrade_ws = strcasestr(text, "websocket") != NULL;
+    }
+    else if (strncasecmp(text, "Sec-WebSocket-Key:", 18) == 0) {
+        text += 18;
+        text += strspn(text, " \t");
+        m_ws_key = text;
+    }
+    else if (strncasecmp(text, "HTTP2-Settings:", 15) == 0) {
+        text += 15;
+        text += strspn(text, " \t");
+        m_http2_settings = text;
+    }
     else if (strncasecmp(text, "Host:", 5) == 0) {
         // 获取 Host 头部字段
         text += 5;
@@ -416,6 +1253,8 @@ HttpConn::HTTP_CODE HttpConn::process_read() {
                     return BAD_REQUEST;
                 }
                 else if (ret == GET_REQUEST) {
+                    m_trace.mark(RequestTrace::PARSE_DONE);
+                    m_parsed = true;
                     return do_request();
                 }
                 break;
@@ -423,8 +1262,11 @@ HttpConn::HTTP_CODE HttpConn::process_read() {
             case CHECK_STATE_CONTENT:
             {
                 ret = parse_content(text);
-                if (ret == GET_REQUEST)
+                if (ret == GET_REQUEST) {
+                    m_trace.mark(RequestTrace::PARSE_DONE);
+                    m_parsed = true;
                     return do_request();
+                }
                 line_status = LINE_OPEN;
                 break;
             }
@@ -441,21 +1283,43 @@ HttpConn::HTTP_CODE HttpConn::process_read() {
 
 // ---------- 一系列生成相应响应报文的函数 ----------
 
+// 统计响应状态码
+void HttpConn::count_status(int status) {
+    Metrics::count_status(status);
+    m_trace.status = status;
+}
+
+// 错误响应的状态码和页面，与 process_write 一致：请求错误也返回 404
+int HttpConn::error_page(HTTP_CODE code, const char *&page) {
+    switch (code) {
+        case INTERNAL_ERROR:
+            page = error_500_form;
+            return 500;
+        case FORBIDDEN_REQUEST:
+            page = error_403_form;
+            return 403;
+        case SERVICE_UNAVAILABLE:
+            page = error_503_form;
+            return 503;
+        case TOO_MANY_REQUESTS:
+            page = error_429_form;
+            return 429;
+        case BAD_GATEWAY:
+            page = error_502_form;
+            return 502;
+        default:
+            page = error_404_form;
+            return 404;
+    }
+}
+
 // 将响应内容写入写缓冲区中
 bool HttpConn::add_response(const char *format, ...) {
-    if (m_write_idx >= WRITE_BUFFER_SIZE) return false;
     va_list arg_list;   // 指针类型，指向参数列表中的参数
     va_start(arg_list, format); // 指向第一个参数
-    int len = vsnprintf(m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - m_read_idx - 1, format, arg_list);   // s 存放生成的字符串，max_len 最大字符串长度，format 输出格式的字符串，arg 参数列表指针
-    if (len >= WRITE_BUFFER_SIZE - m_write_idx - 1) {
-        va_end(arg_list);
-        return false;
-    }
-    m_write_idx += len;
+    bool ret = m_out.vprintf(format, arg_list);    // 直接格式化到 m_out 的内存块中，放不下时换一块，没有长度限制
     va_end(arg_list); // 回收指针
-    // printf("回复\n");
-    // printf("%s", m_write_buf);
-    return true;
+    return ret;
 }
 
 // 生成响应行
@@ -468,8 +1332,8 @@ bool HttpConn::add_content_length(int content_length) {
     return add_response("Content-Length:%d\r\n", content_length);
 }
 // 响应内容类型
-bool HttpConn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+bool HttpConn::add_content_type(const char *type) {
+    return add_response("Content-Type:%s\r\n", type);
 }
 // 是否保持长连接
 bool HttpConn::add_linger() {
@@ -489,7 +1353,7 @@ bool HttpConn::add_headers(int content_length) {
 
 // 生成响应内容
 bool HttpConn::add_content(const char *content) {
-    return add_response("%s", content);
+    return m_out.append_ref(content, strlen(content));
 }
 
 // 根据解析的请求生成相应响应报文
@@ -498,6 +1362,7 @@ bool HttpConn::process_write(HTTP_CODE ret) {
     switch (ret) {
         case INTERNAL_ERROR:
         {
+            count_status(500);
             add_status_line(500, error_500_title);
             add_headers(strlen(error_500_form));
             if (!add_content(error_500_form)) {
@@ -508,6 +1373,7 @@ bool HttpConn::process_write(HTTP_CODE ret) {
         // 针对没资源和请求错误
         case BAD_REQUEST: case NO_RESOURCE:
         {
+            count_status(404);
             add_status_line(404, error_404_title);
             add_headers(strlen(error_404_form));
             if (!add_content(error_404_form)) {
@@ -515,8 +1381,43 @@ bool HttpConn::process_write(HTTP_CODE ret) {
             }
             break;
         }
+        case SERVICE_UNAVAILABLE:
+        {
+            count_status(503);
+            add_status_line(503, error_503_title);
+            add_response("Retry-After:%d\r\n", RETRY_AFTER);
+            add_headers(strlen(error_503_form));
+            if (!add_content(error_503_form)) {
+                return false;
+            }
+            break;
+        }
+        case TOO_MANY_REQUESTS:
+        {
+            count_status(429);
+            add_status_line(429, error_429_title);
+            add_response("Retry-After:%d\r\n", RETRY_AFTER);
+            add_headers(strlen(error_429_form));
+            if (!add_content(error_429_form)) {
+                return false;
+            }
+            break;
+        }
+        case BAD_GATEWAY:
+        {
+            count_status(502);
+            add_status_line(502, error_502_title);
+            add_headers(strlen(error_502_form));
+            if (!add_content(error_502_form)) {
+                return false;
+            }
+            break;
+        }
+        case PROXY_REQUEST:
+            return build_proxy_request();
         case FORBIDDEN_REQUEST:
         {
+            count_status(403);
             add_status_line(403, error_403_title);
             add_headers(strlen(error_403_form));
             if (!add_content(error_403_form)) {
@@ -525,16 +1426,11 @@ bool HttpConn::process_write(HTTP_CODE ret) {
             break;
         }
         case FILE_REQUEST: {
+            count_status(200);
             add_status_line(200, ok_200_title);
             if (m_file_stat.st_size != 0) {
                 add_headers(m_file_stat.st_size);
-                m_iv[0].iov_base = m_write_buf;
-                m_iv[0].iov_len = m_write_idx;
-                m_iv[1].iov_base = m_file_address;
-                m_iv[1].iov_len = m_file_stat.st_size;
-                m_iv_count = 2;
-                bytes_to_send = m_write_idx + m_file_stat.st_size;
-                return true;
+                return m_out.append_ref(m_file_address, m_file_stat.st_size);
             }
             else {
                 const char *ok_string = "<html><body></body></html>";
@@ -542,14 +1438,44 @@ bool HttpConn::process_write(HTTP_CODE ret) {
                 if (!add_content(ok_string))
                     return false;
             }
+            break;
+        }
+        case SWITCH_PROTOCOL:
+        {
+            count_status(101);
+            add_status_line(101, "Switching Protocols");
+            if (m_ws) {
+                add_response("Connection:Upgrade\r\nUpgrade:websocket\r\nSec-WebSocket-Accept:%s\r\n\r\n",
+                             WsSession::accept_key(m_ws_key).c_str());
+                break;
+            }
+            // 101 之后紧接着服务器的 SETTINGS 帧和流 1 的响应
+            add_response("Connection:Upgrade\r\nUpgrade:h2c\r\n\r\n");
+            m_h2->produce(m_out);
+            break;
+        }
+        case CONTENT_REQUEST:
+        {
+            count_status(200);
+            add_status_line(200, ok_200_title);
+            add_content_type(m_content_type ? m_content_type : "text/plain");
+            add_headers(m_body.size());
+            return m_out.append_ref(m_body.data(), m_body.size());
+        }
+        case STREAM_REQUEST:
+        {
+            count_status(200);
+            add_status_line(200, ok_200_title);
+            add_content_type(m_stream->content_type());
+            add_response("Transfer-Encoding:chunked\r\n");
+            add_linger();
+            add_blank_line();
+            // 第一段和响应头一起发送
+            return next_chunk();
         }
         default:
             return false;
     }
 
-    m_iv[0].iov_base = m_write_buf;
-    m_iv[0].iov_len = m_write_idx;
-    m_iv_count = 1;
-    bytes_to_send = m_write_idx;
     return true;
 }
\ No newline at end of file
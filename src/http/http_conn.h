@@ -4,6 +4,7 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <cctype>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -13,8 +14,26 @@
 #include <sys/stat.h>
 #include <sys/epoll.h>
 #include <sys/uio.h>
+#include <atomic>
+#include <string>
+#include "../conf/config.h"
+#include "../core/arena/arena.h"
+#include "../core/buffer/buffer_chain.h"
+#include "../core/metrics/metrics.h"
+#include "../core/trace/tracer.h"
+#include "../core/tls/tls.h"
+#include "../core/limit/client_limiter.h"
+#include "../core/log/log.h"
+#include "body_stream.h"
+#include "http2.h"
+#include "proxy.h"
+#include "router.h"
+#include "websocket.h"
+#include "../db/sql_conn_pool.h"
+#include "../db/user_cache.h"
+#include "../db/user_writer.h"
 
-class HttpConn {
+class alignas(64) HttpConn {
 public:
     // HTTP 请求方式，目前只支持 GET
     enum METHOD
@@ -51,7 +70,15 @@ public:
         NO_RESOURCE         ：      表示服务器没有资源
         FORBIDDEN_REQUEST   ：      表示客户对资源没有足够的访问权限
         FILE_REQUEST        ：      文件请求，获取文件成功
+        CONTENT_REQUEST     ：      动态内容请求，响应体已生成在 m_body 中
+        STREAM_REQUEST      ：      动态内容请求，响应体由 m_stream 分段生成，chunked 编码发送
+        PROXY_REQUEST       ：      请求匹配反向代理的路径前缀，由 m_proxy 转发给上游
+        BAD_GATEWAY         ：      上游连接失败或者响应有误
         INTERNAL_ERROR      ：      表示服务器内部错误
+        SERVICE_UNAVAILABLE ：      服务器过载，请求没有被处理
+        TOO_MANY_REQUESTS   ：      客户端超过了请求速率，请求没有被处理
+        SWITCH_PROTOCOL     ：      请求升级到 HTTP/2（h2c）或 WebSocket，返回 101 后连接由 m_h2 或 m_ws 处理
+        BLOCKING_REQUEST    ：      主线程内联处理时，请求可能阻塞（文件不在页缓存中、访问数据库），交给线程池
         CLOSED_CONNECTION   ：      表示客户端已经关闭连接了
      */
     enum HTTP_CODE
@@ -62,7 +89,15 @@ public:
         NO_RESOURCE,
         FORBIDDEN_REQUEST,
         FILE_REQUEST,
+        CONTENT_REQUEST,
+        STREAM_REQUEST,
+        PROXY_REQUEST,
+        BAD_GATEWAY,
         INTERNAL_ERROR,
+        SERVICE_UNAVAILABLE,
+        TOO_MANY_REQUESTS,
+        SWITCH_PROTOCOL,
+        BLOCKING_REQUEST,
         CLOSED_CONNECTION
     };
 
@@ -79,56 +114,176 @@ public:
         LINE_OPEN
     };
 
+    /*
+        连接所处的阶段，主线程在读写之后、交给线程池之前据此设置定时器
+        PHASE_WAIT      ：      没有未完成的请求：等待第一个请求或者保持连接空闲
+        PHASE_HEADER    ：      收到了请求的一部分，请求头还没有读完
+        PHASE_BODY      ：      读取请求体
+        PHASE_SEND      ：      发送响应
+        PHASE_OTHER     ：      HTTP/2、WebSocket、转发中的请求，没有单独的期限
+     */
+    enum PHASE
+    {
+        PHASE_WAIT = 0,
+        PHASE_HEADER,
+        PHASE_BODY,
+        PHASE_SEND,
+        PHASE_OTHER
+    };
+
+    /*
+        主线程内联处理请求的结果
+        INLINE_POOL     ：      HTTP/2，或者请求可能阻塞，交给线程池；请求已经解析时线程池从 do_request 继续
+        INLINE_READ     ：      请求不完整，已经重新注册 EPOLLIN
+        INLINE_WRITE    ：      响应已经生成，立即发送
+        INLINE_CLOSE    ：      生成响应失败，关闭连接
+     */
+    enum INLINE
+    {
+        INLINE_POOL = 0,
+        INLINE_READ,
+        INLINE_WRITE,
+        INLINE_CLOSE
+    };
+
     static const int FILENAME_LEN = 200;        // 实际文件名长度
     static const int READ_BUFFER_SIZE = 2048;   // 定义读缓冲区的大小
-    static const int WRITE_BUFFER_SIZE = 1024;  // 定义写缓冲区的大小
+    static const int BUFFER_SIZE = READ_BUFFER_SIZE + 1;   // 读缓冲区多一个字节放结尾的 '\0'
+    static const int USER_FIELD_LEN = 64;       // 登录、注册表单中用户名和密码的最大长度
+    static const int RETRY_AFTER = 1;           // 过载时建议客户端重试的间隔，秒
+    static const size_t CHUNK_HEAD = 18;        // chunk 长度行的最大长度，16 位十六进制加 \r\n
+    static const off_t INLINE_FILE_MAX = 1 << 20;   // 主线程内联发送的文件的最大长度，更大的文件检查页缓存的开销也大
     static int m_epollfd;                       // 所有的 socket 上的事件都被注册同一个 epoll 对象
-    static int m_user_count;                    // 统计用户的数量
+    static std::atomic<int> m_user_count;       // 统计用户的数量，主线程与工作线程都会修改
+    static const char *METRICS_URL;             // 保留的运行时统计地址
+    static const char *TRACE_URL;               // 管理端口上导出最近请求的地址
+
+    // 请求处理函数，arg 为注册路由时给出的参数
+    // 返回 FILE_REQUEST 前映射好文件，CONTENT_REQUEST 前把响应体写入 body()，STREAM_REQUEST 前 set_stream，
+    // 也可以返回 NO_RESOURCE 等错误码，由 process_write 生成错误响应
+    typedef HTTP_CODE (*Handler)(HttpConn &conn, int arg);
+    struct Route {
+        Handler handler;
+        int arg;
+        bool nonblocking;       // 处理函数不会阻塞（不读磁盘、不访问数据库），可以在主线程内联执行
+    };
+    typedef Router<Route>::MATCH MATCH;
+
+    // 注册路由，pattern 为静态字符串，在第一次 build_routes（WebServer 加载配置）之前调用，之后生成的路由表都包含它
+    static void add_route(const char *pattern, MATCH match, Handler handler, int arg = 0, bool nonblocking = false);
+    // 用内置路由、注册的路由和配置中的反向代理生成 site 的路由表，加载配置时调用
+    static std::shared_ptr<const RouteTable> build_routes(const SiteConfig &site);
 
 public:
-    HttpConn() {}
-    ~HttpConn() {}
+    HttpConn() : m_read_buf(NULL), m_out(m_arena), m_sockfd(-1), m_tls(NULL), m_h2(NULL), m_ws(NULL), m_stream(NULL), m_proxy(NULL), m_file_address(NULL), m_limit_slot(-1), m_buf_owned(false) {}
+    ~HttpConn() { delete m_tls; delete m_h2; delete m_ws; delete m_stream; delete m_proxy; if (m_buf_owned) delete[] m_read_buf; }
 
     void init(int sockfd, const sockaddr_in &address);   // 初始化新接收的连接
     void close_conn();                                   // 关闭连接
     void process();                                      // 用户处理客户端请求
+    INLINE process_inline();                             // 主线程，解析请求，确定不会阻塞时直接生成响应
+    bool admit();                                        // 主线程，请求进入线程池之前检查客户端的请求速率
+    bool reject(HTTP_CODE code = SERVICE_UNAVAILABLE);   // 服务器过载或者客户端超过速率，不解析请求直接生成 503 或 429 响应
+    void shed();                                         // 线程池调用，请求排队过久被丢弃，返回 503
     bool read();                                         // 循环读取客户数据，直到无数据可读或者对方关闭连接
     bool write();                                        // 向客户端发送数据
+    void set_admin(bool admin) { m_admin = admin; }      // 来自管理端口的连接，所有请求都返回运行时统计
+    void set_buffer(char *buf) { m_read_buf = buf; }     // 使用外部分配的 BUFFER_SIZE 字节读缓冲区，不再自己分配
+    void set_tls() { m_tls = new TlsConn(m_sockfd); }   // 来自 TLS 端口的连接，第一次可读时开始握手
+    void set_limit(int slot) { m_limit_slot = slot; }    // 连接持有的限流表项，关闭时释放
+    bool tls_wait() const { return m_tls_wait; }         // read 之后：TLS 握手没有完成或者记录不完整，已经重新注册事件
+    bool tls_wake() const { return m_tls_wake; }         // EPOLLOUT 是为了读取 OpenSSL 中剩下的数据
+    PHASE phase() const;                                 // 主线程，工作线程没有在处理这个连接时调用
+    int bytes_sent() const { return bytes_have_send; }   // 当前响应已经发送的字节
+    void trace_mark(RequestTrace::PHASE phase) { m_trace.mark(phase); }  // 记录当前请求到达某个阶段的时间
 
-private:
-    // 记录 HTTP 请求报文中相关的信息
+    // 以下供请求处理函数使用
+    METHOD method() const { return m_method; }
+    const char *url() const { return m_url; }           // 原始的请求地址
+    const char *path() const { return m_path; }         // URL 解码后的路径，不含查询串
+    const char *content() const { return m_string; }    // 请求体，没有时为 NULL
+    const SiteConfig &site() const { return *m_site; }
+    std::string &body() { return m_body; }
+    void set_content_type(const char *type) { m_content_type = type; }  // type 为静态字符串
+    void set_stream(BodyStream *stream) { m_stream = stream; }          // 响应结束后释放
 
-    char m_real_file[FILENAME_LEN];         // 本地资源文件路径
-    struct stat m_file_stat;                // 存储文件状态
-    char *m_file_address;                   // 内存映射地址
+    // WebSocket 握手完成后连接只在主线程处理
+    bool is_websocket() const { return m_ws && m_ws->established(); }
+    bool process_ws();                                   // 主线程解析读到的帧，广播收到的消息并发送
+    bool ws_send(const std::shared_ptr<const std::string> &frame);   // 主线程，追加一个序列化好的帧，等待 EPOLLOUT 发送
+    bool keepalive();                                    // 定时器超时时发送 ping，上一个 ping 还没有回复时返回 false
+    void ws_close();                                     // 连接关闭时退出广播、释放会话
 
-    char *m_url;                            // 请求行，请求地址
-    METHOD m_method;                        // 请求行，请求方法
-    char *m_version;                        // 请求行，请求协议,只支持 HTTP1.1
-    long m_content_length;                  // 请求头，请求体的长度
-    bool m_linger;                          // 请求头，保持长连接
-    char *m_host;                           // 请求头，客户机信息
-    char *m_string;                         // 存储请求头数据?
+    bool proxy_event();                                  // 主线程，转发中的上游连接上有事件，返回 false 时关闭连接
+    void release_sessions();                             // 定时器关闭连接时调用：退出 WebSocket 频道，关闭转发中的上游连接，释放限流表项
 
-    int m_sockfd;                           // 客户端的套接字
-    sockaddr_in m_address;                  // 客户端的信息
+    // 以下静态函数 HTTP/1.1 和 HTTP/2 共用
+    // 对请求地址的路径部分做 URL 解码，结果分配在 arena 中
+    static char *decode_path(Arena &arena, const char *url);
+    // 把路径映射到资源目录下的文件，成功返回 FILE_REQUEST，文件为空时 address 为 NULL
+    // cached_only 为 true 时只在路径和文件内容都在内核缓存中时映射，否则返回 BLOCKING_REQUEST
+    static HTTP_CODE map_file(Arena &arena, const SiteConfig &site, const char *path, struct stat &st, char *&address, bool cached_only = false);
+    // 错误响应的状态码和页面
+    static int error_page(HTTP_CODE code, const char *&page);
+
+private:
+    // ---------- 热数据：每次读写、解析都会访问，放在对象开头的缓存行中 ----------
+    // 读缓冲区放在对象之外，对象按缓存行对齐，users 数组中相邻的连接不共享缓存行，
+    // 不同线程处理相邻的连接时没有伪共享
 
-    char m_read_buf[READ_BUFFER_SIZE];      // 读缓冲区
+    char *m_read_buf;                       // 读缓冲区，第一次使用时分配，之后随 fd 复用
     int m_read_idx;                         // 表示读缓冲区中读入的客户端的最后一个字节的下一个位置。因为数据可能不是一次性读完
     int m_checked_idx;                      // 当前正在解析的字符正在读缓冲区的位置
     int m_start_line;                       // 当前正在解析的行的起始位置
+    CHECK_STATE m_check_state;              // 主状态机当前所处的位置
 
-    char m_write_buf[WRITE_BUFFER_SIZE];    // 写缓冲区
-    int m_write_idx;                        // 写缓冲区中待发送的字节数
-    struct iovec m_iv[2];                   // 用于 writev 函数。0 是响应头，1 是内容
-    int m_iv_count;                         // 分散的文件个数
-    int bytes_to_send;                      // 将要发送的字节
+    Arena m_arena;                          // 解析请求时的内存分配，init 时整体归还；在 m_out 之前构造，m_out 持有它的引用
+    BufferChain m_out;                      // 待发送的响应：响应头、文件映射、动态内容，内存来自 m_arena
     int bytes_have_send;                    // 已经发送的字节
 
-    CHECK_STATE m_check_state;              // 主状态机当前所处的位置
+    int m_sockfd;                           // 客户端的套接字
+    TlsConn *m_tls;                         // TLS 端口上的连接的 TLS 会话，明文连接为 NULL
+    bool m_tls_wait;                        // 上一次 read 没有得到新的数据
+    bool m_tls_wake;                        // 等待读时 OpenSSL 中还有数据，用 EPOLLOUT 唤醒
+    Http2Session *m_h2;                     // 切换到 HTTP/2 后的会话，HTTP/1.1 连接为 NULL
+    WsSession *m_ws;                        // 升级到 WebSocket 后的会话
+    BodyStream *m_stream;                   // 流式响应还没有生成完的响应体
+    ProxyConn *m_proxy;                     // 正在转发给上游的请求
+    METHOD m_method;                        // 请求行，请求方法
+    long m_content_length;                  // 请求头，请求体的长度
+    bool m_linger;                          // 请求头，保持长连接
+    bool m_admin;                           // 是否是管理端口上的连接
+    char *m_url;                            // 请求行，请求地址
+    char *m_path;                           // 请求地址中 URL 解码后的路径，不含查询串，分配在 m_arena 中
+    char *m_version;                        // 请求行，请求协议,只支持 HTTP1.1
+    char *m_host;                           // 请求头，客户机信息
+    char *m_http2_settings;                 // 请求头，HTTP2-Settings，和 Upgrade: h2c 一起出现时升级到 HTTP/2
+    bool m_upgrade_h2c;                     // 请求头，Upgrade 中是否有 h2c
+    bool m_upgrade_ws;                      // 请求头，Upgrade 中是否有 websocket
+    char *m_ws_key;                         // 请求头，Sec-WebSocket-Key
+    char *m_string;                         // 存储请求头数据?
+    char *m_file_address;                   // 内存映射地址
+
+    // ---------- 冷数据：每个请求最多访问一两次 ----------
+
+    struct stat m_file_stat;                // 存储文件状态
+    std::string m_body;                     // 动态生成的响应体
+    std::string m_chunk;                    // 流式响应当前的一段，前面留出 CHUNK_HEAD 字节写长度
+    const char *m_content_type;             // m_body 的类型，NULL 时为 text/plain
+    int m_header_start;                     // 读缓冲区中第一个请求头的位置，转发时原样取出
+    std::shared_ptr<const SiteConfig> m_site;   // 处理当前请求所用的配置快照
+    sockaddr_in m_address;                  // 客户端的信息
+    RequestTrace m_trace;                   // 当前请求各阶段的时间戳
+    int m_limit_slot;                       // ClientLimiter 中的表项，不限制时为 -1
+    bool m_inline;                          // 正在主线程内联处理，可能阻塞的请求返回 BLOCKING_REQUEST
+    bool m_parsed;                          // 当前请求已经解析完，交给线程池后从 do_request 继续
+    bool m_buf_owned;                       // 读缓冲区是否由自己分配
 
 private:
     void init();                                // 初始化新接受的连接，内部操作
+    bool tls_handshake();                       // 继续 TLS 握手，没有完成时按需要等待读写，失败返回 false
+    ssize_t send_out();                         // 发送 m_out，TLS 连接没有 kTLS 时由 SSL_write 加密
+    void rearm(int ev);                         // 重新注册 socket 上的事件（EPOLLONESHOT）
 
     LINE_STATUS parse_line();                   // 解析具体的行
     char *get_line() { return m_read_buf + m_start_line; }; // 返回行
@@ -139,17 +294,43 @@ private:
     HTTP_CODE process_read();                   // 解析 HTTP 请求
 
     HTTP_CODE do_request();                     // 根据请求，建立磁盘资源到内存的映射
+    HTTP_CODE upgrade_h2c();                    // 创建 HTTP/2 会话，当前请求成为流 1
+    bool is_h2_preface();                       // 读缓冲区是否以 HTTP/2 连接序言开头（prior knowledge）
+    void process_h2(HTTP_CODE refuse);          // 把读到的数据交给 HTTP/2 会话，生成要发送的帧
+    bool write_h2();                            // 发送 HTTP/2 帧，发送完后继续生成，直到窗口用完
+    HTTP_CODE upgrade_ws();                     // 创建 WebSocket 会话，101 发送完后加入频道
+    bool write_ws();                            // 发送 WebSocket 帧，没有发送完时同时等待读写
+    bool next_chunk();                          // 生成流式响应的下一段放入 m_out，响应体已经结束时返回 false
+    bool build_proxy_request();                 // 生成转发给上游的请求报文
+    bool write_proxy(ProxyConn::STATUS status); // 根据转发的进展继续等待、结束这个请求或者改为返回 502
+    HTTP_CODE do_user_request(bool login, const char *&page);   // 处理登录和注册，给出要返回的页面
+
+    // 内置的请求处理函数
+    static HTTP_CODE serve_file(HttpConn &conn, int arg);       // 资源目录下的文件
+    static HTTP_CODE serve_user(HttpConn &conn, int arg);       // 登录（arg 为 1）和注册的表单
+    static HTTP_CODE serve_metrics(HttpConn &conn, int arg);    // 运行时统计
+    static HTTP_CODE serve_trace(HttpConn &conn, int arg);      // 最近的请求，只在管理端口上
+    static HTTP_CODE serve_proxy(HttpConn &conn, int arg);      // 转发给 site().proxies[arg]
+    static const Router<Route> &admin_routes();                 // 管理端口的路由表，不随配置变化
     void unmap();                               // 解除映射，对内存映射区进行 munmap 操作
 
-    bool add_response(const char *format, ...);             // 将响应内容写入写缓冲区中
+    void count_status(int status);                          // 统计响应状态码
+    bool add_response(const char *format, ...);             // 将格式化的响应内容追加到 m_out
     bool add_status_line(int status, const char *title);    // 生成响应行
     bool add_content_length(int content_length);            // 响应头，内容长度
-    bool add_content_type();                                // 响应头，内容类型
+    bool add_content_type(const char *type);                // 响应头，内容类型
     bool add_linger();                                      // 响应头，是否保持长连接
     bool add_blank_line();                                  // 响应头，添加空行，分割响应头和内容
     bool add_headers(int content_length);                   // 生成响应头
-    bool add_content(const char *content);                  // 生成响应内容
+    bool add_content(const char *content);                  // 生成响应内容，content 为静态字符串，只引用不复制
     bool process_write(HTTP_CODE ret);                      // 根据解析的请求生成相应响应报文
+
+    friend class HttpConnBench;                             // 微基准不经过 socket，直接驱动解析状态机
+};
+
+// 一份配置对应的路由表，作为 SiteConfig 的一部分在重新加载配置时整体替换
+struct RouteTable {
+    Router<HttpConn::Route> router;
 };
 
 #endif // HTTP_CONN_H_
\ No newline at end of file
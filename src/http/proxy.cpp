@@ -0,0 +1,617 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/tcp.h>
+#include "proxy.h"
+#include "../core/metrics/metrics.h"
+#include "../core/tls/tls.h"
+
+int UpstreamPool::m_epollfd = -1;
+std::vector<UpstreamPool::Owner> UpstreamPool::m_owner;
+std::unordered_map<uint64_t, std::vector<int> > UpstreamPool::m_idle;
+std::vector<int> UpstreamPool::m_pipes;
+
+// 逐跳的头部只对一段连接有效，不转发
+static bool is_header(const char *line, size_t len, const char *name) {
+    return strlen(name) == len && strncasecmp(line, name, len) == 0;
+}
+
+static bool value_has(const char *value, size_t len, const char *token) {
+    std::string text(value, len);
+    return strcasestr(text.c_str(), token) != NULL;
+}
+
+
+// ---------- ChunkScanner ----------
+
+size_t ChunkScanner::scan(const char *data, size_t len) {
+    size_t i = 0;
+    while (i < len && m_state != DONE && m_state != ERROR) {
+        char c = data[i];
+        switch (m_state) {
+            case SIZE_START:
+            case SIZE:
+            {
+                int digit = (c >= '0' && c <= '9') ? c - '0' : (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                            (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+                if (digit >= 0) {
+                    m_state = (m_size >> 60) ? ERROR : SIZE;
+                    m_size = m_size << 4 | digit;
+                }
+                else if (m_state == SIZE_START) {
+                    m_state = ERROR;
+                }
+                else if (c == ';' || c == ' ' || c == '\t') {
+                    m_state = EXT;
+                }
+                else if (c == '\r') {
+                    m_state = SIZE_LF;
+                }
+                else {
+                    m_state = ERROR;
+                }
+                ++i;
+                break;
+            }
+            case EXT:
+            {
+                if (c == '\r') {
+                    m_state = SIZE_LF;
+                }
+                ++i;
+                break;
+            }
+            case SIZE_LF:
+            {
+                // 长度为 0 的块表示响应体结束，之后是 trailer
+                m_state = c != '\n' ? ERROR : m_size ? DATA : TRAILER;
+                ++i;
+                break;
+            }
+            case DATA:
+            {
+                // 块的数据整段跳过
+                size_t n = len - i < m_size ? len - i : m_size;
+                m_size -= n;
+                i += n;
+                if (m_size == 0) {
+                    m_state = DATA_CR;
+                }
+                break;
+            }
+            case DATA_CR:
+            {
+                m_state = c == '\r' ? DATA_LF : ERROR;
+                ++i;
+                break;
+            }
+            case DATA_LF:
+            {
+                m_state = c == '\n' ? SIZE_START : ERROR;
+                ++i;
+                break;
+            }
+            case TRAILER:
+            {
+                m_state = c == '\r' ? TRAILER_LF : TRAILER_LINE;
+                ++i;
+                break;
+            }
+            case TRAILER_LINE:
+            {
+                if (c == '\n') {
+                    m_state = TRAILER;
+                }
+                ++i;
+                break;
+            }
+            case TRAILER_LF:
+            {
+                m_state = c == '\n' ? DONE : ERROR;
+                ++i;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    return i;
+}
+
+
+// ---------- ProxyConn ----------
+
+ProxyConn::ProxyConn(HttpConn *conn, int clientfd, TlsConn *tls, const sockaddr_in &upstream, bool keepalive)
+    : m_conn(conn), m_clientfd(clientfd), m_tls(tls), m_addr(upstream), m_fd(-1), m_reused(false), m_retried(false),
+      m_state(STATE_INIT), m_sent(0), m_out_sent(0), m_body(BODY_NONE), m_remaining(0), m_piped(0),
+      m_status(0), m_bytes(0), m_keepalive(keepalive), m_upstream_keepalive(false) {
+    m_pipe[0] = m_pipe[1] = -1;
+}
+
+// 中途放弃（客户端关闭、超时）时上游连接上可能还有没读完的响应，不能复用
+// 工作线程生成请求后出错时也会在工作线程中释放，此时还没有取得上游连接和管道
+ProxyConn::~ProxyConn() {
+    if (m_fd >= 0) {
+        UpstreamPool::release(m_fd, false);
+    }
+    if (m_pipe[0] >= 0) {
+        if (m_piped == 0) {
+            UpstreamPool::put_pipe(m_pipe);
+        }
+        else {
+            close(m_pipe[0]);
+            close(m_pipe[1]);
+        }
+    }
+}
+
+ProxyConn::STATUS ProxyConn::resume() {
+    if (m_state == STATE_INIT) {
+        Metrics::add(Metrics::PROXY_REQUESTS);
+        return start(false);
+    }
+    if (m_state == STATE_BODY) {
+        return relay();
+    }
+    return AGAIN;
+}
+
+ProxyConn::STATUS ProxyConn::on_upstream() {
+    switch (m_state) {
+        case STATE_CONNECTING:
+        {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+                return BAD_GATEWAY;
+            }
+            m_state = STATE_SENDING;
+            return send_request();
+        }
+        case STATE_SENDING:
+            return send_request();
+        case STATE_HEADER:
+            return read_header();
+        case STATE_BODY:
+            return relay();
+        default:
+            return AGAIN;
+    }
+}
+
+ProxyConn::STATUS ProxyConn::start(bool fresh) {
+    m_fd = UpstreamPool::acquire(m_addr, m_conn, fresh, m_reused);
+    if (m_fd < 0) {
+        return BAD_GATEWAY;
+    }
+    m_sent = 0;
+    if (m_reused) {
+        m_state = STATE_SENDING;
+        return send_request();
+    }
+    // 非阻塞 connect，连接建立后可写
+    m_state = STATE_CONNECTING;
+    return AGAIN;
+}
+
+// 空闲连接可能在取出前刚被上游关闭（上游的空闲超时），还没有收到任何响应时换一个新连接重发
+// 只重发 GET，其他方法上游可能已经处理过
+ProxyConn::STATUS ProxyConn::retry_or_fail() {
+    if (!m_reused || m_retried || !m_in.empty() || m_request.compare(0, 4, "GET ") != 0) {
+        return BAD_GATEWAY;
+    }
+    m_retried = true;
+    UpstreamPool::release(m_fd, false);
+    m_fd = -1;
+    return start(true);
+}
+
+ProxyConn::STATUS ProxyConn::send_request() {
+    while (m_sent < m_request.size()) {
+        ssize_t n = send(m_fd, m_request.data() + m_sent, m_request.size() - m_sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                return wait_upstream(EPOLLOUT);
+            }
+            return retry_or_fail();
+        }
+        m_sent += n;
+    }
+    m_state = STATE_HEADER;
+    return wait_upstream(EPOLLIN);
+}
+
+ProxyConn::STATUS ProxyConn::read_header() {
+    char buf[4096];
+    while (1) {
+        size_t end = m_in.find("\r\n\r\n");
+        if (end != std::string::npos) {
+            if (!parse_header(end + 4)) {
+                return BAD_GATEWAY;
+            }
+            if (m_state == STATE_BODY) {
+                return relay();
+            }
+            // 1xx 中间响应已经丢弃，继续找最终的响应头
+            continue;
+        }
+        if (m_in.size() > MAX_HEADER) {
+            return BAD_GATEWAY;
+        }
+
+        ssize_t n = recv(m_fd, buf, sizeof(buf), 0);
+        if (n < 0 && errno == EAGAIN) {
+            return wait_upstream(EPOLLIN);
+        }
+        if (n <= 0) {
+            return m_in.empty() ? retry_or_fail() : BAD_GATEWAY;
+        }
+        m_in.append(buf, n);
+    }
+}
+
+// m_in 的前 end 字节是完整的响应头
+// 状态行统一为 HTTP/1.1，去掉逐跳的头部，按客户端连接重新生成 Connection；其余头部原样转发
+bool ProxyConn::parse_header(size_t end) {
+    const char *p = m_in.data();
+    if (end < 16 || strncmp(p, "HTTP/1.", 7) != 0) {
+        return false;
+    }
+    m_status = atoi(p + 9);
+    if (m_status < 100 || m_status > 999 || m_status == 101) {
+        return false;
+    }
+    if (m_status < 200) {
+        m_in.erase(0, end);
+        return true;
+    }
+
+    m_upstream_keepalive = p[7] != '0';
+    bool chunked = false;
+    bool has_length = false;
+    uint64_t length = 0;
+
+    size_t eol = m_in.find("\r\n");
+    m_out.assign("HTTP/1.1");
+    m_out.append(p + 8, eol + 2 - 8);
+    for (size_t pos = eol + 2; pos < end - 2; pos = eol + 2) {
+        eol = m_in.find("\r\n", pos);
+        const char *line = p + pos;
+        const char *colon = static_cast<const char *>(memchr(line, ':', eol - pos));
+        if (!colon) {
+            return false;
+        }
+        size_t name_len = colon - line;
+        const char *value = colon + 1;
+        value += strspn(value, " \t");
+        size_t value_len = p + eol - value;
+
+        if (is_header(line, name_len, "Content-Length")) {
+            has_length = true;
+            length = strtoull(value, NULL, 10);
+        }
+        else if (is_header(line, name_len, "Transfer-Encoding")) {
+            chunked = value_has(value, value_len, "chunked");
+        }
+        else if (is_header(line, name_len, "Connection")) {
+            if (value_has(value, value_len, "close")) {
+                m_upstream_keepalive = false;
+            }
+            else if (value_has(value, value_len, "keep-alive")) {
+                m_upstream_keepalive = true;
+            }
+            continue;
+        }
+        else if (is_header(line, name_len, "Keep-Alive") || is_header(line, name_len, "Proxy-Connection")) {
+            continue;
+        }
+        m_out.append(line, eol + 2 - pos);
+    }
+
+    if (m_status == 204 || m_status == 304) {
+        m_body = BODY_NONE;
+    }
+    else if (chunked) {
+        m_body = BODY_CHUNKED;
+    }
+    else if (has_length) {
+        m_body = length ? BODY_LENGTH : BODY_NONE;
+        m_remaining = length;
+    }
+    else {
+        // 响应体以上游关闭连接结束，客户端也只能靠关闭连接知道响应结束
+        m_body = BODY_EOF;
+        m_upstream_keepalive = false;
+        m_keepalive = false;
+    }
+    m_out.append(m_keepalive ? "Connection:keep-alive\r\n\r\n" : "Connection:close\r\n\r\n");
+
+    // 和响应头一起读到的响应体跟在改写后的响应头后面发送，超出响应的部分说明上游不可靠，不再复用
+    const char *rest = p + end;
+    size_t rest_len = m_in.size() - end;
+    size_t used = rest_len;
+    if (m_body == BODY_NONE) {
+        used = 0;
+    }
+    else if (m_body == BODY_LENGTH) {
+        used = rest_len < m_remaining ? rest_len : m_remaining;
+        m_remaining -= used;
+    }
+    else if (m_body == BODY_CHUNKED) {
+        used = m_chunks.scan(rest, rest_len);
+        if (m_chunks.error()) {
+            return false;
+        }
+    }
+    m_out.append(rest, used);
+    if (used < rest_len) {
+        m_upstream_keepalive = false;
+    }
+    m_in.clear();
+    m_state = STATE_BODY;
+    return true;
+}
+
+ProxyConn::STATUS ProxyConn::relay() {
+    STATUS ret = flush();
+    if (ret != DONE) {
+        return ret;
+    }
+    switch (m_body) {
+        case BODY_NONE:
+            return finish();
+        case BODY_CHUNKED:
+            return copy_body();
+        default:
+            return m_tls ? copy_body() : splice_body();
+    }
+}
+
+ProxyConn::STATUS ProxyConn::flush() {
+    while (m_out_sent < m_out.size()) {
+        const char *data = m_out.data() + m_out_sent;
+        size_t len = m_out.size() - m_out_sent;
+        ssize_t n = m_tls ? m_tls->write(data, len) : send(m_clientfd, data, len, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                return wait_client();
+            }
+            return FAILED;
+        }
+        m_out_sent += n;
+        m_bytes += n;
+        Metrics::add(Metrics::BYTES_OUT, n);
+    }
+    m_out.clear();
+    m_out_sent = 0;
+    return DONE;
+}
+
+// 上游 socket -> 管道 -> 客户端 socket，数据只在内核中移动
+// 管道中有数据时先送到客户端，客户端发不动时停止从上游读，等客户端可写
+ProxyConn::STATUS ProxyConn::splice_body() {
+    if (m_pipe[0] < 0 && !UpstreamPool::get_pipe(m_pipe)) {
+        m_pipe[0] = m_pipe[1] = -1;
+        return FAILED;
+    }
+    while (1) {
+        if (m_piped > 0) {
+            ssize_t n = splice(m_pipe[0], NULL, m_clientfd, NULL, m_piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                if (errno == EAGAIN) {
+                    return wait_client();
+                }
+                return FAILED;
+            }
+            m_piped -= n;
+            m_bytes += n;
+            Metrics::add(Metrics::BYTES_OUT, n);
+            continue;
+        }
+        if (m_body == BODY_LENGTH && m_remaining == 0) {
+            return finish();
+        }
+
+        size_t want = PIPE_CHUNK;
+        if (m_body == BODY_LENGTH && m_remaining < want) {
+            want = m_remaining;
+        }
+        ssize_t n = splice(m_fd, NULL, m_pipe[1], NULL, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n == 0) {
+            // 有长度的响应体没有收完上游就关闭了，客户端已经收到响应头，只能关闭连接
+            return m_body == BODY_EOF ? finish() : FAILED;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN) {
+                return wait_upstream(EPOLLIN);
+            }
+            return FAILED;
+        }
+        m_piped += n;
+        if (m_body == BODY_LENGTH) {
+            m_remaining -= n;
+        }
+    }
+}
+
+// 读到用户空间再转发：chunked 响应体需要逐字节找到结尾才知道上游连接能否复用；
+// 客户端连接由 OpenSSL 加密时数据要经过 SSL_write，也不能 splice
+ProxyConn::STATUS ProxyConn::copy_body() {
+    char buf[16384];
+    while (1) {
+        STATUS ret = flush();
+        if (ret != DONE) {
+            return ret;
+        }
+        if (m_body == BODY_CHUNKED ? m_chunks.done() : m_body == BODY_LENGTH && m_remaining == 0) {
+            return finish();
+        }
+        size_t want = sizeof(buf);
+        if (m_body == BODY_LENGTH && m_remaining < want) {
+            want = m_remaining;
+        }
+        ssize_t n = recv(m_fd, buf, want, 0);
+        if (n < 0 && errno == EAGAIN) {
+            return wait_upstream(EPOLLIN);
+        }
+        if (n == 0 && m_body == BODY_EOF) {
+            return finish();
+        }
+        if (n <= 0) {
+            return FAILED;
+        }
+        size_t used = n;
+        if (m_body == BODY_CHUNKED) {
+            used = m_chunks.scan(buf, n);
+            if (m_chunks.error()) {
+                return FAILED;
+            }
+            if (used < (size_t)n) {
+                m_upstream_keepalive = false;
+            }
+        }
+        else if (m_body == BODY_LENGTH) {
+            m_remaining -= n;
+        }
+        m_out.assign(buf, used);
+    }
+}
+
+ProxyConn::STATUS ProxyConn::finish() {
+    if (m_pipe[0] >= 0) {
+        UpstreamPool::put_pipe(m_pipe);
+        m_pipe[0] = m_pipe[1] = -1;
+    }
+    UpstreamPool::release(m_fd, m_upstream_keepalive);
+    m_fd = -1;
+    return DONE;
+}
+
+ProxyConn::STATUS ProxyConn::wait_upstream(uint32_t ev) {
+    UpstreamPool::arm(m_fd, ev);
+    return AGAIN;
+}
+
+// 客户端可写时事件循环调用 HttpConn::write，再回到 resume
+ProxyConn::STATUS ProxyConn::wait_client() {
+    UpstreamPool::arm(m_clientfd, EPOLLOUT);
+    return AGAIN;
+}
+
+
+// ---------- UpstreamPool ----------
+
+HttpConn *UpstreamPool::on_event(int fd) {
+    Owner &owner = m_owner[fd];
+    if (owner.conn) {
+        return owner.conn;
+    }
+    // 空闲连接上不应该有任何数据，可读说明上游关闭了连接
+    std::vector<int> &idle = m_idle[owner.key];
+    for (size_t i = 0; i < idle.size(); ++i) {
+        if (idle[i] == fd) {
+            idle.erase(idle.begin() + i);
+            Metrics::add(Metrics::PROXY_IDLE, -1);
+            break;
+        }
+    }
+    close_fd(fd);
+    return NULL;
+}
+
+int UpstreamPool::acquire(const sockaddr_in &addr, HttpConn *conn, bool fresh, bool &reused) {
+    uint64_t k = key(addr);
+    std::vector<int> &idle = m_idle[k];
+    if (!fresh && !idle.empty()) {
+        // 最近放回的连接最不可能已经被上游的空闲超时关闭
+        int fd = idle.back();
+        idle.pop_back();
+        Metrics::add(Metrics::PROXY_IDLE, -1);
+        m_owner[fd].conn = conn;
+        reused = true;
+        return fd;
+    }
+
+    reused = false;
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&addr), sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = EPOLLOUT | EPOLLONESHOT | EPOLLRDHUP;
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        close(fd);
+        return -1;
+    }
+    if ((size_t)fd >= m_owner.size()) {
+        m_owner.resize(fd + 1);
+    }
+    Owner &owner = m_owner[fd];
+    owner.used = true;
+    owner.conn = conn;
+    owner.key = k;
+    Metrics::add(Metrics::PROXY_CONNECTS);
+    return fd;
+}
+
+void UpstreamPool::release(int fd, bool reusable) {
+    Owner &owner = m_owner[fd];
+    owner.conn = NULL;
+    std::vector<int> &idle = m_idle[owner.key];
+    if (reusable && idle.size() < MAX_IDLE) {
+        idle.push_back(fd);
+        Metrics::add(Metrics::PROXY_IDLE);
+        // 空闲期间只关心上游关闭连接
+        arm(fd, EPOLLIN);
+        return;
+    }
+    close_fd(fd);
+}
+
+void UpstreamPool::arm(int fd, uint32_t ev) {
+    epoll_event event;
+    event.data.fd = fd;
+    event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
+    epoll_ctl(m_epollfd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void UpstreamPool::close_fd(int fd) {
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    m_owner[fd].used = false;
+    m_owner[fd].conn = NULL;
+}
+
+bool UpstreamPool::get_pipe(int fds[2]) {
+    if (!m_pipes.empty()) {
+        fds[1] = m_pipes.back();
+        m_pipes.pop_back();
+        fds[0] = m_pipes.back();
+        m_pipes.pop_back();
+        return true;
+    }
+    return pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0;
+}
+
+// 只放回已经排空的管道
+void UpstreamPool::put_pipe(int fds[2]) {
+    if (m_pipes.size() < MAX_PIPES * 2) {
+        m_pipes.push_back(fds[0]);
+        m_pipes.push_back(fds[1]);
+        return;
+    }
+    close(fds[0]);
+    close(fds[1]);
+}
@@ -0,0 +1,180 @@
+#ifndef PROXY_H_
+#define PROXY_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <netinet/in.h>
+
+class HttpConn;
+class TlsConn;
+
+// 在原样转发的 chunked 响应体中找到响应的结尾（长度为 0 的块及其后的 trailer）
+class ChunkScanner {
+public:
+    ChunkScanner() : m_state(SIZE_START), m_size(0) {}
+
+    // 扫描 len 字节，返回其中属于当前响应的字节数，小于 len 时响应已经结束
+    size_t scan(const char *data, size_t len);
+    bool done() const { return m_state == DONE; }
+    bool error() const { return m_state == ERROR; }
+
+private:
+    enum STATE
+    {
+        SIZE_START = 0, // 块长度的第一位，长度不能为空
+        SIZE,           // 块长度，十六进制
+        EXT,            // 块扩展，直到行尾
+        SIZE_LF,
+        DATA,
+        DATA_CR,
+        DATA_LF,
+        TRAILER,        // trailer 的行首，空行表示结束
+        TRAILER_LINE,
+        TRAILER_LF,
+        DONE,
+        ERROR
+    };
+
+    STATE m_state;
+    uint64_t m_size;    // 当前块剩余的字节数
+};
+
+// 转发给上游的一个请求及其响应
+// 工作线程在 process_write 中生成转发的请求，之后只在主线程访问：取得上游连接、发送请求、
+// 读取响应头并改写后发给客户端、转发响应体
+// 有长度或者以关闭连接结束的响应体用 splice 经过管道从上游 socket 直接送到客户端 socket，不复制到用户空间；
+// chunked 响应体需要找到结尾，读到用户空间原样转发；客户端是没有 kTLS 的 TLS 连接时响应体也要读到用户空间，经过 SSL_write 发送
+class ProxyConn {
+public:
+    enum STATUS
+    {
+        AGAIN = 0,      // 在等待上游或客户端的事件，已经注册到 epoll
+        DONE,           // 响应已经完整转发，上游连接已经放回连接池
+        FAILED,         // 已经向客户端发送了部分响应后出错，只能关闭客户端连接
+        BAD_GATEWAY     // 还没有向客户端发送任何数据时上游出错，由调用者返回 502
+    };
+
+    static const size_t MAX_HEADER = 16384;     // 上游响应头的最大长度
+    static const size_t PIPE_CHUNK = 65536;     // 一次 splice 的最大字节数，管道的默认容量
+
+    // tls 不为 NULL 时发给客户端的数据由它加密
+    ProxyConn(HttpConn *conn, int clientfd, TlsConn *tls, const sockaddr_in &upstream, bool keepalive);
+    ~ProxyConn();
+
+    // 转发给上游的请求报文，由工作线程生成
+    std::string &request() { return m_request; }
+
+    STATUS resume();                    // 第一次调用时开始转发，之后在客户端可写时继续
+    STATUS on_upstream();               // 上游连接上有事件
+
+    bool keepalive() const { return m_keepalive; }  // 响应结束后客户端连接能否继续使用
+    int status() const { return m_status; }
+    long bytes() const { return m_bytes; }          // 发给客户端的字节数
+
+private:
+    enum STATE
+    {
+        STATE_INIT = 0,
+        STATE_CONNECTING,
+        STATE_SENDING,          // 发送请求
+        STATE_HEADER,           // 读取响应头
+        STATE_BODY              // 转发响应体
+    };
+
+    enum BODY
+    {
+        BODY_NONE = 0,
+        BODY_LENGTH,            // Content-Length
+        BODY_CHUNKED,
+        BODY_EOF                // 没有长度，上游关闭连接表示结束
+    };
+
+    STATUS start(bool fresh);           // 取得上游连接，fresh 为 true 时不使用空闲连接
+    STATUS retry_or_fail();             // 复用的连接已经被上游关闭时换一个新连接重试一次
+    STATUS send_request();
+    STATUS read_header();
+    bool parse_header(size_t end);      // 改写响应头放入 m_out
+    STATUS relay();
+    STATUS flush();                     // 把 m_out 发给客户端
+    STATUS splice_body();
+    STATUS copy_body();
+    STATUS finish();
+
+    STATUS wait_upstream(uint32_t ev);
+    STATUS wait_client();
+
+    HttpConn *m_conn;
+    int m_clientfd;
+    TlsConn *m_tls;
+    sockaddr_in m_addr;
+    int m_fd;                   // 上游连接
+    bool m_reused;              // 上游连接来自连接池
+    bool m_retried;
+    STATE m_state;
+
+    std::string m_request;
+    size_t m_sent;
+    std::string m_in;           // 读取中的响应头
+    std::string m_out;          // 待发给客户端的数据：改写后的响应头、chunked 的响应体
+    size_t m_out_sent;
+
+    BODY m_body;
+    uint64_t m_remaining;       // BODY_LENGTH 还没有读取的字节
+    ChunkScanner m_chunks;
+    int m_pipe[2];
+    size_t m_piped;             // 管道中还没有送到客户端的字节
+
+    int m_status;
+    long m_bytes;
+    bool m_keepalive;
+    bool m_upstream_keepalive;
+};
+
+// 上游连接池，只在主线程访问
+// 每个上游地址保留一组空闲的长连接，空闲连接仍注册在 epoll 中，被上游关闭时移除
+// 正在使用的上游连接记录对应的客户端连接，事件循环据此把上游 fd 上的事件交给它
+class UpstreamPool {
+public:
+    static const size_t MAX_IDLE = 32;          // 每个上游保留的空闲连接数
+    static const size_t MAX_PIPES = 64;         // 保留的空闲管道数
+
+    static void init(int epollfd) { m_epollfd = epollfd; }
+
+    // fd 是否是上游连接（正在使用或空闲）
+    static bool owns(int fd) { return fd >= 0 && (size_t)fd < m_owner.size() && m_owner[fd].used; }
+    // 上游连接上有事件：正在使用的返回对应的客户端连接；空闲连接上有事件说明被上游关闭或者出错，关闭并返回 NULL
+    static HttpConn *on_event(int fd);
+
+    // 取得一个到 addr 的连接并注册到 epoll（等待可写），优先使用空闲连接；新建的连接用非阻塞 connect
+    static int acquire(const sockaddr_in &addr, HttpConn *conn, bool fresh, bool &reused);
+    // 响应结束后放回连接池，reusable 为 false 或者空闲连接已满时关闭
+    static void release(int fd, bool reusable);
+    // 重新注册 fd 上关心的事件（EPOLLONESHOT）
+    static void arm(int fd, uint32_t ev);
+
+    // 用于 splice 的非阻塞管道
+    static bool get_pipe(int fds[2]);
+    static void put_pipe(int fds[2]);
+
+private:
+    struct Owner {
+        bool used;
+        HttpConn *conn;         // 空闲时为 NULL
+        uint64_t key;           // 所属的上游
+    };
+
+    static uint64_t key(const sockaddr_in &addr) {
+        return (uint64_t)addr.sin_addr.s_addr << 16 | addr.sin_port;
+    }
+    static void close_fd(int fd);
+
+    static int m_epollfd;
+    static std::vector<Owner> m_owner;                                  // 按 fd 下标
+    static std::unordered_map<uint64_t, std::vector<int> > m_idle;      // 每个上游的空闲连接，后进先出
+    static std::vector<int> m_pipes;                                    // 空闲管道，两个 fd 一组
+};
+
+#endif // PROXY_H_
@@ -0,0 +1,155 @@
+#ifndef ROUTER_H_
+#define ROUTER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+// 按路径分发请求的路由表，T 为路由对应的处理函数等数据
+// 路由分为完整匹配（EXACT）和前缀匹配（PREFIX），查找时完整匹配优先，其次是最长的前缀，与注册的顺序无关
+// 前缀按路径段匹配：前缀以 '/' 结尾，或者路径在前缀之后结束或紧跟 '/' 时才算匹配，/api 匹配 /api/x 而不匹配 /apiary
+// add 之后调用 compile 把所有路由编译成压缩前缀树（radix tree）：节点放在一个数组中，边上的字符串放在
+// 一个字符串中，同一节点的子节点连续存放并按首字符排序。查找只沿路径走一遍，耗时与路由数量无关，不分配内存
+// 反向代理的前缀来自配置文件，重新加载配置时还会变化，所以树在运行时编译，没有做成 constexpr；静态的内置路由是 constexpr 数组
+// compile 之后只读，可以被多个线程同时查找
+template <typename T>
+class Router {
+public:
+    enum MATCH
+    {
+        EXACT = 0,
+        PREFIX
+    };
+
+    // 同一个 pattern 和 match 注册多次时后注册的生效
+    void add(const std::string &pattern, MATCH match, const T &value) {
+        Pending p = {pattern, match, (int32_t)m_values.size()};
+        m_pending.push_back(p);
+        m_values.push_back(value);
+    }
+
+    void compile() {
+        std::stable_sort(m_pending.begin(), m_pending.end(),
+                         [](const Pending &a, const Pending &b) { return a.pattern < b.pattern; });
+        m_nodes.clear();
+        m_labels.clear();
+        Node root = {0, 0, 0, 0, -1, -1};
+        m_nodes.push_back(root);
+        build(0, 0, m_pending.size(), 0);
+    }
+
+    // path 以 '\0' 结尾，没有匹配的路由时返回 NULL
+    const T *find(const char *path) const {
+        if (m_nodes.empty()) {
+            return NULL;
+        }
+        const char *labels = m_labels.data();
+        int32_t best = m_nodes[0].prefix;
+        const Node *node = &m_nodes[0];
+        const char *p = path;
+        while (true) {
+            if (*p == '\0') {
+                if (node->exact >= 0) {
+                    best = node->exact;
+                }
+                break;
+            }
+            // 子节点按边的首字符排序，二分查找
+            uint32_t lo = node->first_child, hi = lo + node->child_count;
+            unsigned char c = *p;
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) / 2;
+                if ((unsigned char)labels[m_nodes[mid].label] < c) {
+                    lo = mid + 1;
+                }
+                else {
+                    hi = mid;
+                }
+            }
+            if (lo == node->first_child + node->child_count || (unsigned char)labels[m_nodes[lo].label] != c) {
+                break;
+            }
+            const Node *child = &m_nodes[lo];
+            // 路径比边短时在 '\0' 处就不相等
+            uint32_t i = 1;
+            while (i < child->label_len && p[i] == labels[child->label + i]) {
+                ++i;
+            }
+            if (i < child->label_len) {
+                break;
+            }
+            p += child->label_len;
+            node = child;
+            if (node->prefix >= 0 && (*p == '\0' || *p == '/' || p[-1] == '/')) {
+                best = node->prefix;
+            }
+        }
+        return best >= 0 ? &m_values[best] : NULL;
+    }
+
+    size_t size() const { return m_values.size(); }
+    size_t nodes() const { return m_nodes.size(); }
+
+private:
+    struct Node {
+        uint32_t label;         // 从父节点到这里的边在 m_labels 中的起点，根节点没有边
+        uint32_t label_len;
+        uint32_t first_child;   // 子节点在 m_nodes 中连续存放
+        uint32_t child_count;
+        int32_t exact;          // 路径正好在这里结束时的路由，-1 表示没有
+        int32_t prefix;         // 路径经过这里时的前缀路由
+    };
+
+    struct Pending {
+        std::string pattern;
+        MATCH match;
+        int32_t value;          // 在 m_values 中的下标
+    };
+
+    // [begin, end) 的路由有相同的前 depth 个字符，即节点 n 所代表的路径
+    void build(uint32_t n, size_t begin, size_t end, size_t depth) {
+        // 排序后正好在这个节点结束的路由排在最前面
+        while (begin < end && m_pending[begin].pattern.size() == depth) {
+            const Pending &p = m_pending[begin++];
+            (p.match == EXACT ? m_nodes[n].exact : m_nodes[n].prefix) = p.value;
+        }
+        // 其余的按第 depth 个字符分组，每组一个子节点
+        std::vector<std::pair<size_t, size_t> > groups;
+        for (size_t i = begin; i < end;) {
+            size_t j = i + 1;
+            while (j < end && m_pending[j].pattern[depth] == m_pending[i].pattern[depth]) {
+                ++j;
+            }
+            groups.push_back(std::make_pair(i, j));
+            i = j;
+        }
+        uint32_t first = m_nodes.size();
+        m_nodes[n].first_child = first;
+        m_nodes[n].child_count = groups.size();
+        Node empty = {0, 0, 0, 0, -1, -1};
+        m_nodes.resize(first + groups.size(), empty);
+        for (size_t k = 0; k < groups.size(); ++k) {
+            // 有序时组内第一个和最后一个的公共前缀就是整组的公共前缀
+            const std::string &a = m_pending[groups[k].first].pattern;
+            const std::string &b = m_pending[groups[k].second - 1].pattern;
+            size_t len = 1;
+            while (depth + len < a.size() && depth + len < b.size() && a[depth + len] == b[depth + len]) {
+                ++len;
+            }
+            m_nodes[first + k].label = m_labels.size();
+            m_nodes[first + k].label_len = len;
+            m_labels.append(a, depth, len);
+            build(first + k, groups[k].first, groups[k].second, depth + len);
+        }
+    }
+
+    std::vector<Pending> m_pending;     // 注册的路由，compile 时排序
+    std::vector<T> m_values;
+    std::vector<Node> m_nodes;          // m_nodes[0] 为根节点
+    std::string m_labels;
+};
+
+#endif // ROUTER_H_
@@ -0,0 +1,356 @@
+#include <cstring>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "websocket.h"
+#include "http_conn.h"
+
+std::unordered_map<std::string, std::vector<HttpConn *> > WsHub::m_channels;
+std::vector<WsHub::Pending> WsHub::m_queue;
+Locker WsHub::m_lock;
+int WsHub::m_eventfd = -1;
+
+// ---------- 握手 ----------
+
+// SHA-1，只用于计算握手的 Sec-WebSocket-Accept
+static void sha1(const unsigned char *data, size_t len, unsigned char digest[20]) {
+    uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    // 补位：0x80，若干 0，最后 8 字节为位长度
+    std::string msg(reinterpret_cast<const char *>(data), len);
+    msg.push_back((char)0x80);
+    while (msg.size() % 64 != 56) {
+        msg.push_back(0);
+    }
+    uint64_t bits = (uint64_t)len * 8;
+    for (int i = 7; i >= 0; --i) {
+        msg.push_back((char)(bits >> (i * 8)));
+    }
+
+    for (size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[80];
+        const unsigned char *p = reinterpret_cast<const unsigned char *>(msg.data()) + off;
+        for (int i = 0; i < 16; ++i) {
+            w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+        }
+        for (int i = 16; i < 80; ++i) {
+            uint32_t t = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+            w[i] = t << 1 | t >> 31;
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            }
+            else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            }
+            else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            }
+            else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            uint32_t t = (a << 5 | a >> 27) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = b << 30 | b >> 2;
+            b = a;
+            a = t;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+    for (int i = 0; i < 5; ++i) {
+        digest[i * 4] = h[i] >> 24;
+        digest[i * 4 + 1] = h[i] >> 16;
+        digest[i * 4 + 2] = h[i] >> 8;
+        digest[i * 4 + 3] = h[i];
+    }
+}
+
+std::string WsSession::accept_key(const char *key) {
+    static const char guid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string text(key, strcspn(key, " \t"));
+    text += guid;
+    unsigned char digest[20];
+    sha1(reinterpret_cast<const unsigned char *>(text.data()), text.size(), digest);
+
+    std::string out;
+    for (int i = 0; i < 20; i += 3) {
+        uint32_t v = digest[i] << 16 | (i + 1 < 20 ? digest[i + 1] << 8 : 0) | (i + 2 < 20 ? digest[i + 2] : 0);
+        out.push_back(table[v >> 18 & 0x3f]);
+        out.push_back(table[v >> 12 & 0x3f]);
+        out.push_back(i + 1 < 20 ? table[v >> 6 & 0x3f] : '=');
+        out.push_back(i + 2 < 20 ? table[v & 0x3f] : '=');
+    }
+    return out;
+}
+
+
+// ---------- 帧 ----------
+
+std::shared_ptr<const std::string> WsSession::frame(OPCODE op, const char *data, size_t len) {
+    std::shared_ptr<std::string> out(new std::string);
+    out->reserve(len + 10);
+    out->push_back((char)(0x80 | op));
+    if (len < 126) {
+        out->push_back((char)len);
+    }
+    else if (len < 65536) {
+        out->push_back((char)126);
+        out->push_back((char)(len >> 8));
+        out->push_back((char)len);
+    }
+    else {
+        out->push_back((char)127);
+        for (int i = 7; i >= 0; --i) {
+            out->push_back((char)((uint64_t)len >> (i * 8)));
+        }
+    }
+    out->append(data, len);
+    return out;
+}
+
+void WsSession::unmask(char *data, size_t len, const uint8_t mask[4], size_t offset) {
+    // 按 offset 轮转掩码，之后每个位置 i 用 rotated[i % 4]
+    uint8_t rotated[4];
+    for (int j = 0; j < 4; ++j) {
+        rotated[j] = mask[(offset + j) & 3];
+    }
+    uint32_t m32;
+    memcpy(&m32, rotated, 4);
+
+    size_t i = 0;
+#if defined(__AVX2__)
+    __m256i m256 = _mm256_set1_epi32((int)m32);
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + i), _mm256_xor_si256(v, m256));
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i m128 = _mm_set1_epi32((int)m32);
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), _mm_xor_si128(v, m128));
+    }
+#endif
+    // 没有 SIMD 时一次 8 字节
+    uint64_t m64 = (uint64_t)m32 << 32 | m32;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t v;
+        memcpy(&v, data + i, 8);
+        v ^= m64;
+        memcpy(data + i, &v, 8);
+    }
+    // 前面每次处理 4 的倍数个字节，剩下的部分仍从 rotated[0] 开始
+    for (; i < len; ++i) {
+        data[i] ^= rotated[i & 3];
+    }
+}
+
+bool WsSession::fail(uint16_t code, BufferChain &out) {
+    if (!m_closing) {
+        char payload[2] = {(char)(code >> 8), (char)code};
+        out.append_blob(frame(CLOSE, payload, 2));
+        m_closing = true;
+    }
+    m_in.clear();
+    return false;
+}
+
+bool WsSession::feed(const char *data, size_t len, BufferChain &out, std::vector<Message> &messages) {
+    if (m_closing) {
+        return false;
+    }
+    m_in.append(data, len);
+
+    size_t pos = 0;
+    while (m_in.size() - pos >= 2) {
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(m_in.data()) + pos;
+        size_t left = m_in.size() - pos;
+        bool fin = p[0] & 0x80;
+        OPCODE op = static_cast<OPCODE>(p[0] & 0x0f);
+        // 没有协商扩展，RSV 位必须为 0；客户端的帧必须加掩码
+        if ((p[0] & 0x70) || !(p[1] & 0x80)) {
+            return fail(1002, out);
+        }
+
+        uint64_t payload_len = p[1] & 0x7f;
+        size_t header = 2;
+        if (payload_len == 126) {
+            if (left < 4) {
+                break;
+            }
+            payload_len = (uint64_t)p[2] << 8 | p[3];
+            header = 4;
+        }
+        else if (payload_len == 127) {
+            if (left < 10) {
+                break;
+            }
+            payload_len = 0;
+            for (int i = 0; i < 8; ++i) {
+                payload_len = payload_len << 8 | p[2 + i];
+            }
+            header = 10;
+        }
+        if (payload_len > MAX_MESSAGE) {
+            return fail(1009, out);
+        }
+        const uint8_t *mask = p + header;
+        header += 4;
+        if (left < header + payload_len) {
+            break;
+        }
+
+        char *payload = &m_in[pos + header];
+        unmask(payload, payload_len, mask);
+        pos += header + payload_len;
+
+        if (op & 0x8) {
+            // 控制帧不能分片，负载不超过 125 字节，可以夹在分片消息中间
+            if (!fin || payload_len > 125) {
+                return fail(1002, out);
+            }
+            if (op == PING) {
+                out.append_blob(frame(PONG, payload, payload_len));
+            }
+            else if (op == PONG) {
+                m_awaiting_pong = false;
+            }
+            else if (op == CLOSE) {
+                // 回复同样的关闭原因，发送完后关闭连接
+                out.append_blob(frame(CLOSE, payload, payload_len < 2 ? payload_len : 2));
+                m_closing = true;
+                m_in.clear();
+                return false;
+            }
+            else {
+                return fail(1002, out);
+            }
+            continue;
+        }
+
+        if (op == TEXT || op == BINARY) {
+            if (m_msg_op != CONTINUATION) {
+                return fail(1002, out);
+            }
+            m_msg_op = op;
+            m_msg.assign(payload, payload_len);
+        }
+        else if (op == CONTINUATION) {
+            if (m_msg_op == CONTINUATION) {
+                return fail(1002, out);
+            }
+            if (m_msg.size() + payload_len > MAX_MESSAGE) {
+                return fail(1009, out);
+            }
+            m_msg.append(payload, payload_len);
+        }
+        else {
+            return fail(1002, out);
+        }
+
+        if (fin) {
+            messages.push_back(Message(m_msg_op, std::string()));
+            messages.back().second.swap(m_msg);
+            m_msg_op = CONTINUATION;
+        }
+    }
+
+    m_in.erase(0, pos);
+    return true;
+}
+
+
+// ---------- 广播 ----------
+
+bool WsHub::init(int epollfd) {
+    m_eventfd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_eventfd < 0) {
+        return false;
+    }
+    epoll_event event;
+    event.data.fd = m_eventfd;
+    event.events = EPOLLIN;
+    return epoll_ctl(epollfd, EPOLL_CTL_ADD, m_eventfd, &event) == 0;
+}
+
+void WsHub::subscribe(HttpConn *conn, const std::string &channel) {
+    m_channels[channel].push_back(conn);
+    Metrics::add(Metrics::WEBSOCKET_ACTIVE);
+}
+
+void WsHub::unsubscribe(HttpConn *conn, const std::string &channel) {
+    std::unordered_map<std::string, std::vector<HttpConn *> >::iterator it = m_channels.find(channel);
+    if (it == m_channels.end()) {
+        return;
+    }
+    std::vector<HttpConn *> &conns = it->second;
+    for (size_t i = 0; i < conns.size(); ++i) {
+        if (conns[i] == conn) {
+            conns[i] = conns.back();
+            conns.pop_back();
+            Metrics::add(Metrics::WEBSOCKET_ACTIVE, -1);
+            break;
+        }
+    }
+    if (conns.empty()) {
+        m_channels.erase(it);
+    }
+}
+
+size_t WsHub::broadcast(const std::string &channel, WsSession::OPCODE op, const char *data, size_t len) {
+    std::unordered_map<std::string, std::vector<HttpConn *> >::iterator it = m_channels.find(channel);
+    if (it == m_channels.end()) {
+        return 0;
+    }
+    // 帧只序列化一次，每个连接的发送链表引用同一个 shared_ptr，最后一个连接发送完后释放
+    std::shared_ptr<const std::string> frame = WsSession::frame(op, data, len);
+    std::vector<HttpConn *> &conns = it->second;
+    for (size_t i = 0; i < conns.size(); ++i) {
+        conns[i]->ws_send(frame);
+    }
+    return conns.size();
+}
+
+void WsHub::publish(const std::string &channel, WsSession::OPCODE op, const std::string &data) {
+    if (m_eventfd < 0) {
+        return;
+    }
+    m_lock.lock();
+    Pending pending = {channel, op, data};
+    m_queue.push_back(pending);
+    m_lock.unlock();
+    uint64_t one = 1;
+    if (::write(m_eventfd, &one, sizeof(one)) < 0) {
+        // 计数器已满时主线程一定会被唤醒，忽略
+    }
+}
+
+void WsHub::dispatch() {
+    uint64_t n;
+    if (::read(m_eventfd, &n, sizeof(n)) < 0) {
+        return;
+    }
+    std::vector<Pending> queue;
+    m_lock.lock();
+    queue.swap(m_queue);
+    m_lock.unlock();
+    for (size_t i = 0; i < queue.size(); ++i) {
+        broadcast(queue[i].channel, queue[i].op, queue[i].data.data(), queue[i].data.size());
+    }
+}
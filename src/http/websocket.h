@@ -0,0 +1,103 @@
+#ifndef WEBSOCKET_H_
+#define WEBSOCKET_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "../core/buffer/buffer_chain.h"
+#include "../core/lock/locker.h"
+
+class HttpConn;
+
+// 一个 WebSocket 连接（RFC 6455）的帧解析状态
+// 握手完成后连接只在主线程处理：读到的帧直接在主线程解析，不进入线程池
+class WsSession {
+public:
+    enum OPCODE
+    {
+        CONTINUATION = 0x0,
+        TEXT = 0x1,
+        BINARY = 0x2,
+        CLOSE = 0x8,
+        PING = 0x9,
+        PONG = 0xa
+    };
+
+    typedef std::pair<OPCODE, std::string> Message;
+
+    static const size_t MAX_MESSAGE = 1 << 20;      // 收到的一条消息（包括分片）的上限
+    static const size_t MAX_PENDING = 4 << 20;      // 待发送的字节超过这个值的慢连接直接关闭
+    static const size_t MAX_RETAINED = 256 << 10;   // 输出一直没有发送完时，从 Arena 分配的内存超过这个值就整理一次
+
+    explicit WsSession(const char *channel) : m_channel(channel), m_msg_op(CONTINUATION), m_established(false),
+                                              m_closing(false), m_overflow(false), m_awaiting_pong(false) {}
+
+    // 握手响应中的 Sec-WebSocket-Accept：base64(SHA-1(key + GUID))
+    static std::string accept_key(const char *key);
+    // 序列化一个服务器发出的帧，服务器的帧不加掩码，同一个帧可以发给任意多个连接
+    static std::shared_ptr<const std::string> frame(OPCODE op, const char *data, size_t len);
+    // 对 len 字节做掩码运算（异或），SSE2/AVX2 一次处理 16/32 字节，offset 为 data 在负载中的位置
+    static void unmask(char *data, size_t len, const uint8_t mask[4], size_t offset = 0);
+
+    // 解析读到的字节，不完整的帧留到下一次；ping 的回复和 close 追加到 out，完整的消息放入 messages
+    // 出现协议错误或者收到 close 后返回 false，发送完 out 后关闭连接
+    bool feed(const char *data, size_t len, BufferChain &out, std::vector<Message> &messages);
+
+    const std::string &channel() const { return m_channel; }
+    bool established() const { return m_established; }
+    void set_established() { m_established = true; }
+    bool closing() const { return m_closing; }
+    bool overflow() const { return m_overflow; }
+    void set_overflow() { m_overflow = true; }
+    bool awaiting_pong() const { return m_awaiting_pong; }
+    void ping_sent() { m_awaiting_pong = true; }
+
+private:
+    bool fail(uint16_t code, BufferChain &out);     // 发送 close 帧，code 为关闭原因
+
+    std::string m_channel;          // 握手请求的路径，同一个路径上的连接互相广播
+    std::string m_in;               // 未处理的输入
+    std::string m_msg;              // 正在接收的分片消息
+    OPCODE m_msg_op;                // 分片消息的类型，CONTINUATION 表示没有
+    bool m_established;             // 101 响应已经发送完
+    bool m_closing;                 // 已经发送 close 帧
+    bool m_overflow;                // 待发送的数据超过 MAX_PENDING
+    bool m_awaiting_pong;           // 定时器发出的 ping 还没有收到回复
+};
+
+// 按频道（握手请求的路径）管理 WebSocket 连接，一个帧只序列化一次，所有连接共享同一块内存
+class WsHub {
+public:
+    // 创建 eventfd 并加入 epoll，其他线程 publish 后用它唤醒主线程
+    static bool init(int epollfd);
+    static int eventfd() { return m_eventfd; }
+
+    // 以下只在主线程调用
+    static void subscribe(HttpConn *conn, const std::string &channel);
+    static void unsubscribe(HttpConn *conn, const std::string &channel);
+    // 发送给频道上的所有连接，返回连接数
+    static size_t broadcast(const std::string &channel, WsSession::OPCODE op, const char *data, size_t len);
+    // eventfd 可读时取出其他线程 publish 的消息并广播
+    static void dispatch();
+
+    // 任意线程调用，由主线程广播
+    static void publish(const std::string &channel, WsSession::OPCODE op, const std::string &data);
+
+private:
+    struct Pending {
+        std::string channel;
+        WsSession::OPCODE op;
+        std::string data;
+    };
+
+    static std::unordered_map<std::string, std::vector<HttpConn *> > m_channels;
+    static std::vector<Pending> m_queue;
+    static Locker m_lock;
+    static int m_eventfd;
+};
+
+#endif // WEBSOCKET_H_
@@ -5,9 +5,22 @@ int main(int argc, char *argv[]) {
 
     WebServer server;
     server.config.parse_arg(argc, argv);
+    // TLS 上下文在 fork 之前创建
+    if (!server.tls()) {
+        return 1;
+    }
 
+    // 多进程模式，主进程只管理工作进程，工作进程从这里继续
+    if (server.config.workers > 0 && !server.prefork()) {
+        return 0;
+    }
+
+    // 连接表，需在创建线程之前，线程继承绑定的节点
+    server.conn_table();
     // 线程池
     server.thread_pool();
+    // 数据库连接池与用户表
+    server.sql_pool();
     // 监听
     server.event_listen();
     // 运行 
@@ -1,9 +1,29 @@
+#include <new>
+#include <sys/wait.h>
+#include <sys/prctl.h>
 #include "webserver.h"
 
+Waiter *WebServer::m_waiters = NULL;
+
+// 协程模式下的定时器回调：关闭连接后以 CLOSED 唤醒挂起在这个 fd 上的协程，让它结束
+static void coro_cb_func(client_data *user_data) {
+    cb_func(user_data);
+    WebServer::m_waiters[user_data->sockfd].wake(Waiter::CLOSED);
+}
+
 WebServer::WebServer() {
-    // http_conn类对象
-    users = new HttpConn[config.MAX_FD];
-    events = new epoll_event[config.MAX_EVENT_NUMBER];
+    m_worker = -1;
+    m_listenfd = -1;
+    m_adminfd = -1;
+    m_tlsfd = -1;
+    m_epollfd = -1;
+    m_pipefd[0] = m_pipefd[1] = -1;
+    m_pool = NULL;
+    m_accept_paused = false;
+    users = NULL;
+    users_timer = NULL;
+    events = NULL;
+    m_buffers = NULL;
 
     //root文件夹路径
     char server_path[200];
@@ -12,51 +32,362 @@ WebServer::WebServer() {
     m_root = (char *)malloc(strlen(server_path) + strlen(root) + 1);
     strcpy(m_root, server_path);
     strcat(m_root, root);
-
-    //定时器
-    users_timer = new client_data[config.MAX_FD];
 }
 
 WebServer::~WebServer() {
     close(m_epollfd);
     close(m_listenfd);
+    if (m_adminfd != -1) {
+        close(m_adminfd);
+    }
+    if (m_tlsfd != -1) {
+        close(m_tlsfd);
+    }
     close(m_pipefd[1]);
     close(m_pipefd[0]);
-    delete[] events;
-    delete[] users;
-    delete[] users_timer;
     delete m_pool;
+    if (users) {
+        for (int i = 0; i < config.MAX_FD; ++i) {
+            users[i].~HttpConn();
+        }
+    }
+    NumaMem::free(users);
+    NumaMem::free(users_timer);
+    NumaMem::free(events);
+    NumaMem::free(m_buffers);
+    delete[] m_waiters;
+    m_waiters = NULL;
+    UserWriter::instance()->shutdown();
+    Log::shutdown();
+}
+
+void WebServer::conn_table() {
+    int node = -1;
+    if (config.numa) {
+        if (m_worker >= 0) {
+            // 多进程时工作进程轮流绑定到各个节点，进程内所有线程的 CPU 和内存都在这个节点上
+            node = m_worker % NumaMem::node_count();
+            if (!NumaMem::bind_node(node)) {
+                fprintf(stderr, "bind to numa node %d failed\n", node);
+                node = -1;
+            }
+        }
+        else {
+            // 单进程时不绑定 CPU，否则之后创建的线程池线程都只能用一个节点的 CPU；
+            // 只把主线程使用的连接表等放到启动时所在的节点
+            node = NumaMem::current_node();
+        }
+    }
+    NumaMem::HUGE_PAGES huge = (NumaMem::HUGE_PAGES)config.huge_pages;
+
+    // mmap 得到的内存已清零，client_data 和 epoll_event 不需要构造；
+    // HttpConn 需要构造，users 的每一页在启动时都会被写到，物理内存在这里就全部分配
+    void *mem = NumaMem::alloc("users", sizeof(HttpConn) * config.MAX_FD, node, huge);
+    users_timer = (client_data *)NumaMem::alloc("users_timer", sizeof(client_data) * config.MAX_FD, node, huge);
+    events = (epoll_event *)NumaMem::alloc("events", sizeof(epoll_event) * config.MAX_EVENT_NUMBER, node, huge);
+    assert(mem && users_timer && events);
+    users = (HttpConn *)mem;
+    for (int i = 0; i < config.MAX_FD; ++i) {
+        new (&users[i]) HttpConn;
+    }
+
+    // 开启时缓冲区也预先整块分配并按同样的方式放置；缓冲区启动时不写入，只有连接实际用到的页才会分配物理内存
+    // 每个连接的缓冲区按缓存行对齐，相邻连接的缓冲区不共享缓存行
+    if (node >= 0 || huge != NumaMem::HUGE_NONE) {
+        size_t stride = (HttpConn::BUFFER_SIZE + 63) & ~(size_t)63;
+        m_buffers = (char *)NumaMem::alloc("buffers", stride * config.MAX_FD, node, huge);
+        if (m_buffers) {
+            for (int i = 0; i < config.MAX_FD; ++i) {
+                users[i].set_buffer(m_buffers + stride * i);
+            }
+        }
+    }
+    Metrics::add_collector(NumaMem::render);
+
+    if (config.coroutine) {
+        m_waiters = new Waiter[config.MAX_FD];
+    }
+}
+
+bool WebServer::tls() {
+    if (config.tls_port <= 0) {
+        return true;
+    }
+    if (!TlsContext::init(config.tls_cert.c_str(), config.tls_key.c_str())) {
+        fprintf(stderr, "load tls certificate %s / key %s failed\n", config.tls_cert.c_str(), config.tls_key.c_str());
+        return false;
+    }
+    return true;
 }
 
 void WebServer::thread_pool() {
-    m_pool = new ThreadPool<HttpConn>;
+    m_pool = new ThreadPool<HttpConn>(config.thread_num, config.MAX_REQUESTS, config.QUEUE_TARGET_MS, config.QUEUE_INTERVAL_MS);
+    m_pool->set_elastic(config.thread_max, config.thread_grow_ms, config.thread_idle_s);
 }
 
-void WebServer::event_listen() {
+int WebServer::open_listenfd(int port) {
     // 创建 socket 套接字
-    m_listenfd = socket(AF_INET, SOCK_STREAM, 0);
-    assert(m_listenfd >= 0);
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    assert(listenfd >= 0);
 
     int ret = 0;
     struct sockaddr_in address;
     bzero(&address, sizeof(address));
     address.sin_family = AF_INET;
     address.sin_addr.s_addr = htonl(INADDR_ANY);
-    address.sin_port = htons(config.port);
+    address.sin_port = htons(port);
 
     int flag = 1;
     // 端口复用。设置 socket 选项，可以立刻重用 socket 地址
-    setsockopt(m_listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
 
     // 绑定具体的 socket 地址
-    ret = bind(m_listenfd, (struct sockaddr *)&address, sizeof(address));
+    ret = bind(listenfd, (struct sockaddr *)&address, sizeof(address));
     assert(ret >= 0);
 
     // 监听 socket
-    ret = listen(m_listenfd, 5);
+    ret = listen(listenfd, 5);
     assert(ret >= 0);
 
+    return listenfd;
+}
+
+void WebServer::add_listenfd(int listenfd) {
+    // 监听 socket 是水平触发；多个工作进程共享同一个监听 socket 时用 EPOLLEXCLUSIVE 避免惊群
+    epoll_event event;
+    event.data.fd = listenfd;
+    event.events = EPOLLIN;
+    if (m_worker >= 0) {
+        event.events |= EPOLLEXCLUSIVE;
+    }
+    if (epoll_ctl(m_epollfd, EPOLL_CTL_ADD, listenfd, &event) < 0 && errno == EINVAL) {
+        // 内核不支持 EPOLLEXCLUSIVE（4.5 之前）时退回普通方式，accept 失败返回 EAGAIN
+        event.events = EPOLLIN;
+        epoll_ctl(m_epollfd, EPOLL_CTL_ADD, listenfd, &event);
+    }
+}
+
+bool WebServer::prefork() {
+    // 监听 socket 由主进程创建，工作进程继承后共享同一个全连接队列，
+    // 某个工作进程退出时队列中的连接由其他进程接受，不会丢失
+    m_listenfd = open_listenfd(config.port);
+    utils.setnonblocking(m_listenfd);
+    if (config.admin_port > 0) {
+        m_adminfd = open_listenfd(config.admin_port);
+        utils.setnonblocking(m_adminfd);
+    }
+    if (config.tls_port > 0) {
+        m_tlsfd = open_listenfd(config.tls_port);
+        utils.setnonblocking(m_tlsfd);
+    }
+    // 最后一组分片留给主进程
+    if (!Metrics::init_shared(config.workers + 1)) {
+        fprintf(stderr, "create shared metrics failed\n");
+    }
+    Metrics::set_process(config.workers);
+    // 限流表所有工作进程共用，主进程不接受连接，不需要自己的连接计数
+    if (!ClientLimiter::init(config.workers)) {
+        fprintf(stderr, "create shared limiter table failed\n");
+    }
+    // 用户表所有工作进程共用，每个工作进程启动时把数据库中的用户加载进去
+    if (!UserCache::instance()->init_shared(config.user_table_size)) {
+        fprintf(stderr, "create shared user table failed, users registered on one worker cannot log in on others\n");
+    }
+
+    // 主进程同步等待信号，fork 出的工作进程恢复原来的信号掩码
+    sigset_t mask, old_mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, &old_mask);
+
+    std::vector<pid_t> workers(config.workers, -1);
+    for (int i = 0; i < config.workers; ++i) {
+        workers[i] = spawn_worker(i, old_mask);
+        if (workers[i] == 0) {
+            return true;
+        }
+    }
+    supervise(workers, old_mask);
+    return m_worker >= 0;
+}
+
+pid_t WebServer::spawn_worker(int index, const sigset_t &old_mask) {
+    pid_t master = getpid();
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "fork worker %d failed: %s\n", index, strerror(errno));
+        return -1;
+    }
+    if (pid > 0) {
+        Metrics::add(Metrics::WORKERS);
+        return pid;
+    }
+
+    // 工作进程：主进程退出时随之退出
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+    if (getppid() != master) {
+        _exit(0);
+    }
+    sigprocmask(SIG_SETMASK, &old_mask, NULL);
+    m_worker = index;
+    Metrics::set_process(index);
+    ClientLimiter::set_process(index);
+
+    // 日志目录、trace 文件、注册日志按进程区分，避免多个进程同时切分或截断同一个文件
+    std::string suffix = "." + std::to_string(index);
+    if (!config.log_dir.empty()) {
+        config.log_dir += suffix;
+    }
+    config.trace_file += suffix;
+    config.journal_file += suffix;
+    return 0;
+}
+
+void WebServer::supervise(std::vector<pid_t> &workers, const sigset_t &old_mask) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGHUP);
+    sigaddset(&mask, SIGUSR1);
+
+    int n = workers.size();
+    std::vector<time_t> started(n, time(NULL));
+    std::vector<time_t> restart_at(n, 0);
+    bool stop = false;
+
+    while (!stop) {
+        struct timespec wait = {1, 0};
+        int sig = sigtimedwait(&mask, NULL, &wait);
+        switch (sig) {
+            case SIGTERM:
+            case SIGINT:
+                stop = true;
+                break;
+            case SIGHUP:
+            case SIGUSR1:
+                // 重新加载配置、导出 trace 由每个工作进程自己完成
+                for (int i = 0; i < n; ++i) {
+                    if (workers[i] > 0) {
+                        kill(workers[i], sig);
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+
+        // 回收退出的工作进程，启动后 1 秒内就退出的延迟 1 秒再拉起，避免反复崩溃时空转
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            for (int i = 0; i < n; ++i) {
+                if (workers[i] != pid) {
+                    continue;
+                }
+                if (WIFSIGNALED(status)) {
+                    fprintf(stderr, "worker %d (pid %d) killed by signal %d\n", i, pid, WTERMSIG(status));
+                }
+                else {
+                    fprintf(stderr, "worker %d (pid %d) exited with status %d\n", i, pid, WEXITSTATUS(status));
+                }
+                workers[i] = -1;
+                Metrics::add(Metrics::WORKERS, -1);
+                Metrics::reset_gauges(i);
+                ClientLimiter::reset_process(i);
+                restart_at[i] = time(NULL) - started[i] < 1 ? time(NULL) + 1 : 0;
+            }
+        }
+
+        time_t now = time(NULL);
+        for (int i = 0; i < n && !stop; ++i) {
+            if (workers[i] != -1 || now < restart_at[i]) {
+                continue;
+            }
+            workers[i] = spawn_worker(i, old_mask);
+            if (workers[i] == 0) {
+                return;
+            }
+            started[i] = now;
+            Metrics::add(Metrics::WORKER_RESTARTS);
+        }
+    }
+
+    // 通知工作进程退出并等待
+    for (int i = 0; i < n; ++i) {
+        if (workers[i] > 0) {
+            kill(workers[i], SIGTERM);
+        }
+    }
+    while (wait(NULL) > 0) {
+    }
+}
+
+void WebServer::sql_pool() {
+    DbConnFactory factory = find_db_factory(config.db_backend.c_str());
+    if (!factory) {
+        fprintf(stderr, "unknown database %s\n", config.db_backend.c_str());
+        return;
+    }
+    DbConfig db_config;
+    db_config.host = config.db_host;
+    db_config.port = config.db_port;
+    db_config.user = config.db_user;
+    db_config.password = config.db_password;
+    db_config.database = config.db_name;
+
+    // 登录和注册只访问内存用户表，用到连接的只有这里加载用户表和 UserWriter 的写回线程；
+    // 写回线程在这里的连接归还之前就会启动，两个连接互不等待
+    static const int SQL_CONN_NUM = 2;
+    SqlConnPool *pool = SqlConnPool::instance();
+    if (!pool->init(factory, db_config, SQL_CONN_NUM)) {
+        // 连不上数据库时只影响登录和注册，静态文件照常提供
+        fprintf(stderr, "connect to %s database failed, login and register are disabled\n", config.db_backend.c_str());
+        return;
+    }
+
+    std::vector<UserRecord> users;
+    DbConn *conn = NULL;
+    ConnectionRAII conn_raii(&conn, pool);
+    if (!conn->load_users(users)) {
+        fprintf(stderr, "load user table failed\n");
+    }
+    UserCache::instance()->load(users);
+
+    // 重放上次退出时还没写入数据库的注册用户
+    if (!UserWriter::instance()->init(pool, config.journal_file.c_str())) {
+        fprintf(stderr, "open %s failed, register is disabled\n", config.journal_file.c_str());
+    }
+}
+
+void WebServer::event_listen() {
+    int ret = 0;
+    // 多进程模式下监听 socket 已由主进程创建
+    if (m_listenfd == -1) {
+        m_listenfd = open_listenfd(config.port);
+        if (config.admin_port > 0) {
+            m_adminfd = open_listenfd(config.admin_port);
+        }
+        if (config.tls_port > 0) {
+            m_tlsfd = open_listenfd(config.tls_port);
+        }
+    }
+
     utils.init(config.TIMESLOT);
+    update_site_config();
+    if (!ClientLimiter::ready() && !ClientLimiter::init(1)) {
+        fprintf(stderr, "create limiter table failed, client limits disabled\n");
+    }
+    Tracer::init(config.slow_ms, config.trace_file.c_str());
+    // 只开启慢请求记录时也启动日志的后台线程，由它写入 trace 文件
+    if ((!config.log_dir.empty() || config.slow_ms > 0) && !Log::init(config.log_dir.c_str(), config.LOG_FILE_SIZE)) {
+        fprintf(stderr, "open log dir %s failed\n", config.log_dir.c_str());
+    }
 
     // 创建 epoll 事件数组
     epoll_event events[config.MAX_EVENT_NUMBER];
@@ -64,7 +395,16 @@ void WebServer::event_listen() {
     assert(m_epollfd != -1);
 
     // 将监听的文件描述符添加到 epoll 对象中
-    utils.addfd(m_epollfd, m_listenfd, false);
+    utils.setnonblocking(m_listenfd);
+    add_listenfd(m_listenfd);
+    if (m_adminfd != -1) {
+        utils.setnonblocking(m_adminfd);
+        add_listenfd(m_adminfd);
+    }
+    if (m_tlsfd != -1) {
+        utils.setnonblocking(m_tlsfd);
+        add_listenfd(m_tlsfd);
+    }
     HttpConn::m_epollfd = m_epollfd;
 
     // 创建管道
@@ -73,9 +413,17 @@ void WebServer::event_listen() {
     utils.setnonblocking(m_pipefd[1]);
     utils.addfd(m_epollfd, m_pipefd[0], false);
 
+    UpstreamPool::init(m_epollfd);
+    // 其他线程向 WebSocket 频道发布消息时唤醒主线程
+    if (!WsHub::init(m_epollfd)) {
+        LOG_WARN("%s", "websocket eventfd failed, publish disabled");
+    }
+
     utils.addsig(SIGPIPE, SIG_IGN);
     utils.addsig(SIGALRM, utils.sig_handler, false);
     utils.addsig(SIGTERM, utils.sig_handler, false);
+    utils.addsig(SIGUSR1, utils.sig_handler, false);
+    utils.addsig(SIGHUP, utils.sig_handler, false);
 
     alarm(config.TIMESLOT);
 
@@ -92,9 +440,12 @@ void WebServer::init_timer(int connfd, struct sockaddr_in client_address) {
     // 创建定时器，设置回调函数和超时时间，绑定用户数据，讲定时器添加到链表中
     util_timer *timer = new util_timer;
     timer->user_data = &users_timer[connfd];
-    timer->cb_func = cb_func;
+    timer->cb_func = m_waiters ? coro_cb_func : cb_func;
+    timer->conn = users + connfd;
     time_t cur = time(NULL);
-    timer->expire = cur + 3 * config.TIMESLOT;
+    timer->reason = util_timer::FIRST_BYTE;
+    timer->phase_start = cur;
+    timer->expire = cur + config.first_byte_timeout;
 
     users_timer[connfd].address = client_address;
     users_timer[connfd].sockfd = connfd;
@@ -103,11 +454,61 @@ void WebServer::init_timer(int connfd, struct sockaddr_in client_address) {
     utils.m_timer_lst.add_timer(timer);
 }
 
-//若有数据传输，则将定时器往后延迟3个单位
-//并对新的定时器在链表上的位置进行调整
+// 读写之后按连接所处的阶段重新计算到期时间，并对定时器在链表上的位置进行调整
+// 等待第一个请求、读取请求头、保持连接空闲从进入阶段时开始计算，逐字节发送也不会延后；
+// 读取请求体按两次收到数据的间隔；发送响应要求平均速率不低于 send_min_rate，读得慢的客户端不能一直占着文件映射
 void WebServer::adjust_timer(util_timer *timer) {
     time_t cur = time(NULL);
-    timer->expire = cur + 3 * config.TIMESLOT;
+    util_timer::REASON reason = util_timer::IDLE;
+    if (timer->conn) {
+        switch (timer->conn->phase()) {
+            case HttpConn::PHASE_WAIT:
+                // 还没有收到过请求时仍然是第一个字节的期限
+                reason = timer->reason == util_timer::FIRST_BYTE ? util_timer::FIRST_BYTE : util_timer::KEEPALIVE;
+                break;
+            case HttpConn::PHASE_HEADER:
+                reason = util_timer::HEADER;
+                break;
+            case HttpConn::PHASE_BODY:
+                reason = util_timer::BODY;
+                break;
+            case HttpConn::PHASE_SEND:
+                reason = util_timer::SEND;
+                break;
+            default:
+                break;
+        }
+    }
+    if (reason != timer->reason) {
+        timer->reason = reason;
+        timer->phase_start = cur;
+    }
+
+    switch (reason) {
+        case util_timer::FIRST_BYTE:
+            timer->expire = timer->phase_start + config.first_byte_timeout;
+            break;
+        case util_timer::HEADER:
+            timer->expire = timer->phase_start + config.header_timeout;
+            break;
+        case util_timer::BODY:
+            timer->expire = cur + config.body_timeout;
+            break;
+        case util_timer::SEND:
+            if (config.send_min_rate > 0) {
+                timer->expire = timer->phase_start + config.timeout + timer->conn->bytes_sent() / config.send_min_rate;
+            }
+            else {
+                timer->expire = cur + config.timeout;
+            }
+            break;
+        case util_timer::KEEPALIVE:
+            timer->expire = timer->phase_start + config.keepalive_timeout;
+            break;
+        default:
+            timer->expire = cur + config.timeout;
+            break;
+    }
     utils.m_timer_lst.adjust_timer(timer);
 }
 
@@ -118,27 +519,57 @@ void WebServer::expire_timer(util_timer *timer, int sockfd) {
     }
 }
 
-bool WebServer::deal_client_data() {
+bool WebServer::deal_client_data(int listenfd) {
     struct sockaddr_in client_address;
     socklen_t client_addrlen = sizeof(client_address);
-    int connfd = accept(m_listenfd, (struct sockaddr *)&client_address, &client_addrlen);
+    int connfd = accept(listenfd, (struct sockaddr *)&client_address, &client_addrlen);
 
     if (connfd < 0) {
-        // printf("%s:errno is:%d", "accept error", errno);
+        // 多个工作进程同时被唤醒时，连接可能已被其他进程接受
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG_ERROR("%s:errno is:%d", "accept error", errno);
+        }
         return false;
     }
 
     if (HttpConn::m_user_count >= config.MAX_FD) {
         // 目前连接数满了
         // 可以回写用户端一个信息
+        LOG_WARN("%s", "too many connections");
         close(connfd);
         return false;
     }
+    Metrics::add(Metrics::ACCEPTS);
+
+    // 按客户端 IP 限制并发连接数，超过时直接关闭，不分配定时器；管理端口不受限制
+    int slot = -1;
+    if (listenfd != m_adminfd) {
+        uint32_t ip = ntohl(client_address.sin_addr.s_addr);
+        const ClientLimiter::Rule *rule = ClientLimiter::match(SiteConfig::current()->limits, ip);
+        bool rejected = false;
+        if (rule) {
+            slot = ClientLimiter::acquire(*rule, ip, rejected);
+        }
+        if (rejected) {
+            close(connfd);
+            return false;
+        }
+    }
     init_timer(connfd, client_address);
+    users[connfd].set_limit(slot);
+    users[connfd].set_admin(listenfd == m_adminfd);
+    if (listenfd == m_tlsfd) {
+        users[connfd].set_tls();
+    }
+    if (m_waiters) {
+        // 上一个连接关闭时协程可能还在等待（工作线程关闭的连接要等定时器到期才唤醒），先让它结束
+        m_waiters[connfd].wake(Waiter::CLOSED);
+        serve(connfd);
+    }
     return true;
 }
 
-bool WebServer::deal_with_signal(bool &timeout, bool &stop_server) {
+bool WebServer::deal_with_signal(bool &timeout, bool &stop_server, bool &reload) {
     // 监听信号
     int ret = 0;
     int sig;
@@ -163,6 +594,17 @@ bool WebServer::deal_with_signal(bool &timeout, bool &stop_server) {
                     stop_server = true;
                     break;
                 }
+                case SIGHUP:
+                {
+                    reload = true;
+                    break;
+                }
+                case SIGUSR1:
+                {
+                    // 导出所有线程最近完成的请求
+                    Tracer::dump_recent();
+                    break;
+                }
             }
         }
     }
@@ -171,16 +613,59 @@ bool WebServer::deal_with_signal(bool &timeout, bool &stop_server) {
 
 void WebServer::deal_with_read(int sockfd) {
     util_timer *timer = users_timer[sockfd].timer;
+    if (users[sockfd].is_websocket()) {
+        // WebSocket 帧很小，解析和广播都在主线程完成，不进入线程池
+        if (users[sockfd].read() && (users[sockfd].tls_wait() || users[sockfd].process_ws())) {
+            if (timer) {
+                adjust_timer(timer);
+            }
+        }
+        else {
+            expire_timer(timer, sockfd);
+        }
+        return;
+    }
     // 客户端发送请求
     if (users[sockfd].read()) {
-        // 一次性把所有的数据读完, 将该事件放入请求队列
-        m_pool->append(users + sockfd);
-
-        //若有数据传输，则将定时器往后延迟3个单位
-        //并对新的定时器在链表上的位置进行调整
+        if (users[sockfd].tls_wait()) {
+            // TLS 握手中或者记录不完整，read 已经重新注册了事件
+            if (timer) {
+                adjust_timer(timer);
+            }
+            return;
+        }
+        // 客户端超过请求速率时在主线程直接返回 429，不进入线程池
+        if (!users[sockfd].admit()) {
+            if (users[sockfd].reject(HttpConn::TOO_MANY_REQUESTS)) {
+                deal_with_write(sockfd);
+            }
+            else {
+                expire_timer(timer, sockfd);
+            }
+            return;
+        }
+        // 按读到数据后的阶段调整定时器，交给线程池之后连接的状态由工作线程修改，不能再读取
         if (timer) {
             adjust_timer(timer);
         }
+        if (config.inline_requests) {
+            // 不会阻塞的请求在主线程直接生成响应并立即发送，不经过线程池
+            switch (users[sockfd].process_inline()) {
+                case HttpConn::INLINE_READ:
+                    return;
+                case HttpConn::INLINE_WRITE:
+                    deal_with_write(sockfd);
+                    return;
+                case HttpConn::INLINE_CLOSE:
+                    expire_timer(timer, sockfd);
+                    return;
+                default:
+                    break;
+            }
+        }
+        // 一次性把所有的数据读完, 这一轮事件处理完后和其他连接一起放入请求队列
+        users[sockfd].trace_mark(RequestTrace::ENQUEUE);
+        m_ready.push_back(users + sockfd);
     }
     else {
         expire_timer(timer, sockfd);
@@ -195,6 +680,115 @@ void WebServer::deal_with_write(int sockfd) {
     if (users[sockfd].write()) {
         //若有数据传输，则将定时器往后延迟3个单位
         //并对新的定时器在链表上的位置进行调整
+        if (timer) {
+            if (users[sockfd].is_websocket() && timer->keepalive_interval == 0) {
+                // 握手完成，空闲超时改为先 ping，没有回应再关闭
+                timer->keepalive_interval = config.timeout;
+            }
+            adjust_timer(timer);
+        }
+    }
+    else {
+        expire_timer(timer, sockfd);
+    }
+}
+
+// 一个连接的协程，在协程模式下代替 deal_with_read / deal_with_write
+// 每次 co_await 挂起到 fd 上的下一个事件，请求交给线程池后也是等待工作线程重新注册的事件：
+// 请求不完整时为可读，响应生成后为可写；期间连接的状态由工作线程修改，协程不访问
+ConnTask WebServer::serve(int sockfd) {
+    HttpConn &conn = users[sockfd];
+    Waiter &waiter = m_waiters[sockfd];
+    Metrics::add(Metrics::CORO_ACTIVE);
+
+    uint32_t ev = co_await waiter;
+    while (ev != Waiter::CLOSED) {
+        util_timer *timer = users_timer[sockfd].timer;
+        bool open = !(ev & (EPOLLRDHUP | EPOLLHUP | EPOLLERR));
+        bool send = open && !(ev & EPOLLIN) && !conn.tls_wake() && (ev & EPOLLOUT);
+
+        if (open && !send) {
+            open = conn.read();
+            if (!open || conn.tls_wait()) {
+                // 出错，或者 TLS 握手中、记录不完整，read 已经重新注册了事件
+            }
+            else if (conn.is_websocket()) {
+                // WebSocket 帧在主线程解析和广播
+                open = conn.process_ws();
+            }
+            else if (!conn.admit()) {
+                // 超过请求速率，直接返回 429
+                open = conn.reject(HttpConn::TOO_MANY_REQUESTS);
+                send = open;
+            }
+            else {
+                if (timer) {
+                    adjust_timer(timer);
+                }
+                HttpConn::INLINE done = config.inline_requests ? conn.process_inline() : HttpConn::INLINE_POOL;
+                if (done == HttpConn::INLINE_POOL) {
+                    // 这一轮事件处理完后和其他连接一起放入请求队列；队列已满时 submit_ready 生成 503 并以可写唤醒
+                    conn.trace_mark(RequestTrace::ENQUEUE);
+                    m_ready.push_back(&conn);
+                    ev = co_await waiter;
+                    continue;
+                }
+                else {
+                    // 在主线程处理完，响应立即发送；请求不完整时已经重新注册 EPOLLIN
+                    open = done != HttpConn::INLINE_CLOSE;
+                    send = done == HttpConn::INLINE_WRITE;
+                }
+            }
+        }
+        if (send) {
+            open = conn.write();
+            if (open && timer && conn.is_websocket() && timer->keepalive_interval == 0) {
+                // 握手完成，空闲超时改为先 ping，没有回应再关闭
+                timer->keepalive_interval = config.timeout;
+            }
+        }
+
+        if (!open) {
+            expire_timer(timer, sockfd);
+            break;
+        }
+        if (timer) {
+            adjust_timer(timer);
+        }
+        ev = co_await waiter;
+    }
+    Metrics::add(Metrics::CORO_ACTIVE, -1);
+}
+
+void WebServer::submit_ready() {
+    if (m_ready.empty()) {
+        return;
+    }
+    int n = m_pool->append_batch(m_ready.data(), m_ready.size());
+    // 请求队列已满，在主线程直接返回 503，不让连接停在队列外等到超时
+    for (size_t i = n; i < m_ready.size(); ++i) {
+        int sockfd = m_ready[i] - users;
+        if (!m_ready[i]->reject()) {
+            expire_timer(users_timer[sockfd].timer, sockfd);
+        }
+        else if (m_waiters) {
+            m_waiters[sockfd].wake(EPOLLOUT);
+        }
+        else {
+            deal_with_write(sockfd);
+        }
+    }
+    m_ready.clear();
+}
+
+void WebServer::deal_with_upstream(int fd) {
+    HttpConn *conn = UpstreamPool::on_event(fd);
+    if (!conn) {
+        return;
+    }
+    int sockfd = conn - users;
+    util_timer *timer = users_timer[sockfd].timer;
+    if (conn->proxy_event()) {
         if (timer) {
             adjust_timer(timer);
         }
@@ -204,12 +798,109 @@ void WebServer::deal_with_write(int sockfd) {
     }
 }
 
+void WebServer::update_site_config() {
+    std::shared_ptr<SiteConfig> site(new SiteConfig);
+    site->doc_root = config.doc_root.empty() ? m_root : config.doc_root;
+    for (size_t i = 0; i < config.proxy.size(); ++i) {
+        SiteConfig::ProxyRoute route;
+        if (SiteConfig::parse_proxy(config.proxy[i], route)) {
+            site->proxies.push_back(route);
+        }
+        else {
+            // 启动时日志还没有打开，重新加载时写日志
+            fprintf(stderr, "bad proxy %s, expect \"<prefix> <host>:<port>\"\n", config.proxy[i].c_str());
+            LOG_ERROR("bad proxy %s", config.proxy[i].c_str());
+        }
+    }
+    for (size_t i = 0; i < config.limit.size(); ++i) {
+        ClientLimiter::Rule rule;
+        if (ClientLimiter::parse_rule(config.limit[i], rule)) {
+            site->limits.push_back(rule);
+        }
+        else {
+            fprintf(stderr, "bad limit %s, expect \"<ip>[/<prefix>] rate=<n> burst=<n> conns=<n> [shared]\"\n", config.limit[i].c_str());
+            LOG_ERROR("bad limit %s", config.limit[i].c_str());
+        }
+    }
+    ClientLimiter::sort_rules(site->limits);
+    site->routes = HttpConn::build_routes(*site);
+    SiteConfig::update(site);
+}
+
+void WebServer::reload_config() {
+    if (config.config_file.empty()) {
+        LOG_WARN("%s", "reload: no config file given with -f");
+        return;
+    }
+    Config fresh(config);
+    if (!fresh.parse_file(config.config_file.c_str())) {
+        LOG_ERROR("reload: open %s failed", config.config_file.c_str());
+        return;
+    }
+
+    // 线程池在线调整，多出的线程处理完手上的请求再退出
+    if (fresh.thread_num != config.thread_num && fresh.thread_num > 0) {
+        m_pool->resize(fresh.thread_num);
+        config.thread_num = fresh.thread_num;
+    }
+    config.thread_max = fresh.thread_max;
+    config.thread_grow_ms = fresh.thread_grow_ms;
+    config.thread_idle_s = fresh.thread_idle_s;
+    m_pool->set_elastic(config.thread_max, config.thread_grow_ms, config.thread_idle_s);
+    // 只影响之后新建或调整的定时器
+    if (fresh.timeout > 0) {
+        config.timeout = fresh.timeout;
+    }
+    config.first_byte_timeout = fresh.first_byte_timeout;
+    config.header_timeout = fresh.header_timeout;
+    config.body_timeout = fresh.body_timeout;
+    config.send_min_rate = fresh.send_min_rate;
+    config.keepalive_timeout = fresh.keepalive_timeout;
+    config.inline_requests = fresh.inline_requests;
+    // 新请求使用新的资源目录，处理中的请求仍使用旧的
+    config.doc_root = fresh.doc_root;
+    config.proxy = fresh.proxy;
+    config.limit = fresh.limit;
+    update_site_config();
+
+    LOG_INFO("reload %s: thread_num=%d timeout=%d doc_root=%s", config.config_file.c_str(),
+             config.thread_num, config.timeout, SiteConfig::current()->doc_root.c_str());
+}
+
+void WebServer::throttle_accept() {
+    bool saturated = m_pool->saturated();
+    if (saturated == m_accept_paused) {
+        return;
+    }
+    // 监听 socket 是水平触发，从 epoll 中移除即可暂停 accept，连接留在内核的全连接队列中
+    // （EPOLLEXCLUSIVE 不能用 EPOLL_CTL_MOD 修改，所以移除后重新加入）
+    if (saturated) {
+        epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_listenfd, NULL);
+        if (m_tlsfd != -1) {
+            epoll_ctl(m_epollfd, EPOLL_CTL_DEL, m_tlsfd, NULL);
+        }
+    }
+    else {
+        add_listenfd(m_listenfd);
+        if (m_tlsfd != -1) {
+            add_listenfd(m_tlsfd);
+        }
+    }
+    m_accept_paused = saturated;
+    Metrics::add(Metrics::ACCEPT_PAUSED, saturated ? 1 : -1);
+    if (saturated) {
+        LOG_WARN("%s", "thread pool saturated, pause accepting");
+    }
+}
+
 void WebServer::event_loop() {
     bool timeout = false;
     bool stop_server = false;
+    bool reload = false;
 
     while (!stop_server) {
-        int number = epoll_wait(m_epollfd, events, config.MAX_EVENT_NUMBER, -1);
+        // 暂停 accept 期间定时醒来检查线程池是否恢复
+        int number = epoll_wait(m_epollfd, events, config.MAX_EVENT_NUMBER, m_accept_paused ? 10 : -1);
         if (number < 0 && errno != EINTR) {
             break;
         }
@@ -218,10 +909,18 @@ void WebServer::event_loop() {
             int sockfd = events[i].data.fd;
 
             // 新客户连接
-            if (sockfd == m_listenfd) {
-                bool flag = deal_client_data();
+            if (sockfd == m_listenfd || sockfd == m_adminfd || sockfd == m_tlsfd) {
+                bool flag = deal_client_data(sockfd);
                 if (false == flag) continue;
             }
+            else if (UpstreamPool::owns(sockfd)) {
+                // 反向代理的上游连接，关闭、出错也交给转发的状态机处理
+                deal_with_upstream(sockfd);
+            }
+            else if (m_waiters && m_waiters[sockfd].waiting()) {
+                // 协程模式：客户连接上的所有事件交给它的协程
+                m_waiters[sockfd].wake(events[i].events);
+            }
             else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
                 // 服务器端关闭连接，移除对应的定时器
                 util_timer *timer = users_timer[sockfd].timer;
@@ -229,20 +928,31 @@ void WebServer::event_loop() {
             }
             else if ((sockfd == m_pipefd[0]) && (events[i].events & EPOLLIN)) {
                 // 处理信号
-                bool flag = deal_with_signal(timeout, stop_server);
+                deal_with_signal(timeout, stop_server, reload);
+            }
+            else if (sockfd == WsHub::eventfd()) {
+                WsHub::dispatch();
             }
-            else if (events[i].events & EPOLLIN) {
+            else if ((events[i].events & EPOLLIN) || users[sockfd].tls_wake()) {
                 deal_with_read(sockfd);
             }
             else if (events[i].events & EPOLLOUT) {
                 deal_with_write(sockfd);
             }
         }
+        submit_ready();
 
         if (timeout) {
             utils.timer_handler();
             timeout = false;
         }
+
+        if (reload) {
+            reload_config();
+            reload = false;
+        }
+
+        throttle_accept();
     }
 }
 
@@ -4,15 +4,23 @@
 #include <cstdio>
 #include <cstring>
 #include <cassert>
+#include <vector>
 #include <signal.h>
 #include <errno.h>
 #include <arpa/inet.h>
 #include <sys/epoll.h>
 
 #include "../../conf/config.h"
+#include "../../core/coro/coro.h"
+#include "../../core/numa/numa_mem.h"
 #include "../../core/threadpool/threadpool.h"
 #include "../../core/timer/lst_timer.h"
+#include "../../core/trace/tracer.h"
+#include "../../core/log/log.h"
 #include "../../http/http_conn.h"
+#include "../../db/sql_conn_pool.h"
+#include "../../db/user_cache.h"
+#include "../../db/user_writer.h"
 
 class WebServer {
 public:
@@ -21,21 +29,51 @@ public:
 
     void init(Config &config);
 
+    // 多进程模式：主进程创建监听 socket，fork 出工作进程并在退出时重新拉起
+    // 在工作进程中返回 true，继续初始化并运行；主进程在所有工作进程退出后返回 false
+    bool prefork();
+    // 分配连接表（users、users_timer、events）和读缓冲区，按配置绑定 NUMA 节点、使用大页
+    void conn_table();
+    // 加载 TLS 证书，需在 fork 之前调用，工作进程共享会话票据的密钥；没有开启 TLS 时直接返回 true
+    bool tls();
     // 初始化线程池
     void thread_pool();
+    // 初始化数据库连接池，加载用户表
+    void sql_pool();
     // 事件监听
     void event_listen();
     // 处理事件
     void event_loop();
 
+    // 创建监听 socket
+    int open_listenfd(int port);
+    // 将监听 socket 加入 epoll，多进程共享时只唤醒一个进程
+    void add_listenfd(int listenfd);
+
+    // 主进程：创建第 index 个工作进程
+    pid_t spawn_worker(int index, const sigset_t &old_mask);
+    // 主进程：等待信号，回收并重新拉起退出的工作进程
+    void supervise(std::vector<pid_t> &workers, const sigset_t &old_mask);
+
     // 处理用户的信息
-    bool deal_client_data();
+    bool deal_client_data(int listenfd);
+    // 线程池饱和时暂停接受新连接，恢复后重新接受
+    void throttle_accept();
     // 处理信号
-    bool deal_with_signal(bool &timeout, bool &stop_server);
+    bool deal_with_signal(bool &timeout, bool &stop_server, bool &reload);
+    // 重新读取配置文件，调整线程池、超时时间，替换资源目录
+    void reload_config();
+    // 发布处理请求用的配置
+    void update_site_config();
     // 读取用户请求
     void deal_with_read(int sockfd);
+    void deal_with_upstream(int fd);
     // 响应用户请求
     void deal_with_write(int sockfd);
+    // 把这一轮事件中读到请求的连接一次提交给线程池，放不下的返回 503
+    void submit_ready();
+    // 协程模式：接受连接后为它创建的协程，读取请求、交给线程池、发送响应依次进行
+    ConnTask serve(int sockfd);
 
     // 将用户加入定时器
     void init_timer(int connfd, struct sockaddr_in client_address);
@@ -47,14 +85,22 @@ public:
 public:
     char *m_root;                       // 资源文件根目录
 
+    int m_worker;                       // 工作进程编号，单进程模式为 -1
     int m_listenfd;                     // sockt 套接字
+    int m_adminfd;                      // 管理端口的 socket 套接字，未开启时为 -1
+    int m_tlsfd;                        // TLS 端口的 socket 套接字，未开启时为 -1
     int m_epollfd;                      // epoll 套接字
     int m_pipefd[2];                    // 管道套接字
+    bool m_accept_paused;               // 是否暂停接受新连接
 
     epoll_event *events;                // 事件数组
     client_data *users_timer;
     HttpConn *users;
+    char *m_buffers;                    // 所有连接的读缓冲区，未开启 NUMA 和大页时为 NULL，由连接自己分配
     ThreadPool<HttpConn> *m_pool;
+    std::vector<HttpConn *> m_ready;    // 这一轮事件中等待进入线程池的连接
+    // 协程模式下每个 fd 上挂起的协程，按 fd 下标；定时器回调要用，所以是静态的，非协程模式为 NULL
+    static Waiter *m_waiters;
     Utils utils;
     Config config;
 };
@@ -0,0 +1,59 @@
+#include <string>
+#include <vector>
+#include "test.h"
+
+struct TestCase {
+    std::string name;
+    TestFunc func;
+};
+
+// 用函数内静态变量，保证注册时已经完成构造
+static std::vector<TestCase> &test_cases() {
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+static int g_failures = 0;      // 当前用例失败的检查数
+
+void Test::add(const char *name, TestFunc func) {
+    TestCase c = {name, func};
+    test_cases().push_back(c);
+}
+
+void Test::fail(const char *file, int line, const char *expr) {
+    printf("    %s:%d: CHECK(%s) failed\n", file, line, expr);
+    ++g_failures;
+}
+
+int Test::run_all(const char *filter, int &count) {
+    int failed = 0;
+    count = 0;
+    for (size_t i = 0; i < test_cases().size(); ++i) {
+        const TestCase &c = test_cases()[i];
+        if (filter && c.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        g_failures = 0;
+        c.func();
+        printf("%-6s %s\n", g_failures == 0 ? "ok" : "FAIL", c.name.c_str());
+        fflush(stdout);
+        if (g_failures != 0) {
+            ++failed;
+        }
+        ++count;
+    }
+    return failed;
+}
+
+int main(int argc, char *argv[]) {
+    // 用法：./unittest [过滤字符串]，如 ./unittest hpack
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    int count = 0;
+    int failed = Test::run_all(filter, count);
+    if (count == 0) {
+        printf("no test matches '%s'\n", filter ? filter : "");
+        return 1;
+    }
+    printf("%d/%d passed\n", count - failed, count);
+    return failed == 0 ? 0 : 1;
+}
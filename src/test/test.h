@@ -0,0 +1,35 @@
+#ifndef TEST_H_
+#define TEST_H_
+
+#include <cstdio>
+
+typedef void (*TestFunc)();
+
+// 单元测试用例注册表，用例与微基准一样在全局作用域注册
+class Test {
+public:
+    static void add(const char *name, TestFunc func);
+    // 运行名字中包含 filter 的所有用例，filter 为空时全部运行，返回失败的用例数
+    static int run_all(const char *filter, int &count);
+    // 记录当前用例的一次检查失败，用例继续运行
+    static void fail(const char *file, int line, const char *expr);
+};
+
+// 在全局作用域中注册用例
+struct TestRegistrar {
+    TestRegistrar(const char *name, TestFunc func) {
+        Test::add(name, func);
+    }
+};
+
+// 检查失败时输出位置和表达式，不中断用例
+#define CHECK(expr) \
+    do { \
+        if (!(expr)) { \
+            Test::fail(__FILE__, __LINE__, #expr); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+#endif // TEST_H_
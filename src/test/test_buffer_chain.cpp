@@ -0,0 +1,60 @@
+#include <memory>
+#include <string>
+#include "test.h"
+#include "../core/arena/arena.h"
+#include "../core/buffer/buffer_chain.h"
+
+// 共享块所在的段发送完就释放，不等到 reset；copy_pending 只包含还没发送的字节
+static void test_blob_release() {
+    Arena arena;
+    BufferChain out(arena);
+    std::weak_ptr<const std::string> first, second;
+    {
+        std::shared_ptr<const std::string> a = std::make_shared<const std::string>(100, 'a');
+        std::shared_ptr<const std::string> b = std::make_shared<const std::string>(100, 'b');
+        first = a;
+        second = b;
+        out.append("hdr", 3);
+        out.append_blob(a);
+        out.append("x", 1);
+        out.append_blob(b);
+    }
+    CHECK_EQ(out.size(), (size_t)204);
+
+    out.consume(50);
+    CHECK(!first.expired());
+    out.consume(53);
+    CHECK(first.expired());
+    CHECK(!second.expired());
+    CHECK_EQ(*out.copy_pending(), "x" + std::string(100, 'b'));
+
+    out.consume(101);
+    CHECK(second.expired());
+    CHECK(out.empty());
+}
+
+// 整理：复制未发送的数据、reset 后再追加，内容不变，占用的 Arena 内存归零重计
+static void test_compact() {
+    Arena arena;
+    BufferChain out(arena);
+    std::string expect;
+    for (int i = 0; i < 1000; ++i) {
+        std::string piece = "frame" + std::to_string(i) + ";";
+        out.append(piece.data(), piece.size());
+        expect += piece;
+    }
+    out.consume(6);
+    expect.erase(0, 6);
+    CHECK(out.retained() > 0);
+
+    std::shared_ptr<const std::string> pending = out.copy_pending();
+    out.reset();
+    arena.reset();
+    CHECK_EQ(out.retained(), (size_t)0);
+    out.append_blob(pending);
+    CHECK_EQ(*out.copy_pending(), expect);
+    CHECK_EQ(out.size(), expect.size());
+}
+
+static TestRegistrar r1("buffer/blob_release", test_blob_release);
+static TestRegistrar r2("buffer/compact", test_compact);
@@ -0,0 +1,78 @@
+#include <string>
+#include "test.h"
+#include "../http/proxy.h"
+
+// 一次扫描全部数据，返回属于响应的字节数
+static size_t scan_all(ChunkScanner &scanner, const std::string &data) {
+    return scanner.scan(data.data(), data.size());
+}
+
+// 每次只给 step 个字节，返回属于响应的字节数
+static size_t scan_split(ChunkScanner &scanner, const std::string &data, size_t step) {
+    size_t used = 0;
+    for (size_t pos = 0; pos < data.size() && !scanner.done() && !scanner.error(); pos += step) {
+        size_t n = data.size() - pos < step ? data.size() - pos : step;
+        used += scanner.scan(data.data() + pos, n);
+    }
+    return used;
+}
+
+// 响应体在长度为 0 的块和 trailer 之后结束，后面的字节（下一个响应）不计入
+static void test_end() {
+    const std::string body = "4\r\nWiki\r\n5;name=value\r\npedia\r\nE \r\n in\r\n\r\nchunks.\r\n0\r\n\r\n";
+    const std::string trailer = "1A\r\nabcdefghijklmnopqrstuvwxyz\r\n0\r\nExpires: never\r\nX-A: b\r\n\r\n";
+    const std::string next = "HTTP/1.1 200 OK\r\n";
+
+    for (size_t step = 1; step <= 7; ++step) {
+        ChunkScanner a;
+        CHECK_EQ(scan_split(a, body + next, step), body.size());
+        CHECK(a.done());
+        CHECK(!a.error());
+
+        ChunkScanner b;
+        CHECK_EQ(scan_split(b, trailer + next, step), trailer.size());
+        CHECK(b.done());
+    }
+
+    // 没有结束之前所有字节都属于响应
+    ChunkScanner c;
+    CHECK_EQ(scan_all(c, "4\r\nWi"), (size_t)5);
+    CHECK_EQ(scan_all(c, "ki\r\n0\r\n"), (size_t)7);
+    CHECK(!c.done());
+    CHECK_EQ(scan_all(c, "\r"), (size_t)1);
+    CHECK(!c.done());
+    CHECK_EQ(scan_all(c, "\nx"), (size_t)1);
+    CHECK(c.done());
+    CHECK_EQ(scan_all(c, "more"), (size_t)0);
+}
+
+// 大块的数据分多次到达，整段跳过
+static void test_large_chunk() {
+    std::string body = "10000\r\n" + std::string(65536, '\r') + "\r\n0\r\n\r\n";
+    ChunkScanner scanner;
+    CHECK_EQ(scan_split(scanner, body, 1000), body.size());
+    CHECK(scanner.done());
+}
+
+static bool invalid(const std::string &data) {
+    ChunkScanner scanner;
+    scan_all(scanner, data);
+    return scanner.error() && !scanner.done();
+}
+
+static void test_errors() {
+    CHECK(invalid("zz\r\n"));                           // 长度不是十六进制
+    CHECK(invalid("\r\n\r\n"));                         // 长度为空
+    CHECK(invalid(";ext\r\n\r\n"));
+    CHECK(invalid("4\r\nWiki\r\n\r\n"));                // 块之间的长度为空
+    CHECK(invalid("4\rX"));                             // 长度行缺少 LF
+    CHECK(invalid("4\r\nWikiX\r\n"));                   // 数据比长度长
+    CHECK(invalid("4\r\nWiki\rX"));
+    CHECK(invalid("0\r\n\rX"));                         // 最后的空行缺少 LF
+    CHECK(invalid("10000000000000000\r\n"));            // 超过 64 位
+    CHECK(!invalid("ffffffffffffffff\r\n"));
+}
+
+static TestRegistrar r1("chunk/end", test_end);
+static TestRegistrar r2("chunk/large_chunk", test_large_chunk);
+static TestRegistrar r3("chunk/errors", test_errors);
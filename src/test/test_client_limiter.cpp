@@ -0,0 +1,133 @@
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "test.h"
+#include "../core/limit/client_limiter.h"
+
+// 表只分配一次，两个进程的连接计数；各用例使用不同的 IP，互不影响
+static void init_table() {
+    if (!ClientLimiter::ready()) {
+        ClientLimiter::init(2);
+    }
+    ClientLimiter::set_process(0);
+}
+
+static ClientLimiter::Rule rule(const char *text) {
+    ClientLimiter::Rule r;
+    CHECK(ClientLimiter::parse_rule(text, r));
+    return r;
+}
+
+static uint32_t ip(int a, int b, int c, int d) {
+    return (uint32_t)a << 24 | (uint32_t)b << 16 | (uint32_t)c << 8 | (uint32_t)d;
+}
+
+static void test_parse() {
+    ClientLimiter::Rule r = rule("10.1.2.3/8 rate=2.5 burst=10 conns=4 shared");
+    CHECK_EQ(r.network, ip(10, 0, 0, 0));
+    CHECK_EQ(r.mask, 0xff000000u);
+    CHECK_EQ(r.prefix, 8);
+    CHECK(r.shared);
+    CHECK(r.rate == 2.5);
+    CHECK_EQ(r.burst, 10);
+    CHECK_EQ(r.max_conns, 4);
+
+    // 没有给出容量时为一秒的请求数，单个 IP 的掩码为全 1，/0 匹配所有地址
+    r = rule("192.168.0.7 rate=2.5");
+    CHECK_EQ(r.prefix, 32);
+    CHECK_EQ(r.mask, 0xffffffffu);
+    CHECK(!r.shared);
+    CHECK_EQ(r.burst, 3);
+    CHECK_EQ(r.max_conns, 0);
+    r = rule("0.0.0.0/0 conns=100");
+    CHECK_EQ(r.mask, 0u);
+    CHECK_EQ(r.burst, 1);
+
+    ClientLimiter::Rule bad;
+    CHECK(!ClientLimiter::parse_rule("", bad));
+    CHECK(!ClientLimiter::parse_rule("10.0.0.1/33 rate=1", bad));
+    CHECK(!ClientLimiter::parse_rule("10.0.0 rate=1", bad));
+    CHECK(!ClientLimiter::parse_rule("10.0.0.1 speed=1", bad));
+    CHECK(!ClientLimiter::parse_rule("10.0.0.1 rate=-1", bad));
+}
+
+// 规则按前缀从长到短匹配，与配置中的顺序无关
+static void test_match() {
+    std::vector<ClientLimiter::Rule> rules;
+    rules.push_back(rule("0.0.0.0/0 rate=1"));
+    rules.push_back(rule("10.0.0.0/8 rate=2"));
+    rules.push_back(rule("10.1.0.0/16 rate=3"));
+    rules.push_back(rule("10.1.2.3 rate=4"));
+    ClientLimiter::sort_rules(rules);
+
+    CHECK(ClientLimiter::match(rules, ip(10, 1, 2, 3))->rate == 4);
+    CHECK(ClientLimiter::match(rules, ip(10, 1, 2, 4))->rate == 3);
+    CHECK(ClientLimiter::match(rules, ip(10, 2, 0, 1))->rate == 2);
+    CHECK(ClientLimiter::match(rules, ip(11, 0, 0, 1))->rate == 1);
+
+    rules.erase(rules.end() - 1);
+    CHECK(ClientLimiter::match(rules, ip(11, 0, 0, 1)) == NULL);
+}
+
+// 并发连接数：超过上限的连接被拒绝，关闭后空出名额；shared 时整个网段共用，所有进程的连接一起计算
+static void test_conns() {
+    init_table();
+    bool rejected = false;
+
+    ClientLimiter::Rule each = rule("172.16.0.0/24 conns=2");
+    int a = ClientLimiter::acquire(each, ip(172, 16, 0, 1), rejected);
+    int b = ClientLimiter::acquire(each, ip(172, 16, 0, 1), rejected);
+    CHECK(a >= 0 && a == b && !rejected);
+    CHECK_EQ(ClientLimiter::acquire(each, ip(172, 16, 0, 1), rejected), -1);
+    CHECK(rejected);
+    CHECK(ClientLimiter::acquire(each, ip(172, 16, 0, 2), rejected) >= 0 && !rejected);
+    ClientLimiter::release(a);
+    CHECK_EQ(ClientLimiter::acquire(each, ip(172, 16, 0, 1), rejected), a);
+    CHECK(!rejected);
+
+    ClientLimiter::Rule shared = rule("172.17.0.0/24 conns=2 shared");
+    int c = ClientLimiter::acquire(shared, ip(172, 17, 0, 1), rejected);
+    CHECK(c >= 0 && !rejected);
+    ClientLimiter::set_process(1);
+    CHECK_EQ(ClientLimiter::acquire(shared, ip(172, 17, 0, 2), rejected), c);
+    CHECK_EQ(ClientLimiter::acquire(shared, ip(172, 17, 0, 3), rejected), -1);
+    CHECK(rejected);
+
+    // 工作进程 1 退出后主进程清零它的计数
+    ClientLimiter::set_process(0);
+    ClientLimiter::reset_process(1);
+    CHECK_EQ(ClientLimiter::acquire(shared, ip(172, 17, 0, 3), rejected), c);
+    CHECK(!rejected);
+    CHECK_EQ(ClientLimiter::acquire(shared, ip(172, 17, 0, 4), rejected), -1);
+}
+
+// 令牌桶：连续放行 burst 个请求，之后按速率恢复；没有速率限制的表项和 slot -1 总是放行
+static void test_rate() {
+    init_table();
+    bool rejected = false;
+
+    int slot = ClientLimiter::acquire(rule("172.18.0.1 rate=1 burst=3"), ip(172, 18, 0, 1), rejected);
+    CHECK(slot >= 0);
+    CHECK(ClientLimiter::allow(slot));
+    CHECK(ClientLimiter::allow(slot));
+    CHECK(ClientLimiter::allow(slot));
+    CHECK(!ClientLimiter::allow(slot));
+    CHECK(!ClientLimiter::allow(slot));
+
+    slot = ClientLimiter::acquire(rule("172.18.0.2 rate=200 burst=1"), ip(172, 18, 0, 2), rejected);
+    CHECK(ClientLimiter::allow(slot));
+    CHECK(!ClientLimiter::allow(slot));
+    usleep(10000);
+    CHECK(ClientLimiter::allow(slot));
+
+    slot = ClientLimiter::acquire(rule("172.18.0.3 conns=10"), ip(172, 18, 0, 3), rejected);
+    for (int i = 0; i < 1000; ++i) {
+        CHECK(ClientLimiter::allow(slot));
+    }
+    CHECK(ClientLimiter::allow(-1));
+}
+
+static TestRegistrar r1("limit/parse", test_parse);
+static TestRegistrar r2("limit/match", test_match);
+static TestRegistrar r3("limit/conns", test_conns);
+static TestRegistrar r4("limit/rate", test_rate);
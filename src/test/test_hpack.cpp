@@ -0,0 +1,219 @@
+#include <string>
+#include "test.h"
+#include "../http/hpack.h"
+
+// 十六进制字符串转成字节，忽略空格
+static std::string unhex(const char *hex) {
+    std::string out;
+    int high = -1;
+    for (const char *p = hex; *p; ++p) {
+        int v = (*p >= '0' && *p <= '9') ? *p - '0' : (*p >= 'a' && *p <= 'f') ? *p - 'a' + 10 : -1;
+        if (v < 0) {
+            continue;
+        }
+        if (high < 0) {
+            high = v;
+        }
+        else {
+            out.push_back((char)(high << 4 | v));
+            high = -1;
+        }
+    }
+    return out;
+}
+
+static bool decode(HpackDecoder &decoder, const std::string &block, HpackHeaders &headers) {
+    headers.clear();
+    return decoder.decode(reinterpret_cast<const uint8_t *>(block.data()), block.size(), headers);
+}
+
+static bool decode_one(const std::string &block) {
+    HpackDecoder decoder;
+    HpackHeaders headers;
+    return decode(decoder, block, headers);
+}
+
+// 带前缀的整数，RFC 7541 C.1
+static void test_int() {
+    std::string out;
+    hpack::encode_int(10, 5, 0, out);
+    CHECK_EQ(out, unhex("0a"));
+    out.clear();
+    hpack::encode_int(1337, 5, 0, out);
+    CHECK_EQ(out, unhex("1f 9a 0a"));
+    out.clear();
+    hpack::encode_int(42, 8, 0, out);
+    CHECK_EQ(out, unhex("2a"));
+
+    uint64_t value = 0;
+    std::string in = unhex("1f 9a 0a");
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(in.data());
+    CHECK(hpack::decode_int(p, p + in.size(), 5, value));
+    CHECK_EQ(value, (uint64_t)1337);
+    CHECK(p == reinterpret_cast<const uint8_t *>(in.data()) + in.size());
+
+    // 缺少后续字节、超过 32 位
+    p = reinterpret_cast<const uint8_t *>(in.data());
+    CHECK(!hpack::decode_int(p, p + 2, 5, value));
+    in = unhex("1f ff ff ff ff 7f");
+    p = reinterpret_cast<const uint8_t *>(in.data());
+    CHECK(!hpack::decode_int(p, p + in.size(), 5, value));
+}
+
+// 同一个连接上的三个请求，后面的请求引用前面加入动态表的条目，RFC 7541 C.3（不用 Huffman）和 C.4（Huffman）
+static void test_requests() {
+    static const char *const blocks[2][3] = {
+        {"8286 8441 0f77 7777 2e65 7861 6d70 6c65 2e63 6f6d",
+         "8286 84be 5808 6e6f 2d63 6163 6865",
+         "8287 85bf 400a 6375 7374 6f6d 2d6b 6579 0c63 7573 746f 6d2d 7661 6c75 65"},
+        {"8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+         "8286 84be 5886 a8eb 1064 9cbf",
+         "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf"}
+    };
+    for (int huffman = 0; huffman < 2; ++huffman) {
+        HpackDecoder decoder;
+        HpackHeaders h;
+
+        CHECK(decode(decoder, unhex(blocks[huffman][0]), h));
+        CHECK_EQ(h.size(), (size_t)4);
+        if (h.size() == 4) {
+            CHECK_EQ(h[0].first, ":method");
+            CHECK_EQ(h[0].second, "GET");
+            CHECK_EQ(h[1].second, "http");
+            CHECK_EQ(h[2].second, "/");
+            CHECK_EQ(h[3].first, ":authority");
+            CHECK_EQ(h[3].second, "www.example.com");
+        }
+
+        CHECK(decode(decoder, unhex(blocks[huffman][1]), h));
+        CHECK_EQ(h.size(), (size_t)5);
+        if (h.size() == 5) {
+            CHECK_EQ(h[3].second, "www.example.com");
+            CHECK_EQ(h[4].first, "cache-control");
+            CHECK_EQ(h[4].second, "no-cache");
+        }
+
+        CHECK(decode(decoder, unhex(blocks[huffman][2]), h));
+        CHECK_EQ(h.size(), (size_t)5);
+        if (h.size() == 5) {
+            CHECK_EQ(h[1].second, "https");
+            CHECK_EQ(h[2].second, "/index.html");
+            CHECK_EQ(h[3].second, "www.example.com");
+            CHECK_EQ(h[4].first, "custom-key");
+            CHECK_EQ(h[4].second, "custom-value");
+        }
+    }
+}
+
+// 格式错误的头部块都要返回 false，不能越界读
+static void test_invalid() {
+    CHECK(!decode_one(unhex("80")));                    // 下标 0
+    CHECK(!decode_one(unhex("be")));                    // 动态表为空时的下标 62
+    CHECK(!decode_one(unhex("44 05 2f 61")));           // 字符串比剩余的字节长
+    CHECK(!decode_one(unhex("40 01 61")));              // 名字之后缺少值
+    CHECK(!decode_one(unhex("41 81 00")));              // Huffman 填充不是全 1
+    CHECK(!decode_one(unhex("41 82 ff ff")));           // Huffman 的填充超过 7 位
+    CHECK(!decode_one(unhex("41 84 ff ff ff ff")));     // 字符串中出现 EOS
+    CHECK(!decode_one(unhex("3f e2 1f")));              // 动态表大小更新超过 4096
+    CHECK(!decode_one(unhex("82 20")));                 // 大小更新不在头部块的开头
+    CHECK(decode_one(unhex("20 3f e1 1f 82")));         // 开头连续的大小更新，4096 为上限
+    CHECK(decode_one(std::string()));
+
+    // 解码后的头部列表超过上限（压缩炸弹）：动态表中的一个大条目被反复引用
+    std::string block = unhex("40 01 78 7f e9 06");
+    block += std::string(1000, 'v');
+    for (int i = 0; i < 80; ++i) {
+        block += unhex("be");
+    }
+    CHECK(!decode_one(block));
+}
+
+// 动态表：新条目下标最小，超过上限时淘汰最旧的，上限改小时立即淘汰
+static void test_table() {
+    HpackTable table(100);
+    table.insert("a", "1");                             // 34 字节
+    table.insert("b", "2");
+    CHECK_EQ(table.get(62)->first, "b");
+    CHECK_EQ(table.get(63)->first, "a");
+    CHECK(table.get(64) == NULL);
+
+    table.insert("c", "3");                             // 102 > 100，淘汰 a
+    CHECK_EQ(table.get(62)->first, "c");
+    CHECK_EQ(table.get(63)->first, "b");
+    CHECK(table.get(64) == NULL);
+
+    bool exact = false;
+    CHECK_EQ(table.find("b", "2", exact), (size_t)63);
+    CHECK(exact);
+    CHECK_EQ(table.find("b", "x", exact), (size_t)63);
+    CHECK(!exact);
+    CHECK_EQ(table.find(":path", "/", exact), (size_t)4);
+    CHECK(exact);
+
+    // 比整张表还大的条目清空动态表，自己也不加入
+    table.insert("d", std::string(200, 'x'));
+    CHECK(table.get(62) == NULL);
+
+    table.insert("e", "5");
+    table.set_max_size(0);
+    CHECK(table.get(62) == NULL);
+    CHECK_EQ(table.get(61)->first, "www-authenticate");
+}
+
+// 编码器的输出用解码器还原，包括对端把动态表改小之后的大小更新
+static void test_roundtrip() {
+    HpackEncoder encoder;
+    HpackDecoder decoder;
+    HpackHeaders h;
+    for (int round = 0; round < 3; ++round) {
+        if (round == 2) {
+            encoder.set_max_table_size(0);
+        }
+        std::string block;
+        encoder.begin(block);
+        encoder.encode(":status", "200", block);
+        encoder.encode("content-type", "text/html", block);
+        encoder.encode("server", "molecule", block);
+        encoder.encode("content-length", std::to_string(1000 + round), block, false);
+        CHECK(decode(decoder, block, h));
+        CHECK_EQ(h.size(), (size_t)4);
+        if (h.size() == 4) {
+            CHECK_EQ(h[0].second, "200");
+            CHECK_EQ(h[1].second, "text/html");
+            CHECK_EQ(h[2].first, "server");
+            CHECK_EQ(h[2].second, "molecule");
+            CHECK_EQ(h[3].second, std::to_string(1000 + round));
+        }
+        // 第二个块中重复的头部只用一个字节的下标
+        if (round == 1) {
+            CHECK(block.size() < 12);
+        }
+    }
+
+    // 所有字节值经过 Huffman 编码再解码，重复的常见字符让 Huffman 编码更短
+    std::string s;
+    for (int c = 0; c < 256; ++c) {
+        s.push_back((char)c);
+    }
+    for (int i = 0; i < 300; ++i) {
+        s += "www.example.com";
+    }
+    std::string out;
+    hpack::encode_string(s, out);
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(out.data());
+    std::string back;
+    CHECK_EQ((uint8_t)out[0] & 0x80, 0x80);
+    CHECK(hpack::decode_string(p, p + out.size(), back));
+    CHECK_EQ(back, s);
+
+    out.clear();
+    hpack::encode_string("custom-value", out);
+    CHECK_EQ((uint8_t)out[0] & 0x80, 0x80);
+    CHECK_EQ(out.size(), (size_t)1 + hpack::huffman_length("custom-value"));
+}
+
+static TestRegistrar r1("hpack/int", test_int);
+static TestRegistrar r2("hpack/requests", test_requests);
+static TestRegistrar r3("hpack/invalid", test_invalid);
+static TestRegistrar r4("hpack/table", test_table);
+static TestRegistrar r5("hpack/roundtrip", test_roundtrip);
@@ -0,0 +1,255 @@
+#include <string>
+#include <vector>
+#include "test.h"
+#include "../core/arena/arena.h"
+#include "../core/buffer/buffer_chain.h"
+#include "../http/http2.h"
+
+struct H2Frame {
+    uint8_t type;
+    uint8_t flags;
+    uint32_t stream_id;
+    std::string payload;
+};
+
+static std::string u32(uint32_t v) {
+    return std::string() + (char)(v >> 24) + (char)(v >> 16) + (char)(v >> 8) + (char)v;
+}
+
+static uint32_t get_u32(const std::string &s, size_t off) {
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(s.data()) + off;
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static std::string frame(uint8_t type, uint8_t flags, uint32_t stream_id, const std::string &payload) {
+    size_t len = payload.size();
+    std::string f;
+    f += (char)(len >> 16);
+    f += (char)(len >> 8);
+    f += (char)len;
+    f += (char)type;
+    f += (char)flags;
+    return f + u32(stream_id) + payload;
+}
+
+static std::string setting(uint16_t id, uint32_t value) {
+    return std::string() + (char)(id >> 8) + (char)id + u32(value);
+}
+
+static std::string window_update(uint32_t stream_id, uint32_t increment) {
+    return frame(Http2Session::WINDOW_UPDATE, 0, stream_id, u32(increment));
+}
+
+// GET path 的请求头，不用 Huffman 和动态表
+static std::string get(uint32_t stream_id, const std::string &path, bool end_stream = true) {
+    std::string block = "\x82\x86";
+    block += (char)0x04;
+    block += (char)path.size();
+    block += path;
+    uint8_t flags = Http2Session::FLAG_END_HEADERS | (end_stream ? Http2Session::FLAG_END_STREAM : 0);
+    return frame(Http2Session::HEADERS, flags, stream_id, block);
+}
+
+// 扮演客户端：send 交给会话解析，recv 取出会话生成的所有帧
+struct H2Client {
+    Http2Session session;
+    Arena arena;
+    BufferChain out;
+
+    explicit H2Client(uint32_t initial_window) : session(-1, 0), out(arena) {
+        send(std::string(Http2Session::PREFACE, Http2Session::PREFACE_LEN) +
+             frame(Http2Session::SETTINGS, 0, 0, setting(Http2Session::SETTINGS_INITIAL_WINDOW_SIZE, initial_window)));
+        recv();
+    }
+
+    void send(const std::string &data) { session.feed(data.data(), data.size()); }
+
+    std::vector<H2Frame> recv() {
+        session.produce(out);
+        std::string data = out.empty() ? std::string() : *out.copy_pending();
+        out.consume(out.size());
+        std::vector<H2Frame> frames;
+        for (size_t pos = 0; pos + 9 <= data.size(); ) {
+            const uint8_t *p = reinterpret_cast<const uint8_t *>(data.data()) + pos;
+            H2Frame f;
+            size_t len = (size_t)p[0] << 16 | (size_t)p[1] << 8 | p[2];
+            f.type = p[3];
+            f.flags = p[4];
+            f.stream_id = get_u32(data, pos + 5) & 0x7fffffff;
+            f.payload = data.substr(pos + 9, len);
+            frames.push_back(f);
+            pos += 9 + len;
+        }
+        return frames;
+    }
+};
+
+// frames 中 DATA 的总字节数，最后一个 DATA 带 END_STREAM 时置 end_stream
+static size_t data_bytes(const std::vector<H2Frame> &frames, bool &end_stream) {
+    size_t n = 0;
+    end_stream = false;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (frames[i].type == Http2Session::DATA) {
+            n += frames[i].payload.size();
+            end_stream = frames[i].flags & Http2Session::FLAG_END_STREAM;
+        }
+    }
+    return n;
+}
+
+// 响应头中的 content-length
+static size_t content_length(HpackDecoder &decoder, const std::vector<H2Frame> &frames) {
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (frames[i].type != Http2Session::HEADERS) {
+            continue;
+        }
+        HpackHeaders headers;
+        decoder.decode(reinterpret_cast<const uint8_t *>(frames[i].payload.data()), frames[i].payload.size(), headers);
+        for (size_t j = 0; j < headers.size(); ++j) {
+            if (headers[j].first == "content-length") {
+                return std::stoul(headers[j].second);
+            }
+        }
+    }
+    return 0;
+}
+
+// 只有一个 GOAWAY 或 RST_STREAM 帧，返回其中的错误码，没有返回 -1
+static int error_code(const std::vector<H2Frame> &frames, uint8_t type) {
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (frames[i].type == type) {
+            return (int)get_u32(frames[i].payload, type == Http2Session::GOAWAY ? 4 : 0);
+        }
+    }
+    return -1;
+}
+
+// 流的发送窗口：用完就停，WINDOW_UPDATE 之后继续，SETTINGS 把初始值改小后窗口可以为负
+static void test_stream_window() {
+    H2Client c(10);
+    HpackDecoder decoder;
+    bool end = false;
+
+    c.send(get(1, "/metrics"));
+    std::vector<H2Frame> frames = c.recv();
+    size_t length = content_length(decoder, frames);
+    CHECK(length > 100);
+    CHECK_EQ(data_bytes(frames, end), (size_t)10);
+    CHECK(!end);
+    CHECK_EQ(data_bytes(c.recv(), end), (size_t)0);
+
+    c.send(window_update(1, 5));
+    CHECK_EQ(data_bytes(c.recv(), end), (size_t)5);
+
+    // 窗口 0，初始值从 10 改为 0 后是 -10，增加 15 才能再发送 5 字节
+    c.send(frame(Http2Session::SETTINGS, 0, 0, setting(Http2Session::SETTINGS_INITIAL_WINDOW_SIZE, 0)));
+    frames = c.recv();
+    CHECK_EQ(frames.size(), (size_t)1);
+    CHECK_EQ(frames[0].type, Http2Session::SETTINGS);
+    CHECK_EQ(frames[0].flags, Http2Session::FLAG_ACK);
+    c.send(window_update(1, 10));
+    CHECK_EQ(data_bytes(c.recv(), end), (size_t)0);
+    c.send(window_update(1, 5));
+    CHECK_EQ(data_bytes(c.recv(), end), (size_t)5);
+
+    c.send(window_update(1, 1 << 20));
+    CHECK_EQ(data_bytes(c.recv(), end), length - 20);
+    CHECK(end);
+}
+
+// 连接的发送窗口由所有流共用，默认 65535
+static void test_connection_window() {
+    H2Client c(1 << 20);
+    HpackDecoder decoder;
+    bool end = false;
+
+    std::string requests;
+    for (uint32_t id = 1; id < 80; id += 2) {
+        requests += get(id, "/metrics");
+    }
+    c.send(requests);
+    std::vector<H2Frame> frames = c.recv();
+    size_t total = 0;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (frames[i].type == Http2Session::HEADERS) {
+            total += content_length(decoder, std::vector<H2Frame>(1, frames[i]));
+        }
+    }
+    CHECK(total > (size_t)Http2Session::DEFAULT_WINDOW);
+    CHECK_EQ(data_bytes(frames, end), (size_t)Http2Session::DEFAULT_WINDOW);
+    CHECK_EQ(data_bytes(c.recv(), end), (size_t)0);
+
+    c.send(window_update(0, 1000));
+    CHECK_EQ(data_bytes(c.recv(), end), (size_t)1000);
+    // 一次 produce 最多放入 SEND_BATCH 字节，剩下的分几次取完
+    c.send(window_update(0, 1 << 24));
+    size_t rest = 0, n;
+    while ((n = data_bytes(c.recv(), end)) > 0) {
+        rest += n;
+        CHECK(n <= Http2Session::SEND_BATCH);
+    }
+    CHECK_EQ(rest, total - Http2Session::DEFAULT_WINDOW - 1000);
+}
+
+// 收到的请求体：每个 DATA 立即归还流的窗口，连接的窗口攒够半个再归还
+static void test_receive_window() {
+    H2Client c(Http2Session::DEFAULT_WINDOW);
+    c.send(get(1, "/metrics", false));
+    std::string body(16000, 'b');
+    for (int i = 0; i < 3; ++i) {
+        c.send(frame(Http2Session::DATA, 0, 1, body));
+    }
+    std::vector<H2Frame> frames = c.recv();
+    uint32_t stream_credit = 0, connection_credit = 0;
+    for (size_t i = 0; i < frames.size(); ++i) {
+        if (frames[i].type == Http2Session::WINDOW_UPDATE) {
+            (frames[i].stream_id ? stream_credit : connection_credit) += get_u32(frames[i].payload, 0);
+        }
+    }
+    CHECK_EQ(stream_credit, (uint32_t)48000);
+    CHECK_EQ(connection_credit, (uint32_t)48000);
+}
+
+// 窗口超过 2^31-1 和增量为 0 的处理：连接级是连接错误，流级只重置这个流
+static void test_window_errors() {
+    {
+        H2Client c(Http2Session::DEFAULT_WINDOW);
+        c.send(window_update(0, 0x7fffffff));
+        CHECK_EQ(error_code(c.recv(), Http2Session::GOAWAY), (int)Http2Session::FLOW_CONTROL_ERROR);
+    }
+    {
+        H2Client c(Http2Session::DEFAULT_WINDOW);
+        c.send(window_update(0, 0));
+        CHECK_EQ(error_code(c.recv(), Http2Session::GOAWAY), (int)Http2Session::PROTOCOL_ERROR);
+    }
+    {
+        H2Client c(Http2Session::DEFAULT_WINDOW);
+        c.send(frame(Http2Session::SETTINGS, 0, 0, setting(Http2Session::SETTINGS_INITIAL_WINDOW_SIZE, 0x80000000)));
+        CHECK_EQ(error_code(c.recv(), Http2Session::GOAWAY), (int)Http2Session::FLOW_CONTROL_ERROR);
+    }
+    {
+        // 窗口为 0 的流发送完响应头后一直打开
+        H2Client c(0);
+        c.send(get(1, "/metrics") + get(3, "/metrics"));
+        c.recv();
+        c.send(window_update(1, 0x7fffffff));
+        c.send(window_update(1, 1));
+        std::vector<H2Frame> frames = c.recv();
+        CHECK_EQ(error_code(frames, Http2Session::RST_STREAM), (int)Http2Session::FLOW_CONTROL_ERROR);
+        CHECK_EQ(error_code(frames, Http2Session::GOAWAY), -1);
+
+        c.send(window_update(3, 0));
+        frames = c.recv();
+        CHECK_EQ(error_code(frames, Http2Session::RST_STREAM), (int)Http2Session::PROTOCOL_ERROR);
+        CHECK_EQ(error_code(frames, Http2Session::GOAWAY), -1);
+
+        // 关闭后的流上的 WINDOW_UPDATE 忽略
+        c.send(window_update(1, 100));
+        CHECK(c.recv().empty());
+    }
+}
+
+static TestRegistrar r1("http2/stream_window", test_stream_window);
+static TestRegistrar r2("http2/connection_window", test_connection_window);
+static TestRegistrar r3("http2/receive_window", test_receive_window);
+static TestRegistrar r4("http2/window_errors", test_window_errors);
@@ -0,0 +1,78 @@
+#include <string>
+#include "test.h"
+#include "../http/router.h"
+
+// 查找 path 匹配到的路由值，没有匹配时为 -1
+static int route(const Router<int> &router, const char *path) {
+    const int *value = router.find(path);
+    return value ? *value : -1;
+}
+
+// 完整匹配优先于前缀，前缀取最长的，与注册顺序无关
+static void test_priority() {
+    Router<int> router;
+    router.add("/api/v1/", Router<int>::PREFIX, 3);
+    router.add("/metrics", Router<int>::EXACT, 2);
+    router.add("/", Router<int>::PREFIX, 1);
+    router.add("/api/", Router<int>::PREFIX, 4);
+    router.add("/api/v1/users", Router<int>::EXACT, 5);
+    router.compile();
+
+    CHECK_EQ(route(router, "/metrics"), 2);
+    CHECK_EQ(route(router, "/metrics/x"), 1);
+    CHECK_EQ(route(router, "/metric"), 1);
+    CHECK_EQ(route(router, "/api/v1/users"), 5);
+    CHECK_EQ(route(router, "/api/v1/users/42"), 3);
+    CHECK_EQ(route(router, "/api/v2/users"), 4);
+    CHECK_EQ(route(router, "/api/"), 4);
+    CHECK_EQ(route(router, "/index.html"), 1);
+    CHECK_EQ(route(router, "/"), 1);
+    CHECK_EQ(route(router, ""), -1);
+}
+
+// 不以 '/' 结尾的前缀只匹配完整的路径段
+static void test_segment() {
+    Router<int> router;
+    router.add("/", Router<int>::PREFIX, 1);
+    router.add("/api", Router<int>::PREFIX, 2);
+    router.add("/api/v1", Router<int>::PREFIX, 3);
+    router.add("/static/", Router<int>::PREFIX, 4);
+    router.compile();
+
+    CHECK_EQ(route(router, "/api"), 2);
+    CHECK_EQ(route(router, "/api/"), 2);
+    CHECK_EQ(route(router, "/api/users"), 2);
+    CHECK_EQ(route(router, "/apiary"), 1);
+    CHECK_EQ(route(router, "/api/v1"), 3);
+    CHECK_EQ(route(router, "/api/v1/x"), 3);
+    CHECK_EQ(route(router, "/api/v10"), 2);
+    CHECK_EQ(route(router, "/static/a.css"), 4);
+    CHECK_EQ(route(router, "/static"), 1);
+    CHECK_EQ(route(router, "/staticfiles/a.css"), 1);
+}
+
+// 没有兜底路由时不匹配返回 NULL；同一路由注册多次时后注册的生效
+static void test_miss_and_override() {
+    Router<int> empty;
+    empty.compile();
+    CHECK_EQ(route(empty, "/"), -1);
+
+    Router<int> router;
+    router.add("/login", Router<int>::EXACT, 1);
+    router.add("/login", Router<int>::EXACT, 2);
+    router.add("/log", Router<int>::PREFIX, 3);
+    router.add("/\xe4\xb8\xad", Router<int>::EXACT, 4);
+    router.compile();
+    CHECK_EQ(route(router, "/login"), 2);
+    CHECK_EQ(route(router, "/logi"), -1);
+    CHECK_EQ(route(router, "/logout"), -1);
+    CHECK_EQ(route(router, "/log/2024"), 3);
+    CHECK_EQ(route(router, "/register"), -1);
+    CHECK_EQ(route(router, "/\xe4\xb8\xad"), 4);
+    CHECK_EQ(route(router, "/\xe4\xb8"), -1);
+    CHECK_EQ(router.size(), (size_t)4);
+}
+
+static TestRegistrar r1("router/priority", test_priority);
+static TestRegistrar r2("router/segment", test_segment);
+static TestRegistrar r3("router/miss_and_override", test_miss_and_override);
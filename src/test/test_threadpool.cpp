@@ -0,0 +1,102 @@
+#include <atomic>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include "test.h"
+#include "../core/threadpool/threadpool.h"
+
+// 处理时睡眠 sleep_us，记录正在处理和处理完的个数
+class TestTask {
+public:
+    TestTask() : sleep_us(0) {}
+    void process() {
+        m_running.fetch_add(1);
+        if (sleep_us > 0) {
+            usleep(sleep_us);
+        }
+        m_running.fetch_sub(1);
+        m_done.fetch_add(1);
+    }
+    void shed() {
+        m_done.fetch_add(1);
+    }
+
+    int sleep_us;
+    static std::atomic<int> m_running;
+    static std::atomic<long long> m_done;
+};
+
+std::atomic<int> TestTask::m_running(0);
+std::atomic<long long> TestTask::m_done(0);
+
+// 析构要等到所有工作线程离开 run()：返回时没有线程还在处理请求，也不会再访问线程池
+static void test_destroy_waits() {
+    for (int round = 0; round < 20; ++round) {
+        ThreadPool<TestTask> *pool = new ThreadPool<TestTask>(4, 1000, 1 << 30, 1 << 30);
+        pool->set_elastic(8, 1, 1);
+        TestTask task;
+        task.sleep_us = 2000;
+        TestTask *tasks[16];
+        for (int i = 0; i < 16; ++i) {
+            tasks[i] = &task;
+        }
+        pool->append_batch(tasks, 16);
+        if (round % 2 == 0) {
+            usleep(1000);
+        }
+        delete pool;
+        CHECK_EQ(TestTask::m_running.load(), 0);
+    }
+}
+
+struct DepthProducer {
+    ThreadPool<TestTask> *pool;
+    long long total;
+};
+
+static void *produce(void *arg) {
+    DepthProducer *producer = (DepthProducer *)arg;
+    static TestTask task;
+    TestTask *tasks[8];
+    for (int i = 0; i < 8; ++i) {
+        tasks[i] = &task;
+    }
+    for (long long i = 0; i < producer->total; ) {
+        int n = producer->pool->append_batch(tasks, 1 + i % 8);
+        if (n == 0) {
+            sched_yield();
+        }
+        i += n;
+    }
+    return NULL;
+}
+
+// 主线程提交后工作线程马上取走时，队列长度的度量不能先减后加、出现负数
+// 工作线程先于提交线程使用度量（分片下标更小），抓取时先读到工作线程的减少
+static void test_queue_depth() {
+    int64_t base_depth = Metrics::get(Metrics::QUEUE_DEPTH);
+    int64_t base_threads = Metrics::get(Metrics::POOL_THREADS);
+    ThreadPool<TestTask> *pool = new ThreadPool<TestTask>(4, 1 << 20, 1 << 30, 1 << 30);
+    while (Metrics::get(Metrics::POOL_THREADS) < base_threads + 4) {
+        sched_yield();
+    }
+    TestTask::m_done.store(0);
+    DepthProducer producer = {pool, 200000};
+    pthread_t thread;
+    pthread_create(&thread, NULL, produce, &producer);
+    int64_t min_depth = 0;
+    while (TestTask::m_done.load() < producer.total) {
+        int64_t depth = Metrics::get(Metrics::QUEUE_DEPTH) - base_depth;
+        if (depth < min_depth) {
+            min_depth = depth;
+        }
+    }
+    pthread_join(thread, NULL);
+    delete pool;
+    CHECK(min_depth >= 0);
+    CHECK_EQ(Metrics::get(Metrics::QUEUE_DEPTH), base_depth);
+    CHECK_EQ(Metrics::get(Metrics::POOL_THREADS), base_threads);
+}
+
+static TestRegistrar r1("threadpool/destroy_waits", test_destroy_waits);
+static TestRegistrar r2("threadpool/queue_depth", test_queue_depth);
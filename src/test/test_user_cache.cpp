@@ -0,0 +1,39 @@
+#include <csignal>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "test.h"
+#include "../db/user_cache.h"
+
+// 工作进程在注册时被 SIGKILL，很可能正持有某个分片的锁；之后其他进程的注册和登录不能阻塞，
+// 被杀死的进程写了一半的表项也不能被当成用户
+static void test_owner_dead() {
+    UserCache *cache = UserCache::instance();
+    CHECK(cache->init_shared(16 * 1024));
+    for (int round = 0; round < 20; ++round) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            // 反复注册、删除用户，大部分时间持有某个分片的锁
+            for (long i = 0; ; ++i) {
+                std::string name = "killed" + std::to_string(i % 512);
+                cache->insert(name, "password");
+                cache->erase(name);
+            }
+        }
+        usleep(2000 + round * 500);
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+
+        // 每个分片至少会被加锁一次
+        for (int i = 0; i < 256; ++i) {
+            std::string name = "user" + std::to_string(round) + "_" + std::to_string(i);
+            CHECK(cache->insert(name, "secret"));
+            CHECK(cache->check(name, "secret"));
+            CHECK(!cache->check(name, "wrong"));
+        }
+    }
+    size_t size = cache->size();
+    CHECK(size >= 20 * 256 && size <= 20 * 256 + 512);
+}
+
+static TestRegistrar r1("user_cache/owner_dead", test_owner_dead);
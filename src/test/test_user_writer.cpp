@@ -0,0 +1,80 @@
+#include <cstdint>
+#include <fcntl.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "test.h"
+#include "../db/sql_conn_pool.h"
+#include "../db/user_cache.h"
+#include "../db/user_writer.h"
+
+static const char *JOURNAL = "/tmp/unittest_register.journal";
+
+// 与 user_writer.cpp 中的格式一致：用户名长度，密码长度（0xffff 为作废记录），用户名，密码
+static std::string record(const std::string &name, const std::string &password) {
+    uint16_t lens[2] = {(uint16_t)name.size(), (uint16_t)password.size()};
+    return std::string((const char *)lens, sizeof(lens)) + name + password;
+}
+
+static std::string tombstone(const std::string &name) {
+    uint16_t lens[2] = {(uint16_t)name.size(), 0xffff};
+    return std::string((const char *)lens, sizeof(lens)) + name;
+}
+
+static void write_journal(const std::string &data) {
+    int fd = open(JOURNAL, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    CHECK(fd >= 0);
+    CHECK_EQ(write(fd, data.data(), data.size()), (ssize_t)data.size());
+    close(fd);
+}
+
+static off_t journal_size() {
+    struct stat st;
+    return stat(JOURNAL, &st) == 0 ? st.st_size : -1;
+}
+
+// 连接池没有初始化，后台线程写不进数据库，用户一直留在日志里
+// 重放时跳过被作废的用户、截掉结尾写到一半的记录，之后追加的用户在下次重放时仍然完整
+static void test_replay() {
+    std::string valid = record("journal_a", "pa") + record("journal_b", "pb") + tombstone("journal_b") +
+                        record("journal_c", "pc");
+    std::string torn = record("journal_torn", "pt").substr(0, 7);
+    write_journal(valid + torn);
+
+    UserWriter *writer = UserWriter::instance();
+    UserCache *cache = UserCache::instance();
+    CHECK(writer->init(SqlConnPool::instance(), JOURNAL));
+    CHECK(cache->check("journal_a", "pa"));
+    CHECK(!cache->check("journal_b", "pb"));
+    CHECK(cache->check("journal_c", "pc"));
+    CHECK(!cache->check("journal_torn", "pt"));
+    CHECK_EQ(journal_size(), (off_t)valid.size());
+
+    CHECK(writer->append(UserRecord("journal_d", "pd")));
+    writer->shutdown();
+    CHECK_EQ(journal_size(), (off_t)(valid.size() + record("journal_d", "pd").size()));
+
+    cache->erase("journal_d");
+    CHECK(writer->init(SqlConnPool::instance(), JOURNAL));
+    CHECK(cache->check("journal_d", "pd"));
+    writer->shutdown();
+    unlink(JOURNAL);
+}
+
+// 作废记录只去掉它前面最近的一条同名记录，之后重新注册的同名用户保留
+static void test_tombstone_order() {
+    write_journal(record("journal_x", "old") + tombstone("journal_x") + record("journal_x", "new") +
+                  record("journal_y", "py") + tombstone("journal_y"));
+
+    UserWriter *writer = UserWriter::instance();
+    UserCache *cache = UserCache::instance();
+    CHECK(writer->init(SqlConnPool::instance(), JOURNAL));
+    CHECK(cache->check("journal_x", "new"));
+    CHECK(!cache->check("journal_x", "old"));
+    CHECK(!cache->check("journal_y", "py"));
+    writer->shutdown();
+    unlink(JOURNAL);
+}
+
+static TestRegistrar r1("journal/replay", test_replay);
+static TestRegistrar r2("journal/tombstone_order", test_tombstone_order);
@@ -0,0 +1,204 @@
+#include <string>
+#include <vector>
+#include "test.h"
+#include "../core/arena/arena.h"
+#include "../core/buffer/buffer_chain.h"
+#include "../http/websocket.h"
+
+// 客户端发出的帧：加掩码，first 为第一个字节（FIN、RSV、opcode）
+static std::string client_frame(uint8_t first, const std::string &payload, bool masked = true) {
+    static const uint8_t mask[4] = {0x37, 0xfa, 0x21, 0x3d};
+    std::string f(1, (char)first);
+    uint8_t mask_bit = masked ? 0x80 : 0;
+    size_t len = payload.size();
+    if (len < 126) {
+        f += (char)(mask_bit | len);
+    }
+    else if (len < 65536) {
+        f += (char)(mask_bit | 126);
+        f += (char)(len >> 8);
+        f += (char)len;
+    }
+    else {
+        f += (char)(mask_bit | 127);
+        for (int i = 7; i >= 0; --i) {
+            f += (char)((uint64_t)len >> (8 * i));
+        }
+    }
+    if (!masked) {
+        return f + payload;
+    }
+    f.append((const char *)mask, 4);
+    for (size_t i = 0; i < len; ++i) {
+        f += (char)(payload[i] ^ mask[i % 4]);
+    }
+    return f;
+}
+
+// 只有帧头、负载长度声明为 len 的客户端帧，用于超长的帧
+static std::string client_header(uint8_t first, uint64_t len) {
+    std::string f(1, (char)first);
+    f += (char)(0x80 | 127);
+    for (int i = 7; i >= 0; --i) {
+        f += (char)(len >> (8 * i));
+    }
+    return f + std::string(4, '\0');
+}
+
+// 服务器回复的帧，不加掩码
+static std::string server_frame(uint8_t first, const std::string &payload) {
+    return std::string(1, (char)first) + (char)payload.size() + payload;
+}
+
+static std::string close_frame(uint16_t code) {
+    return server_frame(0x88, std::string() + (char)(code >> 8) + (char)code);
+}
+
+struct WsFeeder {
+    WsSession session;
+    Arena arena;
+    BufferChain out;
+    std::vector<WsSession::Message> messages;
+
+    WsFeeder() : session("/chat"), out(arena) {}
+    bool feed(const std::string &data) {
+        return session.feed(data.data(), data.size(), out, messages);
+    }
+    std::string sent() const { return *out.copy_pending(); }
+};
+
+// 分片的消息中间夹着 ping：先回复 pong，分片拼成一条消息
+static void test_fragmented() {
+    WsFeeder ws;
+    CHECK(ws.feed(client_frame(0x01, "Hel")));
+    CHECK(ws.messages.empty());
+    CHECK(ws.feed(client_frame(0x89, "hb")));
+    CHECK_EQ(ws.sent(), server_frame(0x8a, "hb"));
+    CHECK(ws.feed(client_frame(0x00, "lo, ")));
+    CHECK(ws.feed(client_frame(0x80, "world")));
+    CHECK_EQ(ws.messages.size(), (size_t)1);
+    if (ws.messages.size() == 1) {
+        CHECK_EQ(ws.messages[0].first, WsSession::TEXT);
+        CHECK_EQ(ws.messages[0].second, "Hello, world");
+    }
+
+    // 分片结束后可以开始新的消息
+    CHECK(ws.feed(client_frame(0x82, std::string("\0\1\2", 3))));
+    CHECK_EQ(ws.messages.size(), (size_t)2);
+    if (ws.messages.size() == 2) {
+        CHECK_EQ(ws.messages[1].first, WsSession::BINARY);
+        CHECK_EQ(ws.messages[1].second, std::string("\0\1\2", 3));
+    }
+}
+
+// 帧按任意位置断开到达，包括 16 位和 64 位长度的帧头
+static void test_split_input() {
+    std::string big(70000, 'x');
+    for (size_t i = 0; i < big.size(); ++i) {
+        big[i] = (char)(i * 7);
+    }
+    std::string medium(300, 'm');
+    std::string stream = client_frame(0x81, "short") + client_frame(0x82, medium) + client_frame(0x82, big);
+    size_t steps[] = {1, 3, 7, 4096};
+    for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); ++s) {
+        WsFeeder ws;
+        for (size_t pos = 0; pos < stream.size(); pos += steps[s]) {
+            CHECK(ws.feed(stream.substr(pos, steps[s])));
+        }
+        CHECK_EQ(ws.messages.size(), (size_t)3);
+        if (ws.messages.size() == 3) {
+            CHECK_EQ(ws.messages[0].second, "short");
+            CHECK_EQ(ws.messages[1].second, medium);
+            CHECK(ws.messages[2].second == big);
+        }
+    }
+}
+
+// 单帧或者分片合计超过 MAX_MESSAGE 时以 1009 关闭
+static void test_oversize() {
+    WsFeeder single;
+    CHECK(!single.feed(client_header(0x82, WsSession::MAX_MESSAGE + 1)));
+    CHECK_EQ(single.sent(), close_frame(1009));
+    CHECK(single.session.closing());
+
+    WsFeeder fragments;
+    std::string half(WsSession::MAX_MESSAGE / 2 + 1, 'a');
+    CHECK(fragments.feed(client_frame(0x02, half)));
+    CHECK(!fragments.feed(client_frame(0x80, half)));
+    CHECK_EQ(fragments.sent(), close_frame(1009));
+    CHECK(fragments.messages.empty());
+
+    // 正好 MAX_MESSAGE 时仍然接受
+    WsFeeder limit;
+    CHECK(limit.feed(client_frame(0x82, std::string(WsSession::MAX_MESSAGE, 'b'))));
+    CHECK_EQ(limit.messages.size(), (size_t)1);
+}
+
+// 协议错误以 1002 关闭，关闭后不再解析
+static void test_protocol_errors() {
+    struct Case {
+        std::string data;
+    } cases[] = {
+        {client_frame(0x83, "x")},                          // 保留的数据帧 opcode
+        {client_frame(0x8b, "x")},                          // 保留的控制帧 opcode
+        {client_frame(0x81, "x", false)},                   // 没有掩码
+        {client_frame(0xc1, "x")},                          // RSV1
+        {client_frame(0x09, "x")},                          // 分片的控制帧
+        {client_frame(0x89, std::string(126, 'p'))},        // 超过 125 字节的控制帧
+        {client_frame(0x80, "x")},                          // 没有开始的 continuation
+        {client_frame(0x01, "a") + client_frame(0x81, "b")}, // 分片没有结束又开始新的消息
+    };
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+        WsFeeder ws;
+        CHECK(!ws.feed(cases[i].data));
+        CHECK_EQ(ws.sent(), close_frame(1002));
+        CHECK(ws.session.closing());
+        CHECK(ws.messages.empty());
+        CHECK(!ws.feed(client_frame(0x81, "after")));
+        CHECK(ws.messages.empty());
+    }
+}
+
+// 收到 close 时回复同样的关闭原因，没有原因时回复空的 close
+static void test_close() {
+    WsFeeder ws;
+    CHECK(!ws.feed(client_frame(0x88, std::string("\x03\xe8" "bye", 5))));
+    CHECK_EQ(ws.sent(), close_frame(1000));
+    CHECK(ws.session.closing());
+
+    WsFeeder empty;
+    CHECK(!empty.feed(client_frame(0x88, "")));
+    CHECK_EQ(empty.sent(), server_frame(0x88, ""));
+
+    // pong 清除等待标记
+    WsFeeder pong;
+    pong.session.ping_sent();
+    CHECK(pong.feed(client_frame(0x8a, "")));
+    CHECK(!pong.session.awaiting_pong());
+}
+
+// 向量化的掩码运算与逐字节异或一致，包括不对齐的长度和负载中的偏移
+static void test_unmask() {
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    for (size_t len = 0; len < 100; ++len) {
+        for (size_t offset = 0; offset < 4; ++offset) {
+            std::string data(len, '\0');
+            for (size_t i = 0; i < len; ++i) {
+                data[i] = (char)(i * 31 + 5);
+            }
+            std::string expect = data;
+            for (size_t i = 0; i < len; ++i) {
+                expect[i] ^= mask[(i + offset) % 4];
+            }
+            WsSession::unmask(&data[0], len, mask, offset);
+            CHECK(data == expect);
+        }
+    }
+}
+
+static TestRegistrar r1("ws/fragmented", test_fragmented);
+static TestRegistrar r2("ws/split_input", test_split_input);
+static TestRegistrar r3("ws/oversize", test_oversize);
+static TestRegistrar r4("ws/protocol_errors", test_protocol_errors);
+static TestRegistrar r5("ws/close", test_close);
+static TestRegistrar r6("ws/unmask", test_unmask);
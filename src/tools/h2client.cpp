@@ -0,0 +1,360 @@
+// HTTP/2 明文（h2c）测试客户端：在一个连接上同时打开多个流，检查响应是否完整
+//
+// 用法：h2client [-u] [-w window] [-n repeat] host port path...
+//   -u          先发送 HTTP/1.1 请求，通过 Upgrade: h2c 升级，第一个路径成为流 1；默认直接发送连接序言
+//   -w window   SETTINGS_INITIAL_WINDOW_SIZE，设小一些可以观察服务器的流量控制，默认 65535
+//   -n repeat   每个路径请求的次数
+//
+// 每个流输出状态码、content-length、收到的字节数和 DATA 帧数，最后输出 DATA 帧在不同流之间切换的次数
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+#include <errno.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "../http/hpack.h"
+
+static const char preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+struct StreamResult {
+    std::string path;
+    std::string status;
+    long content_length;
+    long received;
+    int frames;
+    bool done;
+};
+
+static int sockfd = -1;
+static std::string inbuf;
+
+static void frame_header(std::string &out, uint32_t len, uint8_t type, uint8_t flags, uint32_t stream_id) {
+    char b[9] = {(char)(len >> 16), (char)(len >> 8), (char)len, (char)type, (char)flags,
+                 (char)(stream_id >> 24), (char)(stream_id >> 16), (char)(stream_id >> 8), (char)stream_id};
+    out.append(b, 9);
+}
+
+static void put_u32(std::string &out, uint32_t v) {
+    char b[4] = {(char)(v >> 24), (char)(v >> 16), (char)(v >> 8), (char)v};
+    out.append(b, 4);
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static bool send_all(const std::string &data) {
+    size_t off = 0;
+    while (off < data.size()) {
+        ssize_t n = send(sockfd, data.data() + off, data.size() - off, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("send");
+            return false;
+        }
+        off += n;
+    }
+    return true;
+}
+
+static bool recv_more() {
+    char buf[16384];
+    ssize_t n = recv(sockfd, buf, sizeof(buf), 0);
+    if (n <= 0) {
+        return false;
+    }
+    inbuf.append(buf, n);
+    return true;
+}
+
+static std::string settings_payload(uint32_t window) {
+    std::string payload;
+    payload.push_back(0);
+    payload.push_back(4);           // SETTINGS_INITIAL_WINDOW_SIZE
+    put_u32(payload, window);
+    payload.push_back(0);
+    payload.push_back(2);           // SETTINGS_ENABLE_PUSH
+    put_u32(payload, 0);
+    return payload;
+}
+
+static std::string base64url(const std::string &in) {
+    static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+    std::string out;
+    uint32_t acc = 0;
+    int bits = 0;
+    for (size_t i = 0; i < in.size(); ++i) {
+        acc = acc << 8 | (uint8_t)in[i];
+        bits += 8;
+        while (bits >= 6) {
+            bits -= 6;
+            out.push_back(table[(acc >> bits) & 0x3f]);
+        }
+    }
+    if (bits > 0) {
+        out.push_back(table[(acc << (6 - bits)) & 0x3f]);
+    }
+    return out;
+}
+
+static void usage() {
+    fprintf(stderr, "usage: h2client [-u] [-w window] [-n repeat] host port path...\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[]) {
+    bool upgrade = false;
+    uint32_t window = 65535;
+    int repeat = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "uw:n:")) != -1) {
+        switch (opt) {
+            case 'u':
+                upgrade = true;
+                break;
+            case 'w':
+                window = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                repeat = atoi(optarg);
+                break;
+            default:
+                usage();
+        }
+    }
+    if (argc - optind < 3 || repeat < 1) {
+        usage();
+    }
+    const char *host = argv[optind];
+    const char *port = argv[optind + 1];
+    std::vector<std::string> paths;
+    for (int r = 0; r < repeat; ++r) {
+        for (int i = optind + 2; i < argc; ++i) {
+            paths.push_back(argv[i]);
+        }
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", host);
+        return 1;
+    }
+    sockfd = socket(res->ai_family, res->ai_socktype, 0);
+    if (sockfd < 0 || connect(sockfd, res->ai_addr, res->ai_addrlen) < 0) {
+        perror("connect");
+        return 1;
+    }
+    freeaddrinfo(res);
+
+    std::string authority = std::string(host) + ":" + port;
+    std::map<uint32_t, StreamResult> streams;
+    uint32_t next_id = 1;
+    size_t first = 0;
+
+    if (upgrade) {
+        // HTTP/1.1 请求成为流 1，等到 101 之后再发送连接序言
+        std::string req = "GET " + paths[0] + " HTTP/1.1\r\nHost: " + authority +
+                          "\r\nConnection: Upgrade, HTTP2-Settings\r\nUpgrade: h2c\r\nHTTP2-Settings: " +
+                          base64url(settings_payload(window)) + "\r\n\r\n";
+        if (!send_all(req)) {
+            return 1;
+        }
+        size_t end;
+        while ((end = inbuf.find("\r\n\r\n")) == std::string::npos) {
+            if (!recv_more()) {
+                fprintf(stderr, "connection closed before 101\n");
+                return 1;
+            }
+        }
+        if (inbuf.compare(0, 12, "HTTP/1.1 101") != 0) {
+            fprintf(stderr, "upgrade refused: %s\n", inbuf.substr(0, inbuf.find("\r\n")).c_str());
+            return 1;
+        }
+        inbuf.erase(0, end + 4);
+        StreamResult &s = streams[1];
+        s.path = paths[0];
+        s.content_length = -1;
+        s.received = 0;
+        s.frames = 0;
+        s.done = false;
+        next_id = 3;
+        first = 1;
+    }
+
+    std::string out(preface, sizeof(preface) - 1);
+    std::string payload = settings_payload(window);
+    frame_header(out, payload.size(), 4, 0, 0);
+    out += payload;
+
+    // 所有请求一次发出，每个流一个 HEADERS 帧
+    HpackEncoder encoder;
+    for (size_t i = first; i < paths.size(); ++i) {
+        std::string block;
+        encoder.begin(block);
+        encoder.encode(":method", "GET", block);
+        encoder.encode(":scheme", "http", block);
+        encoder.encode(":authority", authority, block);
+        encoder.encode(":path", paths[i], block);
+        frame_header(out, block.size(), 1, 0x4 | 0x1, next_id);
+        out += block;
+        StreamResult &s = streams[next_id];
+        s.path = paths[i];
+        s.content_length = -1;
+        s.received = 0;
+        s.frames = 0;
+        s.done = false;
+        next_id += 2;
+    }
+    if (!send_all(out)) {
+        return 1;
+    }
+
+    HpackDecoder decoder;
+    size_t remaining = streams.size();
+    uint32_t last_data_stream = 0;
+    int switches = 0;
+    std::string header_block;
+    while (remaining > 0) {
+        if (inbuf.size() < 9 || inbuf.size() < 9 + ((uint32_t)(uint8_t)inbuf[0] << 16 | (uint8_t)inbuf[1] << 8 | (uint8_t)inbuf[2])) {
+            if (!recv_more()) {
+                fprintf(stderr, "connection closed with %zu streams open\n", remaining);
+                break;
+            }
+            continue;
+        }
+        const uint8_t *p = reinterpret_cast<const uint8_t *>(inbuf.data());
+        uint32_t len = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+        uint8_t type = p[3], flags = p[4];
+        uint32_t id = get_u32(p + 5) & 0x7fffffff;
+        const uint8_t *payload_p = p + 9;
+        std::string reply;
+
+        switch (type) {
+            case 0:     // DATA
+            {
+                StreamResult &s = streams[id];
+                s.received += len;
+                s.frames++;
+                if (last_data_stream && last_data_stream != id) {
+                    switches++;
+                }
+                last_data_stream = id;
+                // 收到多少就归还多少窗口
+                if (len > 0) {
+                    frame_header(reply, 4, 8, 0, 0);
+                    put_u32(reply, len);
+                    if (!(flags & 0x1)) {
+                        frame_header(reply, 4, 8, 0, id);
+                        put_u32(reply, len);
+                    }
+                }
+                if ((flags & 0x1) && !s.done) {
+                    s.done = true;
+                    remaining--;
+                }
+                break;
+            }
+            case 1:     // HEADERS
+            case 9:     // CONTINUATION
+            {
+                uint32_t off = 0, pad = 0;
+                if (type == 1 && (flags & 0x8)) {
+                    pad = payload_p[0];
+                    off = 1;
+                }
+                if (type == 1 && (flags & 0x20)) {
+                    off += 5;
+                }
+                header_block.append(reinterpret_cast<const char *>(payload_p + off), len - off - pad);
+                if (flags & 0x4) {
+                    HpackHeaders headers;
+                    if (!decoder.decode(reinterpret_cast<const uint8_t *>(header_block.data()), header_block.size(), headers)) {
+                        fprintf(stderr, "stream %u: HPACK decode error\n", id);
+                        return 1;
+                    }
+                    header_block.clear();
+                    StreamResult &s = streams[id];
+                    for (size_t i = 0; i < headers.size(); ++i) {
+                        if (headers[i].first == ":status") {
+                            s.status = headers[i].second;
+                        }
+                        else if (headers[i].first == "content-length") {
+                            s.content_length = atol(headers[i].second.c_str());
+                        }
+                    }
+                }
+                if ((flags & 0x1) && !streams[id].done) {
+                    streams[id].done = true;
+                    remaining--;
+                }
+                break;
+            }
+            case 3:     // RST_STREAM
+            {
+                fprintf(stderr, "stream %u reset, error %u\n", id, get_u32(payload_p));
+                if (!streams[id].done) {
+                    streams[id].done = true;
+                    remaining--;
+                }
+                break;
+            }
+            case 4:     // SETTINGS
+            {
+                if (!(flags & 0x1)) {
+                    frame_header(reply, 0, 4, 0x1, 0);
+                }
+                break;
+            }
+            case 6:     // PING
+            {
+                if (!(flags & 0x1)) {
+                    frame_header(reply, 8, 6, 0x1, 0);
+                    reply.append(reinterpret_cast<const char *>(payload_p), 8);
+                }
+                break;
+            }
+            case 7:     // GOAWAY
+            {
+                fprintf(stderr, "goaway: last stream %u, error %u\n", get_u32(payload_p) & 0x7fffffff, get_u32(payload_p + 4));
+                remaining = 0;
+                break;
+            }
+            default:
+                break;
+        }
+        inbuf.erase(0, 9 + len);
+        if (!reply.empty() && !send_all(reply)) {
+            return 1;
+        }
+    }
+
+    // 关闭连接
+    std::string goaway;
+    frame_header(goaway, 8, 7, 0, 0);
+    put_u32(goaway, 0);
+    put_u32(goaway, 0);
+    send_all(goaway);
+    close(sockfd);
+
+    int failed = 0;
+    for (std::map<uint32_t, StreamResult>::iterator it = streams.begin(); it != streams.end(); ++it) {
+        StreamResult &s = it->second;
+        bool ok = s.done && !s.status.empty() && s.received == s.content_length;
+        printf("stream %-4u %-4s %-24s content-length %-9ld received %-9ld frames %-4d %s\n", it->first,
+               s.status.c_str(), s.path.c_str(), s.content_length, s.received, s.frames, ok ? "ok" : "FAILED");
+        failed += !ok;
+    }
+    printf("%zu streams, %d failed, DATA frames switched stream %d times\n", streams.size(), failed, switches);
+    return failed ? 1 : 0;
+}